@@ -1,428 +1,999 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include "AVL.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <time.h>
+
+#define SLAB_BYTES (64 * 1024)                  /* Size of a slab of nodes allocated with malloc */
+#define HUGE_SLAB_BYTES (2 * 1024 * 1024)       /* Size of a slab of nodes backed by a huge page */
+#define DETACHED_FREE_BATCH 64                  /* Number of detached nodes freed by every update in lazy free mode */
+#define LAZY_DELETE_REBUILD_PERCENT 25          /* Share of removed products among the nodes that makes lazy delete mode rebuild the trees */
+#define SLAB_HEADER_BYTES ((sizeof(NodeSlab) + 15) & ~(size_t)15)  /* Slab header size, keeps the nodes 16 bytes aligned */
+#define CACHE_LINE_BYTES 64                     /* Size of a cache line, nodes that are a multiple of it start on a line boundary */
+#define BPLUS_MIN (BPLUS_ORDER / 2)             /* Minimum number of entries of a B+ tree node other than the root */
+#define AVL_MAX_HEIGHT 48                       /* Bound on the height of an AVL tree of up to 2^32 nodes, the size of the path stacks */
+#define TIME_TREE_MAX_HEIGHT 128                /* Bound on the depth of a time tree of up to 2^32 nodes with any balancing scheme, the size of
+                                                   its path stacks. WAVL and red-black trees stay under 2*log2(n), a treap only with high probability */
+
+/* Operation counters, compiled out unless the library is built with AVL_STATS.
+   A public operation opens its counters with STATS_BEGIN and closes them with STATS_END before every return,
+   the internal functions count into the counters of the open operation */
+#ifdef AVL_STATS
+#define STATS_BEGIN(ds, operation) stats_begin((ds)->stats, operation)
+#define STATS_END() stats_end()
+#define STATS_COUNT(counter) do { if (stats_operation != NULL) stats_operation->counter++; } while (0)
+#else
+#define STATS_BEGIN(ds, operation) ((void)0)
+#define STATS_END() ((void)0)
+#define STATS_COUNT(counter) ((void)0)
+#endif
 
+/***** functions *****/
+#ifdef AVL_STATS
+static void stats_begin(Stats* stats, int operation);
+static void stats_end(void);
+#endif
+
+static NodeSlab* allocate_slab(int huge_pages);
+
+static size_t fibonacci_hash(int key, int shift);
+
+static void init_QualityHistogram(QualityHistogram* histogram);
+static size_t slot_of_quality(const QualityHistogram* histogram, int quality);
+static void grow_QualityHistogram(QualityHistogram* histogram);
+static void add_to_QualityHistogram(QualityHistogram* histogram, int quality);
+static void remove_from_QualityHistogram(QualityHistogram* histogram, int quality);
+static int count_in_QualityHistogram(const QualityHistogram* histogram, int quality);
+static void destroy_QualityHistogram(QualityHistogram* histogram);
+
+static void init_TimeIndex(TimeIndex* index);
+static size_t slot_of_time(const TimeIndex* index, int time);
+static void grow_TimeIndex(TimeIndex* index);
+static void insert_in_TimeIndex(TimeIndex* index, AvlTree* node);
+static void remove_from_TimeIndex(TimeIndex* index, int time);
+static AvlTree* find_in_TimeIndex(const TimeIndex* index, int time);
+static void destroy_TimeIndex(TimeIndex* index);
+
+static AvlTree* createNode(NodePool* pool, int time , int quality);
+static AvlTree* find(AvlTree* tree, int key);
+
+static int insert_in_TimeTree(AvlTree** root, AvlTree* node, int scheme);
+static void append_to_TimeTree(AvlTree** root, AvlTree* node, int scheme);
+static void rebalance_TimeTree_path(AvlTree*** path, int depth, AvlTree* node);
+static void rebalance_RedBlack_insertion(AvlTree*** path, int depth, AvlTree* node);
+static int insert_in_Treap(AvlTree** root, AvlTree* node);
+static void add_to_TimeTree_path(AvlTree*** path, int depth, AvlTree* node);
+static void insert_in_QualityTree(AvlTree** root, AvlTree* node);
+
+static AvlTree* deleteNode(AvlTree** root, int key, int scheme);
+static void remove_from_TimeTree_path(AvlTree*** path, int depth, AvlTree* node, AvlTree* successor);
+static void rebalance_WAVL_deletion(AvlTree*** path, int depth, AvlTree** link);
+static void rebalance_RedBlack_deletion(AvlTree*** path, int depth, AvlTree** link);
+static int deleteNode_in_QualityTree(AvlTree** root, AvlTree* node);
+static AvlTree* mark_removed_in_TimeTree(AvlTree* tree, int time);
+static void mark_removed_in_QualityTree(AvlTree* tree, AvlTree* node);
+static void update_TimeTree_path(AvlTree* tree, int time);
+
+static AvlTree* balance(AvlTree* node);
+static AvlTree* leftRotate(AvlTree* node);
+static AvlTree* rightRotate(AvlTree* node);
+static void update_Node_Variables(AvlTree* node);
+static void update_Node_Variables_Without_Height(AvlTree* node);
+static void update_Node_Aggregates(AvlTree* node);
+static double merge_squared_deviations(double deviations1, long long sum1, int count1, double deviations2, long long sum2, int count2);
+static AvlTree* leftRotate_Ranked(AvlTree* node);
+static AvlTree* rightRotate_Ranked(AvlTree* node);
+static int rankOfRedBlackNode(AvlTree* node);
+static unsigned int priority_of_time(int time);
+static int higher_priority(AvlTree* a, AvlTree* b);
+static int height_of_TimeTree(AvlTree* tree);
+
+static AvlTree* balance_QualityTree(AvlTree* node);
+static AvlTree* leftRotate_QualityTree(AvlTree* node);
+static AvlTree* rightRotate_QualityTree(AvlTree* node);
+static void update_Quality_Node_Variables(AvlTree* node);
+
+static AvlTree* minInTree(AvlTree* tree);
+static AvlTree* maxInTree(AvlTree* tree);
+static AvlTree* minInQualityTree(AvlTree* tree);
+static AvlTree* removeMinInTree(AvlTree* tree);
+static AvlTree* removeMinInQualityTree(AvlTree* tree);
+
+static int heightOfNode(AvlTree * node);
+static int max(int a,int b);
+static int sizeOfNode(AvlTree* node);
+static int heightOfQualityNode(AvlTree* node);
+static int sizeOfQualityNode(AvlTree* node);
+
+static void radix_sort_indices(const int* keys, int* indices, int* scratch, size_t n);
+static size_t flatten_TimeTree(AvlTree* tree, AvlTree** nodes, size_t count);
+static size_t flatten_alive_TimeTree(AvlTree* tree, AvlTree** nodes, size_t count);
+static size_t flatten_QualityTree(AvlTree* tree, AvlTree** nodes, size_t count);
+static AvlTree* build_TimeTree(AvlTree** nodes, size_t n, int scheme);
+static AvlTree* build_Treap(AvlTree** nodes, size_t n);
+static void update_Treap_Variables(AvlTree* tree);
+static AvlTree* build_QualityTree(AvlTree** nodes, size_t n);
+
+static AvlTree* join_TimeTree(AvlTree* left, AvlTree* node, AvlTree* right, int scheme);
+static AvlTree* join_RedBlack(AvlTree* left, AvlTree* node, AvlTree* right);
+static AvlTree* join_right_RedBlack(AvlTree* tree, AvlTree* node, AvlTree* right);
+static AvlTree* join_left_RedBlack(AvlTree* left, AvlTree* node, AvlTree* tree);
+static AvlTree* join_Treap(AvlTree* left, AvlTree* node, AvlTree* right);
+static AvlTree* join2_TimeTree(AvlTree* left, AvlTree* right, int scheme);
+static void split_TimeTree(AvlTree* tree, int time, AvlTree** left, AvlTree** right, int scheme);
+static AvlTree* join_QualityTree(AvlTree* left, AvlTree* node, AvlTree* right);
+static AvlTree* join2_QualityTree(AvlTree* left, AvlTree* right);
+static void split_QualityTree(AvlTree* tree, int quality, AvlTree** left, AvlTree** right);
+static AvlTree* remove_sorted_from_TimeTree(AvlTree* tree, AvlTree** nodes, size_t n, int scheme);
+static AvlTree* remove_sorted_from_QualityTree(AvlTree* tree, AvlTree** nodes, size_t n);
+
+static AvlTree* get_worst_quality(AvlTree* node);
+static AvlTree* get_worst_quality_between_tree_and_sub(AvlTree* left,AvlTree* root,AvlTree* right);
+
+static void insert_in_RangeBestHeap(RangeBestIterator* it, AvlTree* tree, int time1, int time2);
+static RangeBestEntry remove_min_from_RangeBestHeap(RangeBestIterator* it);
+
+static RankTimeNode* createRankTimeNode(NodePool* pool, int time);
+static RankTimeNode* insert_in_RankTimeTree(NodePool* pool, RankTimeNode* tree, int time);
+static void remove_from_RankTimeTree(RankTimeNode* tree, int time);
+static RankTimeNode* build_RankTimeTree(NodePool* pool, const int* times, int n);
+static RankTimeNode* balance_RankTimeTree(RankTimeNode* node);
+static RankTimeNode* leftRotate_RankTimeTree(RankTimeNode* node);
+static RankTimeNode* rightRotate_RankTimeTree(RankTimeNode* node);
+static void update_RankTimeNode_Variables(RankTimeNode* node);
+static int heightOfRankTimeNode(RankTimeNode* node);
+static int sizeOfRankTimeNode(RankTimeNode* node);
+static int count_times_until(RankTimeNode* tree, int time);
+static int count_times_between(RankTimeNode* tree, int time1, int time2);
+static void free_RankTimeTree(NodePool* pool, RankTimeNode* tree);
+
+static RankTree* createRankNode(RankIndex* index, int time, int quality);
+static int sizeOfRankNode(RankTree* node);
+static int insert_in_RankTree(RankIndex* index, RankTree** link, int time, int quality);
+static void insert_in_RankIndex(RankIndex* index, int time, int quality);
+static void remove_from_RankIndex(RankIndex* index, int time, int quality);
+static RankTree* rebuild_RankTree(RankIndex* index, RankTree* tree, int extra_time, int extra_quality, int has_extra);
+static RankTree* build_RankTree(RankIndex* index, const int* times, const int* qualities, int* sorted_times, int* scratch, int lo, int hi);
+static int collect_RankTree(RankTree* tree, int* times, int* qualities, int count);
+static int select_in_RankIndex(const RankIndex* index, int time1, int time2, int i, int* quality);
+static int count_up_to_in_RankIndex(const RankIndex* index, int time1, int time2, int quality, int time);
+static void build_RankIndex(RankIndex* index, AvlTree** nodes, size_t n);
+static void free_RankTree(RankIndex* index, RankTree* tree);
+
+static void init_BPlusTree(BPlusTree* tree, int huge_pages);
+static BPlusNode* createBPlusNode(BPlusTree* tree, int leaf);
+static int compare_BPlusKeys(int quality1, int time1, int quality2, int time2);
+static int sizeOfBPlusNode(BPlusNode* node);
+static int child_index_in_BPlusNode(BPlusNode* node, int quality, int time);
+static BPlusNode* split_BPlusNode(BPlusTree* tree, BPlusNode* node);
+static void insert_entry_in_BPlusNode(BPlusNode* node, int pos, int quality, int time, int size, BPlusSlot slot);
+static void remove_entry_from_BPlusNode(BPlusNode* node, int pos);
+static BPlusNode* insert_in_BPlusNode(BPlusTree* tree, BPlusNode* node, AvlTree* product);
+static void insert_in_BPlusTree(BPlusTree* tree, AvlTree* product);
+static void fix_child_of_BPlusNode(BPlusTree* tree, BPlusNode* node, int c);
+static int delete_from_BPlusNode(BPlusTree* tree, BPlusNode* node, int quality, int time);
+static int delete_from_BPlusTree(BPlusTree* tree, int quality, int time);
+static int count_below_in_BPlusTree(BPlusTree* tree, int quality);
+static int count_range_in_BPlusTree(BPlusTree* tree, int quality1, int quality2);
+static int count_up_to_in_BPlusTree(BPlusTree* tree, int quality, int time);
+static BPlusNode* lower_bound_in_BPlusTree(BPlusTree* tree, int quality, int* pos);
+static AvlTree* select_in_BPlusTree(BPlusTree* tree, int i);
+static void select_many_in_BPlusNode(BPlusNode* node, int offset, const int* ranks, const int* order, int* out, size_t lo, size_t hi);
+static size_t collect_range_from_BPlusTree(BPlusTree* tree, int quality1, int quality2, AvlTree** nodes);
+static size_t flatten_BPlusTree(BPlusTree* tree, AvlTree** nodes);
+static size_t bplus_group_count(size_t n);
+static void build_BPlusTree(BPlusTree* tree, AvlTree** nodes, size_t n);
+static void remove_sorted_from_BPlusTree(BPlusTree* tree, AvlTree** nodes, size_t k);
+
+static void append_to_OperationLog(OperationLog* log, int kind, int value1, int value2);
 
-typedef struct AvlTree
-{
-    int key;                        /* Key of the node */
-    int height;                     /* Height of the node in the AVL tree */
-    int size;                       /* Size of the subtree rooted at this node */
 
-    struct AvlTree* left;           /* Pointer to the left child of the node */
-    struct AvlTree* right;          /* Pointer to the right child of the node */
+/***** functions *****/
 
-    int time;                       /* Time value associated with the node */
-    int quality;                    /* Quality value associated with the node */
-    struct AvlTree* worst_quality;  /* Pointer to the node with the worst quality in the subtree rooted at this node */
+#ifdef AVL_STATS
+/* The operation in progress of every thread: its counters, the counters of the data structure they are added to
+   once it ends, and its start time. stats_operation is NULL when no operation is counted.
+   The sharded container runs the operations of different shards at once and the readers of a shard share it,
+   so the counters of a data structure only change through the atomic additions of stats_end */
+static _Thread_local OperationStats stats_counters;
+static _Thread_local OperationStats* stats_operation = NULL;
+static _Thread_local OperationStats* stats_target = NULL;
+static _Thread_local int stats_depth = 0;
+static _Thread_local struct timespec stats_start;
+
+/* Function to open the counters of an operation, the operations it calls are counted as part of it */
+/*  Time O(1) */
+static void stats_begin(Stats* stats, int operation)
+{
+    if (stats_depth++ > 0 || stats == NULL)
+        return;
 
-} AvlTree;
+    memset(&stats_counters, 0, sizeof(OperationStats));
+    stats_counters.calls = 1;
+    stats_operation = &stats_counters;
+    stats_target = &stats->operations[operation];
+    clock_gettime(CLOCK_MONOTONIC, &stats_start);
+}
 
+/* Function to close the counters of the operation in progress and add them with its latency to the data structure */
+/*  Time O(STATS_LATENCY_BUCKETS) */
+static void stats_end(void)
+{
+    struct timespec now;
+    long elapsed;
+    int bucket = 0;
 
-/***** functions *****/
-AvlTree* createNode(int key , int time , int quality);
-AvlTree* find(AvlTree* tree, int key);
-AvlTree* predecessor(AvlTree* tree, int key);
-AvlTree* successor(AvlTree* tree, int key);
+    if (--stats_depth > 0 || stats_operation == NULL)
+        return;
 
-AvlTree* insert_in_TimeTree(AvlTree* tree, AvlTree* node);
-AvlTree* insert_in_QualityTree(AvlTree* tree, AvlTree* node);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (long)(now.tv_sec - stats_start.tv_sec) * 1000000000L + (now.tv_nsec - stats_start.tv_nsec);
+
+    /* Bucket b holds the latencies in [2^b, 2^(b+1)) ns, the last one everything above */
+    while (bucket < STATS_LATENCY_BUCKETS - 1 && (elapsed >> (bucket + 1)) != 0)
+        bucket++;
+
+    __atomic_fetch_add(&stats_target->calls, stats_counters.calls, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_target->nodes_visited, stats_counters.nodes_visited, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_target->rotations, stats_counters.rotations, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_target->node_updates, stats_counters.node_updates, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_target->allocations, stats_counters.allocations, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_target->total_ns, elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_target->latency[bucket], 1L, __ATOMIC_RELAXED);
+    stats_operation = NULL;
+    stats_target = NULL;
+}
+#endif
 
-AvlTree* deleteNode(AvlTree* tree, int key);
-AvlTree* deleteNode_in_QualityTree(AvlTree* tree, int quality_key , int time_key);
+/* Function to initialize an empty pool of nodes of a given size, no memory is allocated until the first node */
+/*  Time O(1) */
+void init_NodePool(NodePool* pool, size_t object_size, int huge_pages)
+{
+    /* A released node must be able to hold the free list link */
+    if (object_size < sizeof(void*))
+        object_size = sizeof(void*);
+
+    /* Round the node size so every node stays pointer aligned */
+    pool->object_size = (object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    pool->huge_pages = huge_pages;
+
+    pool->slabs = NULL;
+    pool->next_unused = NULL;
+    pool->slab_end = NULL;
+    pool->free_list = NULL;
+
+    pool->hits = 0;
+    pool->misses = 0;
+    pool->slab_count = 0;
+    pool->in_use = 0;
+    pool->bytes = 0;
+}
 
-AvlTree* balance(AvlTree* node);
-AvlTree* leftRotate(AvlTree* node);
-AvlTree* rightRotate(AvlTree* node);
-void update_Node_Variables(AvlTree* node);
+/* Function to allocate a new slab, backed by a huge page when requested and possible */
+/*  Time O(1) */
+static NodeSlab* allocate_slab(int huge_pages)
+{
+    NodeSlab* slab;
 
-AvlTree* minInTree(AvlTree* tree);
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+    void* memory;
 
-int heightOfNode(AvlTree * node);
-int max(int a,int b);
-int sizeOfNode(AvlTree* node);
+    if (huge_pages)
+    {
+#ifdef MAP_HUGETLB
+        /* Try the reserved huge pages first */
+        memory = mmap(NULL, HUGE_SLAB_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#else
+        memory = MAP_FAILED;
+#endif
+        if (memory == MAP_FAILED)
+        {
+            /* No reserved huge pages, map regular memory and ask for transparent huge pages */
+            memory = mmap(NULL, HUGE_SLAB_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+            if (memory != MAP_FAILED)
+                madvise(memory, HUGE_SLAB_BYTES, MADV_HUGEPAGE);
+#endif
+        }
+        if (memory != MAP_FAILED)
+        {
+            slab = (NodeSlab*)memory;
+            slab->bytes = HUGE_SLAB_BYTES;
+            slab->mapped = 1;
+            return slab;
+        }
+    }
+#else
+    (void)huge_pages;
+#endif
 
-AvlTree* get_worst_quality(AvlTree* node);
-AvlTree* get_worst_quality_between_tree_and_sub(AvlTree* left,AvlTree* root,AvlTree* right);
+    /* Fall back to a regular slab */
+    slab = (NodeSlab*)malloc(SLAB_BYTES);
+    /* Check if memory allocation was successful */
+    if (slab == NULL)
+    {
+        exit(1);
+    }
+    slab->bytes = SLAB_BYTES;
+    slab->mapped = 0;
+    return slab;
+}
 
+/* Function to allocate a node from a pool, released nodes are reused first */
+/*  Time O(1) */
+void* alloc_from_NodePool(NodePool* pool)
+{
+    void* node;
+    NodeSlab* slab;
 
-/***** functions *****/
+    pool->in_use++;
+    STATS_COUNT(allocations);
 
-/* Function to Allocate node */
-/*  Time O(1) , Space O(1)*/
-AvlTree* createNode(int key , int time , int quality)
-{
-    /* Allocate memory for the new node */
-    AvlTree* newNode = (AvlTree*)malloc(sizeof(AvlTree));
-    /* Check if memory allocation was successful */
-    if (newNode == NULL)
+    /* Reuse a released node if there is one */
+    if (pool->free_list != NULL)
     {
-        exit(1);
+        node = pool->free_list;
+        pool->free_list = *(void**)node;
+        pool->hits++;
+        return node;
     }
 
-    /* Initialize node values */
-    newNode->key = key;
-    newNode->height = 0;
-    newNode->size = 1;
-    newNode->left = NULL;
-    newNode->right = NULL;
+    pool->misses++;
 
-    /* Set time and quality values */
-    newNode->time = time;
-    newNode->quality = quality;
+    /* If the newest slab is full, allocate a new one */
+    if (pool->next_unused == NULL || pool->next_unused + pool->object_size > pool->slab_end)
+    {
+        slab = allocate_slab(pool->huge_pages);
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->slab_count++;
+        pool->bytes += slab->bytes;
+        pool->next_unused = (char*)slab + SLAB_HEADER_BYTES;
+        pool->slab_end = (char*)slab + slab->bytes;
+
+        /* Nodes whose size is a multiple of a cache line start on a line boundary */
+        if (pool->object_size % CACHE_LINE_BYTES == 0)
+            pool->next_unused = (char*)(((size_t)pool->next_unused + CACHE_LINE_BYTES - 1) & ~(size_t)(CACHE_LINE_BYTES - 1));
+    }
 
-    /* Set worst_quality initially to the new node itself */
-    newNode->worst_quality = newNode;
+    /* Carve the node from the newest slab */
+    node = pool->next_unused;
+    pool->next_unused += pool->object_size;
+    return node;
+}
 
-    /* Return a pointer to the new node */
-    return newNode;
+/* Function to release a node back to its pool */
+/*  Time O(1) */
+void free_to_NodePool(NodePool* pool, void* node)
+{
+    /* Push the node on the free list */
+    *(void**)node = pool->free_list;
+    pool->free_list = node;
+    pool->in_use--;
 }
 
-/* Function to find a node of a given key in a BST */
-/*  Time O(log(n)) */
-AvlTree* find(AvlTree* tree, int key)
+/* Function to release every slab of a pool, the pool is left empty and can be used again */
+/*  Time O(number of slabs) */
+void destroy_NodePool(NodePool* pool)
 {
-    /* If the tree is empty, return NULL */
-    if(tree == NULL)
-        return NULL;
+    NodeSlab* slab = pool->slabs;
+    NodeSlab* next;
 
-    /* If the key is less than the current node's key, search in the left subtree */
-    if(tree->key < key)
-        return find(tree->right, key);
+    while (slab != NULL)
+    {
+        next = slab->next;
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+        if (slab->mapped)
+            munmap(slab, slab->bytes);
+        else
+            free(slab);
+#else
+        free(slab);
+#endif
+        slab = next;
+    }
 
-    /* If the key is greater than the current node's key, search in the right subtree */
-    if(tree->key > key)
-        return find(tree->left, key);
+    /* Reset the pool, the counters of hits and misses are kept */
+    pool->slabs = NULL;
+    pool->next_unused = NULL;
+    pool->slab_end = NULL;
+    pool->free_list = NULL;
+    pool->slab_count = 0;
+    pool->in_use = 0;
+    pool->bytes = 0;
+}
 
-    /* If the key is equal to the current node's key, return the node */
-    return tree;
+/* Function to hash an int to a slot of a table of 2^(64 - shift) slots, by Fibonacci hashing */
+/*  Time O(1) */
+static size_t fibonacci_hash(int key, int shift)
+{
+    return (size_t)(((unsigned long long)(unsigned int)key * 0x9E3779B97F4A7C15ULL) >> shift);
 }
 
-/* Function to find the predecessor of a given key in a BST */
-/*  Time O(log(n)) */
-AvlTree* predecessor(AvlTree *tree, int key)
+/* Function to initialize an empty histogram, the table is allocated by the first product */
+/*  Time O(1) */
+static void init_QualityHistogram(QualityHistogram* histogram)
 {
-    /* Initialize a temporary pointer to NULL */
-    AvlTree* temp = NULL;
+    histogram->slots = NULL;
+    histogram->capacity = 0;
+    histogram->used = 0;
+    histogram->shift = 64;
+}
 
-    /* If the tree is empty, return NULL */
-    if (tree == NULL)
-        return NULL;
+/* Function to find the slot of a quality, or the empty slot where it would go */
+/*  Time O(1) expected */
+static size_t slot_of_quality(const QualityHistogram* histogram, int quality)
+{
+    size_t mask = histogram->capacity - 1;
+    size_t slot = fibonacci_hash(quality, histogram->shift);
 
-    /* Search for the node with the same key in the BST */
-    while (tree != NULL)
+    while (histogram->slots[slot].count != 0 && histogram->slots[slot].quality != quality)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+/* Function to double the number of slots of the histogram and move every quality to its new slot */
+/*  Time O(capacity) */
+static void grow_QualityHistogram(QualityHistogram* histogram)
+{
+    QualitySlot* old_slots = histogram->slots;
+    size_t old_capacity = histogram->capacity;
+    size_t i;
+
+    histogram->capacity = old_capacity != 0 ? 2 * old_capacity : 16;
+    histogram->shift = 64;
+    while (((size_t)1 << (64 - histogram->shift)) < histogram->capacity)
+        histogram->shift--;
+    histogram->slots = (QualitySlot*)calloc(histogram->capacity, sizeof(QualitySlot));
+    if (histogram->slots == NULL)
     {
-        /* If the node key eqaul to the key */
-        if (key == tree->key)
-        {
-            /* The maximum value in the left subtree is the predecessor */
-            if (tree->left != NULL)
-            {
-                temp = tree->left;
-                while (temp->right)
-                    temp = temp->right;
-            }
-            return temp;
-        }
-        /* If the key is less than the current node's key, move to the left subtree */
-        else if(key < tree->key)
-            tree = tree->left;
-        /* Otherwise, move to the right subtree */
-        else
-        {
-            temp = tree;
-            tree = tree->right;
-        }
+        exit(1);
     }
-    return temp;
-}
 
+    for (i = 0; i < old_capacity; i++)
+    {
+        if (old_slots[i].count != 0)
+            histogram->slots[slot_of_quality(histogram, old_slots[i].quality)] = old_slots[i];
+    }
+    free(old_slots);
+}
 
-/* Function to find the successor of a given key in a BST */
-/*  Time O(log(n)) */
-AvlTree* successor(AvlTree* tree, int key)
+/* Function to count one more product with a quality */
+/*  Time O(1) amortized */
+static void add_to_QualityHistogram(QualityHistogram* histogram, int quality)
 {
-    /* Initialize a temporary pointer to NULL */
-    AvlTree* temp = NULL;
+    size_t slot;
 
-    /* If the tree is empty, return NULL */
-    if (tree == NULL)
-        return NULL;
+    /* Keep the table at most half full, so the probe sequences stay short */
+    if (2 * (histogram->used + 1) > histogram->capacity)
+        grow_QualityHistogram(histogram);
 
-    /* Search for the node with the same key in BST */
-    while (tree != NULL)
+    slot = slot_of_quality(histogram, quality);
+    if (histogram->slots[slot].count == 0)
     {
-        /* If the node key eqaul to the key  */
-        if (key == tree->key)
-        {
-            /* the minimum value in the right subtree is successor */
-            if (tree->right != NULL)
-            {
-                temp = tree->right;
-                while (temp->left)
-                    temp = temp->left;
-            }
-            return temp;
-        }
-        /* If the key is less than the current node's key, move to the left subtree */
-        else if (key < tree->key)
-        {
-            temp = tree;
-            tree = tree->left;
-        }
-        /* Otherwise, move to the right subtree */
-        else
-            tree = tree->right;
+        histogram->slots[slot].quality = quality;
+        histogram->used++;
     }
-    return temp;
+    histogram->slots[slot].count++;
 }
 
-/* Function to insert a node into the AVL time tree */
-/*  Time O(log(n)) */
-AvlTree* insert_in_TimeTree(AvlTree* tree, AvlTree* node)
+/* Function to count one product less with a quality, the quality must be in the histogram */
+/*  Time O(1) expected */
+static void remove_from_QualityHistogram(QualityHistogram* histogram, int quality)
 {
-    if(tree==NULL)
-    {
-        /* If the tree is empty, the new node becomes the root */
-        return node;
-    }
-    if(node->key < tree->key)
-    {
-        /* Recursively insert into the left subtree */
-        tree->left = insert_in_TimeTree(tree->left , node);
-    }
-    else
+    size_t mask = histogram->capacity - 1;
+    size_t hole = slot_of_quality(histogram, quality);
+    size_t slot = hole;
+    size_t home;
+
+    if (--histogram->slots[hole].count != 0)
+        return;
+    histogram->used--;
+
+    /* Shift back the qualities of the probe sequence after the emptied slot, so no lookup stops at the hole too early */
+    for (;;)
     {
-        if(node->key > tree-> key)
-        {
-            /* Recursively insert into the right subtree */
-            tree->right = insert_in_TimeTree(tree->right , node);
-        }
-        else
+        slot = (slot + 1) & mask;
+        if (histogram->slots[slot].count == 0)
+            return;
+
+        /* A quality can fill the hole if its home is not cyclically in (hole, slot] */
+        home = fibonacci_hash(histogram->slots[slot].quality, histogram->shift);
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
         {
-            /* Duplicate keys are not allowed */
-            return tree;
+            histogram->slots[hole] = histogram->slots[slot];
+            histogram->slots[slot].count = 0;
+            hole = slot;
         }
     }
+}
 
-    /* update all variables of the node */
-    update_Node_Variables(tree);
+/* Function to get the number of products with a quality */
+/*  Time O(1) expected */
+static int count_in_QualityHistogram(const QualityHistogram* histogram, int quality)
+{
+    if (histogram->used == 0)
+        return 0;
+    return histogram->slots[slot_of_quality(histogram, quality)].count;
+}
 
-    /* balance the tree if necessary */
-    return balance(tree);
+/* Function to release the table of the histogram, it is left empty and can be used again */
+/*  Time O(1) */
+static void destroy_QualityHistogram(QualityHistogram* histogram)
+{
+    free(histogram->slots);
+    init_QualityHistogram(histogram);
 }
 
-/* Function to insert a node into the AVL quality tree */
-/*  Time O(log(n)) */
-AvlTree* insert_in_QualityTree(AvlTree* tree, AvlTree* node)
+/* Function to initialize an empty time index, the table is allocated by the first product */
+/*  Time O(1) */
+static void init_TimeIndex(TimeIndex* index)
 {
-    /* If the tree is empty, the new node becomes the root */
-    if(tree==NULL)
+    index->slots = NULL;
+    index->capacity = 0;
+    index->used = 0;
+    index->shift = 64;
+}
+
+/* Function to find the slot of a time, or the empty slot where it would go */
+/*  Time O(1) expected */
+static size_t slot_of_time(const TimeIndex* index, int time)
+{
+    size_t mask = index->capacity - 1;
+    size_t slot = fibonacci_hash(time, index->shift);
+
+    while (index->slots[slot].node != NULL && index->slots[slot].time != time)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+/* Function to double the number of slots of the time index and move every node to its new slot */
+/*  Time O(capacity) */
+static void grow_TimeIndex(TimeIndex* index)
+{
+    TimeSlot* old_slots = index->slots;
+    size_t old_capacity = index->capacity;
+    size_t i;
+
+    index->capacity = old_capacity != 0 ? 2 * old_capacity : 16;
+    index->shift = 64;
+    while (((size_t)1 << (64 - index->shift)) < index->capacity)
+        index->shift--;
+    index->slots = (TimeSlot*)calloc(index->capacity, sizeof(TimeSlot));
+    if (index->slots == NULL)
     {
-        return node;
+        exit(1);
     }
 
-    /* If the quality of the new node is less than the quality of the current node, recursively insert into the left subtree */
-    if(node->key < tree->key)
+    for (i = 0; i < old_capacity; i++)
     {
-        tree->left = insert_in_QualityTree(tree->left , node);
+        if (old_slots[i].node != NULL)
+            index->slots[slot_of_time(index, old_slots[i].time)] = old_slots[i];
     }
-    else
+    free(old_slots);
+}
+
+/* Function to add the node of a new time to the time index */
+/*  Time O(1) amortized */
+static void insert_in_TimeIndex(TimeIndex* index, AvlTree* node)
+{
+    size_t slot;
+
+    /* Keep the table at most half full, so the probe sequences stay short */
+    if (2 * (index->used + 1) > index->capacity)
+        grow_TimeIndex(index);
+
+    slot = slot_of_time(index, node->time);
+    index->slots[slot].time = node->time;
+    index->slots[slot].node = node;
+    index->used++;
+}
+
+/* Function to remove a time from the time index, the time must be in the index */
+/*  Time O(1) expected */
+static void remove_from_TimeIndex(TimeIndex* index, int time)
+{
+    size_t mask = index->capacity - 1;
+    size_t hole = slot_of_time(index, time);
+    size_t slot = hole;
+    size_t home;
+
+    index->slots[hole].node = NULL;
+    index->used--;
+
+    /* Shift back the times of the probe sequence after the emptied slot, like remove_from_QualityHistogram */
+    for (;;)
     {
-        /* If the quality of the new node is greater than the quality of the current node, recursively insert into the right subtree */
-        if(node->key > tree->key)
-        {
-            tree->right = insert_in_QualityTree(tree->right , node);
-        }
-        else
+        slot = (slot + 1) & mask;
+        if (index->slots[slot].node == NULL)
+            return;
+
+        home = fibonacci_hash(index->slots[slot].time, index->shift);
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
         {
-            /* If the qualities are equal, insert based on time */
-            if(node->time < tree->time)
-                tree->left= insert_in_QualityTree(tree->left , node);
-            else
-                tree->right = insert_in_QualityTree(tree->right , node);
+            index->slots[hole] = index->slots[slot];
+            index->slots[slot].node = NULL;
+            hole = slot;
         }
     }
+}
 
-    /* update all variables of the node */
-    update_Node_Variables(tree);
+/* Function to find the node of a time in the time index, NULL if there is none */
+/*  Time O(1) expected */
+static AvlTree* find_in_TimeIndex(const TimeIndex* index, int time)
+{
+    if (index->used == 0)
+        return NULL;
+    return index->slots[slot_of_time(index, time)].node;
+}
 
-    /* balance the tree if necessary */
-    return balance(tree);
+/* Function to release the table of the time index, it is left empty and can be used again */
+/*  Time O(1) */
+static void destroy_TimeIndex(TimeIndex* index)
+{
+    free(index->slots);
+    init_TimeIndex(index);
 }
 
+/* Function to Allocate node */
+/*  Time O(1) , Space O(1)*/
+static AvlTree* createNode(NodePool* pool, int time , int quality)
+{
+    /* Allocate memory for the new node */
+    AvlTree* newNode = (AvlTree*)alloc_from_NodePool(pool);
+
+    /* Set time and quality values */
+    newNode->time = time;
+    newNode->quality = quality;
+
+    /* Initialize the links of the time tree */
+    newNode->height = 0;
+    newNode->size = 1;
+    newNode->left = NULL;
+    newNode->right = NULL;
 
+    /* Set worst_quality and the aggregates initially to the new node itself */
+    newNode->worst_quality = newNode;
+#ifdef AVL_AGGREGATES
+    newNode->sum_quality = quality;
+    newNode->squared_deviations = 0;
+    newNode->max_quality = quality;
+#endif
+    newNode->alive = 1;
+
+    /* Initialize the links of the quality tree */
+    newNode->q_height = 0;
+    newNode->q_size = 1;
+    newNode->q_left = NULL;
+    newNode->q_right = NULL;
+
+    /* Return a pointer to the new node */
+    return newNode;
+}
 
-/* Function to find the node with the minimum key value in the AVL tree */
+/* Function to find a node of a given time in the time tree */
 /*  Time O(log(n)) */
-AvlTree* minInTree(AvlTree* tree)
+static AvlTree* find(AvlTree* tree, int key)
 {
-    /* If the left child is NULL, then this node has the minimum key value */
-    if(tree->left==NULL)
+    while (tree != NULL)
     {
-        return tree;
+        STATS_COUNT(nodes_visited);
+
+        /* If the key is greater than the current node's time, search in the right subtree */
+        if (tree->time < key)
+            tree = tree->right;
+        /* If the key is less than the current node's time, search in the left subtree */
+        else if (tree->time > key)
+            tree = tree->left;
+        /* If the key is equal to the current node's time, return the node */
+        else
+            return tree;
     }
 
-    /* Recursively search in the left subtree for the node with the minimum key value */
-    return minInTree(tree->left);
+    /* The key is not in the tree */
+    return NULL;
 }
 
-/* Function to find the node with the maximum quality value in the qualityTree      */
+
+
+/* Function to insert a node into the time tree balanced by a given scheme, returns 0 if a node with the same time exists.
+   The path is kept on a stack, it is rebalanced bottom-up only until a height stops changing
+   and the ancestors above only get their size and worst_quality updated */
 /*  Time O(log(n)) */
-int maxQualityInTree(AvlTree* tree)
+static int insert_in_TimeTree(AvlTree** root, AvlTree* node, int scheme)
 {
-    /* If the right child is NULL, then this node has the maximum quality value */
-    if(tree->right==NULL)
+    AvlTree** path[TIME_TREE_MAX_HEIGHT];
+    AvlTree** link = root;
+    AvlTree* tree;
+    int depth = 0;
+
+    /* A treap does not insert at the bottom */
+    if (scheme == BALANCE_TREAP)
+        return insert_in_Treap(root, node);
+
+    /* Descend to the empty link of the new node */
+    while (*link != NULL)
     {
-        return tree->quality;
+        tree = *link;
+        STATS_COUNT(nodes_visited);
+
+        /* Duplicate keys are not allowed */
+        if (node->time == tree->time)
+            return 0;
+
+        path[depth++] = link;
+        link = node->time < tree->time ? &tree->left : &tree->right;
     }
+    *link = node;
 
-    /* Recursively search in the right subtree for the maximum quality value */
-    return maxQualityInTree(tree->right);
+    if (scheme == BALANCE_RED_BLACK)
+        rebalance_RedBlack_insertion(path, depth, node);
+    else
+        rebalance_TimeTree_path(path, depth, node);
+    return 1;
 }
 
-/* Function to delete a node with a given key from the AVL tree */
-/*  Time O(log(n)) */
-AvlTree* deleteNode(AvlTree* tree, int key)
+/* Function to append a node with a time larger than every time of the time tree balanced by a given scheme.
+   The node goes to the end of the right spine, found without comparing any time */
+/*  Time O(log(n)) for the updates of the spine, no search */
+static void append_to_TimeTree(AvlTree** root, AvlTree* node, int scheme)
 {
-    AvlTree* temp;
-
-    /* Base case: if the tree is empty */
-    if (tree == NULL)
-        return NULL;
+    AvlTree** path[TIME_TREE_MAX_HEIGHT];
+    AvlTree** link = root;
+    int depth = 0;
 
-    /* If the key to be deleted is smaller than the root's key,
-       then it lies in the left subtree */
-    if (key < tree->key)
+    /* Follow the right spine to its empty end, in a treap only down to the first node of a lower priority */
+    while (*link != NULL && (scheme != BALANCE_TREAP || higher_priority(*link, node)))
     {
-        tree->left = deleteNode(tree->left, key);
+        STATS_COUNT(nodes_visited);
+        path[depth++] = link;
+        link = &(*link)->right;
     }
-    else if (key > tree->key)
+
+    /* Every time of the rest of the spine is smaller, so the node takes its place with it as the left subtree */
+    if (scheme == BALANCE_TREAP)
     {
-        /* If the key to be deleted is greater than the root's key,
-           then it lies in the right subtree */
-        tree->right = deleteNode(tree->right, key);
+        node->left = *link;
+        update_Node_Variables_Without_Height(node);
+        *link = node;
+        add_to_TimeTree_path(path, depth, node);
+        return;
     }
-    else
-    {
-        /* If the key is the same as the root's key, then this is the node to be deleted */
-        if ((tree->left == NULL) || (tree->right == NULL))
-        {
-            /* If the node has no children or only one child */
+    *link = node;
 
-            /* Get the child node */
-            if (tree->left != NULL)
-            {
-                temp = tree->left;
-            }
-            else
-            {
-                temp = tree->right;
-            }
+    if (scheme == BALANCE_RED_BLACK)
+        rebalance_RedBlack_insertion(path, depth, node);
+    else
+        rebalance_TimeTree_path(path, depth, node);
+}
 
-            /* Free the node */
-            free(tree);
-            return temp;
-        }
-        else
-        {
-            /* If the node has two children, then get the the successor (smallest in the right subtree) */
-            temp = minInTree(tree->right);
+/* Function to rebalance the path of a node just linked in the AVL or WAVL time tree, path holds the links of its depth ancestors.
+   It is rebalanced bottom-up only until a height stops changing and the ancestors above only get their variables updated.
+   Without deletions a WAVL tree is an AVL tree and its ranks are the heights, so both insert the same way */
+/*  Time O(log(n)) */
+static void rebalance_TimeTree_path(AvlTree*** path, int depth, AvlTree* node)
+{
+    AvlTree** link;
+    AvlTree* tree;
+    int old_height;
 
-            /* Copy the successor's data to this node */
-            tree->key = temp->key;
-            tree->time = temp->time;
-            tree->quality = temp->quality;
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        tree = *link;
+        old_height = tree->height;
 
-            /* Delete the successor */
-            tree->right = deleteNode(tree->right, temp->key);
-        }
+        /* update all variables of the node and balance the tree if necessary */
+        update_Node_Variables(tree);
+        *link = balance(tree);
 
+        /* If the height did not change, the ancestors stay balanced */
+        if ((*link)->height == old_height)
+            break;
     }
 
-    /* update all variables of the node */
-    update_Node_Variables(tree);
+    /* The ancestors above only gained the new node */
+    add_to_TimeTree_path(path, depth, node);
+}
 
-    /* balance the tree if necessary */
-    return balance(tree);
+/* Function to update the depth ancestors of a node just linked in the time tree, path holds their links.
+   The shape above the node did not change, they only gained it */
+/*  Time O(depth) */
+static void add_to_TimeTree_path(AvlTree*** path, int depth, AvlTree* node)
+{
+    AvlTree* tree;
 
+    while (depth > 0)
+    {
+        tree = *path[--depth];
+        tree->size++;
+        if (tree->worst_quality == NULL || node->quality < tree->worst_quality->quality ||
+            (node->quality == tree->worst_quality->quality && node->time < tree->worst_quality->time))
+            tree->worst_quality = node;
+        update_Node_Aggregates(tree);
+    }
 }
 
-/* Function to delete a node with a given quality_key and time_key from the AVL quality tree */
-/*  Time O(log(n)) */
-AvlTree* deleteNode_in_QualityTree(AvlTree* tree, int quality_key , int time_key)
+/* Function to rebalance the path of a node just linked in the red-black time tree, path holds the links of its depth ancestors.
+   The node gets the rank of a leaf, which makes it a red child. While its parent is red too, a red uncle is fixed
+   by promoting the grandparent, the fix goes two levels up, a black uncle by one or two rotations that end it */
+/*  Time O(log(n)), O(1) rotations */
+static void rebalance_RedBlack_insertion(AvlTree*** path, int depth, AvlTree* node)
 {
-    AvlTree* temp;
+    AvlTree* parent;
+    AvlTree* grandparent;
+    AvlTree* uncle;
 
-    /* Base case: if the tree is empty */
-    if (tree == NULL)
-        return NULL;
+    /* The ancestors gained the node first, the rotations only recompute the nodes they move */
+    node->height = 1;
+    add_to_TimeTree_path(path, depth, node);
 
-    /* If the quality_key to be deleted is smaller than the root's key, then it lies in the left subtree */
-    if (quality_key < tree->key)
-    {
-        temp = deleteNode_in_QualityTree(tree->left, quality_key, time_key);
-        tree->left = temp;
-    }
-    else if (quality_key > tree->key)
-    {
-        /* If the quality_key to be deleted is greater than the root's key, then it lies in the right subtree */
-        temp = deleteNode_in_QualityTree(tree->right, quality_key, time_key);
-        tree->right = temp;
-    }
-    else
+    while (depth >= 2)
     {
-        /* If the quality_key is the same as the root's key, then check the time_key */
-        if (time_key < tree->time)
+        parent = *path[depth - 1];
+        grandparent = *path[depth - 2];
+
+        /* The tree is fixed once the node or its parent is black */
+        if (node->height != parent->height || parent->height != grandparent->height)
+            return;
+
+        uncle = grandparent->left == parent ? grandparent->right : grandparent->left;
+        if (uncle != NULL && uncle->height == grandparent->height)
         {
-            /* If the time_key to be deleted is smaller than the root's time, then it lies in the left subtree */
-            tree->left = deleteNode_in_QualityTree(tree->left, quality_key, time_key);
+            /* Red uncle: the promotion makes the parent and the uncle black, the grandparent may be a red child now */
+            grandparent->height++;
+            node = grandparent;
+            depth -= 2;
+            continue;
         }
-        else if (time_key > tree->time)
+
+        /* Black uncle: the red node or parent goes above the grandparent, the ranks stay */
+        if (parent == grandparent->left)
         {
-            /* If the time_key to be deleted is greater than the root's time, then it lies in the right subtree */
-            tree->right = deleteNode_in_QualityTree(tree->right, quality_key, time_key);
+            if (node == parent->right)
+                grandparent->left = leftRotate_Ranked(parent);
+            *path[depth - 2] = rightRotate_Ranked(grandparent);
         }
         else
         {
-            /* If both quality_key and time_key match, this is the node to be deleted */
+            if (node == parent->left)
+                grandparent->right = rightRotate_Ranked(parent);
+            *path[depth - 2] = leftRotate_Ranked(grandparent);
+        }
+        return;
+    }
+}
 
-            if ((tree->left == NULL) || (tree->right == NULL))
-            {
-                /* if node is a leaf or only has one son */
+/* Function to insert a node into the treap time tree, returns 0 if a node with the same time exists.
+   The node goes down only until the subtree below has a lower priority, the subtree is split around its time into its children */
+/*  Time O(log(n)) expected */
+static int insert_in_Treap(AvlTree** root, AvlTree* node)
+{
+    AvlTree** path[TIME_TREE_MAX_HEIGHT];
+    AvlTree** link = root;
+    AvlTree* tree;
+    int depth = 0;
 
-                /* Get the child node */
-                if (tree->left != NULL)
-                {
-                    temp = tree->left;
-                }
-                else
-                {
-                    temp = tree->right;
-                }
-                /* Free the node */
-                free(tree);
-                return temp;
-            }
-            else
-            {
-                /* node has two sons */
+    /* Descend to the place of the node */
+    while (*link != NULL && higher_priority(*link, node))
+    {
+        tree = *link;
+        STATS_COUNT(nodes_visited);
 
-                temp = minInTree(tree->right);
+        /* Duplicate keys are not allowed */
+        if (node->time == tree->time)
+            return 0;
 
-                /* Swap key, time, and quality with the successor */
-                tree->key = temp->key;
-                tree->time = temp->time;
-                tree->quality = temp->quality;
+        path[depth++] = link;
+        link = node->time < tree->time ? &tree->left : &tree->right;
+    }
 
-                /* Delete the successor */
-                tree->right = deleteNode_in_QualityTree(tree->right, temp->key, temp->time);
-            }
-        }
+    /* A node with the same time can still be in the subtree below */
+    if (find(*link, node->time) != NULL)
+        return 0;
+
+    split_TimeTree(*link, node->time, &node->left, &node->right, BALANCE_TREAP);
+    update_Node_Variables_Without_Height(node);
+    *link = node;
+    add_to_TimeTree_path(path, depth, node);
+    return 1;
+}
+
+/* Function to insert a node into the AVL quality tree, sorted by (quality, time).
+   Rebalanced bottom-up only until a height stops changing, like insert_in_TimeTree */
+/*  Time O(log(n)) */
+static void insert_in_QualityTree(AvlTree** root, AvlTree* node)
+{
+    AvlTree** path[AVL_MAX_HEIGHT];
+    AvlTree** link = root;
+    AvlTree* tree;
+    int depth = 0;
+    int old_height;
+
+    /* Descend to the empty link of the new node, if the qualities are equal go by time */
+    while (*link != NULL)
+    {
+        tree = *link;
+        STATS_COUNT(nodes_visited);
+        path[depth++] = link;
+        if (node->quality < tree->quality || (node->quality == tree->quality && node->time < tree->time))
+            link = &tree->q_left;
+        else
+            link = &tree->q_right;
     }
+    *link = node;
 
-    /* If the tree before delete had only one node then return */
-    if (tree == NULL)
-        return NULL;
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        tree = *link;
+        old_height = tree->q_height;
+
+        /* update all variables of the node and balance the tree if necessary */
+        update_Quality_Node_Variables(tree);
+        *link = balance_QualityTree(tree);
+
+        /* If the height did not change, the ancestors stay balanced */
+        if ((*link)->q_height == old_height)
+            break;
+    }
+
+    /* The ancestors above only gained the new node */
+    while (depth > 0)
+        (*path[--depth])->q_size++;
+}
+
+
+/* Function to find the node with the minimum time value in the AVL time tree */
+/*  Time O(log(n)) */
+static AvlTree* minInTree(AvlTree* tree)
+{
+    /* The leftmost node has the minimum time value */
+    while (tree->left != NULL)
+        tree = tree->left;
+    return tree;
+}
+
+/* Function to find the node with the maximum time value in the AVL time tree */
+/*  Time O(log(n)) */
+static AvlTree* maxInTree(AvlTree* tree)
+{
+    /* The rightmost node has the maximum time value */
+    while (tree->right != NULL)
+        tree = tree->right;
+    return tree;
+}
+
+/* Function to find the node with the minimum (quality, time) in the AVL quality tree */
+/*  Time O(log(n)) */
+static AvlTree* minInQualityTree(AvlTree* tree)
+{
+    /* The leftmost node has the minimum quality value */
+    while (tree->q_left != NULL)
+        tree = tree->q_left;
+    return tree;
+}
+
+
+/* Function to unlink the node with the minimum time from the AVL time tree, the node is not freed */
+/*  Time O(log(n)) */
+static AvlTree* removeMinInTree(AvlTree* tree)
+{
+    /* If the left child is NULL, then this node is the minimum, its right child takes its place */
+    if (tree->left == NULL)
+        return tree->right;
+
+    tree->left = removeMinInTree(tree->left);
 
     /* update all variables of the node */
     update_Node_Variables(tree);
@@ -431,9 +1002,461 @@ AvlTree* deleteNode_in_QualityTree(AvlTree* tree, int quality_key , int time_key
     return balance(tree);
 }
 
+/* Function to unlink the node with the minimum (quality, time) from the AVL quality tree, the node is not freed */
+/*  Time O(log(n)) */
+static AvlTree* removeMinInQualityTree(AvlTree* tree)
+{
+    /* If the left child is NULL, then this node is the minimum, its right child takes its place */
+    if (tree->q_left == NULL)
+        return tree->q_right;
+
+    tree->q_left = removeMinInQualityTree(tree->q_left);
+
+    /* update all variables of the node */
+    update_Quality_Node_Variables(tree);
+
+    /* balance the tree if necessary */
+    return balance_QualityTree(tree);
+}
+
+/* Function to unlink the node with a given time from the time tree balanced by a given scheme in a single descent, returns the node or NULL.
+   The node is shared with the quality tree, so it is not freed here */
+/*  Time O(log(n)) */
+static AvlTree* deleteNode(AvlTree** root, int key, int scheme)
+{
+    AvlTree** path[TIME_TREE_MAX_HEIGHT];
+    AvlTree** link = root;
+    AvlTree* node;
+    AvlTree* successor = NULL;
+    AvlTree* tree;
+    int depth = 0;
+    int node_depth = 0;
+    int old_height;
+
+    /* Descend to the node with the key */
+    while (*link != NULL && (*link)->time != key)
+    {
+        STATS_COUNT(nodes_visited);
+        path[depth++] = link;
+        link = key < (*link)->time ? &(*link)->left : &(*link)->right;
+    }
+
+    /* The key is not in the tree */
+    node = *link;
+    if (node == NULL)
+        return NULL;
+
+    /* In a treap the children of the node are joined by priority in its place */
+    if (scheme == BALANCE_TREAP)
+    {
+        *link = join2_TimeTree(node->left, node->right, BALANCE_TREAP);
+        remove_from_TimeTree_path(path, depth, node, NULL);
+        return node;
+    }
+
+    if (node->left == NULL || node->right == NULL)
+    {
+        /* If the node has no children or only one child, the child takes its place */
+        *link = node->left != NULL ? node->left : node->right;
+    }
+    else
+    {
+        /* If the node has two children, continue the descent to the successor (smallest in the right subtree) */
+        node_depth = depth;
+        path[depth++] = link;
+        link = &node->right;
+        while ((*link)->left != NULL)
+        {
+            STATS_COUNT(nodes_visited);
+            path[depth++] = link;
+            link = &(*link)->left;
+        }
+
+        /* Unlink the successor, its right child takes its place */
+        successor = *link;
+        *link = successor->right;
+
+        /* The successor takes the place of the node, the path below it goes through the successor now */
+        successor->left = node->left;
+        successor->right = node->right;
+        successor->height = node->height;
+        successor->size = node->size;
+        successor->worst_quality = node->worst_quality;
+#ifdef AVL_AGGREGATES
+        successor->sum_quality = node->sum_quality;
+        successor->squared_deviations = node->squared_deviations;
+        successor->max_quality = node->max_quality;
+#endif
+        *path[node_depth] = successor;
+        if (node_depth + 1 < depth)
+            path[node_depth + 1] = &successor->right;
+        else
+            link = &successor->right;
+    }
+
+    /* The WAVL and red-black trees update the whole path first, the rotations of their fixes only recompute the nodes they move */
+    if (scheme != BALANCE_AVL)
+    {
+        remove_from_TimeTree_path(path, depth, node, successor);
+        if (scheme == BALANCE_WAVL)
+            rebalance_WAVL_deletion(path, depth, link);
+        else
+            rebalance_RedBlack_deletion(path, depth, link);
+        return node;
+    }
+
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        tree = *link;
+        old_height = tree->height;
+
+        /* update all variables of the node and balance the tree if necessary */
+        update_Node_Variables(tree);
+        *link = balance(tree);
+
+        /* If the height did not change, the ancestors stay balanced */
+        if ((*link)->height == old_height)
+            break;
+    }
+
+    /* The ancestors above only lost the node */
+    remove_from_TimeTree_path(path, depth, node, successor);
+    return node;
+}
+
+/* Function to update the depth ancestors of a node just unlinked from the time tree, path holds their links.
+   If the successor took the place of the node, worst_quality is recomputed where it was either of them */
+/*  Time O(depth) */
+static void remove_from_TimeTree_path(AvlTree*** path, int depth, AvlTree* node, AvlTree* successor)
+{
+    AvlTree* tree;
+
+    while (depth > 0)
+    {
+        tree = *path[--depth];
+        tree->size--;
+        if (tree->worst_quality == node || tree->worst_quality == successor)
+            tree->worst_quality = get_worst_quality_between_tree_and_sub(get_worst_quality(tree->left), tree, get_worst_quality(tree->right));
+        update_Node_Aggregates(tree);
+    }
+}
+
+/* Function to fix the ranks of the WAVL time tree after a node was unlinked, link is the link whose subtree lost it and path holds
+   the links of its depth ancestors. Ranks of siblings differ by 1 or 2 and leaves have rank 0, so a leaf left with rank 1 or a child
+   3 ranks below its parent is demoted up the path, with at most one single or double rotation at the end */
+/*  Time O(log(n)), O(1) rotations */
+static void rebalance_WAVL_deletion(AvlTree*** path, int depth, AvlTree** link)
+{
+    AvlTree** parent_link;
+    AvlTree* parent;
+    AvlTree* sibling;
+    AvlTree* outer;
+    AvlTree* inner;
+    int left;
+
+    while (depth > 0)
+    {
+        parent_link = path[--depth];
+        parent = *parent_link;
+        left = link == &parent->left;
+        sibling = left ? parent->right : parent->left;
+
+        if (parent->left == NULL && parent->right == NULL)
+        {
+            /* A leaf of rank 1 is demoted */
+            parent->height = 0;
+        }
+        else if (parent->height - heightOfNode(*link) < 3)
+        {
+            /* The ranks are valid again */
+            return;
+        }
+        else if (parent->height - heightOfNode(sibling) == 2)
+        {
+            /* The sibling is a 2-child, the parent is demoted */
+            parent->height--;
+        }
+        else if (sibling->height - heightOfNode(sibling->left) == 2 && sibling->height - heightOfNode(sibling->right) == 2)
+        {
+            /* The sibling is a 1-child with two 2-children, both are demoted */
+            parent->height--;
+            sibling->height--;
+        }
+        else
+        {
+            outer = left ? sibling->right : sibling->left;
+            inner = left ? sibling->left : sibling->right;
+            if (sibling->height - heightOfNode(outer) == 1)
+            {
+                /* Single rotation, the sibling goes above the parent */
+                *parent_link = left ? leftRotate_Ranked(parent) : rightRotate_Ranked(parent);
+                sibling->height++;
+                parent->height--;
+                if (parent->left == NULL && parent->right == NULL)
+                    parent->height--;
+            }
+            else
+            {
+                /* Double rotation, the inner child of the sibling goes above both */
+                if (left)
+                {
+                    parent->right = rightRotate_Ranked(sibling);
+                    *parent_link = leftRotate_Ranked(parent);
+                }
+                else
+                {
+                    parent->left = leftRotate_Ranked(sibling);
+                    *parent_link = rightRotate_Ranked(parent);
+                }
+                inner->height += 2;
+                sibling->height--;
+                parent->height -= 2;
+            }
+            return;
+        }
+
+        /* The demoted parent may be a 3-child now */
+        link = parent_link;
+    }
+}
+
+/* Function to fix the ranks of the red-black time tree after a node was unlinked, link is the link whose subtree lost it and path holds
+   the links of its depth ancestors. A child 2 ranks below its parent is a missing black node: a red sibling is rotated above
+   the parent first, then a black sibling with two black children is made red by demoting the parent, which moves the fix
+   one level up, and a black sibling with a red child ends it with one or two rotations */
+/*  Time O(log(n)), O(1) rotations */
+static void rebalance_RedBlack_deletion(AvlTree*** path, int depth, AvlTree** link)
+{
+    AvlTree** parent_link;
+    AvlTree* parent;
+    AvlTree* sibling;
+    AvlTree* outer;
+    AvlTree* inner;
+    int left;
+
+    while (depth > 0)
+    {
+        parent_link = path[--depth];
+        parent = *parent_link;
+        if (parent->height - rankOfRedBlackNode(*link) < 2)
+            return;
+
+        left = link == &parent->left;
+        sibling = left ? parent->right : parent->left;
+
+        /* A red sibling goes above the parent, the parent is red now and its new sibling black */
+        if (sibling->height == parent->height)
+        {
+            *parent_link = left ? leftRotate_Ranked(parent) : rightRotate_Ranked(parent);
+            parent_link = left ? &sibling->left : &sibling->right;
+            sibling = left ? parent->right : parent->left;
+        }
+
+        outer = left ? sibling->right : sibling->left;
+        inner = left ? sibling->left : sibling->right;
+        if (rankOfRedBlackNode(outer) == sibling->height)
+        {
+            /* The outer child is red: the sibling goes above the parent and takes its rank */
+            *parent_link = left ? leftRotate_Ranked(parent) : rightRotate_Ranked(parent);
+            sibling->height++;
+            parent->height--;
+            return;
+        }
+        if (rankOfRedBlackNode(inner) == sibling->height)
+        {
+            /* The inner child is red: it goes above the sibling and the parent and takes the rank of the parent */
+            if (left)
+            {
+                parent->right = rightRotate_Ranked(sibling);
+                *parent_link = leftRotate_Ranked(parent);
+            }
+            else
+            {
+                parent->left = leftRotate_Ranked(sibling);
+                *parent_link = rightRotate_Ranked(parent);
+            }
+            inner->height++;
+            parent->height--;
+            return;
+        }
+
+        /* Both children of the sibling are black: the demotion makes the sibling red, a red parent becomes black and ends the fix */
+        parent->height--;
+        if (*path[depth] != parent)
+            return;
+        link = parent_link;
+    }
+}
+
+/* Function to unlink a given node from the AVL quality tree in a single descent by its (quality, time).
+   Returns 0 if the node is not in the tree */
+/*  Time O(log(n)) */
+static int deleteNode_in_QualityTree(AvlTree** root, AvlTree* node)
+{
+    AvlTree** path[AVL_MAX_HEIGHT];
+    AvlTree** link = root;
+    AvlTree* successor = NULL;
+    AvlTree* removed;
+    AvlTree* tree;
+    int depth = 0;
+    int node_depth = 0;
+    int old_height;
+
+    /* Descend to the node */
+    while (*link != NULL && *link != node)
+    {
+        tree = *link;
+        STATS_COUNT(nodes_visited);
+        path[depth++] = link;
+        if (node->quality < tree->quality || (node->quality == tree->quality && node->time < tree->time))
+            link = &tree->q_left;
+        else
+            link = &tree->q_right;
+    }
+
+    /* The node is not in the tree */
+    if (*link == NULL)
+        return 0;
+
+    if (node->q_left == NULL || node->q_right == NULL)
+    {
+        /* if node is a leaf or only has one son, the son takes its place */
+        *link = node->q_left != NULL ? node->q_left : node->q_right;
+    }
+    else
+    {
+        /* node has two sons, continue the descent to the successor */
+        node_depth = depth;
+        path[depth++] = link;
+        link = &node->q_right;
+        while ((*link)->q_left != NULL)
+        {
+            path[depth++] = link;
+            link = &(*link)->q_left;
+        }
+
+        /* Unlink the successor, its right son takes its place */
+        successor = *link;
+        *link = successor->q_right;
+
+        /* The successor takes the place of the node, the path below it goes through the successor now */
+        successor->q_left = node->q_left;
+        successor->q_right = node->q_right;
+        successor->q_height = node->q_height;
+        successor->q_size = node->q_size;
+        *path[node_depth] = successor;
+        if (node_depth + 1 < depth)
+            path[node_depth + 1] = &successor->q_right;
+    }
+
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        tree = *link;
+        old_height = tree->q_height;
+
+        /* update all variables of the node and balance the tree if necessary */
+        update_Quality_Node_Variables(tree);
+        *link = balance_QualityTree(tree);
+
+        /* If the height did not change, the ancestors stay balanced */
+        if ((*link)->q_height == old_height)
+            break;
+    }
+
+    /* The ancestors above only lost the node, below the old place of the node they lost the successor instead.
+       A product removed in lazy delete mode was not counted */
+    while (depth > 0)
+    {
+        tree = *path[--depth];
+        removed = successor != NULL && depth > node_depth ? successor : node;
+        tree->q_size -= removed->alive;
+    }
+
+    return 1;
+}
+
+/* Function to mark the product of a given time removed in the AVL time tree, for lazy delete mode. Returns its node, or NULL if
+   there is no alive product with the time. The node stays in place, its ancestors lose its quality in their counts and aggregates */
+/*  Time O(log(n)) */
+static AvlTree* mark_removed_in_TimeTree(AvlTree* tree, int time)
+{
+    AvlTree* path[TIME_TREE_MAX_HEIGHT];
+    AvlTree* node;
+    int depth = 0;
+
+    /* Descend to the node */
+    while (tree != NULL && tree->time != time)
+    {
+        STATS_COUNT(nodes_visited);
+        path[depth++] = tree;
+        tree = time < tree->time ? tree->left : tree->right;
+    }
+    node = tree;
+    if (node == NULL || !node->alive)
+        return NULL;
+
+    node->alive = 0;
+    update_Node_Variables_Without_Height(node);
+
+    /* The ancestors only lose the product, worst_quality is recomputed only where it was the one */
+    while (depth > 0)
+    {
+        tree = path[--depth];
+        tree->size--;
+        if (tree->worst_quality == node)
+            tree->worst_quality = get_worst_quality_between_tree_and_sub(get_worst_quality(tree->left), tree, get_worst_quality(tree->right));
+        update_Node_Aggregates(tree);
+    }
+    return node;
+}
+
+/* Function to mark a product removed in the AVL quality tree, for lazy delete mode. Every node on its path loses it in its size */
+/*  Time O(log(n)) */
+static void mark_removed_in_QualityTree(AvlTree* tree, AvlTree* node)
+{
+    while (tree != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+        tree->q_size--;
+        if (tree == node)
+            return;
+        if (node->quality < tree->quality || (node->quality == tree->quality && node->time < tree->time))
+            tree = tree->q_left;
+        else
+            tree = tree->q_right;
+    }
+}
+
+/* Function to update the variables of the path from the root of the AVL time tree to the node of a given time,
+   after a product removed in lazy delete mode came back. The shape does not change, nothing is rebalanced */
+/*  Time O(log(n)) */
+static void update_TimeTree_path(AvlTree* tree, int time)
+{
+    AvlTree* path[TIME_TREE_MAX_HEIGHT];
+    int depth = 0;
+
+    /* Descend to the node */
+    while (tree != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+        path[depth++] = tree;
+        if (time == tree->time)
+            break;
+        tree = time < tree->time ? tree->left : tree->right;
+    }
+
+    /* Update the node and its ancestors bottom-up */
+    while (depth > 0)
+        update_Node_Variables_Without_Height(path[--depth]);
+}
+
 /* Function to balance the AVL tree */
 /*  Time O(1)) */
-AvlTree* balance(AvlTree* node)
+static AvlTree* balance(AvlTree* node)
 {
     AvlTree* y;
 
@@ -474,11 +1497,13 @@ AvlTree* balance(AvlTree* node)
 
 /* Function to perform a left rotation */
 /*  Time O(1) */
-AvlTree* leftRotate(AvlTree* node)
+static AvlTree* leftRotate(AvlTree* node)
 {
     AvlTree* sub_tree_1 = node->right;
     AvlTree* sub_tree_2 = sub_tree_1->left;
 
+    STATS_COUNT(rotations);
+
     /* Perform rotation */
     sub_tree_1->left = node;
     node->right = sub_tree_2;
@@ -494,11 +1519,13 @@ AvlTree* leftRotate(AvlTree* node)
 /* Function to perform a right rotation */
 /*  Time O(1) */
 
-AvlTree* rightRotate(AvlTree* node)
+static AvlTree* rightRotate(AvlTree* node)
 {
     AvlTree* sub_tree_1 = node->left;
     AvlTree* sub_tree_2 = sub_tree_1->right;
 
+    STATS_COUNT(rotations);
+
     /* Perform rotation */
     sub_tree_1->right = node;
     node->left = sub_tree_2;
@@ -511,53 +1538,316 @@ AvlTree* rightRotate(AvlTree* node)
     return sub_tree_1;
 }
 
+/* Function to perform a left rotation in the WAVL or red-black time tree, the ranks are left for the caller to fix */
+/*  Time O(1) */
+static AvlTree* leftRotate_Ranked(AvlTree* node)
+{
+    AvlTree* sub_tree_1 = node->right;
+
+    STATS_COUNT(rotations);
+
+    /* Perform rotation */
+    node->right = sub_tree_1->left;
+    sub_tree_1->left = node;
+
+    /* Update the variables of the nodes, their ranks stay */
+    update_Node_Variables_Without_Height(node);
+    update_Node_Variables_Without_Height(sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to perform a right rotation in the WAVL or red-black time tree, the ranks are left for the caller to fix */
+/*  Time O(1) */
+static AvlTree* rightRotate_Ranked(AvlTree* node)
+{
+    AvlTree* sub_tree_1 = node->left;
+
+    STATS_COUNT(rotations);
+
+    /* Perform rotation */
+    node->left = sub_tree_1->right;
+    sub_tree_1->right = node;
+
+    /* Update the variables of the nodes, their ranks stay */
+    update_Node_Variables_Without_Height(node);
+    update_Node_Variables_Without_Height(sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
 /* Function to update the height, size, and worst_quality of a node in the AVL tree */
 /*  Time O(1) */
-void update_Node_Variables(AvlTree* node)
+static void update_Node_Variables(AvlTree* node)
 {
     /* Update the height of the current node */
     node->height = max(heightOfNode(node->left), heightOfNode(node->right)) + 1;
 
-    /* Update the size of the current node */
-    node->size = sizeOfNode(node->left) + sizeOfNode(node->right) + 1;
+    update_Node_Variables_Without_Height(node);
+}
+
+/* Function to update the size, worst_quality and quality aggregates of a node in the time tree, for the balancing schemes
+   that keep something else than the height in the height field, and for the updates that do not change the shape */
+/*  Time O(1) */
+static void update_Node_Variables_Without_Height(AvlTree* node)
+{
+    STATS_COUNT(node_updates);
+
+    /* Update the size of the current node, a product removed in lazy delete mode is not counted */
+    node->size = sizeOfNode(node->left) + sizeOfNode(node->right) + node->alive;
 
     /* Update the worst_quality of the current node */
     node->worst_quality = get_worst_quality_between_tree_and_sub(get_worst_quality(node->left), node, get_worst_quality(node->right));
+
+    /* Update the sums and the max of the qualities of the current node */
+    update_Node_Aggregates(node);
 }
 
-/* Function to return the maximum of two integers  */
+/* Function to update the sum, the squared deviations and the max of the qualities of a node in the AVL tree, from its children.
+   The children must be up to date, and so must be the size of the node. Without AVL_AGGREGATES the nodes keep none */
 /*  Time O(1) */
-int max(int a,int b)
+static void update_Node_Aggregates(AvlTree* node)
 {
-    return a >= b ? a : b;
+#ifdef AVL_AGGREGATES
+    int count;
+
+    /* A product removed in lazy delete mode only contributes its subtrees */
+    count = node->alive;
+    node->sum_quality = node->alive ? node->quality : 0;
+    node->squared_deviations = 0;
+    node->max_quality = node->alive ? node->quality : INT_MIN;
+
+    if (node->left != NULL)
+    {
+        node->squared_deviations = merge_squared_deviations(node->squared_deviations, node->sum_quality, count,
+                                                            node->left->squared_deviations, node->left->sum_quality, node->left->size);
+        count += node->left->size;
+        node->sum_quality += node->left->sum_quality;
+        if (node->left->max_quality > node->max_quality)
+            node->max_quality = node->left->max_quality;
+    }
+    if (node->right != NULL)
+    {
+        node->squared_deviations = merge_squared_deviations(node->squared_deviations, node->sum_quality, count,
+                                                            node->right->squared_deviations, node->right->sum_quality, node->right->size);
+        node->sum_quality += node->right->sum_quality;
+        if (node->right->max_quality > node->max_quality)
+            node->max_quality = node->right->max_quality;
+    }
+#else
+    (void)node;
+#endif
 }
 
-/* Function to return the height of a node  */
+/* Function to get the squared deviations from their mean of the union of two groups of qualities, from the squared deviations,
+   the sum and the count of each (Chan et al.). Only the difference of the means is squared, so large qualities lose no precision
+   as they would in E[q^2] - E[q]^2 */
 /*  Time O(1) */
-int heightOfNode(AvlTree* node)
+static double merge_squared_deviations(double deviations1, long long sum1, int count1, double deviations2, long long sum2, int count2)
 {
-    /* If the node is NULL, return -1 */
-    if (node == NULL)
-        return -1;
-    /* Return the height of the node */
-    return node->height;
+    double delta;
+
+    if (count1 == 0)
+        return deviations2;
+    if (count2 == 0)
+        return deviations1;
+    delta = (double)sum2 / count2 - (double)sum1 / count1;
+    return deviations1 + deviations2 + delta * delta * ((double)count1 * count2 / ((double)count1 + count2));
 }
 
-/* Function to return the size of a node  */
+/* Function to balance the AVL quality tree */
 /*  Time O(1)) */
-int sizeOfNode(AvlTree* node)
+static AvlTree* balance_QualityTree(AvlTree* node)
 {
-    /* If the node is NULL, return 0 */
-    if (node == NULL)
-        return 0;
-    /* Return the size of the node */
-    return node->size;
-}
+    AvlTree* y;
 
-/* Function to return the node with the worst quality in a subtree rooted at a given node  */
-/*  Time O(1) */
-AvlTree* get_worst_quality(AvlTree* node)
-{
+    if(heightOfQualityNode(node->q_left) - heightOfQualityNode(node->q_right) <=1 && heightOfQualityNode(node->q_left) - heightOfQualityNode(node->q_right) >= -1 )
+    {
+        /* Tree is balanced */
+        return node;
+    }
+    else
+    {
+
+        if( heightOfQualityNode(node->q_left) > heightOfQualityNode(node->q_right) )
+        {
+            /* Tree is left heavy */
+            y = node->q_left;
+
+            if( heightOfQualityNode(y->q_left) < heightOfQualityNode(y->q_right) )
+            {
+                /* The left son is right heavy */
+                node->q_left = leftRotate_QualityTree(y);
+            }
+            node = rightRotate_QualityTree(node);
+        }
+        else
+        {
+            /* Tree is right heavy */
+            y = node->q_right;
+            if( heightOfQualityNode(y->q_left) > heightOfQualityNode(y->q_right) )
+            {
+                /* The right son is left heavy */
+                node->q_right =rightRotate_QualityTree(y);
+            }
+            node = leftRotate_QualityTree(node);
+        }
+    }
+    return node;
+}
+
+/* Function to perform a left rotation in the quality tree */
+/*  Time O(1) */
+static AvlTree* leftRotate_QualityTree(AvlTree* node)
+{
+    AvlTree* sub_tree_1 = node->q_right;
+    AvlTree* sub_tree_2 = sub_tree_1->q_left;
+
+    STATS_COUNT(rotations);
+
+    /* Perform rotation */
+    sub_tree_1->q_left = node;
+    node->q_right = sub_tree_2;
+
+    /* Update all variables of the nodes */
+    update_Quality_Node_Variables(node);
+    update_Quality_Node_Variables(sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to perform a right rotation in the quality tree */
+/*  Time O(1) */
+static AvlTree* rightRotate_QualityTree(AvlTree* node)
+{
+    AvlTree* sub_tree_1 = node->q_left;
+    AvlTree* sub_tree_2 = sub_tree_1->q_right;
+
+    STATS_COUNT(rotations);
+
+    /* Perform rotation */
+    sub_tree_1->q_right = node;
+    node->q_left = sub_tree_2;
+
+    /* Update all variables of the nodes */
+    update_Quality_Node_Variables(node);
+    update_Quality_Node_Variables(sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to update the height and size of a node in the AVL quality tree */
+/*  Time O(1) */
+static void update_Quality_Node_Variables(AvlTree* node)
+{
+    STATS_COUNT(node_updates);
+
+    /* Update the height of the current node */
+    node->q_height = max(heightOfQualityNode(node->q_left), heightOfQualityNode(node->q_right)) + 1;
+
+    /* Update the size of the current node, a product removed in lazy delete mode is not counted */
+    node->q_size = sizeOfQualityNode(node->q_left) + sizeOfQualityNode(node->q_right) + node->alive;
+}
+
+/* Function to return the maximum of two integers  */
+/*  Time O(1) */
+static int max(int a,int b)
+{
+    return a >= b ? a : b;
+}
+
+/* Function to return the height of a node  */
+/*  Time O(1) */
+static int heightOfNode(AvlTree* node)
+{
+    /* If the node is NULL, return -1 */
+    if (node == NULL)
+        return -1;
+    /* Return the height of the node */
+    return node->height;
+}
+
+/* Function to return the rank of a node in the red-black time tree, a missing child is black with rank 0 */
+/*  Time O(1) */
+static int rankOfRedBlackNode(AvlTree* node)
+{
+    if (node == NULL)
+        return 0;
+    return node->height;
+}
+
+/* Function to return the priority of a time in the treap time tree. The bits of the time are mixed by a bijection,
+   so every time has its own priority and sorted times get priorities that look random */
+/*  Time O(1) */
+static unsigned int priority_of_time(int time)
+{
+    unsigned int h = (unsigned int)time;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Function to check if a node goes above another node in the treap time tree */
+/*  Time O(1) */
+static int higher_priority(AvlTree* a, AvlTree* b)
+{
+    return priority_of_time(a->time) > priority_of_time(b->time);
+}
+
+/* Function to measure the height of the time tree, for the balancing schemes that do not keep it in the nodes */
+/*  Time O(n) */
+static int height_of_TimeTree(AvlTree* tree)
+{
+    if (tree == NULL)
+        return -1;
+    return max(height_of_TimeTree(tree->left), height_of_TimeTree(tree->right)) + 1;
+}
+
+/* Function to return the height of a node in the quality tree  */
+/*  Time O(1) */
+static int heightOfQualityNode(AvlTree* node)
+{
+    /* If the node is NULL, return -1 */
+    if (node == NULL)
+        return -1;
+    /* Return the height of the node in the quality tree */
+    return node->q_height;
+}
+
+/* Function to return the size of a node  */
+/*  Time O(1)) */
+static int sizeOfNode(AvlTree* node)
+{
+    /* If the node is NULL, return 0 */
+    if (node == NULL)
+        return 0;
+    /* Return the size of the node */
+    return node->size;
+}
+
+/* Function to return the size of a node in the quality tree  */
+/*  Time O(1)) */
+static int sizeOfQualityNode(AvlTree* node)
+{
+    /* If the node is NULL, return 0 */
+    if (node == NULL)
+        return 0;
+    /* Return the size of the node in the quality tree */
+    return node->q_size;
+}
+
+/* Function to return the node with the worst quality in a subtree rooted at a given node  */
+/*  Time O(1) */
+static AvlTree* get_worst_quality(AvlTree* node)
+{
     /* If the node is NULL, return NULL */
     if (node == NULL)
         return NULL;
@@ -571,8 +1861,16 @@ AvlTree* get_worst_quality(AvlTree* node)
   - The node with the worst quality in the right subtree
  */
  /*  Time O(1) */
-AvlTree* get_worst_quality_between_tree_and_sub(AvlTree* left, AvlTree* root, AvlTree* right)
+static AvlTree* get_worst_quality_between_tree_and_sub(AvlTree* left, AvlTree* root, AvlTree* right)
 {
+    /* A product removed in lazy delete mode is no candidate, only the subtrees are compared */
+    if (!root->alive)
+    {
+        if (left == NULL || (right != NULL && right->quality < left->quality))
+            return right;
+        return left;
+    }
+
     /* If the right subtree is NULL */
     if (right == NULL)
     {
@@ -619,480 +1917,5364 @@ AvlTree* get_worst_quality_between_tree_and_sub(AvlTree* left, AvlTree* root, Av
 }
 
 
-/* Function to find the Lowest Common Ancestor (LCA) of two nodes with keys key1 and key2 in a binary search tree */
-/*  Time O(log(n)) */
-AvlTree* findLCA(AvlTree* tree, int key1, int key2)
+/* Function to sort an array of indices by the int keys they point to, stable LSD radix sort on 8 bit digits */
+/*  Time O(n) , Space O(n)*/
+static void radix_sort_indices(const int* keys, int* indices, int* scratch, size_t n)
+{
+    size_t count[256];
+    size_t i, sum, temp;
+    int shift;
+    int* from = indices;
+    int* to = scratch;
+    int* swap;
+
+    for (shift = 0; shift < 32; shift += 8)
+    {
+        /* Count every digit, the sign bit is flipped so negative keys come first */
+        for (i = 0; i < 256; i++)
+            count[i] = 0;
+        for (i = 0; i < n; i++)
+            count[(((unsigned int)keys[from[i]] ^ 0x80000000u) >> shift) & 0xFFu]++;
+
+        /* Turn the counts into the first position of every digit */
+        sum = 0;
+        for (i = 0; i < 256; i++)
+        {
+            temp = count[i];
+            count[i] = sum;
+            sum += temp;
+        }
+
+        /* Move every index to its place, keeping the order of equal digits */
+        for (i = 0; i < n; i++)
+            to[count[(((unsigned int)keys[from[i]] ^ 0x80000000u) >> shift) & 0xFFu]++] = from[i];
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    /* After an even number of passes the sorted indices are back in the indices array */
+}
+
+/* Function to collect the nodes of the time tree in time order */
+/*  Time O(n) */
+static size_t flatten_TimeTree(AvlTree* tree, AvlTree** nodes, size_t count)
 {
     if (tree == NULL)
-        return NULL;
+        return count;
 
-    if (tree->key > key1 && tree->key > key2)
-        return findLCA(tree->left, key1, key2);
+    count = flatten_TimeTree(tree->left, nodes, count);
+    nodes[count++] = tree;
+    return flatten_TimeTree(tree->right, nodes, count);
+}
 
-    if (tree->key < key1 && tree->key < key2)
-        return findLCA(tree->right, key1, key2);
+/* Function to collect the nodes of the time tree in time order, without the products removed in lazy delete mode */
+/*  Time O(n) */
+static size_t flatten_alive_TimeTree(AvlTree* tree, AvlTree** nodes, size_t count)
+{
+    if (tree == NULL)
+        return count;
 
-    return tree;  /* LCA found  */
+    count = flatten_alive_TimeTree(tree->left, nodes, count);
+    if (tree->alive)
+        nodes[count++] = tree;
+    return flatten_alive_TimeTree(tree->right, nodes, count);
 }
-/* Function to get the node with the lowest quality in the path from the left subtree of LCA to a given time (time1) in a binary search tree */
-/*  Time O(log(n)) */
-AvlTree* GetOneRankInTime1Path(AvlTree* tree, int time1)
+
+/* Function to collect the nodes of the quality tree in (quality, time) order */
+/*  Time O(n) */
+static size_t flatten_QualityTree(AvlTree* tree, AvlTree** nodes, size_t count)
 {
-    AvlTree* temp;
-    AvlTree* result_of_sub_tree_left;
-    AvlTree* result_of_sub_tree_right;
+    if (tree == NULL)
+        return count;
 
-    /* If the tree is empty, return NULL */
-    if(tree==NULL)
+    count = flatten_QualityTree(tree->q_left, nodes, count);
+    nodes[count++] = tree;
+    return flatten_QualityTree(tree->q_right, nodes, count);
+}
+
+/* Function to build a perfectly balanced time tree from nodes sorted by time, a treap is built by priority instead */
+/*  Time O(n) */
+static AvlTree* build_TimeTree(AvlTree** nodes, size_t n, int scheme)
+{
+    AvlTree* root;
+    size_t mid, count;
+
+    if (n == 0)
         return NULL;
+    if (scheme == BALANCE_TREAP)
+        return build_Treap(nodes, n);
 
-    /* If the current node's key is the same as the given time1 */
-    if(tree->key==time1)
+    /* The middle node becomes the root, each half becomes a subtree */
+    mid = n / 2;
+    root = nodes[mid];
+    root->left = build_TimeTree(nodes, mid, scheme);
+    root->right = build_TimeTree(nodes + mid + 1, n - mid - 1, scheme);
+
+    /* The children are done, so the height, size and worst_quality of the root can be computed */
+    if (scheme != BALANCE_RED_BLACK)
     {
-        /* Get the node with the worst quality in the right subtree */
-        temp = get_worst_quality(tree->right);
+        update_Node_Variables(root);
+        return root;
+    }
 
-        /* If the right subtree does not contain a node with worse quality */
-        if(temp == NULL)
-        {
-            /* Return the current node */
-            return tree;
-        }
+    /* A red-black subtree of n nodes gets rank floor(log2(n + 1)), the nodes of an incomplete last level are red */
+    update_Node_Variables_Without_Height(root);
+    root->height = 0;
+    for (count = n + 1; count > 1; count >>= 1)
+        root->height++;
+    return root;
+}
 
-        /* If the current node's quality is worse or eqaul than the node in the right subtree */
-        if((tree->quality) <= temp->quality)
-        {
-            /* Return the current node */
-            return tree;
-        }
+/* Function to build the treap of nodes sorted by time. Every node pops the nodes of a lower priority from the right spine,
+   they become its left subtree, and it is pushed as the new end of the spine */
+/*  Time O(n) */
+static AvlTree* build_Treap(AvlTree** nodes, size_t n)
+{
+    AvlTree** spine;
+    AvlTree* last;
+    size_t top = 0, i;
 
-        /* Return the node with the worst quality in the right subtree */
-        return temp;
+    spine = (AvlTree**)malloc(n * sizeof(AvlTree*));
+    if (spine == NULL)
+    {
+        exit(1);
     }
 
-    /* If the current node's key is greater than the given time1 */
-    if(tree->key > time1)
+    for (i = 0; i < n; i++)
     {
-        /* Recursively search the left subtree for the node with the lowest quality in the path */
-        result_of_sub_tree_left = GetOneRankInTime1Path(tree->left,time1);
+        last = NULL;
+        while (top > 0 && higher_priority(nodes[i], spine[top - 1]))
+            last = spine[--top];
+        nodes[i]->left = last;
+        nodes[i]->right = NULL;
+        if (top > 0)
+            spine[top - 1]->right = nodes[i];
+        spine[top++] = nodes[i];
+    }
+    last = spine[0];
+    free(spine);
 
-        /* Get the node with the worst quality in the right subtree */
-        result_of_sub_tree_right = get_worst_quality(tree->right);
+    /* The shape is done, the variables are computed bottom-up */
+    update_Treap_Variables(last);
+    return last;
+}
 
-        /* Return the node with the worst quality between the left subtree, current node, and right subtree */
-        return get_worst_quality_between_tree_and_sub(result_of_sub_tree_left, tree, result_of_sub_tree_right);
+/* Function to compute the variables of every node of a treap time tree, children first */
+/*  Time O(n) */
+static void update_Treap_Variables(AvlTree* tree)
+{
+    if (tree == NULL)
+        return;
+    update_Treap_Variables(tree->left);
+    update_Treap_Variables(tree->right);
+    update_Node_Variables_Without_Height(tree);
+}
+
+/* Function to build a perfectly balanced quality tree from nodes sorted by (quality, time) */
+/*  Time O(n) */
+static AvlTree* build_QualityTree(AvlTree** nodes, size_t n)
+{
+    AvlTree* root;
+    size_t mid;
+
+    if (n == 0)
+        return NULL;
+
+    /* The middle node becomes the root, each half becomes a subtree */
+    mid = n / 2;
+    root = nodes[mid];
+    root->q_left = build_QualityTree(nodes, mid);
+    root->q_right = build_QualityTree(nodes + mid + 1, n - mid - 1);
+
+    /* The children are done, so the height and size of the root can be computed */
+    update_Quality_Node_Variables(root);
+    return root;
+}
+
+/* Function to join two time trees and a middle node, every time in left is smaller than the node's time
+   and every time in right is greater. Returns the root of the balanced tree holding all of them.
+   A WAVL tree joins like an AVL tree: the rebalanced path gets ranks one above its highest child, which are valid WAVL ranks */
+/*  Time O(|height(left) - height(right)| + 1) */
+static AvlTree* join_TimeTree(AvlTree* left, AvlTree* node, AvlTree* right, int scheme)
+{
+    if (scheme == BALANCE_RED_BLACK)
+        return join_RedBlack(left, node, right);
+    if (scheme == BALANCE_TREAP)
+        return join_Treap(left, node, right);
+
+    /* If the left tree is too high, descend its right spine until the heights match */
+    if (heightOfNode(left) > heightOfNode(right) + 1)
+    {
+        left->right = join_TimeTree(left->right, node, right, scheme);
+        update_Node_Variables(left);
+        return balance(left);
     }
 
-    /* If the current node's key is less than the given time1, recursively search the right subtree and ignore the current node*/
-    return GetOneRankInTime1Path(tree->right,time1);
+    /* If the right tree is too high, descend its left spine until the heights match */
+    if (heightOfNode(right) > heightOfNode(left) + 1)
+    {
+        right->left = join_TimeTree(left, node, right->left, scheme);
+        update_Node_Variables(right);
+        return balance(right);
+    }
+
+    /* The heights are close enough, the node becomes the root of both trees */
+    node->left = left;
+    node->right = right;
+    update_Node_Variables(node);
+    return node;
 }
 
+/* Function to join the red-black time trees left and right and a middle node by their ranks (black heights) */
+/*  Time O(|rank(left) - rank(right)| + 1) */
+static AvlTree* join_RedBlack(AvlTree* left, AvlTree* node, AvlTree* right)
+{
+    if (rankOfRedBlackNode(left) > rankOfRedBlackNode(right))
+        return join_right_RedBlack(left, node, right);
+    if (rankOfRedBlackNode(right) > rankOfRedBlackNode(left))
+        return join_left_RedBlack(left, node, right);
+
+    /* The ranks are equal, the node becomes the root of both trees as their black parent */
+    node->left = left;
+    node->right = right;
+    node->height = rankOfRedBlackNode(left) + 1;
+    update_Node_Variables_Without_Height(node);
+    return node;
+}
 
-/* Function to get the node with the lowest quality in the path from the right subtree of LCA to a given time (time2) in a binary search tree */
-/*  Time O(log(n)) */
-AvlTree* GetOneRankInTime2Path(AvlTree* tree, int time2)
+/* Function to join a red-black time tree of a higher rank with right and a middle node. The node becomes a red parent of right
+   at the first black node of the right spine with the rank of right, a red node with a red child is fixed on the way back
+   up like an insertion: by a promotion if the uncle is red, by a rotation otherwise */
+/*  Time O(rank(tree) - rank(right) + 1) */
+static AvlTree* join_right_RedBlack(AvlTree* tree, AvlTree* node, AvlTree* right)
 {
-    AvlTree* temp;
-    AvlTree* result_of_sub_tree_left;
-    AvlTree* result_of_sub_tree_right;
+    AvlTree* child;
+    int rank = rankOfRedBlackNode(right);
 
-    /* If the tree is empty, return NULL */
-    if(tree==NULL)
-        return NULL;
+    if (tree->height == rank + 1 && rankOfRedBlackNode(tree->right) == rank)
+    {
+        node->left = tree->right;
+        node->right = right;
+        node->height = rank + 1;
+        update_Node_Variables_Without_Height(node);
+        tree->right = node;
+    }
+    else
+        tree->right = join_right_RedBlack(tree->right, node, right);
+    update_Node_Variables_Without_Height(tree);
 
-    /* If the current node's key is the same as the given time2 */
-    if(tree->key==time2)
+    /* A red child with a red child below the node */
+    child = tree->right;
+    if (child->height == tree->height && rankOfRedBlackNode(child->right) == child->height)
     {
-        /* Get the node with the worst quality in the left subtree */
-        temp = get_worst_quality(tree->left);
+        if (rankOfRedBlackNode(tree->left) == tree->height)
+            tree->height++;
+        else
+            tree = leftRotate_Ranked(tree);
+    }
+    return tree;
+}
 
-        /* If the left subtree does not contain a node with worse quality */
-        if(temp == NULL)
-        {
-            /* Return the current node */
-            return tree;
-        }
+/* Function to join left with a red-black time tree of a higher rank and a middle node, the mirror of join_right_RedBlack */
+/*  Time O(rank(tree) - rank(left) + 1) */
+static AvlTree* join_left_RedBlack(AvlTree* left, AvlTree* node, AvlTree* tree)
+{
+    AvlTree* child;
+    int rank = rankOfRedBlackNode(left);
 
-        /* If the current node's quality is worse than the node in the left subtree */
-        if((tree->quality) < temp->quality)
-        {
-            /* Return the current node */
-            return tree;
-        }
+    if (tree->height == rank + 1 && rankOfRedBlackNode(tree->left) == rank)
+    {
+        node->left = left;
+        node->right = tree->left;
+        node->height = rank + 1;
+        update_Node_Variables_Without_Height(node);
+        tree->left = node;
+    }
+    else
+        tree->left = join_left_RedBlack(left, node, tree->left);
+    update_Node_Variables_Without_Height(tree);
 
-        /* Return the node with the worst quality in the left subtree */
-        return temp;
+    /* A red child with a red child below the node */
+    child = tree->left;
+    if (child->height == tree->height && rankOfRedBlackNode(child->left) == child->height)
+    {
+        if (rankOfRedBlackNode(tree->right) == tree->height)
+            tree->height++;
+        else
+            tree = rightRotate_Ranked(tree);
     }
+    return tree;
+}
 
-    /* If the current node's key is less than the given time2 */
-    if(tree->key < time2)
+/* Function to join the treap time trees left and right and a middle node, the node goes down the spines of left and right
+   until both subtrees below have a lower priority */
+/*  Time O(log(n)) expected */
+static AvlTree* join_Treap(AvlTree* left, AvlTree* node, AvlTree* right)
+{
+    if (left != NULL && higher_priority(left, node) && (right == NULL || higher_priority(left, right)))
     {
-        /* Recursively search the right subtree for the node with the lowest quality in the path */
-        result_of_sub_tree_right = GetOneRankInTime2Path(tree->right,time2);
+        left->right = join_Treap(left->right, node, right);
+        update_Node_Variables_Without_Height(left);
+        return left;
+    }
+    if (right != NULL && higher_priority(right, node))
+    {
+        right->left = join_Treap(left, node, right->left);
+        update_Node_Variables_Without_Height(right);
+        return right;
+    }
 
-        /* Get the node with the worst quality in the left subtree */
-        result_of_sub_tree_left = get_worst_quality(tree->left);
+    node->left = left;
+    node->right = right;
+    update_Node_Variables_Without_Height(node);
+    return node;
+}
 
-        /* Return the node with the worst quality between the left subtree, current node, and right subtree */
-        return get_worst_quality_between_tree_and_sub(result_of_sub_tree_left, tree, result_of_sub_tree_right);
+/* Function to join two time trees, every time in left is smaller than every time in right */
+/*  Time O(log(n)) */
+static AvlTree* join2_TimeTree(AvlTree* left, AvlTree* right, int scheme)
+{
+    AvlTree* node;
+
+    if (left == NULL)
+        return right;
+    if (right == NULL)
+        return left;
+
+    /* Two treaps are merged along the right spine of left and the left spine of right by priority */
+    if (scheme == BALANCE_TREAP)
+    {
+        if (higher_priority(left, right))
+        {
+            left->right = join2_TimeTree(left->right, right, scheme);
+            update_Node_Variables_Without_Height(left);
+            return left;
+        }
+        right->left = join2_TimeTree(left, right->left, scheme);
+        update_Node_Variables_Without_Height(right);
+        return right;
     }
 
-    /* If the current node's key is greater than the given time2, recursively search the left subtree and ignore the current node */
+    /* The minimum of the right tree becomes the middle node */
+    node = minInTree(right);
+    if (scheme == BALANCE_AVL)
+        right = removeMinInTree(right);
+    else
+        deleteNode(&right, node->time, scheme);
+    return join_TimeTree(left, node, right, scheme);
+}
+
+/* Function to split a time tree into the nodes with a time smaller than a given time (left)
+   and the nodes with a time greater than or equal to it (right) */
+/*  Time O(log(n)) */
+static void split_TimeTree(AvlTree* tree, int time, AvlTree** left, AvlTree** right, int scheme)
+{
+    AvlTree* sub_tree;
+    AvlTree* part;
+
+    /* An empty tree splits into two empty trees */
+    if (tree == NULL)
+    {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+
+    if (tree->time < time)
+    {
+        /* The node and its left subtree go left, split the right subtree */
+        sub_tree = tree->left;
+        split_TimeTree(tree->right, time, &part, right, scheme);
+        *left = join_TimeTree(sub_tree, tree, part, scheme);
+    }
+    else
+    {
+        /* The node and its right subtree go right, split the left subtree */
+        sub_tree = tree->right;
+        split_TimeTree(tree->left, time, left, &part, scheme);
+        *right = join_TimeTree(part, tree, sub_tree, scheme);
+    }
+}
+
+/* Function to join two quality trees and a middle node, every node in left is smaller in (quality, time)
+   than the node and every node in right is greater */
+/*  Time O(|height(left) - height(right)| + 1) */
+static AvlTree* join_QualityTree(AvlTree* left, AvlTree* node, AvlTree* right)
+{
+    /* If the left tree is too high, descend its right spine until the heights match */
+    if (heightOfQualityNode(left) > heightOfQualityNode(right) + 1)
+    {
+        left->q_right = join_QualityTree(left->q_right, node, right);
+        update_Quality_Node_Variables(left);
+        return balance_QualityTree(left);
+    }
+
+    /* If the right tree is too high, descend its left spine until the heights match */
+    if (heightOfQualityNode(right) > heightOfQualityNode(left) + 1)
+    {
+        right->q_left = join_QualityTree(left, node, right->q_left);
+        update_Quality_Node_Variables(right);
+        return balance_QualityTree(right);
+    }
+
+    /* The heights are close enough, the node becomes the root of both trees */
+    node->q_left = left;
+    node->q_right = right;
+    update_Quality_Node_Variables(node);
+    return node;
+}
+
+/* Function to join two quality trees, every node in left is smaller in (quality, time) than every node in right */
+/*  Time O(log(n)) */
+static AvlTree* join2_QualityTree(AvlTree* left, AvlTree* right)
+{
+    AvlTree* node;
+
+    if (left == NULL)
+        return right;
+    if (right == NULL)
+        return left;
+
+    /* The minimum of the right tree becomes the middle node */
+    node = minInQualityTree(right);
+    right = removeMinInQualityTree(right);
+    return join_QualityTree(left, node, right);
+}
+
+/* Function to split a quality tree into the nodes with a quality smaller than a given quality (left)
+   and the nodes with a quality greater than or equal to it (right) */
+/*  Time O(log(n)) */
+static void split_QualityTree(AvlTree* tree, int quality, AvlTree** left, AvlTree** right)
+{
+    AvlTree* sub_tree;
+    AvlTree* part;
+
+    /* An empty tree splits into two empty trees */
+    if (tree == NULL)
+    {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+
+    if (tree->quality < quality)
+    {
+        /* The node and its left subtree go left, split the right subtree */
+        sub_tree = tree->q_left;
+        split_QualityTree(tree->q_right, quality, &part, right);
+        *left = join_QualityTree(sub_tree, tree, part);
+    }
+    else
+    {
+        /* The node and its right subtree go right, split the left subtree */
+        sub_tree = tree->q_right;
+        split_QualityTree(tree->q_left, quality, left, &part);
+        *right = join_QualityTree(part, tree, sub_tree);
+    }
+}
+
+/* Function to remove a batch of nodes sorted by time from the time tree, the nodes are not freed.
+   Every node of the batch must be in the tree */
+/*  Time O(k*log(n/k + 1)) where k is the number of nodes to remove */
+static AvlTree* remove_sorted_from_TimeTree(AvlTree* tree, AvlTree** nodes, size_t n, int scheme)
+{
+    AvlTree* left;
+    AvlTree* right;
+    size_t low = 0, high = n, mid;
+    int contains;
+
+    if (tree == NULL || n == 0)
+        return tree;
+
+    /* Find the first node of the batch with a time that is not smaller than the root's time */
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (nodes[mid]->time < tree->time)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    contains = low < n && nodes[low] == tree;
+
+    /* The smaller nodes are removed from the left subtree, the greater ones from the right subtree */
+    left = remove_sorted_from_TimeTree(tree->left, nodes, low, scheme);
+    right = remove_sorted_from_TimeTree(tree->right, nodes + low + contains, n - low - contains, scheme);
+
+    /* If the root is removed too, join the subtrees without it */
+    if (contains)
+        return join2_TimeTree(left, right, scheme);
+    return join_TimeTree(left, tree, right, scheme);
+}
+
+/* Function to remove a batch of nodes sorted by (quality, time) from the quality tree, the nodes are not freed.
+   Every node of the batch must be in the tree */
+/*  Time O(k*log(n/k + 1)) where k is the number of nodes to remove */
+static AvlTree* remove_sorted_from_QualityTree(AvlTree* tree, AvlTree** nodes, size_t n)
+{
+    AvlTree* left;
+    AvlTree* right;
+    size_t low = 0, high = n, mid;
+    int contains;
+
+    if (tree == NULL || n == 0)
+        return tree;
+
+    /* Find the first node of the batch that is not smaller in (quality, time) than the root */
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (nodes[mid]->quality < tree->quality || (nodes[mid]->quality == tree->quality && nodes[mid]->time < tree->time))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    contains = low < n && nodes[low] == tree;
+
+    /* The smaller nodes are removed from the left subtree, the greater ones from the right subtree */
+    left = remove_sorted_from_QualityTree(tree->q_left, nodes, low);
+    right = remove_sorted_from_QualityTree(tree->q_right, nodes + low + contains, n - low - contains);
+
+    /* If the root is removed too, join the subtrees without it */
+    if (contains)
+        return join2_QualityTree(left, right);
+    return join_QualityTree(left, tree, right);
+}
+
+/* Function to find the Lowest Common Ancestor (LCA) of two nodes with keys key1 and key2 in a binary search tree */
+/*  Time O(log(n)) */
+static AvlTree* findLCA(AvlTree* tree, int key1, int key2)
+{
+    if (tree == NULL)
+        return NULL;
+
+    if (tree->time > key1 && tree->time > key2)
+        return findLCA(tree->left, key1, key2);
+
+    if (tree->time < key1 && tree->time < key2)
+        return findLCA(tree->right, key1, key2);
+
+    return tree;  /* LCA found  */
+}
+/* Function to get the node with the lowest quality in the path from the left subtree of LCA to a given time (time1) in a binary search tree */
+/*  Time O(log(n)) */
+static AvlTree* GetOneRankInTime1Path(AvlTree* tree, int time1)
+{
+    AvlTree* temp;
+    AvlTree* result_of_sub_tree_left;
+    AvlTree* result_of_sub_tree_right;
+
+    /* If the tree is empty, return NULL */
+    if(tree==NULL)
+        return NULL;
+
+    /* If the current node's key is the same as the given time1 */
+    if(tree->time==time1)
+    {
+        /* Get the node with the worst quality in the right subtree */
+        temp = get_worst_quality(tree->right);
+
+        /* Return the current node if its quality is worse or eqaul than the node in the right subtree, otherwise that node */
+        return get_worst_quality_between_tree_and_sub(NULL, tree, temp);
+    }
+
+    /* If the current node's key is greater than the given time1 */
+    if(tree->time > time1)
+    {
+        /* Recursively search the left subtree for the node with the lowest quality in the path */
+        result_of_sub_tree_left = GetOneRankInTime1Path(tree->left,time1);
+
+        /* Get the node with the worst quality in the right subtree */
+        result_of_sub_tree_right = get_worst_quality(tree->right);
+
+        /* Return the node with the worst quality between the left subtree, current node, and right subtree */
+        return get_worst_quality_between_tree_and_sub(result_of_sub_tree_left, tree, result_of_sub_tree_right);
+    }
+
+    /* If the current node's key is less than the given time1, recursively search the right subtree and ignore the current node*/
+    return GetOneRankInTime1Path(tree->right,time1);
+}
+
+
+/* Function to get the node with the lowest quality in the path from the right subtree of LCA to a given time (time2) in a binary search tree */
+/*  Time O(log(n)) */
+static AvlTree* GetOneRankInTime2Path(AvlTree* tree, int time2)
+{
+    AvlTree* temp;
+    AvlTree* result_of_sub_tree_left;
+    AvlTree* result_of_sub_tree_right;
+
+    /* If the tree is empty, return NULL */
+    if(tree==NULL)
+        return NULL;
+
+    /* If the current node's key is the same as the given time2 */
+    if(tree->time==time2)
+    {
+        /* Get the node with the worst quality in the left subtree */
+        temp = get_worst_quality(tree->left);
+
+        /* Return the current node if its quality is worse than the node in the left subtree, otherwise that node */
+        return get_worst_quality_between_tree_and_sub(temp, tree, NULL);
+    }
+
+    /* If the current node's key is less than the given time2 */
+    if(tree->time < time2)
+    {
+        /* Recursively search the right subtree for the node with the lowest quality in the path */
+        result_of_sub_tree_right = GetOneRankInTime2Path(tree->right,time2);
+
+        /* Get the node with the worst quality in the left subtree */
+        result_of_sub_tree_left = get_worst_quality(tree->left);
+
+        /* Return the node with the worst quality between the left subtree, current node, and right subtree */
+        return get_worst_quality_between_tree_and_sub(result_of_sub_tree_left, tree, result_of_sub_tree_right);
+    }
+
+    /* If the current node's key is greater than the given time2, recursively search the left subtree and ignore the current node */
     return GetOneRankInTime2Path(tree->left,time2);
 }
 
-
-/* Function to get the node with the lowest quality between two given times in a binary search tree */
-/*  Time O(2*log(n)) */
-AvlTree* GetOneRankProductBetween(AvlTree* LCA, int time1, int time2)
+
+/* Function to get the node with the lowest quality between two given times in a binary search tree */
+/*  Time O(2*log(n)) */
+static AvlTree* GetOneRankProductBetween(AvlTree* LCA, int time1, int time2)
+{
+    /* Get the node with the lowest quality in the path from the root to time1 in the left subtree of the LCA */
+    AvlTree* result_left = GetOneRankInTime1Path(LCA->left, time1);
+
+    /* Get the node with the lowest quality in the path from the root to time2 in the right subtree of the LCA */
+    AvlTree* result_right = GetOneRankInTime2Path(LCA->right, time2);
+
+    /* Return the node with the worst quality among the result_left, the LCA, and the result_right */
+    return get_worst_quality_between_tree_and_sub(result_left, LCA, result_right);
+}
+
+/* Function to get the size of the nodes in the path from the left subtree of LCA to a given time (time1) in a binary search tree */
+/*  Time O(log(n)) */
+static int size_of_path_time1(AvlTree* tree,int time1)
+{
+    int result_left,result_right;
+
+    /* if tree is empty return 0 */
+    if(tree==NULL)
+        return 0;
+
+    /* if the node key is equal to time1 */
+    if(tree->time == time1)
+        return tree->alive + sizeOfNode(tree->right); /* return the node (unless removed in lazy delete mode) + the size of the right subtree nodes */
+
+    /* if the node key is less then time1 */
+    if(tree->time > time1)
+    {
+        /* save to result_left the size of the left subtree nodes */
+        result_left = size_of_path_time1(tree->left , time1);
+
+        /* save to result_right the size of the right subtree nodes */
+        result_right = sizeOfNode(tree->right);
+
+        return tree->alive + result_left + result_right;
+    }
+    /* if the current node's key is greater than the given time1, recursively search the right subtree, ignore the current node and left subtree */
+    return size_of_path_time1(tree->right,time1);
+
+}
+
+/* Function to get the size of the nodes in the path from the left subtree of LCA to a given time (time1) in a binary search tree */
+/*  Time O(log(n)) */
+static int size_of_path_time2(AvlTree* tree,int time2)
+{
+    int result_left,result_right;
+
+    /* if tree is empty return 0 */
+    if(tree==NULL)
+        return 0;
+
+    /* if the node key is equal to time2 */
+    if(tree->time == time2)
+        return tree->alive + sizeOfNode(tree->left); /* return the node (unless removed in lazy delete mode) + the size of the left subtree nodes */
+
+    /* if the node key is less then time2 */
+    if(tree->time < time2)
+    {
+        /* save to result_right the size of the right subtree nodes */
+        result_right = size_of_path_time2(tree->right , time2);
+
+        /* save to result_left the size of the right subtree nodes */
+        result_left = sizeOfNode(tree->left);
+
+        return tree->alive + result_left + result_right;
+    }
+    /* if the current node's key is greater than the given time2, recursively search the left subtree, ignore the current node and left subtree */
+    return size_of_path_time2(tree->left,time2);
+
+}
+
+/* Function to get the size of nodes between two given times in a binary search tree */
+/*  Time O(2*log(n)) */
+static int size_of_range_in_tree(AvlTree* LCA,int time1,int time2)
+{
+    /* return the size of the left subtree to the LCA */
+    int result_left = size_of_path_time1(LCA->left,time1);
+
+    /* return the size of the right subtree to the LCA */
+    int result_right = size_of_path_time2(LCA->right,time2);
+
+    /* return the size of result_left and the size of result_right and add 1 because of the LCA, unless it was removed in lazy delete mode */
+    return LCA->alive + result_left + result_right;
+
+}
+
+/* Function to Allocate node of an inner time tree of the rank index */
+/*  Time O(1) , Space O(1)*/
+static RankTimeNode* createRankTimeNode(NodePool* pool, int time)
+{
+    /* Allocate memory for the new node */
+    RankTimeNode* newNode = (RankTimeNode*)alloc_from_NodePool(pool);
+
+    /* Initialize node values */
+    newNode->time = time;
+    newNode->height = 0;
+    newNode->size = 1;
+    newNode->alive = 1;
+    newNode->left = NULL;
+    newNode->right = NULL;
+
+    /* Return a pointer to the new node */
+    return newNode;
+}
+
+/* Function to return the height of an inner time tree node  */
+/*  Time O(1) */
+static int heightOfRankTimeNode(RankTimeNode* node)
+{
+    /* If the node is NULL, return -1 */
+    if (node == NULL)
+        return -1;
+    /* Return the height of the node */
+    return node->height;
+}
+
+/* Function to return the size of an inner time tree node  */
+/*  Time O(1) */
+static int sizeOfRankTimeNode(RankTimeNode* node)
+{
+    /* If the node is NULL, return 0 */
+    if (node == NULL)
+        return 0;
+    /* Return the size of the node */
+    return node->size;
+}
+
+/* Function to update the height and size of an inner time tree node */
+/*  Time O(1) */
+static void update_RankTimeNode_Variables(RankTimeNode* node)
+{
+    node->height = max(heightOfRankTimeNode(node->left), heightOfRankTimeNode(node->right)) + 1;
+    node->size = sizeOfRankTimeNode(node->left) + sizeOfRankTimeNode(node->right) + node->alive;
+}
+
+/* Function to perform a left rotation in an inner time tree */
+/*  Time O(1) */
+static RankTimeNode* leftRotate_RankTimeTree(RankTimeNode* node)
+{
+    RankTimeNode* sub_tree_1 = node->right;
+    RankTimeNode* sub_tree_2 = sub_tree_1->left;
+
+    STATS_COUNT(rotations);
+
+    /* Perform rotation */
+    sub_tree_1->left = node;
+    node->right = sub_tree_2;
+
+    /* Update all variables of the nodes */
+    update_RankTimeNode_Variables(node);
+    update_RankTimeNode_Variables(sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to perform a right rotation in an inner time tree */
+/*  Time O(1) */
+static RankTimeNode* rightRotate_RankTimeTree(RankTimeNode* node)
+{
+    RankTimeNode* sub_tree_1 = node->left;
+    RankTimeNode* sub_tree_2 = sub_tree_1->right;
+
+    STATS_COUNT(rotations);
+
+    /* Perform rotation */
+    sub_tree_1->right = node;
+    node->left = sub_tree_2;
+
+    /* Update all variables of the nodes */
+    update_RankTimeNode_Variables(node);
+    update_RankTimeNode_Variables(sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to balance an inner time tree */
+/*  Time O(1) */
+static RankTimeNode* balance_RankTimeTree(RankTimeNode* node)
+{
+    int balance_factor = heightOfRankTimeNode(node->left) - heightOfRankTimeNode(node->right);
+
+    if (balance_factor > 1)
+    {
+        /* Tree is left heavy, if the left son is right heavy rotate it first */
+        if (heightOfRankTimeNode(node->left->left) < heightOfRankTimeNode(node->left->right))
+            node->left = leftRotate_RankTimeTree(node->left);
+        return rightRotate_RankTimeTree(node);
+    }
+    if (balance_factor < -1)
+    {
+        /* Tree is right heavy, if the right son is left heavy rotate it first */
+        if (heightOfRankTimeNode(node->right->left) > heightOfRankTimeNode(node->right->right))
+            node->right = rightRotate_RankTimeTree(node->right);
+        return leftRotate_RankTimeTree(node);
+    }
+
+    /* Tree is balanced */
+    return node;
+}
+
+/* Function to insert a time into an inner time tree, returns the new root.
+   Like insert_in_TimeTree the path is rebalanced only until a height stops changing, above it only the sizes grow.
+   With increasing times every insertion is an append to the right spine, which mostly stops after a level or two.
+   A time that is still in the tree as removed is marked alive again */
+/*  Time O(log(n)) */
+static RankTimeNode* insert_in_RankTimeTree(NodePool* pool, RankTimeNode* tree, int time)
+{
+    RankTimeNode** path[AVL_MAX_HEIGHT];
+    RankTimeNode** link = &tree;
+    RankTimeNode* node;
+    int depth = 0;
+    int old_height;
+
+    /* Descend to the empty link of the new time */
+    while (*link != NULL)
+    {
+        node = *link;
+        if (time == node->time)
+        {
+            /* The removed time comes back, the shape does not change and the path only gains it */
+            node->alive = 1;
+            node->size++;
+            while (depth > 0)
+                (*path[--depth])->size++;
+            return tree;
+        }
+        path[depth++] = link;
+        link = time < node->time ? &node->left : &node->right;
+    }
+    *link = createRankTimeNode(pool, time);
+
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        node = *link;
+        old_height = node->height;
+
+        /* update all variables of the node and balance the tree if necessary */
+        update_RankTimeNode_Variables(node);
+        *link = balance_RankTimeTree(node);
+
+        /* If the height did not change, the ancestors stay balanced */
+        if ((*link)->height == old_height)
+            break;
+    }
+
+    /* The ancestors above only gained the new time */
+    while (depth > 0)
+        (*path[--depth])->size++;
+
+    return tree;
+}
+
+/* Function to remove an alive time from an inner time tree. The node is only marked as removed and the sizes of its path shrink,
+   nothing is unlinked or rebalanced. The rebuilds of the rank index drop the removed times */
+/*  Time O(log(n)) */
+static void remove_from_RankTimeTree(RankTimeNode* tree, int time)
+{
+    while (tree != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+
+        /* Every node on the path loses the time */
+        tree->size--;
+        if (time == tree->time)
+        {
+            tree->alive = 0;
+            return;
+        }
+        tree = time < tree->time ? tree->left : tree->right;
+    }
+}
+
+/* Function to build a perfectly balanced inner time tree from a sorted array of times */
+/*  Time O(n) */
+static RankTimeNode* build_RankTimeTree(NodePool* pool, const int* times, int n)
+{
+    RankTimeNode* node;
+    int mid;
+
+    if (n <= 0)
+        return NULL;
+
+    /* The middle time becomes the root, each half becomes a subtree */
+    mid = n / 2;
+    node = createRankTimeNode(pool, times[mid]);
+    node->left = build_RankTimeTree(pool, times, mid);
+    node->right = build_RankTimeTree(pool, times + mid + 1, n - mid - 1);
+
+    update_RankTimeNode_Variables(node);
+    return node;
+}
+
+/* Function to count the times that are less than or equal to a given time in an inner time tree */
+/*  Time O(log(n)) */
+static int count_times_until(RankTimeNode* tree, int time)
+{
+    int count = 0;
+
+    while (tree != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+        if (tree->time <= time)
+        {
+            /* The node (unless removed) and its whole left subtree are counted, continue to the right */
+            count += sizeOfRankTimeNode(tree->left) + tree->alive;
+            tree = tree->right;
+        }
+        else
+            tree = tree->left;
+    }
+    return count;
+}
+
+/* Function to count the times between time1 and time2 (inclusive) in an inner time tree */
+/*  Time O(log(n)) */
+static int count_times_between(RankTimeNode* tree, int time1, int time2)
+{
+    if (tree == NULL || time1 > time2)
+        return 0;
+
+    /* time1 - 1 would overflow for the smallest int, count_times_until(INT_MIN - 1) is always 0 */
+    if (time1 == INT_MIN)
+        return count_times_until(tree, time2);
+
+    return count_times_until(tree, time2) - count_times_until(tree, time1 - 1);
+}
+
+/* Function to free every node of an inner time tree */
+/*  Time O(n) */
+static void free_RankTimeTree(NodePool* pool, RankTimeNode* tree)
+{
+    if (tree == NULL)
+        return;
+
+    free_RankTimeTree(pool, tree->left);
+    free_RankTimeTree(pool, tree->right);
+    free_to_NodePool(pool, tree);
+}
+
+/* Function to Allocate node of the rank index */
+/*  Time O(1) , Space O(1)*/
+static RankTree* createRankNode(RankIndex* index, int time, int quality)
+{
+    /* Allocate memory for the new node */
+    RankTree* newNode = (RankTree*)alloc_from_NodePool(&index->rankPool);
+
+    /* Initialize node values */
+    newNode->time = time;
+    newNode->quality = quality;
+    newNode->alive = 1;
+    newNode->size = 1;
+    newNode->left = NULL;
+    newNode->right = NULL;
+    newNode->times = createRankTimeNode(&index->timePool, time);
+
+    /* Return a pointer to the new node */
+    return newNode;
+}
+
+/* Function to return the size of a rank index node  */
+/*  Time O(1) */
+static int sizeOfRankNode(RankTree* node)
+{
+    /* If the node is NULL, return 0 */
+    if (node == NULL)
+        return 0;
+    /* Return the size of the node */
+    return node->size;
+}
+
+/* Function to free every node of the rank index and their inner time trees */
+/*  Time O(n*log(n)) */
+static void free_RankTree(RankIndex* index, RankTree* tree)
+{
+    if (tree == NULL)
+        return;
+
+    free_RankTree(index, tree->left);
+    free_RankTree(index, tree->right);
+    free_RankTimeTree(&index->timePool, tree->times);
+    free_to_NodePool(&index->rankPool, tree);
+}
+
+/* Function to collect the alive products of a rank subtree in (quality, time) order */
+/*  Time O(n) */
+static int collect_RankTree(RankTree* tree, int* times, int* qualities, int count)
+{
+    if (tree == NULL)
+        return count;
+
+    count = collect_RankTree(tree->left, times, qualities, count);
+    if (tree->alive)
+    {
+        times[count] = tree->time;
+        qualities[count] = tree->quality;
+        count++;
+    }
+    return collect_RankTree(tree->right, times, qualities, count);
+}
+
+/* Function to build a perfectly balanced rank subtree from products sorted by (quality, time).
+   On return sorted_times[lo..hi) holds the times of the products sorted by time */
+/*  Time O(n*log(n)) */
+static RankTree* build_RankTree(RankIndex* index, const int* times, const int* qualities, int* sorted_times, int* scratch, int lo, int hi)
+{
+    RankTree* node;
+    int mid, i, j, k;
+
+    if (lo >= hi)
+        return NULL;
+
+    mid = lo + (hi - lo) / 2;
+
+    /* Allocate the node without an inner tree, it is built once the children are done */
+    node = (RankTree*)alloc_from_NodePool(&index->rankPool);
+    node->time = times[mid];
+    node->quality = qualities[mid];
+    node->alive = 1;
+    node->size = hi - lo;
+    node->left = build_RankTree(index, times, qualities, sorted_times, scratch, lo, mid);
+    node->right = build_RankTree(index, times, qualities, sorted_times, scratch, mid + 1, hi);
+
+    /* Merge the sorted times of the left and the right subtrees */
+    i = lo;
+    j = mid + 1;
+    k = lo;
+    while (i < mid && j < hi)
+        scratch[k++] = sorted_times[i] < sorted_times[j] ? sorted_times[i++] : sorted_times[j++];
+    while (i < mid)
+        scratch[k++] = sorted_times[i++];
+    while (j < hi)
+        scratch[k++] = sorted_times[j++];
+
+    /* Copy the merged times back and insert the time of the node in its place */
+    k = lo;
+    for (i = lo; i < hi - 1 && scratch[i] < node->time; i++)
+        sorted_times[k++] = scratch[i];
+    sorted_times[k++] = node->time;
+    for (; i < hi - 1; i++)
+        sorted_times[k++] = scratch[i];
+
+    node->times = build_RankTimeTree(&index->timePool, sorted_times + lo, hi - lo);
+    return node;
+}
+
+/* Function to rebuild a rank subtree into a perfectly balanced one, dropping the removed products.
+   If has_extra is set the product (extra_time, extra_quality) is added to the rebuilt subtree */
+/*  Time O(n*log(n)) , Space O(n)*/
+static RankTree* rebuild_RankTree(RankIndex* index, RankTree* tree, int extra_time, int extra_quality, int has_extra)
+{
+    int* times;
+    int* qualities;
+    int* sorted_times;
+    int* scratch;
+    int capacity = sizeOfRankNode(tree) + 1;
+    int count, j;
+    RankTree* result;
+
+    /* Allocate memory for the products of the subtree and the merge buffers */
+    times = (int*)malloc(4 * capacity * sizeof(int));
+    if (times == NULL)
+    {
+        exit(1);
+    }
+    qualities = times + capacity;
+    sorted_times = qualities + capacity;
+    scratch = sorted_times + capacity;
+
+    /* Collect the alive products in (quality, time) order */
+    count = collect_RankTree(tree, times, qualities, 0);
+
+    /* Every node that was not collected is a removed product that is dropped now */
+    index->dead -= sizeOfRankNode(tree) - count;
+
+    /* Insert the extra product in its place */
+    if (has_extra)
+    {
+        for (j = count; j > 0 && (qualities[j - 1] > extra_quality || (qualities[j - 1] == extra_quality && times[j - 1] > extra_time)); j--)
+        {
+            times[j] = times[j - 1];
+            qualities[j] = qualities[j - 1];
+        }
+        times[j] = extra_time;
+        qualities[j] = extra_quality;
+        count++;
+    }
+
+    /* Free the old subtree and build the new one */
+    free_RankTree(index, tree);
+    result = build_RankTree(index, times, qualities, sorted_times, scratch, 0, count);
+
+    /* Free the memory allocated for the arrays */
+    free(times);
+
+    return result;
+}
+
+/* Function to replace the rank index with one built from nodes sorted by (quality, time) */
+/*  Time O(n*log(n)) , Space O(n)*/
+static void build_RankIndex(RankIndex* index, AvlTree** nodes, size_t n)
+{
+    int* times;
+    size_t i;
+
+    /* Allocate memory for the times, the qualities and the merge buffers */
+    times = (int*)malloc((4 * n + 1) * sizeof(int));
+    if (times == NULL)
+    {
+        exit(1);
+    }
+    for (i = 0; i < n; i++)
+    {
+        times[i] = nodes[i]->time;
+        times[n + i] = nodes[i]->quality;
+    }
+
+    /* Free the old index and build the new one */
+    free_RankTree(index, index->root);
+    index->root = build_RankTree(index, times, times + n, times + 2 * n, times + 3 * n, 0, (int)n);
+    index->alive = (int)n;
+    index->dead = 0;
+
+    /* Free the memory allocated for the arrays */
+    free(times);
+}
+
+/* Function to insert a product into a rank subtree, returns the change of the subtree size */
+/*  Time O(log^2(n)) amortized */
+static int insert_in_RankTree(RankIndex* index, RankTree** link, int time, int quality)
+{
+    RankTree* node = *link;
+    RankTree** child;
+    int old_size, delta;
+
+    STATS_COUNT(nodes_visited);
+
+    /* If the subtree is empty, the new node becomes the root */
+    if (node == NULL)
+    {
+        *link = createRankNode(index, time, quality);
+        return 1;
+    }
+
+    /* Go left if the product is smaller in (quality, time) order, otherwise go right */
+    if (quality < node->quality || (quality == node->quality && time < node->time))
+        child = &node->left;
+    else
+        child = &node->right;
+
+    /* If the child would hold more than 3/4 of the subtree, rebuild the subtree with the product */
+    if ((sizeOfRankNode(*child) + 1) * 4 > (node->size + 1) * 3)
+    {
+        old_size = node->size;
+        *link = rebuild_RankTree(index, node, time, quality, 1);
+        return sizeOfRankNode(*link) - old_size;
+    }
+
+    /* Recursively insert into the child and add the time to the inner tree of the node */
+    delta = insert_in_RankTree(index, child, time, quality);
+    node->size += delta;
+    node->times = insert_in_RankTimeTree(&index->timePool, node->times, time);
+
+    return delta;
+}
+
+/* Function to insert a product into the rank index */
+/*  Time O(log^2(n)) amortized */
+static void insert_in_RankIndex(RankIndex* index, int time, int quality)
+{
+    insert_in_RankTree(index, &index->root, time, quality);
+    index->alive++;
+}
+
+/* Function to remove a product from the rank index, the node and its time in the inner trees of its path are only marked as removed */
+/*  Time O(log^2(n)) amortized */
+static void remove_from_RankIndex(RankIndex* index, int time, int quality)
+{
+    RankTree* node = index->root;
+
+    while (node != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+
+        /* Every node on the path holds the time in its inner tree */
+        remove_from_RankTimeTree(node->times, time);
+
+        /* A removed product with the same key may still be on the path, the alive one is to its right */
+        if (node->alive && quality == node->quality && time == node->time)
+        {
+            node->alive = 0;
+            index->alive--;
+            index->dead++;
+            break;
+        }
+
+        if (quality < node->quality || (quality == node->quality && time < node->time))
+            node = node->left;
+        else
+            node = node->right;
+    }
+
+    /* Once most of the nodes are removed products, rebuild the whole index */
+    if (index->dead > index->alive)
+        index->root = rebuild_RankTree(index, index->root, 0, 0, 0);
+}
+
+/* Function to get the time of the ith ranked product (ith smallest quality) between two times in the rank index,
+   its quality is stored in quality unless it is NULL */
+/*  Time O(log^2(n)) */
+static int select_in_RankIndex(const RankIndex* index, int time1, int time2, int i, int* quality)
+{
+    RankTree* node = index->root;
+    int count_left;
+
+    while (node != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+
+        /* Count the products of the left subtree with a time between time1 and time2 */
+        count_left = node->left != NULL ? count_times_between(node->left->times, time1, time2) : 0;
+
+        /* If the ith ranked product is in the left subtree, continue in the left subtree */
+        if (i <= count_left)
+        {
+            node = node->left;
+            continue;
+        }
+        i -= count_left;
+
+        /* If the current node is in the range it is the next ranked product */
+        if (node->alive && node->time >= time1 && node->time <= time2)
+        {
+            if (i == 1)
+            {
+                if (quality != NULL)
+                    *quality = node->quality;
+                return node->time;
+            }
+            i--;
+        }
+
+        /* Otherwise the ith ranked product is in the right subtree */
+        node = node->right;
+    }
+
+    /* There are less than i products between time1 and time2 */
+    return -1;
+}
+
+/* Function to count the products between two times up to a given (quality, time), inclusive, in the rank index */
+/*  Time O(log^2(n)) */
+static int count_up_to_in_RankIndex(const RankIndex* index, int time1, int time2, int quality, int time)
+{
+    RankTree* node = index->root;
+    int count = 0;
+
+    while (node != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+        if (node->quality < quality || (node->quality == quality && node->time <= time))
+        {
+            /* The node and the products of its left subtree in the range are counted, continue to the right */
+            if (node->left != NULL)
+                count += count_times_between(node->left->times, time1, time2);
+            if (node->alive && node->time >= time1 && node->time <= time2)
+                count++;
+            node = node->right;
+        }
+        else
+            node = node->left;
+    }
+    return count;
+}
+
+/* Function to initialize an empty B+ tree, no memory is allocated until the first product */
+/*  Time O(1) */
+static void init_BPlusTree(BPlusTree* tree, int huge_pages)
+{
+    tree->root = NULL;
+    tree->size = 0;
+
+    /* Round the node size to whole cache lines, the pool then starts every node on a line boundary */
+    init_NodePool(&tree->pool, (sizeof(BPlusNode) + CACHE_LINE_BYTES - 1) & ~(size_t)(CACHE_LINE_BYTES - 1), huge_pages);
+}
+
+/* Function to allocate an empty B+ tree node */
+/*  Time O(1) */
+static BPlusNode* createBPlusNode(BPlusTree* tree, int leaf)
+{
+    BPlusNode* node = (BPlusNode*)alloc_from_NodePool(&tree->pool);
+
+    node->count = 0;
+    node->leaf = leaf;
+    node->next = NULL;
+    return node;
+}
+
+/* Function to compare two (quality, time) keys, returns a negative, zero or positive value */
+/*  Time O(1) */
+static int compare_BPlusKeys(int quality1, int time1, int quality2, int time2)
+{
+    if (quality1 != quality2)
+        return quality1 < quality2 ? -1 : 1;
+    if (time1 != time2)
+        return time1 < time2 ? -1 : 1;
+    return 0;
+}
+
+/* Function to get the number of products below a B+ tree node */
+/*  Time O(B) */
+static int sizeOfBPlusNode(BPlusNode* node)
+{
+    int size = 0;
+    int i;
+
+    if (node->leaf)
+        return node->count;
+    for (i = 0; i < node->count; i++)
+        size += node->sizes[i];
+    return size;
+}
+
+/* Function to get the child of an internal node whose keys contain a given key,
+   the smallest key of every child but the first one separates it from its left neighbour */
+/*  Time O(B) */
+static int child_index_in_BPlusNode(BPlusNode* node, int quality, int time)
+{
+    int c = 1;
+
+    while (c < node->count && compare_BPlusKeys(node->qualities[c], node->times[c], quality, time) <= 0)
+        c++;
+    return c - 1;
+}
+
+/* Function to move the upper half of a full node to a new right sibling, returns the sibling */
+/*  Time O(B) */
+static BPlusNode* split_BPlusNode(BPlusTree* tree, BPlusNode* node)
+{
+    BPlusNode* sibling = createBPlusNode(tree, node->leaf);
+    int half = BPLUS_ORDER / 2;
+    int i;
+
+    for (i = half; i < node->count; i++)
+    {
+        sibling->qualities[i - half] = node->qualities[i];
+        sibling->times[i - half] = node->times[i];
+        sibling->sizes[i - half] = node->sizes[i];
+        sibling->slots[i - half] = node->slots[i];
+    }
+    sibling->count = node->count - half;
+    node->count = half;
+
+    /* Keep the leaves linked in order */
+    if (node->leaf)
+    {
+        sibling->next = node->next;
+        node->next = sibling;
+    }
+    return sibling;
+}
+
+/* Function to put an entry at a given position of a node that has room for it */
+/*  Time O(B) */
+static void insert_entry_in_BPlusNode(BPlusNode* node, int pos, int quality, int time, int size, BPlusSlot slot)
+{
+    int i;
+
+    for (i = node->count; i > pos; i--)
+    {
+        node->qualities[i] = node->qualities[i - 1];
+        node->times[i] = node->times[i - 1];
+        node->sizes[i] = node->sizes[i - 1];
+        node->slots[i] = node->slots[i - 1];
+    }
+    node->qualities[pos] = quality;
+    node->times[pos] = time;
+    node->sizes[pos] = size;
+    node->slots[pos] = slot;
+    node->count++;
+}
+
+/* Function to take the entry at a given position out of a node */
+/*  Time O(B) */
+static void remove_entry_from_BPlusNode(BPlusNode* node, int pos)
+{
+    int i;
+
+    node->count--;
+    for (i = pos; i < node->count; i++)
+    {
+        node->qualities[i] = node->qualities[i + 1];
+        node->times[i] = node->times[i + 1];
+        node->sizes[i] = node->sizes[i + 1];
+        node->slots[i] = node->slots[i + 1];
+    }
+}
+
+/* Function to insert a product below a node, returns the new right sibling if the node was split */
+/*  Time O(B*log_B(n)) */
+static BPlusNode* insert_in_BPlusNode(BPlusTree* tree, BPlusNode* node, AvlTree* product)
+{
+    BPlusNode* sibling = NULL;
+    BPlusNode* child_sibling;
+    BPlusSlot slot;
+    int quality, time, size, pos, c;
+
+    STATS_COUNT(nodes_visited);
+    if (node->leaf)
+    {
+        /* Find the position of the product in the leaf */
+        pos = 0;
+        while (pos < node->count && compare_BPlusKeys(node->qualities[pos], node->times[pos], product->quality, product->time) < 0)
+            pos++;
+        quality = product->quality;
+        time = product->time;
+        size = 1;
+        slot.product = product;
+    }
+    else
+    {
+        /* Insert the product in its child and count it */
+        c = child_index_in_BPlusNode(node, product->quality, product->time);
+        child_sibling = insert_in_BPlusNode(tree, node->slots[c].child, product);
+        node->sizes[c]++;
+
+        /* If the child was not split, nothing else changes */
+        if (child_sibling == NULL)
+            return NULL;
+
+        /* The new sibling of the child is put right after it, separated by its smallest key */
+        node->sizes[c] = sizeOfBPlusNode(node->slots[c].child);
+        pos = c + 1;
+        quality = child_sibling->qualities[0];
+        time = child_sibling->times[0];
+        size = sizeOfBPlusNode(child_sibling);
+        slot.child = child_sibling;
+    }
+
+    /* If the node is full, split it and insert in the half that holds the position */
+    if (node->count == BPLUS_ORDER)
+    {
+        sibling = split_BPlusNode(tree, node);
+        if (pos > node->count)
+        {
+            pos -= node->count;
+            node = sibling;
+        }
+    }
+
+    insert_entry_in_BPlusNode(node, pos, quality, time, size, slot);
+    return sibling;
+}
+
+/* Function to insert a product in the B+ tree */
+/*  Time O(B*log_B(n)) */
+static void insert_in_BPlusTree(BPlusTree* tree, AvlTree* product)
+{
+    BPlusNode* sibling;
+    BPlusNode* root;
+
+    tree->size++;
+
+    /* The first product gets a leaf as root */
+    if (tree->root == NULL)
+        tree->root = createBPlusNode(tree, 1);
+
+    /* If the root was split, the tree grows by one level */
+    sibling = insert_in_BPlusNode(tree, tree->root, product);
+    if (sibling != NULL)
+    {
+        root = createBPlusNode(tree, 0);
+        root->qualities[0] = tree->root->qualities[0];
+        root->times[0] = tree->root->times[0];
+        root->sizes[0] = sizeOfBPlusNode(tree->root);
+        root->slots[0].child = tree->root;
+        root->qualities[1] = sibling->qualities[0];
+        root->times[1] = sibling->times[0];
+        root->sizes[1] = sizeOfBPlusNode(sibling);
+        root->slots[1].child = sibling;
+        root->count = 2;
+        tree->root = root;
+    }
+}
+
+/* Function to refill the child at position c of an internal node after it went below the minimum fill,
+   it borrows an entry from a sibling that has more than the minimum or is merged with a sibling */
+/*  Time O(B) */
+static void fix_child_of_BPlusNode(BPlusTree* tree, BPlusNode* node, int c)
+{
+    BPlusNode* child = node->slots[c].child;
+    BPlusNode* left = c > 0 ? node->slots[c - 1].child : NULL;
+    BPlusNode* right = c + 1 < node->count ? node->slots[c + 1].child : NULL;
+    int last, i;
+
+    if (left != NULL && left->count > BPLUS_MIN)
+    {
+        /* Move the last entry of the left sibling to the front of the child */
+        last = left->count - 1;
+        if (child->leaf)
+        {
+            insert_entry_in_BPlusNode(child, 0, left->qualities[last], left->times[last], 1, left->slots[last]);
+            node->qualities[c] = left->qualities[last];
+            node->times[c] = left->times[last];
+            node->sizes[c - 1]--;
+            node->sizes[c]++;
+        }
+        else
+        {
+            /* The separator of the old first child comes from the parent */
+            child->qualities[0] = node->qualities[c];
+            child->times[0] = node->times[c];
+            insert_entry_in_BPlusNode(child, 0, left->qualities[last], left->times[last], left->sizes[last], left->slots[last]);
+            node->qualities[c] = left->qualities[last];
+            node->times[c] = left->times[last];
+            node->sizes[c - 1] -= left->sizes[last];
+            node->sizes[c] += left->sizes[last];
+        }
+        left->count--;
+        return;
+    }
+
+    if (right != NULL && right->count > BPLUS_MIN)
+    {
+        /* Move the first entry of the right sibling to the end of the child */
+        if (child->leaf)
+        {
+            insert_entry_in_BPlusNode(child, child->count, right->qualities[0], right->times[0], 1, right->slots[0]);
+            node->sizes[c]++;
+            node->sizes[c + 1]--;
+        }
+        else
+        {
+            /* The moved child is separated by the separator of the right sibling in the parent */
+            insert_entry_in_BPlusNode(child, child->count, node->qualities[c + 1], node->times[c + 1], right->sizes[0], right->slots[0]);
+            node->sizes[c] += right->sizes[0];
+            node->sizes[c + 1] -= right->sizes[0];
+        }
+        remove_entry_from_BPlusNode(right, 0);
+        node->qualities[c + 1] = right->qualities[0];
+        node->times[c + 1] = right->times[0];
+        return;
+    }
+
+    /* Both siblings have the minimum fill, merge the child with one of them */
+    if (left == NULL)
+    {
+        left = child;
+        c++;
+        child = right;
+    }
+
+    /* Append the entries of the child to its left sibling, the first one is separated by the parent key */
+    if (!child->leaf)
+    {
+        child->qualities[0] = node->qualities[c];
+        child->times[0] = node->times[c];
+    }
+    for (i = 0; i < child->count; i++)
+        insert_entry_in_BPlusNode(left, left->count, child->qualities[i], child->times[i], child->sizes[i], child->slots[i]);
+    if (child->leaf)
+        left->next = child->next;
+    node->sizes[c - 1] += node->sizes[c];
+    remove_entry_from_BPlusNode(node, c);
+    free_to_NodePool(&tree->pool, child);
+}
+
+/* Function to delete the product with a given key below a node, returns 1 if it was found */
+/*  Time O(B*log_B(n)) */
+static int delete_from_BPlusNode(BPlusTree* tree, BPlusNode* node, int quality, int time)
+{
+    int pos, c;
+
+    STATS_COUNT(nodes_visited);
+    if (node->leaf)
+    {
+        /* Find the product in the leaf */
+        for (pos = 0; pos < node->count; pos++)
+        {
+            if (node->qualities[pos] == quality && node->times[pos] == time)
+            {
+                remove_entry_from_BPlusNode(node, pos);
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    /* Delete the product from its child */
+    c = child_index_in_BPlusNode(node, quality, time);
+    if (!delete_from_BPlusNode(tree, node->slots[c].child, quality, time))
+        return 0;
+    node->sizes[c]--;
+
+    /* Refill the child if it became too small */
+    if (node->slots[c].child->count < BPLUS_MIN)
+        fix_child_of_BPlusNode(tree, node, c);
+    return 1;
+}
+
+/* Function to delete the product with a given key from the B+ tree, returns 1 if it was found */
+/*  Time O(B*log_B(n)) */
+static int delete_from_BPlusTree(BPlusTree* tree, int quality, int time)
+{
+    BPlusNode* root = tree->root;
+
+    if (root == NULL || !delete_from_BPlusNode(tree, root, quality, time))
+        return 0;
+    tree->size--;
+
+    /* An empty leaf root leaves an empty tree, an internal root with one child is replaced by it */
+    if (root->leaf && root->count == 0)
+    {
+        tree->root = NULL;
+        free_to_NodePool(&tree->pool, root);
+    }
+    else if (!root->leaf && root->count == 1)
+    {
+        tree->root = root->slots[0].child;
+        free_to_NodePool(&tree->pool, root);
+    }
+    return 1;
+}
+
+/* Function to count the products with a quality smaller than a given quality */
+/*  Time O(B*log_B(n)) */
+static int count_below_in_BPlusTree(BPlusTree* tree, int quality)
+{
+    BPlusNode* node = tree->root;
+    int count = 0;
+    int c, i;
+
+    if (node == NULL)
+        return 0;
+
+    while (!node->leaf)
+    {
+        STATS_COUNT(nodes_visited);
+
+        /* Every child before the last one starting below the quality holds only smaller qualities */
+        c = 1;
+        while (c < node->count && node->qualities[c] < quality)
+            c++;
+        for (i = 0; i < c - 1; i++)
+            count += node->sizes[i];
+        node = node->slots[c - 1].child;
+    }
+
+    for (i = 0; i < node->count && node->qualities[i] < quality; i++)
+        count++;
+    return count;
+}
+
+/* Function to count the products with a quality between quality1 and quality2 (inclusive) */
+/*  Time O(B*log_B(n)) */
+static int count_range_in_BPlusTree(BPlusTree* tree, int quality1, int quality2)
+{
+    int below_end = quality2 == INT_MAX ? tree->size : count_below_in_BPlusTree(tree, quality2 + 1);
+
+    return below_end - count_below_in_BPlusTree(tree, quality1);
+}
+
+/* Function to count the products up to a given (quality, time), inclusive */
+/*  Time O(B*log_B(n)) */
+static int count_up_to_in_BPlusTree(BPlusTree* tree, int quality, int time)
+{
+    BPlusNode* node = tree->root;
+    int count = 0;
+    int c, i;
+
+    if (node == NULL)
+        return 0;
+
+    while (!node->leaf)
+    {
+        STATS_COUNT(nodes_visited);
+
+        /* Every child before the one that contains the key holds only smaller keys */
+        c = child_index_in_BPlusNode(node, quality, time);
+        for (i = 0; i < c; i++)
+            count += node->sizes[i];
+        node = node->slots[c].child;
+    }
+
+    for (i = 0; i < node->count && compare_BPlusKeys(node->qualities[i], node->times[i], quality, time) <= 0; i++)
+        count++;
+    return count;
+}
+
+/* Function to find the first product with a quality at least a given quality, returns its leaf or NULL */
+/*  Time O(B*log_B(n)) */
+static BPlusNode* lower_bound_in_BPlusTree(BPlusTree* tree, int quality, int* pos)
+{
+    BPlusNode* node = tree->root;
+    int c;
+
+    if (node == NULL)
+        return NULL;
+
+    while (!node->leaf)
+    {
+        STATS_COUNT(nodes_visited);
+        c = 1;
+        while (c < node->count && node->qualities[c] < quality)
+            c++;
+        node = node->slots[c - 1].child;
+    }
+
+    *pos = 0;
+    while (*pos < node->count && node->qualities[*pos] < quality)
+        (*pos)++;
+
+    /* The product may be the first one of the next leaf */
+    if (*pos == node->count)
+    {
+        *pos = 0;
+        node = node->next;
+    }
+    return node;
+}
+
+/* Function to get the ith product (ith smallest (quality, time)) of the B+ tree */
+/*  Time O(B*log_B(n)) */
+static AvlTree* select_in_BPlusTree(BPlusTree* tree, int i)
+{
+    BPlusNode* node = tree->root;
+    int c;
+
+    if (node == NULL || i <= 0 || i > tree->size)
+        return NULL;
+
+    /* Skip the children whose products all rank before i */
+    while (!node->leaf)
+    {
+        STATS_COUNT(nodes_visited);
+        c = 0;
+        while (i > node->sizes[c])
+            i -= node->sizes[c++];
+        node = node->slots[c].child;
+    }
+    return node->slots[i - 1].product;
+}
+
+/* Function to answer sorted ranks inside a node of the B+ tree whose first product has rank offset + 1.
+   ranks[order[lo..hi)] are sorted and all fall inside the node, out[order[k]] gets the time of rank ranks[order[k]] */
+/*  Time O(m + B*log_B(n)*log(m)) for m ranks */
+static void select_many_in_BPlusNode(BPlusNode* node, int offset, const int* ranks, const int* order, int* out, size_t lo, size_t hi)
+{
+    size_t end;
+    int c, pos, rank;
+
+    STATS_COUNT(nodes_visited);
+
+    /* Ranks that cover their whole range (contiguous ranks) are read from the linked leaves, starting at the leaf of the first one */
+    if (!node->leaf && hi - lo > 1 && ranks[order[hi - 1]] - ranks[order[lo]] < (int)(hi - lo))
+    {
+        rank = ranks[order[lo]];
+        pos = rank - offset;
+        while (!node->leaf)
+        {
+            STATS_COUNT(nodes_visited);
+            c = 0;
+            while (pos > node->sizes[c])
+                pos -= node->sizes[c++];
+            node = node->slots[c].child;
+        }
+        for (pos--; lo < hi; rank++, pos++)
+        {
+            if (pos == node->count)
+            {
+                node = node->next;
+                pos = 0;
+            }
+            while (lo < hi && ranks[order[lo]] == rank)
+                out[order[lo++]] = node->slots[pos].product->time;
+        }
+        return;
+    }
+
+    if (node->leaf)
+    {
+        for (; lo < hi; lo++)
+            out[order[lo]] = node->slots[ranks[order[lo]] - offset - 1].product->time;
+        return;
+    }
+
+    /* Hand every child the ranks that fall inside it */
+    for (c = 0; c < node->count && lo < hi; c++)
+    {
+        end = lo;
+        while (end < hi && ranks[order[end]] <= offset + node->sizes[c])
+            end++;
+        if (end > lo)
+            select_many_in_BPlusNode(node->slots[c].child, offset, ranks, order, out, lo, end);
+        offset += node->sizes[c];
+        lo = end;
+    }
+}
+
+/* Function to list the products with a quality between quality1 and quality2 (inclusive) in (quality, time) order */
+/*  Time O(B*log_B(n) + k) */
+static size_t collect_range_from_BPlusTree(BPlusTree* tree, int quality1, int quality2, AvlTree** nodes)
+{
+    int pos;
+    size_t count = 0;
+    BPlusNode* leaf = lower_bound_in_BPlusTree(tree, quality1, &pos);
+
+    /* Walk the linked leaves until the quality leaves the range */
+    for (; leaf != NULL; leaf = leaf->next, pos = 0)
+    {
+        for (; pos < leaf->count; pos++)
+        {
+            if (leaf->qualities[pos] > quality2)
+                return count;
+            nodes[count++] = leaf->slots[pos].product;
+        }
+    }
+    return count;
+}
+
+/* Function to list every product of the B+ tree in (quality, time) order */
+/*  Time O(n) */
+static size_t flatten_BPlusTree(BPlusTree* tree, AvlTree** nodes)
+{
+    BPlusNode* leaf = tree->root;
+    size_t count = 0;
+    int i;
+
+    if (leaf == NULL)
+        return 0;
+
+    /* Go down to the first leaf and walk the linked leaves */
+    while (!leaf->leaf)
+        leaf = leaf->slots[0].child;
+    for (; leaf != NULL; leaf = leaf->next)
+    {
+        for (i = 0; i < leaf->count; i++)
+            nodes[count++] = leaf->slots[i].product;
+    }
+    return count;
+}
+
+/* Function to get the number of nodes a level of n entries is packed in, every node but a lone root gets between BPLUS_MIN and BPLUS_ORDER entries */
+/*  Time O(1) */
+static size_t bplus_group_count(size_t n)
+{
+    /* Leave a quarter of every node free for the next inserts, unless the nodes would then be too empty */
+    size_t groups = (n + BPLUS_ORDER * 3 / 4 - 1) / (BPLUS_ORDER * 3 / 4);
+
+    if (groups > 1 && groups * BPLUS_MIN > n)
+        groups = (n + BPLUS_ORDER - 1) / BPLUS_ORDER;
+    return groups;
+}
+
+/* Function to rebuild the B+ tree from products sorted by (quality, time), level by level from the leaves */
+/*  Time O(n) */
+static void build_BPlusTree(BPlusTree* tree, AvlTree** nodes, size_t n)
+{
+    BPlusNode** level;
+    BPlusNode* node;
+    BPlusNode* previous = NULL;
+    size_t groups, count, i, j, first;
+
+    /* Every node of the old tree is released at once */
+    destroy_NodePool(&tree->pool);
+    tree->root = NULL;
+    tree->size = (int)n;
+    if (n == 0)
+        return;
+
+    groups = bplus_group_count(n);
+    level = (BPlusNode**)malloc(groups * sizeof(BPlusNode*));
+    if (level == NULL)
+    {
+        exit(1);
+    }
+
+    /* Pack the products in linked leaves of even fill */
+    for (i = 0, first = 0; i < groups; i++)
+    {
+        node = createBPlusNode(tree, 1);
+        count = n / groups + (i < n % groups ? 1 : 0);
+        for (j = 0; j < count; j++)
+        {
+            node->qualities[j] = nodes[first + j]->quality;
+            node->times[j] = nodes[first + j]->time;
+            node->sizes[j] = 1;
+            node->slots[j].product = nodes[first + j];
+        }
+        node->count = (int)count;
+        first += count;
+        if (previous != NULL)
+            previous->next = node;
+        previous = node;
+        level[i] = node;
+    }
+
+    /* Pack every level in parents until one root is left, the nodes of a level are reused in place */
+    for (n = groups; n > 1; n = groups)
+    {
+        groups = bplus_group_count(n);
+        for (i = 0, first = 0; i < groups; i++)
+        {
+            node = createBPlusNode(tree, 0);
+            count = n / groups + (i < n % groups ? 1 : 0);
+            for (j = 0; j < count; j++)
+            {
+                node->qualities[j] = level[first + j]->qualities[0];
+                node->times[j] = level[first + j]->times[0];
+                node->sizes[j] = sizeOfBPlusNode(level[first + j]);
+                node->slots[j].child = level[first + j];
+            }
+            node->count = (int)count;
+            first += count;
+            level[i] = node;
+        }
+    }
+
+    tree->root = level[0];
+    free(level);
+}
+
+/* Function to delete products sorted by (quality, time) from the B+ tree, one by one if they are few, otherwise by a rebuild */
+/*  Time O(min(k*B*log_B(n), n)) */
+static void remove_sorted_from_BPlusTree(BPlusTree* tree, AvlTree** nodes, size_t k)
+{
+    AvlTree** remaining;
+    size_t n = (size_t)tree->size;
+    size_t log_n = 0;
+    size_t i, j, count;
+
+    while (((size_t)1 << log_n) < n)
+        log_n++;
+
+    /* If only a few products are removed, remove them one by one */
+    if (k * log_n < n)
+    {
+        for (i = 0; i < k; i++)
+            delete_from_BPlusTree(tree, nodes[i]->quality, nodes[i]->time);
+        return;
+    }
+
+    /* Otherwise skip the removed products in one ordered walk and rebuild */
+    remaining = (AvlTree**)malloc((n + 1) * sizeof(AvlTree*));
+    if (remaining == NULL)
+    {
+        exit(1);
+    }
+    n = flatten_BPlusTree(tree, remaining);
+    for (i = 0, j = 0, count = 0; i < n; i++)
+    {
+        if (j < k && remaining[i] == nodes[j])
+            j++;
+        else
+            remaining[count++] = remaining[i];
+    }
+    build_BPlusTree(tree, remaining, count);
+    free(remaining);
+}
+
+/*************************************************/
+
+/* Initialize a data structure with a given value */
+/*  Time O(1) */
+DataStructure Init(int s)
+{
+    return InitWithOptions(s, NULL);
+}
+
+/* Initialize a data structure with a given value and options, NULL options gives the defaults */
+/*  Time O(1) */
+DataStructure InitWithOptions(int s, const InitOptions* options)
+{
+    DataStructure ds;
+    int huge_pages = options != NULL ? options->huge_pages : 0;
+    int lazy_free = options != NULL ? options->lazy_free : 0;
+    int quality_index = options != NULL ? options->quality_index : QUALITY_INDEX_AVL;
+    int time_index = options != NULL ? options->time_index : 0;
+    int lazy_delete = options != NULL ? options->lazy_delete : 0;
+    int balance = options != NULL ? options->balance : BALANCE_AVL;
+    int rank_index = options != NULL ? options->rank_index : 0;
+
+    ds.best_quality = s; /* Set the best quality value */
+    ds.flag_best_quality = 0; /* Set the flag for the best quality */
+    ds.timeTree = NULL; /* Initialize the time tree to NULL */
+    ds.rightmost = NULL; /* The time tree has no rightmost node */
+    ds.balance = balance; /* Set the balancing scheme of the time tree */
+    ds.qualityTree = NULL; /* Initialize the quality tree to NULL */
+    ds.quality_index = quality_index; /* Set the kind of quality index */
+    ds.state = (DataStructureState*)malloc(sizeof(DataStructureState)); /* Allocate the node pool and the indexes */
+    if (ds.state == NULL)
+    {
+        exit(1);
+    }
+    ds.state->rankIndex.root = NULL; /* Initialize the rank index to an empty index */
+    ds.state->rankIndex.alive = 0;
+    ds.state->rankIndex.dead = 0;
+    ds.rank_index = rank_index; /* Set if the rank index is kept */
+    init_QualityHistogram(&ds.state->histogram); /* Initialize the histogram to no quality */
+    init_TimeIndex(&ds.state->timeIndex); /* Initialize the time index to no time */
+    ds.time_index = time_index; /* Set if the time index is kept */
+    ds.lazy_delete = lazy_delete; /* Set the delete mode of RemoveProduct */
+    ds.dead = 0; /* No removed product is kept yet */
+    ds.lazy_free = lazy_free; /* Set the free mode of removed time ranges */
+    ds.detached = NULL;
+    ds.stats = NULL;
+    ds.log = NULL; /* The updates are not logged until OpenLog */
+
+#ifdef AVL_STATS
+    /* Allocate the operation counters, they are shared by every copy of the data structure */
+    ds.stats = (Stats*)calloc(1, sizeof(Stats));
+    if (ds.stats == NULL)
+    {
+        exit(1);
+    }
+#endif
+
+    /* Initialize the node allocators, no memory is allocated until the first product */
+    init_NodePool(&ds.state->nodePool, sizeof(AvlTree), huge_pages);
+    init_NodePool(&ds.state->rankIndex.rankPool, sizeof(RankTree), huge_pages);
+    init_NodePool(&ds.state->rankIndex.timePool, sizeof(RankTimeNode), huge_pages);
+    init_BPlusTree(&ds.state->qualityBPlus, huge_pages);
+
+    return ds; /* Return the initialized data structure */
+}
+
+/* Release every node and index of the data structure, it must be initialized again before it is used again */
+/*  Time O(number of slabs) */
+void Destroy(DataStructure* ds)
+{
+    /* Nothing left to release */
+    if (ds->state == NULL)
+        return;
+
+    /* The log can not record that the products are gone, it is closed */
+    if (ds->log != NULL)
+        CloseLog(ds);
+
+    /* Every node lives in one of the pools, so releasing the slabs releases the trees */
+    destroy_NodePool(&ds->state->nodePool);
+    destroy_NodePool(&ds->state->rankIndex.rankPool);
+    destroy_NodePool(&ds->state->rankIndex.timePool);
+    destroy_NodePool(&ds->state->qualityBPlus.pool);
+    destroy_QualityHistogram(&ds->state->histogram);
+    destroy_TimeIndex(&ds->state->timeIndex);
+    free(ds->state);
+    ds->state = NULL;
+
+    ds->flag_best_quality = 0;
+    ds->timeTree = NULL;
+    ds->rightmost = NULL;
+    ds->qualityTree = NULL;
+    ds->dead = 0;
+    ds->detached = NULL;
+
+    /* Release the operation counters */
+    free(ds->stats);
+    ds->stats = NULL;
+}
+
+/* Function to add the counters of a pool to the allocator statistics */
+/*  Time O(1) */
+static void add_NodePool_stats(NodePool* pool, AllocatorStats* stats)
+{
+    stats->hits += pool->hits;
+    stats->misses += pool->misses;
+    stats->slabs += pool->slab_count;
+    stats->nodes_in_use += pool->in_use;
+    stats->bytes += pool->bytes;
+}
+
+/* Get the counters of every node allocator of the data structure */
+/*  Time O(1) */
+void GetAllocatorStats(DataStructure ds, AllocatorStats* stats)
+{
+    stats->hits = 0;
+    stats->misses = 0;
+    stats->slabs = 0;
+    stats->nodes_in_use = 0;
+    stats->bytes = 0;
+
+    add_NodePool_stats(&ds.state->nodePool, stats);
+    add_NodePool_stats(&ds.state->rankIndex.rankPool, stats);
+    add_NodePool_stats(&ds.state->rankIndex.timePool, stats);
+    add_NodePool_stats(&ds.state->qualityBPlus.pool, stats);
+}
+
+/* Function to get the number of levels of a B+ tree */
+/*  Time O(log_B(n)) */
+static int heightOfBPlusTree(BPlusTree* tree)
+{
+    BPlusNode* node = tree->root;
+    int height = 0;
+
+    while (node != NULL)
+    {
+        height++;
+        node = node->leaf ? NULL : node->slots[0].child;
+    }
+    return height;
+}
+
+/* Get the operation counters and the shape of the data structure, the counters are zero without AVL_STATS */
+/*  Time O(log(n)), O(n) to measure the height of a time tree that is not an AVL tree */
+void GetStats(DataStructure ds, Stats* stats)
+{
+    NodePool* pools[4];
+    int i;
+
+    memset(stats, 0, sizeof(Stats));
+    if (ds.stats != NULL)
+        memcpy(stats->operations, ds.stats->operations, sizeof(stats->operations));
+
+    /* The shape of the trees */
+    stats->time_tree_height = ds.balance == BALANCE_AVL ? heightOfNode(ds.timeTree) : height_of_TimeTree(ds.timeTree);
+    if (ds.quality_index == QUALITY_INDEX_BPLUS)
+        stats->quality_index_height = heightOfBPlusTree(&ds.state->qualityBPlus);
+    else
+        stats->quality_index_height = heightOfQualityNode(ds.qualityTree);
+    stats->products = sizeOfNode(ds.timeTree);
+
+    /* The memory of every pool */
+    pools[0] = &ds.state->nodePool;
+    pools[1] = &ds.state->rankIndex.rankPool;
+    pools[2] = &ds.state->rankIndex.timePool;
+    pools[3] = &ds.state->qualityBPlus.pool;
+    for (i = 0; i < 4; i++)
+    {
+        stats->bytes_in_use += (size_t)pools[i]->in_use * pools[i]->object_size;
+        stats->bytes_reserved += pools[i]->bytes;
+    }
+}
+
+/* Reset the operation counters of the data structure */
+/*  Time O(1) */
+void ResetStats(DataStructure* ds)
+{
+    if (ds->stats != NULL)
+        memset(ds->stats, 0, sizeof(Stats));
+}
+
+/* Function to get the number of products in the quality index of a data structure */
+/*  Time O(1) */
+static int quality_index_size(DataStructure* ds)
+{
+    if (ds->quality_index == QUALITY_INDEX_BPLUS)
+        return ds->state->qualityBPlus.size;
+    return sizeOfQualityNode(ds->qualityTree);
+}
+
+/* Function to list the products of the quality index of a data structure in (quality, time) order */
+/*  Time O(n) */
+static size_t flatten_quality_index(DataStructure* ds, AvlTree** nodes)
+{
+    if (ds->quality_index == QUALITY_INDEX_BPLUS)
+        return flatten_BPlusTree(&ds->state->qualityBPlus, nodes);
+    return flatten_QualityTree(ds->qualityTree, nodes, 0);
+}
+
+/* Function to rebuild the trees of a data structure without the products removed in lazy delete mode, their nodes are freed.
+   It runs once they are a LAZY_DELETE_REBUILD_PERCENT share of the nodes, so its cost is O(1) amortized over the removals */
+/*  Time O(n) */
+static void purge_removed_products(DataStructure* ds)
+{
+    AvlTree** nodes;
+    size_t n = (size_t)sizeOfNode(ds->timeTree) + (size_t)ds->dead;
+    size_t count, alive, i;
+
+    nodes = (AvlTree**)malloc((n + 1) * sizeof(AvlTree*));
+    if (nodes == NULL)
+    {
+        exit(1);
+    }
+
+    /* The AVL quality tree keeps the removed products too, the B+ tree dropped them already */
+    if (ds->quality_index != QUALITY_INDEX_BPLUS)
+    {
+        count = flatten_QualityTree(ds->qualityTree, nodes, 0);
+        for (i = 0, alive = 0; i < count; i++)
+        {
+            if (nodes[i]->alive)
+                nodes[alive++] = nodes[i];
+        }
+        ds->qualityTree = build_QualityTree(nodes, alive);
+    }
+
+    /* Rebuild the time tree from the alive nodes and free the others */
+    count = flatten_TimeTree(ds->timeTree, nodes, 0);
+    for (i = 0, alive = 0; i < count; i++)
+    {
+        if (nodes[i]->alive)
+            nodes[alive++] = nodes[i];
+        else
+            free_to_NodePool(&ds->state->nodePool, nodes[i]);
+    }
+    ds->timeTree = build_TimeTree(nodes, alive, ds->balance);
+    ds->rightmost = alive > 0 ? nodes[alive - 1] : NULL;
+    ds->dead = 0;
+
+    /* Free the memory allocated for the array */
+    free(nodes);
+}
+
+/* Function to bring back a product removed in lazy delete mode whose time is added again, with the new quality.
+   The node is left out of the quality index, returns it or NULL if the time belongs to a product that was not removed */
+/*  Time O(log(n)) */
+static AvlTree* revive_removed_product(DataStructure* ds, int time, int quality)
+{
+    AvlTree* node = find(ds->timeTree, time);
+
+    if (node == NULL || node->alive)
+        return NULL;
+
+    /* The node leaves the AVL quality tree from the place of its old quality, the B+ tree dropped it already */
+    if (ds->quality_index != QUALITY_INDEX_BPLUS)
+    {
+        deleteNode_in_QualityTree(&ds->qualityTree, node);
+        node->q_height = 0;
+        node->q_size = 1;
+        node->q_left = NULL;
+        node->q_right = NULL;
+    }
+
+    /* The time tree keeps the node in place, only the path to it is updated */
+    node->quality = quality;
+    node->alive = 1;
+    update_TimeTree_path(ds->timeTree, time);
+    ds->dead--;
+    return node;
+}
+
+/* Add a product to the data structure */
+/*  Time O(log(n)), O(log^2(n)) amortized with the rank index */
+void AddProduct(DataStructure* ds, int time, int quality)
+{
+    AvlTree* node;
+    int append;
+
+    STATS_BEGIN(ds, STATS_ADD_PRODUCT);
+
+    /* record the update in the log first */
+    if(ds->log != NULL)
+        append_to_OperationLog(ds->log, LOG_ADD_PRODUCT, time, quality);
+
+    /* free a few nodes of the removed time ranges, they are reused by the pool */
+    if(ds->detached != NULL)
+        ReclaimDetached(ds,DETACHED_FREE_BATCH);
+
+    /* a time larger than the rightmost one is appended to the end of the time tree, it can not exist yet */
+    if(ds->rightmost == NULL && ds->timeTree != NULL)
+        ds->rightmost = maxInTree(ds->timeTree);
+    append = ds->rightmost == NULL || time > ds->rightmost->time;
+
+    /* input check with the time index: if a product with the same time exists do nothing */
+    if(!append && ds->time_index && find_in_TimeIndex(&ds->state->timeIndex,time) != NULL)
+    {
+        STATS_END();
+        return;
+    }
+
+    /* create one node for the product, it is linked in both trees */
+    node = createNode(&ds->state->nodePool, time, quality);
+
+    /* insert node to time tree, input check: if a product with the same time exists release the node and do nothing */
+    if(append)
+    {
+        append_to_TimeTree(&ds->timeTree,node,ds->balance);
+        ds->rightmost = node;
+    }
+    else if(!insert_in_TimeTree(&ds->timeTree,node,ds->balance))
+    {
+        free_to_NodePool(&ds->state->nodePool,node);
+
+        /* a product removed in lazy delete mode comes back with the new quality, any other product stays as it is */
+        node = ds->dead > 0 ? revive_removed_product(ds,time,quality) : NULL;
+        if(node == NULL)
+        {
+            STATS_END();
+            return;
+        }
+    }
+
+    /* insert node to quality index */
+    if(ds->quality_index == QUALITY_INDEX_BPLUS)
+        insert_in_BPlusTree(&ds->state->qualityBPlus,node);
+    else
+        insert_in_QualityTree(&ds->qualityTree,node);
+
+    /* insert the product to the rank index */
+    if(ds->rank_index)
+        insert_in_RankIndex(&ds->state->rankIndex,time,quality);
+
+    /* count the product in the histogram of its quality, and index its node by time */
+    add_to_QualityHistogram(&ds->state->histogram,quality);
+    if(ds->time_index)
+        insert_in_TimeIndex(&ds->state->timeIndex,node);
+
+    /* if the quality is eqaul to our best quality then set the flag to tree */
+    if(quality==ds->best_quality)
+        ds->flag_best_quality=1;
+
+    STATS_END();
+}
+
+/* Add n products to the data structure at once. The products are sorted with a radix sort and
+   both trees are rebuilt perfectly balanced, a product whose time already exists is ignored like in AddProduct */
+/*  Time O(n + m) where m is the number of products already in the data structure, plus O((n + m)*log(n + m)) with the rank index */
+void AddProductsBulk(DataStructure* ds, const int* times, const int* qualities, size_t n)
+{
+    int* order;
+    int* scratch;
+    int* new_qualities;
+    AvlTree** old_nodes;
+    AvlTree** new_nodes;
+    AvlTree** merged;
+    size_t existing;
+    size_t unique, added, total, i, j, k;
+    size_t log_existing = 0;
+    OperationLog* log;
+
+    /* Input check: nothing to add */
+    if (n == 0)
+        return;
+
+    STATS_BEGIN(ds, STATS_ADD_PRODUCTS_BULK);
+
+    /* Record every product in the log, the AddProduct calls below must not record them again */
+    log = ds->log;
+    if (log != NULL)
+    {
+        for (i = 0; i < n; i++)
+            append_to_OperationLog(log, LOG_ADD_PRODUCT, times[i], qualities[i]);
+        ds->log = NULL;
+    }
+
+    /* The trees are merged node by node, the products removed in lazy delete mode are dropped first */
+    if (ds->dead > 0)
+        purge_removed_products(ds);
+    existing = (size_t)sizeOfNode(ds->timeTree);
+
+    /* Sort the products by time */
+    order = (int*)malloc(3 * n * sizeof(int));
+    if (order == NULL)
+    {
+        exit(1);
+    }
+    scratch = order + n;
+    new_qualities = scratch + n;
+    for (i = 0; i < n; i++)
+        order[i] = (int)i;
+    radix_sort_indices(times, order, scratch, n);
+
+    /* Keep the first product of every time, like a loop of AddProduct would */
+    unique = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (unique == 0 || times[order[unique - 1]] != times[order[i]])
+            order[unique++] = order[i];
+    }
+
+    /* If only a few products are added to a large data structure, inserting them one by one is cheaper than a rebuild */
+    while (((size_t)1 << log_existing) < existing)
+        log_existing++;
+    if (unique * log_existing < existing)
+    {
+        for (i = 0; i < unique; i++)
+            AddProduct(ds, times[order[i]], qualities[order[i]]);
+        free(order);
+        ds->log = log;
+        STATS_END();
+        return;
+    }
+
+    old_nodes = (AvlTree**)malloc(2 * (existing + unique) * sizeof(AvlTree*));
+    if (old_nodes == NULL)
+    {
+        exit(1);
+    }
+    new_nodes = old_nodes + existing;
+    merged = new_nodes + unique;
+
+    /* Merge the existing nodes with the new products by time, creating a node for every new time */
+    flatten_TimeTree(ds->timeTree, old_nodes, 0);
+    added = 0;
+    total = 0;
+    for (i = 0, j = 0; i < existing || j < unique; )
+    {
+        if (j >= unique || (i < existing && old_nodes[i]->time < times[order[j]]))
+            merged[total++] = old_nodes[i++];
+        else if (i < existing && old_nodes[i]->time == times[order[j]])
+            j++;
+        else
+        {
+            new_nodes[added] = createNode(&ds->state->nodePool, times[order[j]], qualities[order[j]]);
+            merged[total++] = new_nodes[added++];
+            add_to_QualityHistogram(&ds->state->histogram, qualities[order[j]]);
+            if (ds->time_index)
+                insert_in_TimeIndex(&ds->state->timeIndex, new_nodes[added - 1]);
+            if (qualities[order[j]] == ds->best_quality)
+                ds->flag_best_quality = 1;
+            j++;
+        }
+    }
+    ds->timeTree = build_TimeTree(merged, total, ds->balance);
+    ds->rightmost = merged[total - 1];
+
+    /* Sort the new nodes by quality, they are already sorted by time so the order is (quality, time) */
+    for (i = 0; i < added; i++)
+    {
+        new_qualities[i] = new_nodes[i]->quality;
+        order[i] = (int)i;
+    }
+    radix_sort_indices(new_qualities, order, scratch, added);
+
+    /* Merge the existing nodes with the new nodes by (quality, time) */
+    flatten_quality_index(ds, old_nodes);
+    for (i = 0, j = 0, k = 0; i < existing || j < added; k++)
+    {
+        if (j >= added || (i < existing && (old_nodes[i]->quality < new_nodes[order[j]]->quality ||
+            (old_nodes[i]->quality == new_nodes[order[j]]->quality && old_nodes[i]->time < new_nodes[order[j]]->time))))
+            merged[k] = old_nodes[i++];
+        else
+            merged[k] = new_nodes[order[j++]];
+    }
+    if (ds->quality_index == QUALITY_INDEX_BPLUS)
+        build_BPlusTree(&ds->state->qualityBPlus, merged, total);
+    else
+        ds->qualityTree = build_QualityTree(merged, total);
+
+    /* Rebuild the rank index from the products in (quality, time) order */
+    if (ds->rank_index)
+        build_RankIndex(&ds->state->rankIndex, merged, total);
+
+    /* Free the memory allocated for the arrays */
+    free(old_nodes);
+    free(order);
+
+    ds->log = log;
+    STATS_END();
+}
+
+/* Remove a product from the data structure */
+/*  Time O(log(n)), O(log^2(n)) amortized with the rank index */
+void RemoveProduct(DataStructure* ds, int time)
+{
+    AvlTree* node_to_del;
+    int quality;
+
+    STATS_BEGIN(ds, STATS_REMOVE_PRODUCT);
+
+    /* record the update in the log first */
+    if(ds->log != NULL)
+        append_to_OperationLog(ds->log, LOG_REMOVE_PRODUCT, time, 0);
+
+    /*input check with the time index, if the product not exists return without a descent*/
+    if(ds->time_index)
+    {
+        if(find_in_TimeIndex(&ds->state->timeIndex,time) == NULL)
+        {
+            STATS_END();
+            return;
+        }
+        remove_from_TimeIndex(&ds->state->timeIndex,time);
+    }
+
+    if(ds->lazy_delete)
+    {
+        /* in lazy delete mode the node stays in the trees, it is marked removed and only the counts of its paths are updated */
+        node_to_del = mark_removed_in_TimeTree(ds->timeTree,time);
+
+        /*input check, if the product not exists or was removed already return and do nothing*/
+        if(node_to_del == NULL)
+        {
+            STATS_END();
+            return;
+        }
+        quality = node_to_del->quality;
+        ds->dead++;
+
+        /* the B+ tree has no successor to copy, the product is deleted from it right away */
+        if(ds->quality_index == QUALITY_INDEX_BPLUS)
+            delete_from_BPlusTree(&ds->state->qualityBPlus,quality,time);
+        else
+            mark_removed_in_QualityTree(ds->qualityTree,node_to_del);
+    }
+    else
+    {
+        /* unlink the product from time tree in the same descent that finds it */
+        node_to_del = deleteNode(&ds->timeTree,time,ds->balance);
+
+        /*input check, if the product not exists return and do nothing*/
+        if(!node_to_del)
+        {
+            STATS_END();
+            return;
+        }
+
+        /* the rightmost node is looked up again by the next addition */
+        if(node_to_del == ds->rightmost)
+            ds->rightmost = NULL;
+
+        /* find the quality of the product */
+        quality = node_to_del->quality;
+
+        /* unlink the same node from quality index and free it */
+        if(ds->quality_index == QUALITY_INDEX_BPLUS)
+            delete_from_BPlusTree(&ds->state->qualityBPlus,quality,time);
+        else
+            deleteNode_in_QualityTree(&ds->qualityTree,node_to_del);
+        free_to_NodePool(&ds->state->nodePool,node_to_del);
+    }
+
+    /* delete product from rank index and from the histogram */
+    if(ds->rank_index)
+        remove_from_RankIndex(&ds->state->rankIndex,time,quality);
+    remove_from_QualityHistogram(&ds->state->histogram,quality);
+
+    /* if the quality of the deleted  product is eqaul to our best quality and there is not any product with that quality, set the flag to false */
+    if(ds->best_quality==quality && count_in_QualityHistogram(&ds->state->histogram,quality)==0)
+        ds->flag_best_quality=0;
+
+    /* once the removed products are a large enough share of the nodes, rebuild the trees without them */
+    if((long long)ds->dead * 100 > (long long)LAZY_DELETE_REBUILD_PERCENT * (sizeOfNode(ds->timeTree) + ds->dead))
+        purge_removed_products(ds);
+
+    STATS_END();
+}
+
+/* Function to remove k products from the rank index, the products must already be unlinked from the quality tree */
+/*  Time O(min(k*log^2(n), n*log(n))) */
+static void remove_many_from_RankIndex(DataStructure* ds, AvlTree** nodes, size_t k)
+{
+    AvlTree** remaining;
+    size_t n = (size_t)quality_index_size(ds);
+    size_t log_n = 0;
+    size_t i;
+
+    /* Without the rank index there is nothing to update */
+    if (!ds->rank_index)
+        return;
+
+    while (((size_t)1 << log_n) < n)
+        log_n++;
+
+    /* If only a few products are removed, remove them one by one */
+    if (k * log_n * log_n < n)
+    {
+        for (i = 0; i < k; i++)
+            remove_from_RankIndex(&ds->state->rankIndex, nodes[i]->time, nodes[i]->quality);
+        return;
+    }
+
+    /* Otherwise rebuild the index from the products left in the quality index */
+    remaining = (AvlTree**)malloc((n + 1) * sizeof(AvlTree*));
+    if (remaining == NULL)
+    {
+        exit(1);
+    }
+    flatten_quality_index(ds, remaining);
+    build_RankIndex(&ds->state->rankIndex, remaining, n);
+    free(remaining);
+}
+
+/* Remove every product with a quality between quality1 and quality2 (inclusive) from the data structure.
+   The band is cut out of the quality tree with split and join, and its nodes are removed from the time tree in one batched pass */
+/*  Time O(log(n) + k*log(n/k + 1)) for the trees (k = number of removed products), plus O(min(k*log^2(n), n*log(n))) with the rank index */
+void RemoveQualityRange(DataStructure* ds, int quality1, int quality2)
+{
+    AvlTree* lower;
+    AvlTree* band;
+    AvlTree* upper;
+    AvlTree** nodes;
+    AvlTree** sorted;
+    int* order;
+    int* scratch;
+    int* times;
+    size_t k, i;
+
+    /*input check, an empty range removes nothing*/
+    if (quality1 > quality2)
+        return;
+
+    STATS_BEGIN(ds, STATS_REMOVE_QUALITY);
+
+    /* record the update in the log first */
+    if (ds->log != NULL)
+        append_to_OperationLog(ds->log, LOG_REMOVE_QUALITY_RANGE, quality1, quality2);
+
+    /* The band is counted by its subtree sizes, the products removed in lazy delete mode are dropped first */
+    if (ds->dead > 0)
+        purge_removed_products(ds);
+
+    if (ds->quality_index == QUALITY_INDEX_BPLUS)
+    {
+        /* The B+ tree counts the band with two rank descents, it is removed once its products are collected */
+        band = NULL;
+        k = (size_t)count_range_in_BPlusTree(&ds->state->qualityBPlus, quality1, quality2);
+    }
+    else
+    {
+        /* Cut the band [quality1, quality2] out of the quality tree and join what is left */
+        split_QualityTree(ds->qualityTree, quality1, &lower, &band);
+        if (quality2 == INT_MAX)
+            upper = NULL;
+        else
+            split_QualityTree(band, quality2 + 1, &band, &upper);
+        ds->qualityTree = join2_QualityTree(lower, upper);
+        k = (size_t)sizeOfQualityNode(band);
+    }
+
+    /*input check, if there is no product in the band return and do nothing*/
+    if (k == 0)
+    {
+        STATS_END();
+        return;
+    }
+
+    /* if the best quality is in the band, there is no product with it anymore, set the flag to false */
+    if (quality1 <= ds->best_quality && ds->best_quality <= quality2)
+        ds->flag_best_quality = 0;
+
+    /* Allocate memory for the nodes of the band and the sort buffers */
+    nodes = (AvlTree**)malloc(2 * k * sizeof(AvlTree*));
+    order = (int*)malloc(3 * k * sizeof(int));
+    if (nodes == NULL || order == NULL)
+    {
+        exit(1);
+    }
+    sorted = nodes + k;
+    scratch = order + k;
+    times = scratch + k;
+
+    /* Collect the nodes of the band and remove them from the rank index */
+    if (ds->quality_index == QUALITY_INDEX_BPLUS)
+    {
+        collect_range_from_BPlusTree(&ds->state->qualityBPlus, quality1, quality2, nodes);
+        remove_sorted_from_BPlusTree(&ds->state->qualityBPlus, nodes, k);
+    }
+    else
+        flatten_QualityTree(band, nodes, 0);
+    remove_many_from_RankIndex(ds, nodes, k);
+
+    /* Sort the nodes of the band by time and remove them from the time tree in one pass */
+    for (i = 0; i < k; i++)
+    {
+        times[i] = nodes[i]->time;
+        order[i] = (int)i;
+    }
+    radix_sort_indices(times, order, scratch, k);
+    for (i = 0; i < k; i++)
+        sorted[i] = nodes[order[i]];
+    ds->timeTree = remove_sorted_from_TimeTree(ds->timeTree, sorted, k, ds->balance);
+    ds->rightmost = NULL;
+
+    /* Free the nodes of the band and uncount them from the histogram */
+    for (i = 0; i < k; i++)
+    {
+        remove_from_QualityHistogram(&ds->state->histogram, nodes[i]->quality);
+        if (ds->time_index)
+            remove_from_TimeIndex(&ds->state->timeIndex, nodes[i]->time);
+        free_to_NodePool(&ds->state->nodePool, nodes[i]);
+    }
+
+    /* Free the memory allocated for the arrays */
+    free(order);
+    free(nodes);
+
+    STATS_END();
+}
+
+/* Remove all k (k = number of products that have quality input) products with the same quality input from the data structure */
+/*  Time O(log(n) + k*log(n/k + 1)), plus O(min(k*log^2(n), n*log(n))) with the rank index */
+void RemoveQuality(DataStructure* ds, int quality)
+{
+    /*input check, the histogram tells without a descent that no product has the quality*/
+    if (count_in_QualityHistogram(&ds->state->histogram, quality) == 0)
+        return;
+
+    RemoveQualityRange(ds, quality, quality);
+}
+
+/* Free up to budget nodes of the time ranges removed in lazy free mode, returns the number of freed nodes */
+/*  Time O(budget) */
+size_t ReclaimDetached(DataStructure* ds, size_t budget)
+{
+    AvlTree* node;
+    size_t freed = 0;
+
+    while (ds->detached != NULL && freed < budget)
+    {
+        /* Pop a subtree root and push its children instead, they are linked through q_left */
+        node = ds->detached;
+        ds->detached = node->q_left;
+        if (node->left != NULL)
+        {
+            node->left->q_left = ds->detached;
+            ds->detached = node->left;
+        }
+        if (node->right != NULL)
+        {
+            node->right->q_left = ds->detached;
+            ds->detached = node->right;
+        }
+
+        free_to_NodePool(&ds->state->nodePool, node);
+        freed++;
+    }
+    return freed;
+}
+
+/* Remove every product with a time between time1 and time2 (inclusive) from the data structure.
+   The range is cut out of the time tree with split and join, and its nodes are removed from the quality tree in one batched pass */
+/*  Time O(log(n) + k*log(n/k + 1)) for the trees (k = number of removed products), plus O(min(k*log^2(n), n*log(n))) with the rank index */
+void RemoveTimeRange(DataStructure* ds, int time1, int time2)
+{
+    AvlTree* lower;
+    AvlTree* band;
+    AvlTree* upper;
+    AvlTree** nodes;
+    AvlTree** sorted;
+    int* order;
+    int* scratch;
+    int* qualities;
+    size_t k, i;
+
+    /*input check, an empty range removes nothing*/
+    if (time1 > time2)
+        return;
+
+    STATS_BEGIN(ds, STATS_REMOVE_TIME_RANGE);
+
+    /* record the update in the log first */
+    if (ds->log != NULL)
+        append_to_OperationLog(ds->log, LOG_REMOVE_TIME_RANGE, time1, time2);
+
+    /* The range is counted by its subtree sizes, the products removed in lazy delete mode are dropped first */
+    if (ds->dead > 0)
+        purge_removed_products(ds);
+
+    /* free a few nodes of the previously removed time ranges */
+    if (ds->detached != NULL)
+        ReclaimDetached(ds, DETACHED_FREE_BATCH);
+
+    /* Cut the range [time1, time2] out of the time tree and join what is left */
+    split_TimeTree(ds->timeTree, time1, &lower, &band, ds->balance);
+    if (time2 == INT_MAX)
+        upper = NULL;
+    else
+        split_TimeTree(band, time2 + 1, &band, &upper, ds->balance);
+    ds->timeTree = join2_TimeTree(lower, upper, ds->balance);
+    ds->rightmost = NULL;
+
+    /*input check, if there is no product in the range return and do nothing*/
+    k = (size_t)sizeOfNode(band);
+    if (k == 0)
+    {
+        STATS_END();
+        return;
+    }
+
+    /* Allocate memory for the nodes of the range and the sort buffers */
+    nodes = (AvlTree**)malloc(2 * k * sizeof(AvlTree*));
+    order = (int*)malloc(3 * k * sizeof(int));
+    if (nodes == NULL || order == NULL)
+    {
+        exit(1);
+    }
+    sorted = nodes + k;
+    scratch = order + k;
+    qualities = scratch + k;
+
+    /* Collect the nodes of the range, they are sorted by time so a stable sort by quality gives (quality, time) order */
+    flatten_TimeTree(band, nodes, 0);
+    for (i = 0; i < k; i++)
+    {
+        qualities[i] = nodes[i]->quality;
+        order[i] = (int)i;
+        remove_from_QualityHistogram(&ds->state->histogram, qualities[i]);
+        if (ds->time_index)
+            remove_from_TimeIndex(&ds->state->timeIndex, nodes[i]->time);
+    }
+    radix_sort_indices(qualities, order, scratch, k);
+    for (i = 0; i < k; i++)
+        sorted[i] = nodes[order[i]];
+
+    /* Remove the nodes from the quality index in one pass and then from the rank index */
+    if (ds->quality_index == QUALITY_INDEX_BPLUS)
+        remove_sorted_from_BPlusTree(&ds->state->qualityBPlus, sorted, k);
+    else
+        ds->qualityTree = remove_sorted_from_QualityTree(ds->qualityTree, sorted, k);
+    remove_many_from_RankIndex(ds, sorted, k);
+
+    /* if every product with the best quality was removed, set the flag to false */
+    if (count_in_QualityHistogram(&ds->state->histogram, ds->best_quality) == 0)
+        ds->flag_best_quality = 0;
+
+    if (ds->lazy_free)
+    {
+        /* Keep the detached time subtree, the next updates free it a few nodes at a time */
+        band->q_left = ds->detached;
+        ds->detached = band;
+    }
+    else
+    {
+        /* Free the nodes of the range */
+        for (i = 0; i < k; i++)
+            free_to_NodePool(&ds->state->nodePool, nodes[i]);
+    }
+
+    /* Free the memory allocated for the arrays */
+    free(order);
+    free(nodes);
+
+    STATS_END();
+}
+
+/* Remove every product with a time smaller than a given time from the data structure */
+/*  Time O(log(n) + k*log(n/k + 1)) for the trees (k = number of removed products), plus O(min(k*log^2(n), n*log(n))) with the rank index */
+void ExpireBefore(DataStructure* ds, int time)
+{
+    /*input check, no time is smaller than the smallest int*/
+    if (time == INT_MIN)
+        return;
+
+    RemoveTimeRange(ds, INT_MIN, time - 1);
+}
+
+/* Function to get the ith ranked product (ith smallest quality) in the AVL quality tree, NULL if there is none */
+/*  Time O(log(n)) */
+static AvlTree* select_in_QualityTree(AvlTree* tree, int i)
+{
+    int size_left;
+
+    /* Input check: If i is less than or equal to 0, or greater than the size of the tree, return NULL */
+    if(i<=0 || sizeOfQualityNode(tree) < i)
+        return NULL;
+
+    while (tree != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+
+        /* Calculate the size of the left subtree */
+        size_left = sizeOfQualityNode(tree->q_left);
+
+        /* If the current node is the ith ranked product, return it. A product removed in lazy delete mode has no rank */
+        if(tree->alive && size_left + 1 == i)
+            return tree;
+
+        /* If the ith ranked product is in the left subtree, search in the left subtree */
+        if(size_left + 1 > i)
+            tree = tree->q_left;
+        /* If the ith ranked product is in the right subtree, search in the right subtree */
+        else
+        {
+            i -= size_left + tree->alive;
+            tree = tree->q_right;
+        }
+    }
+    return NULL;
+}
+
+/* Function to count the products of the AVL quality tree up to a given (quality, time), inclusive */
+/*  Time O(log(n)) */
+static int count_up_to_in_QualityTree(AvlTree* tree, int quality, int time)
+{
+    int count = 0;
+
+    while (tree != NULL)
+    {
+        STATS_COUNT(nodes_visited);
+        if (tree->quality < quality || (tree->quality == quality && tree->time <= time))
+        {
+            /* The node (unless removed in lazy delete mode) and its whole left subtree are counted, continue to the right */
+            count += sizeOfQualityNode(tree->q_left) + tree->alive;
+            tree = tree->q_right;
+        }
+        else
+            tree = tree->q_left;
+    }
+    return count;
+}
+
+/* Function to count the products of a time subtree between two times up to a given (quality, time), inclusive.
+   It answers CountProductsUpTo without the rank index, a subtree whose lowest quality is above the quality is skipped */
+/*  Time O((c+1)*log(n)) , c = number of products between the times with a quality up to the given quality */
+static int count_up_to_in_TimeTree(AvlTree* tree, int time1, int time2, int quality, int time)
+{
+    int count = 0;
+
+    /* Input check: an empty subtree, or one without a product of a low enough quality, adds nothing */
+    if (tree == NULL || tree->worst_quality == NULL || tree->worst_quality->quality > quality)
+        return 0;
+
+    STATS_COUNT(nodes_visited);
+    if (tree->time > time1)
+        count += count_up_to_in_TimeTree(tree->left, time1, time2, quality, time);
+    if (tree->alive && tree->time >= time1 && tree->time <= time2 &&
+        (tree->quality < quality || (tree->quality == quality && tree->time <= time)))
+        count++;
+    if (tree->time < time2)
+        count += count_up_to_in_TimeTree(tree->right, time1, time2, quality, time);
+    return count;
+}
+
+/* Function to walk a quality subtree whose first product has rank offset + 1 in order, writing the time of rank ranks[order[k]]
+   to out[order[k]] from k = lo on while the ranks fall inside the subtree. Returns the first rank left, only the subtrees that
+   hold ranks of the list are visited */
+/*  Time O(k + log(n)) when the k ranks fall in a range of O(k) ranks */
+static size_t scan_in_QualityTree(AvlTree* tree, int offset, const int* ranks, const int* order, int* out, size_t lo, size_t hi)
+{
+    int rank;
+
+    while (tree != NULL && lo < hi)
+    {
+        STATS_COUNT(nodes_visited);
+        rank = offset + sizeOfQualityNode(tree->q_left) + 1;
+
+        /* The left subtree holds the ranks before this node */
+        if (ranks[order[lo]] < rank)
+            lo = scan_in_QualityTree(tree->q_left, offset, ranks, order, out, lo, hi);
+
+        /* A product removed in lazy delete mode has no rank, the rank belongs to the right subtree */
+        if (tree->alive)
+        {
+            while (lo < hi && ranks[order[lo]] == rank)
+                out[order[lo++]] = tree->time;
+        }
+        else
+            rank--;
+
+        /* Continue with the ranks of the right subtree */
+        offset = rank;
+        tree = tree->q_right;
+    }
+    return lo;
+}
+
+/* Function to answer sorted ranks inside a quality subtree whose first product has rank offset + 1.
+   ranks[order[lo..hi)] are sorted and all fall inside the subtree, out[order[k]] gets the time of rank ranks[order[k]] */
+/*  Time O(m + log(n)*log(m)) for m ranks */
+static void select_many_in_QualityTree(AvlTree* tree, int offset, const int* ranks, const int* order, int* out, size_t lo, size_t hi)
+{
+    size_t first, last, middle;
+    int rank;
+
+    while (lo < hi)
+    {
+        /* Ranks that cover their whole range (contiguous ranks) are an in order scan of the subtree */
+        if (hi - lo > 1 && ranks[order[hi - 1]] - ranks[order[lo]] < (int)(hi - lo))
+        {
+            scan_in_QualityTree(tree, offset, ranks, order, out, lo, hi);
+            return;
+        }
+
+        STATS_COUNT(nodes_visited);
+        rank = offset + sizeOfQualityNode(tree->q_left) + 1;
+
+        /* Binary search the ranks for the ones before the node [lo, first) and the ones of the node [first, last) */
+        first = lo;
+        last = hi;
+        while (first < last)
+        {
+            middle = first + (last - first) / 2;
+            if (ranks[order[middle]] < rank)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        /* A product removed in lazy delete mode has no rank, the rank belongs to the right subtree */
+        last = first;
+        if (tree->alive)
+        {
+            for (; last < hi && ranks[order[last]] == rank; last++)
+                out[order[last]] = tree->time;
+        }
+        else
+            rank--;
+
+        /* Split the ranks between the two subtrees, the right part continues in the loop */
+        if (first > lo)
+            select_many_in_QualityTree(tree->q_left, offset, ranks, order, out, lo, first);
+        lo = last;
+        offset = rank;
+        tree = tree->q_right;
+    }
+}
+
+/* Function to get the ith ranked product (ith smallest quality) in a binary search tree */
+/*  Time O(log(n)) */
+int GetIthRankProduct(DataStructure ds, int i)
+{
+    AvlTree* product;
+    int time;
+
+    STATS_BEGIN(&ds, STATS_GET_ITH_RANK);
+
+    /* With the B+ tree index the rank descent reads the subtree counts of each node */
+    if(ds.quality_index == QUALITY_INDEX_BPLUS)
+        product = select_in_BPlusTree(&ds.state->qualityBPlus, i);
+    else
+        product = select_in_QualityTree(ds.qualityTree, i);
+    time = product != NULL ? product->time : -1;
+
+    STATS_END();
+    return time;
+}
+
+/* Function to get the products of several ranks at once, out[k] gets the time of the ranks[k]th ranked product or -1.
+   The ranks are sorted and answered by one descent that splits them at every node */
+/*  Time O(m + log(n)*log(m)) for m ranks , Space O(m)*/
+void GetIthRankProducts(DataStructure ds, const int* ranks, int* out, size_t m)
+{
+    int* order;
+    int* scratch;
+    size_t lo, hi, k;
+    int size, sorted;
+
+    /* Input check: no rank to answer */
+    if (m == 0)
+        return;
+
+    STATS_BEGIN(&ds, STATS_GET_ITH_RANKS);
+
+    /* Sort the positions of the ranks by rank */
+    order = (int*)malloc(2 * m * sizeof(int));
+    if (order == NULL)
+    {
+        exit(1);
+    }
+    scratch = order + m;
+    sorted = 1;
+    for (k = 0; k < m; k++)
+    {
+        order[k] = (int)k;
+        if (k > 0 && ranks[k - 1] > ranks[k])
+            sorted = 0;
+    }
+    /* Report pages usually ask for the ranks in order already */
+    if (!sorted)
+        radix_sort_indices(ranks, order, scratch, m);
+
+    /* The ranks outside 1..n have no product */
+    size = ds.quality_index == QUALITY_INDEX_BPLUS ? ds.state->qualityBPlus.size : sizeOfQualityNode(ds.qualityTree);
+    for (lo = 0; lo < m && ranks[order[lo]] <= 0; lo++)
+        out[order[lo]] = -1;
+    for (hi = m; hi > lo && ranks[order[hi - 1]] > size; hi--)
+        out[order[hi - 1]] = -1;
+
+    if (lo < hi)
+    {
+        if (ds.quality_index == QUALITY_INDEX_BPLUS)
+            select_many_in_BPlusNode(ds.state->qualityBPlus.root, 0, ranks, order, out, lo, hi);
+        else
+            select_many_in_QualityTree(ds.qualityTree, 0, ranks, order, out, lo, hi);
+    }
+
+    free(order);
+
+    STATS_END();
+}
+
+/* Function to get the ith ranked product between two times without the rank index, returns its time and stores its quality
+   unless quality is NULL. A cursor over the range returns the products in rank order until the ith one */
+/*  Time O(i*(log(n) + log(i))) */
+static int select_in_TimeRange(DataStructure ds, int time1, int time2, int i, int* quality)
+{
+    RangeBestIterator it;
+    int time = -1;
+    int product_time;
+    int product_quality;
+
+    it = InitRangeBestIterator(ds, time1, time2);
+    while (i > 0 && NextRangeBest(&it, &product_time, &product_quality))
+    {
+        if (--i == 0)
+        {
+            time = product_time;
+            if (quality != NULL)
+                *quality = product_quality;
+        }
+    }
+    DestroyRangeBestIterator(&it);
+    return time;
+}
+
+/* Function to get the ith ranked product (ith smallest quality) between two times in a binary search tree.
+   The rank index answers in O(log^2(n)), without it the whole time range is answered by the quality index and any other range by a cursor */
+/*  Time O(log^2(n)) with the rank index, O(i*(log(n) + log(i))) otherwise , Space O(1) with the rank index */
+int GetIthRankProductBetween(DataStructure ds, int time1, int time2, int i)
+{
+    int time;
+    int quality;
+
+    /* Input check: If i is less than or equal to 0, or the range is empty, return -1 */
+    if(i<=0 || time1>time2)
+        return -1;
+
+    STATS_BEGIN(&ds, STATS_GET_ITH_RANK_BETWEEN);
+
+    /* Descend the rank index by quality, counting the products of each left subtree with a time in the range */
+    if(ds.rank_index)
+        time = select_in_RankIndex(&ds.state->rankIndex,time1,time2,i,NULL);
+    else
+        time = GetIthRankProductKey(ds,time1,time2,i,&quality);
+
+    STATS_END();
+    return time;
+}
+
+/* Function to get the ith ranked product between two times, returns its time and stores its quality.
+   With the whole time range the quality index answers in O(log(n)), otherwise the rank index in O(log^2(n)) or a cursor without it */
+/*  Time O(log^2(n)) with the rank index, O(i*(log(n) + log(i))) otherwise */
+int GetIthRankProductKey(DataStructure ds, int time1, int time2, int i, int* quality)
+{
+    AvlTree* product;
+
+    /* Input check: If i is less than or equal to 0, or the range is empty, return -1 */
+    if(i<=0 || time1>time2)
+        return -1;
+
+    if(time1==INT_MIN && time2==INT_MAX)
+    {
+        if(ds.quality_index == QUALITY_INDEX_BPLUS)
+            product = select_in_BPlusTree(&ds.state->qualityBPlus, i);
+        else
+            product = select_in_QualityTree(ds.qualityTree, i);
+        if(product == NULL)
+            return -1;
+        *quality = product->quality;
+        return product->time;
+    }
+
+    if(!ds.rank_index)
+        return select_in_TimeRange(ds,time1,time2,i,quality);
+    return select_in_RankIndex(&ds.state->rankIndex,time1,time2,i,quality);
+}
+
+/* Function to count the products between two times that rank up to a given (quality, time), inclusive.
+   With the whole time range the quality index answers in O(log(n)), otherwise the rank index in O(log^2(n)).
+   Without it the time tree is walked, skipping the subtrees of higher qualities, and the count of every quality is the size of the range */
+/*  Time O(log^2(n)) with the rank index, O((c+1)*log(n)) otherwise (c = the count) */
+int CountProductsUpTo(DataStructure ds, int time1, int time2, int quality, int time)
+{
+    /* Input check: an empty range holds no product */
+    if(time1>time2)
+        return 0;
+
+    if(time1==INT_MIN && time2==INT_MAX)
+    {
+        if(ds.quality_index == QUALITY_INDEX_BPLUS)
+            return count_up_to_in_BPlusTree(&ds.state->qualityBPlus, quality, time);
+        return count_up_to_in_QualityTree(ds.qualityTree, quality, time);
+    }
+
+    if(!ds.rank_index)
+    {
+        if(quality==INT_MAX && time==INT_MAX)
+            return CountBetween(ds,time1,time2);
+        return count_up_to_in_TimeTree(ds.timeTree,time1,time2,quality,time);
+    }
+    return count_up_to_in_RankIndex(&ds.state->rankIndex,time1,time2,quality,time);
+}
+
+/* Function to count the products between two times with a quality below a given quality */
+/*  Time O(log^2(n)) with the rank index, O((c+1)*log(n)) otherwise (c = the count) */
+static int count_below_quality(DataStructure ds, int time1, int time2, int quality)
+{
+    /* No quality is below INT_MIN, and quality - 1 would overflow */
+    if(quality==INT_MIN)
+        return 0;
+    return CountProductsUpTo(ds,time1,time2,quality-1,INT_MAX);
+}
+
+/* Function to count the products between two times with a quality between two qualities, both inclusive.
+   The band is the difference of two rank counts in the rank index */
+/*  Time O(log^2(n)) with the rank index, O((c+1)*log(n)) otherwise (c = number of products between the times up to quality2) */
+int CountProductsInBand(DataStructure ds, int time1, int time2, int quality1, int quality2)
+{
+    /* Input check: an empty range or band holds no product */
+    if(time1>time2 || quality1>quality2)
+        return 0;
+
+    return CountProductsUpTo(ds,time1,time2,quality2,INT_MAX) - count_below_quality(ds,time1,time2,quality1);
+}
+
+/* Function to get the best product (lowest quality, then lowest time) between two times with a quality of at least quality_min,
+   returns its time and stores its quality, or returns -1. It is the product ranked right after those below quality_min */
+/*  Time O(log^2(n)) with the rank index, O((r+1)*(log(n) + log(r+1))) otherwise (r = its rank between the times) */
+int GetBestProductInBand(DataStructure ds, int time1, int time2, int quality_min, int* quality)
+{
+    /* Input check: an empty range holds no product */
+    if(time1>time2)
+        return -1;
+
+    return GetIthRankProductKey(ds,time1,time2,count_below_quality(ds,time1,time2,quality_min)+1,quality);
+}
+
+/* Function to list the products between two times with a quality between two qualities in rank order, returns their number.
+   At most max products are stored in times and qualities */
+/*  Time O((k+1)log^2(n)) with the rank index, O((r+k+1)*(log(n) + log(r+k+1))) otherwise
+    (k = number of listed products, r = number of products between the times below quality1) */
+size_t GetProductsInBand(DataStructure ds, int time1, int time2, int quality1, int quality2, int* times, int* qualities, size_t max)
+{
+    RangeBestIterator it;
+    size_t k;
+    int first;
+    int count;
+    int time;
+    int quality;
+
+    /* Input check: an empty range or band holds no product */
+    if(time1>time2 || quality1>quality2)
+        return 0;
+
+    /* Without the rank index a cursor walks the range in rank order, past the products below the band */
+    if(!ds.rank_index)
+    {
+        k = 0;
+        it = InitRangeBestIterator(ds,time1,time2);
+        while(k<max && NextRangeBest(&it,&time,&quality) && quality<=quality2)
+        {
+            if(quality>=quality1)
+            {
+                times[k] = time;
+                qualities[k] = quality;
+                k++;
+            }
+        }
+        DestroyRangeBestIterator(&it);
+        return k;
+    }
+
+    /* The products of the band hold the ranks first .. first + count - 1 of the time range */
+    first = count_below_quality(ds,time1,time2,quality1)+1;
+    count = CountProductsUpTo(ds,time1,time2,quality2,INT_MAX)-first+1;
+
+    for(k=0; k<max && (int)k<count; k++)
+        times[k] = GetIthRankProductKey(ds,time1,time2,first+(int)k,&qualities[k]);
+
+    return k;
+}
+
+/* Function to list every product of the data structure in time order, returns their number.
+   times and qualities must hold room for every product */
+/*  Time O(n) */
+size_t GetProductsByTime(DataStructure ds, int* times, int* qualities)
+{
+    AvlTree** nodes;
+    size_t n = (size_t)sizeOfNode(ds.timeTree);
+    size_t i;
+
+    nodes = (AvlTree**)malloc((n + 1) * sizeof(AvlTree*));
+    if (nodes == NULL)
+    {
+        exit(1);
+    }
+    flatten_alive_TimeTree(ds.timeTree, nodes, 0);
+    for (i = 0; i < n; i++)
+    {
+        times[i] = nodes[i]->time;
+        qualities[i] = nodes[i]->quality;
+    }
+    free(nodes);
+    return n;
+}
+
+/* Function to add a time range to the heap of an iterator, keyed by its product of lowest (quality, time). An empty range is skipped.
+   tree is a time subtree that holds every product of the range, the search starts there */
+/*  Time O(h + log(k)) for a subtree of height h and k ranges in the heap */
+static void insert_in_RangeBestHeap(RangeBestIterator* it, AvlTree* tree, int time1, int time2)
+{
+    AvlTree* LCA = findLCA(tree, time1, time2);
+    RangeBestEntry entry;
+    size_t i, parent;
+
+    /* No product between the two times */
+    if (LCA == NULL || LCA->time < time1 || LCA->time > time2)
+        return;
+
+    /* Every product between the two times may have been removed in lazy delete mode */
+    entry.product = GetOneRankProductBetween(LCA, time1, time2);
+    if (entry.product == NULL)
+        return;
+    entry.LCA = LCA;
+    entry.time1 = time1;
+    entry.time2 = time2;
+
+    if (it->count == it->capacity)
+    {
+        it->capacity = it->capacity == 0 ? 16 : 2 * it->capacity;
+        it->heap = (RangeBestEntry*)realloc(it->heap, it->capacity * sizeof(RangeBestEntry));
+        if (it->heap == NULL)
+        {
+            exit(1);
+        }
+    }
+
+    /* Sift the new range up */
+    i = it->count++;
+    while (i > 0)
+    {
+        parent = (i - 1) / 2;
+        if (compare_BPlusKeys(it->heap[parent].product->quality, it->heap[parent].product->time,
+                              entry.product->quality, entry.product->time) <= 0)
+            break;
+        it->heap[i] = it->heap[parent];
+        i = parent;
+    }
+    it->heap[i] = entry;
+}
+
+/* Function to take the range with the lowest product out of the heap of an iterator, the heap must not be empty */
+/*  Time O(log(k)) for k ranges in the heap */
+static RangeBestEntry remove_min_from_RangeBestHeap(RangeBestIterator* it)
+{
+    RangeBestEntry top = it->heap[0];
+    RangeBestEntry last = it->heap[--it->count];
+    size_t i = 0, child;
+
+    /* Sift the last range down from the root */
+    while ((child = 2 * i + 1) < it->count)
+    {
+        if (child + 1 < it->count &&
+            compare_BPlusKeys(it->heap[child + 1].product->quality, it->heap[child + 1].product->time,
+                              it->heap[child].product->quality, it->heap[child].product->time) < 0)
+            child++;
+        if (compare_BPlusKeys(last.product->quality, last.product->time,
+                              it->heap[child].product->quality, it->heap[child].product->time) <= 0)
+            break;
+        it->heap[i] = it->heap[child];
+        i = child;
+    }
+    if (it->count > 0)
+        it->heap[i] = last;
+    return top;
+}
+
+/* Function to open a cursor over the products between two times in rank order, without modifying the data structure */
+/*  Time O(log(n)) */
+RangeBestIterator InitRangeBestIterator(DataStructure ds, int time1, int time2)
+{
+    RangeBestIterator it;
+
+    it.timeTree = ds.timeTree;
+    it.heap = NULL;
+    it.count = 0;
+    it.capacity = 0;
+
+    /* The whole range starts as one entry keyed by its lowest product */
+    if (time1 <= time2)
+        insert_in_RangeBestHeap(&it, it.timeTree, time1, time2);
+    return it;
+}
+
+/* Function to get the next product of a cursor, returns 0 once every product of the range was returned.
+   The product with the lowest (quality, time) of the range it came from is returned, and the range is split around it */
+/*  Time O(log(n) + log(k)) after k products */
+int NextRangeBest(RangeBestIterator* it, int* time, int* quality)
+{
+    RangeBestEntry entry;
+
+    if (it->count == 0)
+        return 0;
+
+    entry = remove_min_from_RangeBestHeap(it);
+    *time = entry.product->time;
+    *quality = entry.product->quality;
+
+    /* The products before and after it in time are the two new ranges, both inside the subtree of the LCA of the range */
+    if (entry.product->time > entry.time1)
+        insert_in_RangeBestHeap(it, entry.LCA, entry.time1, entry.product->time - 1);
+    if (entry.product->time < entry.time2)
+        insert_in_RangeBestHeap(it, entry.LCA, entry.product->time + 1, entry.time2);
+    return 1;
+}
+
+/* Function to release the heap of a cursor */
+/*  Time O(1) */
+void DestroyRangeBestIterator(RangeBestIterator* it)
+{
+    free(it->heap);
+    it->heap = NULL;
+    it->count = 0;
+    it->capacity = 0;
+}
+
+/* Function to check if a flag indicating the existence of the best quality is set in the DataStructure */
+/*  Time O(1) */
+int Exists(DataStructure ds)
+{
+    /* Return the value of the flag indicating the existence of the best quality */
+    return ds.flag_best_quality;
+}
+
+/* Function to find the product of a given time, returns 1 and stores its quality (if quality is not NULL) when it exists */
+/*  Time O(1) expected with the time index, O(log(n)) otherwise */
+int FindProduct(DataStructure ds, int time, int* quality)
+{
+    AvlTree* node;
+
+    if (ds.time_index)
+        node = find_in_TimeIndex(&ds.state->timeIndex, time);
+    else
+        node = find(ds.timeTree, time);
+
+    /* A product removed in lazy delete mode is not found */
+    if (node == NULL || !node->alive)
+        return 0;
+    if (quality != NULL)
+        *quality = node->quality;
+    return 1;
+}
+
+/* Function to get the number of products with a given quality */
+/*  Time O(1) expected */
+int CountQuality(DataStructure ds, int quality)
+{
+    return count_in_QualityHistogram(&ds.state->histogram, quality);
+}
+
+/* Function to check if a product with a given quality exists */
+/*  Time O(1) expected */
+int ExistsQuality(DataStructure ds, int quality)
+{
+    return count_in_QualityHistogram(&ds.state->histogram, quality) != 0;
+}
+
+
+/*************************************************/
+
+#define COMPACT_NULL 0                  /* Index of the sentinel record, stands for an empty subtree */
+
+static void grow_CompactDataStructure(CompactDataStructure* cds);
+static void unmap_CompactDataStructure(CompactDataStructure* cds);
+static unsigned int createCompactNode(CompactDataStructure* cds, int time, int quality);
+static void free_CompactNode(CompactDataStructure* cds, unsigned int node);
+static unsigned int worse_of_CompactNodes(CompactNode* nodes, unsigned int a, unsigned int b);
+static void update_CompactNode_Variables(CompactDataStructure* cds, unsigned int node);
+static unsigned int leftRotate_Compact(CompactDataStructure* cds, unsigned int node);
+static unsigned int rightRotate_Compact(CompactDataStructure* cds, unsigned int node);
+static unsigned int balance_Compact(CompactDataStructure* cds, unsigned int node);
+static void update_CompactQuality_Variables(CompactDataStructure* cds, unsigned int node);
+static unsigned int leftRotate_CompactQuality(CompactDataStructure* cds, unsigned int node);
+static unsigned int rightRotate_CompactQuality(CompactDataStructure* cds, unsigned int node);
+static unsigned int balance_CompactQuality(CompactDataStructure* cds, unsigned int node);
+static unsigned int find_in_CompactTimeTree(CompactDataStructure* cds, int time);
+static int insert_in_CompactTimeTree(CompactDataStructure* cds, unsigned int node);
+static void insert_in_CompactQualityTree(CompactDataStructure* cds, unsigned int node);
+static unsigned int deleteNode_in_CompactTimeTree(CompactDataStructure* cds, int time);
+static int deleteNode_in_CompactQualityTree(CompactDataStructure* cds, unsigned int node);
+static size_t collect_quality_in_CompactTree(CompactDataStructure* cds, unsigned int tree, int quality, unsigned int* nodes, size_t count);
+
+static unsigned int build_CompactTimeTree(CompactDataStructure* cds, unsigned int first, unsigned int last);
+static unsigned int build_CompactQualityTree(CompactDataStructure* cds, const int* order, int first, int last);
+static CompactDataStructure compact_of_DataStructure(DataStructure ds);
+static unsigned long long checksum_of_words(const void* data, size_t words, unsigned long long hash);
+static size_t snapshot_section_bytes(size_t bytes);
+static int write_snapshot_section(FILE* file, const void* data, size_t bytes, unsigned long long* hash);
+static int write_Snapshot(const CompactDataStructure* cds, const char* path, unsigned long long log_sequence);
+static int check_SnapshotHeader(const SnapshotHeader* header, size_t bytes);
+static int check_Snapshot_indices(const CompactNode* nodes, const CompactQualityNode* q_nodes, unsigned int used);
+static void release_snapshot_mapping(void* mapping, size_t bytes);
+static size_t flatten_CompactTimeTree(CompactDataStructure* cds, unsigned int tree, int* times, int* qualities, size_t count);
+static int restore_Snapshot(const char* path, DataStructure* ds, unsigned long long* log_sequence);
+
+/* Initialize an empty compact data structure with a given value */
+/*  Time O(1) */
+CompactDataStructure InitCompact(int s)
+{
+    CompactDataStructure cds;
+
+    cds.best_quality = s; /* Set the best quality value */
+    cds.flag_best_quality = 0; /* Set the flag for the best quality */
+    cds.timeRoot = COMPACT_NULL; /* Initialize the trees to empty trees */
+    cds.qualityRoot = COMPACT_NULL;
+    cds.nodes = NULL; /* The arrays are allocated with the first product */
+    cds.q_nodes = NULL;
+    cds.heights = NULL;
+    cds.q_heights = NULL;
+    cds.capacity = 0;
+    cds.used = 0;
+    cds.free_list = COMPACT_NULL;
+    cds.mapping = NULL; /* Only LoadSnapshot maps a file */
+    cds.mapping_bytes = 0;
+
+    return cds; /* Return the initialized data structure */
+}
+
+/* Release the arrays of a compact data structure, it is left empty and can be used again */
+/*  Time O(1) */
+void DestroyCompact(CompactDataStructure* cds)
+{
+    /* The arrays of a loaded snapshot are released with its mapping */
+    if (cds->mapping != NULL)
+        release_snapshot_mapping(cds->mapping, cds->mapping_bytes);
+    else
+    {
+        free(cds->nodes);
+        free(cds->q_nodes);
+        free(cds->heights);
+        free(cds->q_heights);
+    }
+    *cds = InitCompact(cds->best_quality);
+}
+
+/* Function to double the capacity of the record arrays, the records keep their indices */
+/*  Time O(n) amortized O(1) */
+static void grow_CompactDataStructure(CompactDataStructure* cds)
+{
+    unsigned int capacity = cds->capacity == 0 ? 64 : cds->capacity * 2;
+    CompactNode* nodes;
+    CompactQualityNode* q_nodes;
+    unsigned char* heights;
+    unsigned char* q_heights;
+
+    /* The indices are 32 bit */
+    if (capacity <= cds->capacity)
+    {
+        exit(1);
+    }
+
+    /* The arrays of a loaded snapshot can not grow inside the file mapping */
+    if (cds->mapping != NULL)
+        unmap_CompactDataStructure(cds);
+
+    nodes = (CompactNode*)realloc(cds->nodes, (size_t)capacity * sizeof(CompactNode));
+    if (nodes == NULL)
+    {
+        exit(1);
+    }
+    cds->nodes = nodes;
+    q_nodes = (CompactQualityNode*)realloc(cds->q_nodes, (size_t)capacity * sizeof(CompactQualityNode));
+    if (q_nodes == NULL)
+    {
+        exit(1);
+    }
+    cds->q_nodes = q_nodes;
+    heights = (unsigned char*)realloc(cds->heights, (size_t)capacity);
+    q_heights = (unsigned char*)realloc(cds->q_heights, (size_t)capacity);
+    if (heights == NULL || q_heights == NULL)
+    {
+        exit(1);
+    }
+    cds->heights = heights;
+    cds->q_heights = q_heights;
+
+    /* The first allocation sets up the empty sentinel, an empty subtree has size 0 and height 0 */
+    if (cds->capacity == 0)
+    {
+        cds->nodes[COMPACT_NULL].time = 0;
+        cds->nodes[COMPACT_NULL].quality = 0;
+        cds->nodes[COMPACT_NULL].left = COMPACT_NULL;
+        cds->nodes[COMPACT_NULL].right = COMPACT_NULL;
+        cds->nodes[COMPACT_NULL].worst_quality = COMPACT_NULL;
+        cds->nodes[COMPACT_NULL].size = 0;
+        cds->q_nodes[COMPACT_NULL].q_left = COMPACT_NULL;
+        cds->q_nodes[COMPACT_NULL].q_right = COMPACT_NULL;
+        cds->q_nodes[COMPACT_NULL].q_size = 0;
+        cds->heights[COMPACT_NULL] = 0;
+        cds->q_heights[COMPACT_NULL] = 0;
+        cds->used = 1;
+    }
+    cds->capacity = capacity;
+}
+
+/* Function to move the arrays of a loaded snapshot from its file mapping to the heap */
+/*  Time O(n) */
+static void unmap_CompactDataStructure(CompactDataStructure* cds)
+{
+    CompactNode* nodes = (CompactNode*)malloc((size_t)cds->capacity * sizeof(CompactNode));
+    CompactQualityNode* q_nodes = (CompactQualityNode*)malloc((size_t)cds->capacity * sizeof(CompactQualityNode));
+    unsigned char* heights = (unsigned char*)malloc((size_t)cds->capacity);
+    unsigned char* q_heights = (unsigned char*)malloc((size_t)cds->capacity);
+
+    if (nodes == NULL || q_nodes == NULL || heights == NULL || q_heights == NULL)
+    {
+        exit(1);
+    }
+    memcpy(nodes, cds->nodes, (size_t)cds->used * sizeof(CompactNode));
+    memcpy(q_nodes, cds->q_nodes, (size_t)cds->used * sizeof(CompactQualityNode));
+    memcpy(heights, cds->heights, (size_t)cds->used);
+    memcpy(q_heights, cds->q_heights, (size_t)cds->used);
+
+    release_snapshot_mapping(cds->mapping, cds->mapping_bytes);
+    cds->mapping = NULL;
+    cds->mapping_bytes = 0;
+    cds->nodes = nodes;
+    cds->q_nodes = q_nodes;
+    cds->heights = heights;
+    cds->q_heights = q_heights;
+}
+
+/* Function to allocate the record of a new product, a leaf of height 1 in both trees */
+/*  Time O(1) amortized */
+static unsigned int createCompactNode(CompactDataStructure* cds, int time, int quality)
+{
+    unsigned int node;
+
+    /* Reuse a released record if there is one */
+    if (cds->free_list != COMPACT_NULL)
+    {
+        node = cds->free_list;
+        cds->free_list = cds->nodes[node].left;
+    }
+    else
+    {
+        if (cds->used == cds->capacity)
+            grow_CompactDataStructure(cds);
+        node = cds->used++;
+    }
+
+    cds->nodes[node].time = time;
+    cds->nodes[node].quality = quality;
+    cds->nodes[node].left = COMPACT_NULL;
+    cds->nodes[node].right = COMPACT_NULL;
+    cds->nodes[node].worst_quality = node;
+    cds->nodes[node].size = 1;
+    cds->q_nodes[node].q_left = COMPACT_NULL;
+    cds->q_nodes[node].q_right = COMPACT_NULL;
+    cds->q_nodes[node].q_size = 1;
+    cds->heights[node] = 1;
+    cds->q_heights[node] = 1;
+    return node;
+}
+
+/* Function to release the record of a product */
+/*  Time O(1) */
+static void free_CompactNode(CompactDataStructure* cds, unsigned int node)
+{
+    cds->nodes[node].left = cds->free_list;
+    cds->free_list = node;
+}
+
+/* Function to return the product with the worse quality of two products, the sentinel loses to every product.
+   Equal qualities go to the smaller time, like get_worst_quality_between_tree_and_sub */
+/*  Time O(1) */
+static unsigned int worse_of_CompactNodes(CompactNode* nodes, unsigned int a, unsigned int b)
+{
+    if (a == COMPACT_NULL)
+        return b;
+    if (b == COMPACT_NULL)
+        return a;
+    if (nodes[b].quality < nodes[a].quality || (nodes[b].quality == nodes[a].quality && nodes[b].time < nodes[a].time))
+        return b;
+    return a;
+}
+
+/* Function to update the height, size, and worst_quality of a record in the time tree */
+/*  Time O(1) */
+static void update_CompactNode_Variables(CompactDataStructure* cds, unsigned int node)
+{
+    CompactNode* nodes = cds->nodes;
+    unsigned int left = nodes[node].left;
+    unsigned int right = nodes[node].right;
+
+    cds->heights[node] = (unsigned char)(1 + max(cds->heights[left], cds->heights[right]));
+    nodes[node].size = nodes[left].size + nodes[right].size + 1;
+    nodes[node].worst_quality = worse_of_CompactNodes(nodes, worse_of_CompactNodes(nodes, nodes[left].worst_quality, node), nodes[right].worst_quality);
+}
+
+/* Function to perform a left rotation in the time tree */
+/*  Time O(1) */
+static unsigned int leftRotate_Compact(CompactDataStructure* cds, unsigned int node)
+{
+    unsigned int sub_tree_1 = cds->nodes[node].right;
+    unsigned int sub_tree_2 = cds->nodes[sub_tree_1].left;
+
+    /* Perform rotation */
+    cds->nodes[sub_tree_1].left = node;
+    cds->nodes[node].right = sub_tree_2;
+
+    /* Update update all variables of the node */
+    update_CompactNode_Variables(cds, node);
+    update_CompactNode_Variables(cds, sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to perform a right rotation in the time tree */
+/*  Time O(1) */
+static unsigned int rightRotate_Compact(CompactDataStructure* cds, unsigned int node)
+{
+    unsigned int sub_tree_1 = cds->nodes[node].left;
+    unsigned int sub_tree_2 = cds->nodes[sub_tree_1].right;
+
+    /* Perform rotation */
+    cds->nodes[sub_tree_1].right = node;
+    cds->nodes[node].left = sub_tree_2;
+
+    /* Update update all variables of the node */
+    update_CompactNode_Variables(cds, node);
+    update_CompactNode_Variables(cds, sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to balance a record of the time tree */
+/*  Time O(1) */
+static unsigned int balance_Compact(CompactDataStructure* cds, unsigned int node)
+{
+    CompactNode* nodes = cds->nodes;
+    unsigned char* heights = cds->heights;
+    unsigned int y;
+    int difference = heights[nodes[node].left] - heights[nodes[node].right];
+
+    if (difference <= 1 && difference >= -1)
+    {
+        /* Tree is balanced */
+        return node;
+    }
+
+    if (difference > 1)
+    {
+        /* Tree is right heavy */
+        y = nodes[node].left;
+        if (heights[nodes[y].left] < heights[nodes[y].right])
+        {
+            /* The left son is right heavy */
+            nodes[node].left = leftRotate_Compact(cds, y);
+        }
+        return rightRotate_Compact(cds, node);
+    }
+
+    /* Tree is left heavy */
+    y = nodes[node].right;
+    if (heights[nodes[y].left] > heights[nodes[y].right])
+    {
+        /* The right son is left heavy */
+        nodes[node].right = rightRotate_Compact(cds, y);
+    }
+    return leftRotate_Compact(cds, node);
+}
+
+/* Function to update the height and size of a record in the quality tree */
+/*  Time O(1) */
+static void update_CompactQuality_Variables(CompactDataStructure* cds, unsigned int node)
+{
+    CompactQualityNode* q_nodes = cds->q_nodes;
+    unsigned int left = q_nodes[node].q_left;
+    unsigned int right = q_nodes[node].q_right;
+
+    cds->q_heights[node] = (unsigned char)(1 + max(cds->q_heights[left], cds->q_heights[right]));
+    q_nodes[node].q_size = q_nodes[left].q_size + q_nodes[right].q_size + 1;
+}
+
+/* Function to perform a left rotation in the quality tree */
+/*  Time O(1) */
+static unsigned int leftRotate_CompactQuality(CompactDataStructure* cds, unsigned int node)
+{
+    unsigned int sub_tree_1 = cds->q_nodes[node].q_right;
+    unsigned int sub_tree_2 = cds->q_nodes[sub_tree_1].q_left;
+
+    /* Perform rotation */
+    cds->q_nodes[sub_tree_1].q_left = node;
+    cds->q_nodes[node].q_right = sub_tree_2;
+
+    /* Update update all variables of the node */
+    update_CompactQuality_Variables(cds, node);
+    update_CompactQuality_Variables(cds, sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to perform a right rotation in the quality tree */
+/*  Time O(1) */
+static unsigned int rightRotate_CompactQuality(CompactDataStructure* cds, unsigned int node)
+{
+    unsigned int sub_tree_1 = cds->q_nodes[node].q_left;
+    unsigned int sub_tree_2 = cds->q_nodes[sub_tree_1].q_right;
+
+    /* Perform rotation */
+    cds->q_nodes[sub_tree_1].q_right = node;
+    cds->q_nodes[node].q_left = sub_tree_2;
+
+    /* Update update all variables of the node */
+    update_CompactQuality_Variables(cds, node);
+    update_CompactQuality_Variables(cds, sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to balance a record of the quality tree */
+/*  Time O(1) */
+static unsigned int balance_CompactQuality(CompactDataStructure* cds, unsigned int node)
+{
+    CompactQualityNode* q_nodes = cds->q_nodes;
+    unsigned char* q_heights = cds->q_heights;
+    unsigned int y;
+    int difference = q_heights[q_nodes[node].q_left] - q_heights[q_nodes[node].q_right];
+
+    if (difference <= 1 && difference >= -1)
+    {
+        /* Tree is balanced */
+        return node;
+    }
+
+    if (difference > 1)
+    {
+        /* Tree is right heavy */
+        y = q_nodes[node].q_left;
+        if (q_heights[q_nodes[y].q_left] < q_heights[q_nodes[y].q_right])
+        {
+            /* The left son is right heavy */
+            q_nodes[node].q_left = leftRotate_CompactQuality(cds, y);
+        }
+        return rightRotate_CompactQuality(cds, node);
+    }
+
+    /* Tree is left heavy */
+    y = q_nodes[node].q_right;
+    if (q_heights[q_nodes[y].q_left] > q_heights[q_nodes[y].q_right])
+    {
+        /* The right son is left heavy */
+        q_nodes[node].q_right = rightRotate_CompactQuality(cds, y);
+    }
+    return leftRotate_CompactQuality(cds, node);
+}
+
+/* Function to find the record of a given time in the time tree, returns COMPACT_NULL if there is none */
+/*  Time O(log(n)) */
+static unsigned int find_in_CompactTimeTree(CompactDataStructure* cds, int time)
+{
+    CompactNode* nodes = cds->nodes;
+    unsigned int tree = cds->timeRoot;
+
+    while (tree != COMPACT_NULL && nodes[tree].time != time)
+        tree = time < nodes[tree].time ? nodes[tree].left : nodes[tree].right;
+    return tree;
+}
+
+/* Function to insert a record in the time tree, returns 0 if a record with the same time exists.
+   Rebalanced bottom-up only until a height stops changing, like insert_in_TimeTree */
+/*  Time O(log(n)) */
+static int insert_in_CompactTimeTree(CompactDataStructure* cds, unsigned int node)
+{
+    CompactNode* nodes = cds->nodes;
+    unsigned int* path[AVL_MAX_HEIGHT];
+    unsigned int* link = &cds->timeRoot;
+    unsigned int tree;
+    int depth = 0;
+    unsigned char old_height;
+
+    /* Descend to the empty link of the new record */
+    while (*link != COMPACT_NULL)
+    {
+        tree = *link;
+
+        /* Duplicate keys are not allowed */
+        if (nodes[node].time == nodes[tree].time)
+            return 0;
+
+        path[depth++] = link;
+        link = nodes[node].time < nodes[tree].time ? &nodes[tree].left : &nodes[tree].right;
+    }
+    *link = node;
+
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        tree = *link;
+        old_height = cds->heights[tree];
+
+        /* update all variables of the node and balance the tree if necessary */
+        update_CompactNode_Variables(cds, tree);
+        *link = balance_Compact(cds, tree);
+
+        /* If the height did not change, the ancestors stay balanced */
+        if (cds->heights[*link] == old_height)
+            break;
+    }
+
+    /* The ancestors above only gained the new record */
+    while (depth > 0)
+    {
+        tree = *path[--depth];
+        nodes[tree].size++;
+        nodes[tree].worst_quality = worse_of_CompactNodes(nodes, nodes[tree].worst_quality, node);
+    }
+    return 1;
+}
+
+/* Function to insert a record in the quality tree, sorted by (quality, time) */
+/*  Time O(log(n)) */
+static void insert_in_CompactQualityTree(CompactDataStructure* cds, unsigned int node)
+{
+    CompactNode* nodes = cds->nodes;
+    CompactQualityNode* q_nodes = cds->q_nodes;
+    unsigned int* path[AVL_MAX_HEIGHT];
+    unsigned int* link = &cds->qualityRoot;
+    unsigned int tree;
+    int depth = 0;
+    unsigned char old_height;
+
+    /* Descend to the empty link of the new record, if the qualities are equal go by time */
+    while (*link != COMPACT_NULL)
+    {
+        tree = *link;
+        path[depth++] = link;
+        if (nodes[node].quality < nodes[tree].quality || (nodes[node].quality == nodes[tree].quality && nodes[node].time < nodes[tree].time))
+            link = &q_nodes[tree].q_left;
+        else
+            link = &q_nodes[tree].q_right;
+    }
+    *link = node;
+
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        tree = *link;
+        old_height = cds->q_heights[tree];
+
+        /* update all variables of the node and balance the tree if necessary */
+        update_CompactQuality_Variables(cds, tree);
+        *link = balance_CompactQuality(cds, tree);
+
+        /* If the height did not change, the ancestors stay balanced */
+        if (cds->q_heights[*link] == old_height)
+            break;
+    }
+
+    /* The ancestors above only gained the new record */
+    while (depth > 0)
+        q_nodes[*path[--depth]].q_size++;
+}
+
+/* Function to unlink the record of a given time from the time tree in a single descent, returns it or COMPACT_NULL */
+/*  Time O(log(n)) */
+static unsigned int deleteNode_in_CompactTimeTree(CompactDataStructure* cds, int time)
+{
+    CompactNode* nodes = cds->nodes;
+    unsigned int* path[AVL_MAX_HEIGHT];
+    unsigned int* link = &cds->timeRoot;
+    unsigned int node;
+    unsigned int successor = COMPACT_NULL;
+    unsigned int tree;
+    int depth = 0;
+    int node_depth;
+    unsigned char old_height;
+
+    /* Descend to the record with the time */
+    while (*link != COMPACT_NULL && nodes[*link].time != time)
+    {
+        path[depth++] = link;
+        link = time < nodes[*link].time ? &nodes[*link].left : &nodes[*link].right;
+    }
+
+    /* The time is not in the tree */
+    node = *link;
+    if (node == COMPACT_NULL)
+        return COMPACT_NULL;
+
+    if (nodes[node].left == COMPACT_NULL || nodes[node].right == COMPACT_NULL)
+    {
+        /* If the record has no children or only one child, the child takes its place */
+        *link = nodes[node].left != COMPACT_NULL ? nodes[node].left : nodes[node].right;
+    }
+    else
+    {
+        /* If the record has two children, continue the descent to the successor */
+        node_depth = depth;
+        path[depth++] = link;
+        link = &nodes[node].right;
+        while (nodes[*link].left != COMPACT_NULL)
+        {
+            path[depth++] = link;
+            link = &nodes[*link].left;
+        }
+
+        /* Unlink the successor, its right child takes its place */
+        successor = *link;
+        *link = nodes[successor].right;
+
+        /* The successor takes the place of the record, the path below it goes through the successor now */
+        nodes[successor].left = nodes[node].left;
+        nodes[successor].right = nodes[node].right;
+        nodes[successor].size = nodes[node].size;
+        nodes[successor].worst_quality = nodes[node].worst_quality;
+        cds->heights[successor] = cds->heights[node];
+        *path[node_depth] = successor;
+        if (node_depth + 1 < depth)
+            path[node_depth + 1] = &nodes[successor].right;
+    }
+
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        tree = *link;
+        old_height = cds->heights[tree];
+
+        /* update all variables of the node and balance the tree if necessary */
+        update_CompactNode_Variables(cds, tree);
+        *link = balance_Compact(cds, tree);
+
+        /* If the height did not change, the ancestors stay balanced */
+        if (cds->heights[*link] == old_height)
+            break;
+    }
+
+    /* The ancestors above only lost the record, worst_quality is recomputed only if it was the record or the moved successor */
+    while (depth > 0)
+    {
+        tree = *path[--depth];
+        nodes[tree].size--;
+        if (nodes[tree].worst_quality == node || nodes[tree].worst_quality == successor)
+            nodes[tree].worst_quality = worse_of_CompactNodes(nodes, worse_of_CompactNodes(nodes, nodes[nodes[tree].left].worst_quality, tree), nodes[nodes[tree].right].worst_quality);
+    }
+    return node;
+}
+
+/* Function to unlink a record from the quality tree in a single descent by its (quality, time).
+   Returns 1 if a record with the same quality is left in the tree */
+/*  Time O(log(n)) */
+static int deleteNode_in_CompactQualityTree(CompactDataStructure* cds, unsigned int node)
+{
+    CompactNode* nodes = cds->nodes;
+    CompactQualityNode* q_nodes = cds->q_nodes;
+    unsigned int* path[AVL_MAX_HEIGHT];
+    unsigned int* link = &cds->qualityRoot;
+    unsigned int successor;
+    unsigned int previous = COMPACT_NULL;       /* In-order neighbours of the record */
+    unsigned int next = COMPACT_NULL;
+    unsigned int tree;
+    int depth = 0;
+    int node_depth;
+    unsigned char old_height;
+
+    /* Descend to the record */
+    while (*link != COMPACT_NULL && *link != node)
+    {
+        tree = *link;
+        path[depth++] = link;
+        if (nodes[node].quality < nodes[tree].quality || (nodes[node].quality == nodes[tree].quality && nodes[node].time < nodes[tree].time))
+        {
+            next = tree;
+            link = &q_nodes[tree].q_left;
+        }
+        else
+        {
+            previous = tree;
+            link = &q_nodes[tree].q_right;
+        }
+    }
+
+    /* The record is not in the tree */
+    if (*link == COMPACT_NULL)
+        return 0;
+
+    /* The neighbours inside the subtrees of the record are closer than the ancestors */
+    if (q_nodes[node].q_left != COMPACT_NULL)
+    {
+        previous = q_nodes[node].q_left;
+        while (q_nodes[previous].q_right != COMPACT_NULL)
+            previous = q_nodes[previous].q_right;
+    }
+
+    if (q_nodes[node].q_left == COMPACT_NULL || q_nodes[node].q_right == COMPACT_NULL)
+    {
+        /* if the record is a leaf or only has one son, the son takes its place */
+        if (q_nodes[node].q_right != COMPACT_NULL)
+        {
+            next = q_nodes[node].q_right;
+            while (q_nodes[next].q_left != COMPACT_NULL)
+                next = q_nodes[next].q_left;
+        }
+        *link = q_nodes[node].q_left != COMPACT_NULL ? q_nodes[node].q_left : q_nodes[node].q_right;
+    }
+    else
+    {
+        /* the record has two sons, continue the descent to the successor */
+        node_depth = depth;
+        path[depth++] = link;
+        link = &q_nodes[node].q_right;
+        while (q_nodes[*link].q_left != COMPACT_NULL)
+        {
+            path[depth++] = link;
+            link = &q_nodes[*link].q_left;
+        }
+
+        /* Unlink the successor, its right son takes its place */
+        successor = *link;
+        next = successor;
+        *link = q_nodes[successor].q_right;
+
+        /* The successor takes the place of the record, the path below it goes through the successor now */
+        q_nodes[successor].q_left = q_nodes[node].q_left;
+        q_nodes[successor].q_right = q_nodes[node].q_right;
+        q_nodes[successor].q_size = q_nodes[node].q_size;
+        cds->q_heights[successor] = cds->q_heights[node];
+        *path[node_depth] = successor;
+        if (node_depth + 1 < depth)
+            path[node_depth + 1] = &q_nodes[successor].q_right;
+    }
+
+    /* Rebalance the path while the height of the subtrees changes */
+    while (depth > 0)
+    {
+        link = path[--depth];
+        tree = *link;
+        old_height = cds->q_heights[tree];
+
+        /* update all variables of the node and balance the tree if necessary */
+        update_CompactQuality_Variables(cds, tree);
+        *link = balance_CompactQuality(cds, tree);
+
+        /* If the height did not change, the ancestors stay balanced */
+        if (cds->q_heights[*link] == old_height)
+            break;
+    }
+
+    /* The ancestors above only lost the record */
+    while (depth > 0)
+        q_nodes[*path[--depth]].q_size--;
+
+    /* Records with the same quality are next to each other in (quality, time) order */
+    return (previous != COMPACT_NULL && nodes[previous].quality == nodes[node].quality) || (next != COMPACT_NULL && nodes[next].quality == nodes[node].quality);
+}
+
+/* Function to list the records of a given quality in a quality subtree, skipping the subtrees that can not hold it */
+/*  Time O(log(n) + k) */
+static size_t collect_quality_in_CompactTree(CompactDataStructure* cds, unsigned int tree, int quality, unsigned int* nodes, size_t count)
+{
+    if (tree == COMPACT_NULL)
+        return count;
+
+    if (cds->nodes[tree].quality >= quality)
+        count = collect_quality_in_CompactTree(cds, cds->q_nodes[tree].q_left, quality, nodes, count);
+    if (cds->nodes[tree].quality == quality)
+        nodes[count++] = tree;
+    if (cds->nodes[tree].quality <= quality)
+        count = collect_quality_in_CompactTree(cds, cds->q_nodes[tree].q_right, quality, nodes, count);
+    return count;
+}
+
+/* Add a product to the compact data structure */
+/*  Time O(log(n)) */
+void AddProductCompact(CompactDataStructure* cds, int time, int quality)
+{
+    unsigned int node;
+
+    /* create one record for the product, it is linked in both trees */
+    node = createCompactNode(cds, time, quality);
+
+    /*input check, if a product with the same time exists release the record and do nothing*/
+    if (!insert_in_CompactTimeTree(cds, node))
+    {
+        free_CompactNode(cds, node);
+        return;
+    }
+    insert_in_CompactQualityTree(cds, node);
+
+    /* if the quality is eqaul to our best quality then set the flag to tree */
+    if (quality == cds->best_quality)
+        cds->flag_best_quality = 1;
+}
+
+/* Remove a product from the compact data structure */
+/*  Time O(log(n)) */
+void RemoveProductCompact(CompactDataStructure* cds, int time)
+{
+    unsigned int node;
+    int quality_left;
+
+    /* unlink the product from time tree in the same descent that finds it */
+    node = deleteNode_in_CompactTimeTree(cds, time);
+
+    /*input check, if the product not exists return and do nothing*/
+    if (node == COMPACT_NULL)
+        return;
+
+    /* unlink the same record from quality tree and release it */
+    quality_left = deleteNode_in_CompactQualityTree(cds, node);
+    if (cds->best_quality == cds->nodes[node].quality && !quality_left)
+        cds->flag_best_quality = 0;
+    free_CompactNode(cds, node);
+}
+
+/* Remove all k products with a given quality from the compact data structure */
+/*  Time O(k*log(n)) */
+void RemoveQualityCompact(CompactDataStructure* cds, int quality)
+{
+    unsigned int* nodes;
+    size_t k, i;
+
+    /*input check, an empty structure has nothing to remove*/
+    if (cds->qualityRoot == COMPACT_NULL)
+        return;
+
+    /* Collect the records of the quality, at most every record */
+    nodes = (unsigned int*)malloc((size_t)cds->q_nodes[cds->qualityRoot].q_size * sizeof(unsigned int));
+    if (nodes == NULL)
+    {
+        exit(1);
+    }
+    k = collect_quality_in_CompactTree(cds, cds->qualityRoot, quality, nodes, 0);
+
+    /* Unlink them from both trees and release them */
+    for (i = 0; i < k; i++)
+    {
+        deleteNode_in_CompactTimeTree(cds, cds->nodes[nodes[i]].time);
+        deleteNode_in_CompactQualityTree(cds, nodes[i]);
+        free_CompactNode(cds, nodes[i]);
+    }
+    if (k > 0 && quality == cds->best_quality)
+        cds->flag_best_quality = 0;
+
+    free(nodes);
+}
+
+/* Function to get the time of the ith ranked product (ith smallest quality) of the compact data structure */
+/*  Time O(log(n)) */
+int GetIthRankProductCompact(CompactDataStructure cds, int i)
+{
+    CompactQualityNode* q_nodes = cds.q_nodes;
+    unsigned int tree = cds.qualityRoot;
+    int size_left;
+
+    /* Input check: If i is less than or equal to 0, or greater than the number of products, return -1 */
+    if (tree == COMPACT_NULL || i <= 0 || q_nodes[tree].q_size < i)
+        return -1;
+
+    /* The descent only reads the 12 byte quality records */
+    while (1)
+    {
+        size_left = q_nodes[q_nodes[tree].q_left].q_size;
+
+        /* If the current record is the ith ranked product, return its time */
+        if (size_left + 1 == i)
+            return cds.nodes[tree].time;
+
+        /* Otherwise continue in the subtree that holds it */
+        if (size_left + 1 > i)
+            tree = q_nodes[tree].q_left;
+        else
+        {
+            i -= size_left + 1;
+            tree = q_nodes[tree].q_right;
+        }
+    }
+}
+
+/* Function to check if a product with the best quality exists in the compact data structure */
+/*  Time O(1) */
+int ExistsCompact(CompactDataStructure cds)
+{
+    /* Return the value of the flag indicating the existence of the best quality */
+    return cds.flag_best_quality;
+}
+
+/* Function to check if a product with a given time exists in the compact data structure */
+/*  Time O(log(n)) */
+int FindCompact(CompactDataStructure cds, int time)
+{
+    return find_in_CompactTimeTree(&cds, time) != COMPACT_NULL;
+}
+
+/* Function to count the products with a time between time1 and time2 (inclusive) of the compact data structure */
+/*  Time O(log(n)) */
+int CountBetweenCompact(CompactDataStructure cds, int time1, int time2)
+{
+    CompactNode* nodes = cds.nodes;
+    unsigned int split = cds.timeRoot;
+    unsigned int tree;
+    int count;
+
+    /* Input check: an empty range holds no product */
+    if (time1 > time2)
+        return 0;
+
+    /* Find the root of the smallest subtree that holds the range */
+    while (split != COMPACT_NULL && (nodes[split].time < time1 || nodes[split].time > time2))
+        split = nodes[split].time < time1 ? nodes[split].right : nodes[split].left;
+    if (split == COMPACT_NULL)
+        return 0;
+    count = 1;
+
+    /* Count the times at least time1 in its left subtree, the right subtrees on the way are whole */
+    tree = nodes[split].left;
+    while (tree != COMPACT_NULL)
+    {
+        if (nodes[tree].time >= time1)
+        {
+            count += nodes[nodes[tree].right].size + 1;
+            tree = nodes[tree].left;
+        }
+        else
+            tree = nodes[tree].right;
+    }
+
+    /* Count the times at most time2 in its right subtree */
+    tree = nodes[split].right;
+    while (tree != COMPACT_NULL)
+    {
+        if (nodes[tree].time <= time2)
+        {
+            count += nodes[nodes[tree].left].size + 1;
+            tree = nodes[tree].right;
+        }
+        else
+            tree = nodes[tree].left;
+    }
+    return count;
+}
+
+/* Function to get the time of the product with the worst quality of the compact data structure, -1 if it is empty */
+/*  Time O(1) */
+int GetWorstProductCompact(CompactDataStructure cds)
+{
+    if (cds.timeRoot == COMPACT_NULL)
+        return -1;
+    return cds.nodes[cds.nodes[cds.timeRoot].worst_quality].time;
+}
+
+
+/*************************************************/
+
+#define SNAPSHOT_MAGIC "AVLSNAP"                /* First bytes of a snapshot file */
+#define SNAPSHOT_BYTE_ORDER 0x01020304u         /* Read back differently on a machine of the other byte order */
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL     /* FNV-1a offset basis */
+#define CHECKSUM_PRIME 0x100000001b3ULL         /* FNV-1a prime */
+
+/* Function to build a perfectly balanced compact time tree over the records first..last, which are sorted by time */
+/*  Time O(n) */
+static unsigned int build_CompactTimeTree(CompactDataStructure* cds, unsigned int first, unsigned int last)
+{
+    unsigned int middle;
+
+    if (first > last)
+        return COMPACT_NULL;
+
+    middle = first + (last - first) / 2;
+    cds->nodes[middle].left = build_CompactTimeTree(cds, first, middle - 1);
+    cds->nodes[middle].right = build_CompactTimeTree(cds, middle + 1, last);
+    update_CompactNode_Variables(cds, middle);
+    return middle;
+}
+
+/* Function to build a perfectly balanced compact quality tree over the records order[first..last] + 1, which are sorted by (quality, time) */
+/*  Time O(n) */
+static unsigned int build_CompactQualityTree(CompactDataStructure* cds, const int* order, int first, int last)
+{
+    int middle;
+    unsigned int node;
+
+    if (first > last)
+        return COMPACT_NULL;
+
+    middle = first + (last - first) / 2;
+    node = (unsigned int)order[middle] + 1;
+    cds->q_nodes[node].q_left = build_CompactQualityTree(cds, order, first, middle - 1);
+    cds->q_nodes[node].q_right = build_CompactQualityTree(cds, order, middle + 1, last);
+    update_CompactQuality_Variables(cds, node);
+    return node;
+}
+
+/* Function to copy the products of a data structure into a new compact data structure with balanced trees.
+   Record i + 1 holds the ith product by time */
+/*  Time O(n) */
+static CompactDataStructure compact_of_DataStructure(DataStructure ds)
+{
+    CompactDataStructure cds = InitCompact(ds.best_quality);
+    AvlTree** products;
+    int* qualities;
+    int* order;
+    int* scratch;
+    size_t n = (size_t)sizeOfNode(ds.timeTree);
+    size_t i;
+
+    cds.flag_best_quality = ds.flag_best_quality;
+    while ((size_t)cds.capacity < n + 1)
+        grow_CompactDataStructure(&cds);
+
+    products = (AvlTree**)malloc((n + 1) * sizeof(AvlTree*));
+    qualities = (int*)malloc((3 * n + 1) * sizeof(int));
+    if (products == NULL || qualities == NULL)
+    {
+        exit(1);
+    }
+    order = qualities + n;
+    scratch = order + n;
+
+    /* The records follow the time order, the time tree is then the middle split of the records */
+    flatten_alive_TimeTree(ds.timeTree, products, 0);
+    for (i = 0; i < n; i++)
+    {
+        cds.nodes[i + 1].time = products[i]->time;
+        cds.nodes[i + 1].quality = products[i]->quality;
+        cds.q_nodes[i + 1].q_left = COMPACT_NULL;
+        cds.q_nodes[i + 1].q_right = COMPACT_NULL;
+        qualities[i] = products[i]->quality;
+        order[i] = (int)i;
+    }
+    cds.used = (unsigned int)n + 1;
+    cds.timeRoot = build_CompactTimeTree(&cds, 1, (unsigned int)n);
+
+    /* The stable sort by quality keeps equal qualities in time order, which is the (quality, time) order */
+    radix_sort_indices(qualities, order, scratch, n);
+    cds.qualityRoot = build_CompactQualityTree(&cds, order, 0, (int)n - 1);
+
+    free(products);
+    free(qualities);
+    return cds;
+}
+
+/* Function to add 8 byte words to a checksum, FNV-1a over words instead of bytes */
+/*  Time O(n) */
+static unsigned long long checksum_of_words(const void* data, size_t words, unsigned long long hash)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    unsigned long long word;
+    size_t i;
+
+    for (i = 0; i < words; i++)
+    {
+        memcpy(&word, bytes + 8 * i, 8);
+        hash = (hash ^ word) * CHECKSUM_PRIME;
+    }
+    return hash;
+}
+
+/* Function to round the size of a section of a snapshot up to SNAPSHOT_ALIGN */
+/*  Time O(1) */
+static size_t snapshot_section_bytes(size_t bytes)
+{
+    return (bytes + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+/* Function to write a section of a snapshot followed by zeros up to SNAPSHOT_ALIGN, and add it to the checksum.
+   Returns 0, or -1 if the write failed */
+/*  Time O(n) */
+static int write_snapshot_section(FILE* file, const void* data, size_t bytes, unsigned long long* hash)
+{
+    unsigned char padding[SNAPSHOT_ALIGN + 8];
+    size_t whole = bytes / 8 * 8;
+    size_t rest = snapshot_section_bytes(bytes) - whole;
+
+    /* The padding starts with the bytes of the last partial word so the checksum sees whole words */
+    memset(padding, 0, sizeof(padding));
+    memcpy(padding, (const unsigned char*)data + whole, bytes - whole);
+    *hash = checksum_of_words(data, whole / 8, *hash);
+    *hash = checksum_of_words(padding, rest / 8, *hash);
+
+    if (fwrite(data, 1, whole, file) != whole || fwrite(padding, 1, rest, file) != rest)
+        return -1;
+    return 0;
+}
+
+/* Function to write the arrays of a compact data structure to a snapshot file. The file is written under
+   a temporary name and renamed, so a crash leaves the previous snapshot in place. Returns 0, or -1 on failure */
+/*  Time O(n) */
+static int write_Snapshot(const CompactDataStructure* cds, const char* path, unsigned long long log_sequence)
+{
+    SnapshotHeader header;
+    CompactDataStructure empty;
+    unsigned long long hash = CHECKSUM_SEED;
+    size_t used = cds->used;
+    size_t offset = snapshot_section_bytes(sizeof(SnapshotHeader));
+    char* temporary;
+    FILE* file;
+    int result = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.node_bytes = sizeof(CompactNode);
+    header.q_node_bytes = sizeof(CompactQualityNode);
+    header.best_quality = cds->best_quality;
+    header.flag_best_quality = cds->flag_best_quality;
+    header.timeRoot = cds->timeRoot;
+    header.qualityRoot = cds->qualityRoot;
+    header.used = cds->used;
+    header.free_list = cds->free_list;
+    header.log_sequence = log_sequence;
+
+    /* An empty structure has no arrays yet, the file still holds the sentinel record */
+    if (used == 0)
+    {
+        empty = InitCompact(cds->best_quality);
+        empty.flag_best_quality = cds->flag_best_quality;
+        grow_CompactDataStructure(&empty);
+        result = write_Snapshot(&empty, path, log_sequence);
+        DestroyCompact(&empty);
+        return result;
+    }
+
+    /* Lay the sections out one after the other */
+    header.nodes_offset = offset;
+    offset += snapshot_section_bytes(used * sizeof(CompactNode));
+    header.q_nodes_offset = offset;
+    offset += snapshot_section_bytes(used * sizeof(CompactQualityNode));
+    header.heights_offset = offset;
+    offset += snapshot_section_bytes(used);
+    header.q_heights_offset = offset;
+    offset += snapshot_section_bytes(used);
+    header.file_bytes = offset;
+
+    temporary = (char*)malloc(strlen(path) + 5);
+    if (temporary == NULL)
+    {
+        exit(1);
+    }
+    strcpy(temporary, path);
+    strcat(temporary, ".tmp");
+
+    file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        free(temporary);
+        return -1;
+    }
+
+    /* The header goes first with a zero checksum, it is rewritten once the checksum is known */
+    result |= write_snapshot_section(file, &header, sizeof(header), &hash);
+    result |= write_snapshot_section(file, cds->nodes, used * sizeof(CompactNode), &hash);
+    result |= write_snapshot_section(file, cds->q_nodes, used * sizeof(CompactQualityNode), &hash);
+    result |= write_snapshot_section(file, cds->heights, used, &hash);
+    result |= write_snapshot_section(file, cds->q_heights, used, &hash);
+    header.checksum = hash;
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)
+        result = -1;
+    if (fflush(file) != 0)
+        result = -1;
+#ifdef __linux__
+    if (result == 0 && fsync(fileno(file)) != 0)
+        result = -1;
+#endif
+    if (fclose(file) != 0)
+        result = -1;
+
+    if (result == 0 && rename(temporary, path) != 0)
+        result = -1;
+    if (result != 0)
+        remove(temporary);
+    free(temporary);
+    return result;
+}
+
+/* Function to check that a snapshot header describes a file of a given size that this build can read */
+/*  Time O(1) */
+static int check_SnapshotHeader(const SnapshotHeader* header, size_t bytes)
+{
+    unsigned long long used = header->used;
+
+    if (bytes < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+        return 0;
+    if (header->version != SNAPSHOT_VERSION || header->byte_order != SNAPSHOT_BYTE_ORDER)
+        return 0;
+    if (header->node_bytes != sizeof(CompactNode) || header->q_node_bytes != sizeof(CompactQualityNode))
+        return 0;
+    if (header->file_bytes != bytes || used == 0 || header->timeRoot >= used || header->qualityRoot >= used || header->free_list >= used)
+        return 0;
+
+    /* Every array must lie inside the file, the records at an aligned offset */
+    if (header->nodes_offset % SNAPSHOT_ALIGN != 0 || header->nodes_offset > bytes || used * sizeof(CompactNode) > bytes - header->nodes_offset)
+        return 0;
+    if (header->q_nodes_offset % SNAPSHOT_ALIGN != 0 || header->q_nodes_offset > bytes || used * sizeof(CompactQualityNode) > bytes - header->q_nodes_offset)
+        return 0;
+    if (header->heights_offset > bytes || used > bytes - header->heights_offset)
+        return 0;
+    if (header->q_heights_offset > bytes || used > bytes - header->q_heights_offset)
+        return 0;
+    return 1;
+}
+
+/* Function to check that every index of the records of a snapshot points to one of its used records, so the descents of the
+   queries stay inside the file. The header only bounds the roots and the arrays */
+/*  Time O(n) */
+static int check_Snapshot_indices(const CompactNode* nodes, const CompactQualityNode* q_nodes, unsigned int used)
 {
-    /* Get the node with the lowest quality in the path from the root to time1 in the left subtree of the LCA */
-    AvlTree* result_left = GetOneRankInTime1Path(LCA->left, time1);
-
-    /* Get the node with the lowest quality in the path from the root to time2 in the right subtree of the LCA */
-    AvlTree* result_right = GetOneRankInTime2Path(LCA->right, time2);
+    unsigned int i;
 
-    /* Return the node with the worst quality among the result_left, the LCA, and the result_right */
-    return get_worst_quality_between_tree_and_sub(result_left, LCA, result_right);
+    for (i = 0; i < used; i++)
+    {
+        if (nodes[i].left >= used || nodes[i].right >= used || nodes[i].worst_quality >= used)
+            return 0;
+        if (q_nodes[i].q_left >= used || q_nodes[i].q_right >= used)
+            return 0;
+    }
+    return 1;
 }
 
-/* Function to update the worst quality pointer in the nodes of the path to targer_key */
-/*  Time O(log(n)) */
-void fix_worst_quality(AvlTree* tree, int target_key)
+/* Function to release the memory a snapshot was loaded into */
+/*  Time O(1) */
+static void release_snapshot_mapping(void* mapping, size_t bytes)
 {
-    if(tree==NULL)
-        return;
+#ifdef __linux__
+    munmap(mapping, bytes);
+#else
+    (void)bytes;
+    free(mapping);
+#endif
+}
 
-    /* If the target key is less than the current node's key, go to the left subtree */
-    if(tree->key > target_key)
-        fix_worst_quality(tree->left, target_key);
+/* Function to collect the products of a compact time tree in time order */
+/*  Time O(n) */
+static size_t flatten_CompactTimeTree(CompactDataStructure* cds, unsigned int tree, int* times, int* qualities, size_t count)
+{
+    if (tree == COMPACT_NULL)
+        return count;
+
+    count = flatten_CompactTimeTree(cds, cds->nodes[tree].left, times, qualities, count);
+    times[count] = cds->nodes[tree].time;
+    qualities[count] = cds->nodes[tree].quality;
+    count++;
+    return flatten_CompactTimeTree(cds, cds->nodes[tree].right, times, qualities, count);
+}
 
-    /* If the target key is greater than the current node's key, go to the right subtree */
-    if(tree->key < target_key)
-        fix_worst_quality(tree->right, target_key);
+/* Save the products of a data structure to a snapshot file, in the compact format with balanced trees.
+   With a log attached the snapshot remembers how many logged updates it holds. Returns 0, or -1 if the file could not be written */
+/*  Time O(n) */
+int SaveSnapshot(DataStructure ds, const char* path)
+{
+    CompactDataStructure cds = compact_of_DataStructure(ds);
+    int result = write_Snapshot(&cds, path, ds.log != NULL ? ds.log->sequence : 0);
 
-    /* Update the node's variables after fixing the worst quality pointer */
-    update_Node_Variables(tree);
+    DestroyCompact(&cds);
+    return result;
 }
 
-/* Function to get the size of the nodes in the path from the left subtree of LCA to a given time (time1) in a binary search tree */
-/*  Time O(log(n)) */
-int size_of_path_time1(AvlTree* tree,int time1)
+/* Save a compact data structure to a snapshot file as it is. Returns 0, or -1 if the file could not be written */
+/*  Time O(n) */
+int SaveSnapshotCompact(CompactDataStructure cds, const char* path)
 {
-    int result_left,result_right;
-
-    /* if tree is empty return 0 */
-    if(tree==NULL)
-        return 0;
+    return write_Snapshot(&cds, path, 0);
+}
 
-    /* if the node key is equal to time1 */
-    if(tree->key == time1)
-        return 1 + sizeOfNode(tree->left); /* return 1 + the size of the right subtree nodes */
+/* Load a snapshot file into a compact data structure, returns 0, or -1 if the file is missing, damaged or of another version.
+   The file is mapped privately, the queries read it in place and the first write to a page copies that page.
+   With verify the checksum of the whole file is checked first, and every child and worst_quality index must point to a record
+   of the file, which reads every page once. Without verify only the header is checked and the records are trusted:
+   a damaged or crafted file can then send the queries outside the mapping, so verify = 0 is only for files this process wrote */
+/*  Time O(1) without verify, O(n) with verify */
+int LoadSnapshot(const char* path, CompactDataStructure* cds, int verify)
+{
+    SnapshotHeader header;
+    unsigned char* base;
+    size_t bytes;
+    unsigned long long hash = CHECKSUM_SEED;
+    size_t header_bytes = snapshot_section_bytes(sizeof(SnapshotHeader));
+    unsigned char first[SNAPSHOT_ALIGN * ((sizeof(SnapshotHeader) + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN)];
+#ifdef __linux__
+    struct stat status;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < header_bytes)
+    {
+        close(fd);
+        return -1;
+    }
+    bytes = (size_t)status.st_size;
+    base = (unsigned char*)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == (unsigned char*)MAP_FAILED)
+        return -1;
+#else
+    FILE* file = fopen(path, "rb");
+    long length;
 
-    /* if the node key is less then time1 */
-    if(tree->key > time1)
+    if (file == NULL)
+        return -1;
+    if (fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < (long)header_bytes || fseek(file, 0, SEEK_SET) != 0)
     {
-        /* save to result_left the size of the left subtree nodes */
-        result_left = size_of_path_time1(tree->left , time1);
+        fclose(file);
+        return -1;
+    }
+    bytes = (size_t)length;
+    base = (unsigned char*)malloc(bytes);
+    if (base == NULL)
+    {
+        exit(1);
+    }
+    if (fread(base, 1, bytes, file) != bytes)
+    {
+        fclose(file);
+        free(base);
+        return -1;
+    }
+    fclose(file);
+#endif
 
-        /* save to result_right the size of the right subtree nodes */
-        result_right = sizeOfNode(tree->right);
+    memcpy(&header, base, sizeof(header));
+    if (!check_SnapshotHeader(&header, bytes))
+    {
+        release_snapshot_mapping(base, bytes);
+        return -1;
+    }
 
-        return 1 + result_left + result_right;
+    /* The checksum was computed with a zero checksum field */
+    if (verify)
+    {
+        memcpy(first, base, header_bytes);
+        memset(first + offsetof(SnapshotHeader, checksum), 0, sizeof(header.checksum));
+        hash = checksum_of_words(first, header_bytes / 8, hash);
+        hash = checksum_of_words(base + header_bytes, (bytes - header_bytes) / 8, hash);
+        if (hash != header.checksum ||
+            !check_Snapshot_indices((const CompactNode*)(base + header.nodes_offset), (const CompactQualityNode*)(base + header.q_nodes_offset), header.used))
+        {
+            release_snapshot_mapping(base, bytes);
+            return -1;
+        }
     }
-    /* if the current node's key is greater than the given time1, recursively search the right subtree, ignore the current node and left subtree */
-    return size_of_path_time1(tree->right,time1);
 
+    *cds = InitCompact(header.best_quality);
+    cds->flag_best_quality = header.flag_best_quality;
+    cds->timeRoot = header.timeRoot;
+    cds->qualityRoot = header.qualityRoot;
+    cds->nodes = (CompactNode*)(base + header.nodes_offset);
+    cds->q_nodes = (CompactQualityNode*)(base + header.q_nodes_offset);
+    cds->heights = base + header.heights_offset;
+    cds->q_heights = base + header.q_heights_offset;
+    cds->capacity = header.used;
+    cds->used = header.used;
+    cds->free_list = header.free_list;
+    cds->mapping = base;
+    cds->mapping_bytes = bytes;
+    return 0;
 }
 
-/* Function to get the size of the nodes in the path from the left subtree of LCA to a given time (time1) in a binary search tree */
-/*  Time O(log(n)) */
-int size_of_path_time2(AvlTree* tree,int time2)
+/* Function to add the products of a snapshot file to a data structure and get the number of logged updates it holds */
+/*  Time O(n*log(n)) for the rank index, O(n) for the trees */
+static int restore_Snapshot(const char* path, DataStructure* ds, unsigned long long* log_sequence)
 {
-    int result_left,result_right;
-
-    /* if tree is empty return 0 */
-    if(tree==NULL)
-        return 0;
+    CompactDataStructure cds;
+    SnapshotHeader header;
+    int* times;
+    size_t n;
 
-    /* if the node key is equal to time2 */
-    if(tree->key == time2)
-        return 1 + sizeOfNode(tree->right); /* return 1 + the size of the right subtree nodes */
+    if (LoadSnapshot(path, &cds, 1) != 0)
+        return -1;
+    memcpy(&header, cds.mapping, sizeof(header));
+    *log_sequence = header.log_sequence;
 
-    /* if the node key is less then time2 */
-    if(tree->key < time2)
+    n = (size_t)cds.nodes[cds.timeRoot].size;
+    times = (int*)malloc((2 * n + 1) * sizeof(int));
+    if (times == NULL)
     {
-        /* save to result_right the size of the right subtree nodes */
-        result_right = size_of_path_time2(tree->right , time2);
-
-        /* save to result_left the size of the right subtree nodes */
-        result_left = sizeOfNode(tree->left);
-
-        return 1 + result_left + result_right;
+        exit(1);
     }
-    /* if the current node's key is greater than the given time2, recursively search the left subtree, ignore the current node and left subtree */
-    return size_of_path_time2(tree->left,time2);
+    flatten_CompactTimeTree(&cds, cds.timeRoot, times, times + n, 0);
+    AddProductsBulk(ds, times, times + n, n);
 
+    free(times);
+    DestroyCompact(&cds);
+    return 0;
 }
 
-/* Function to get the size of nodes between two given times in a binary search tree */
-/*  Time O(2*log(n)) */
-int size_of_range_in_tree(AvlTree* LCA,int time1,int time2)
+/* Add the products of a snapshot file to a data structure with one AddProductsBulk. Returns 0, or -1 like LoadSnapshot */
+/*  Time O(n*log(n)) for the rank index, O(n) for the trees */
+int RestoreSnapshot(const char* path, DataStructure* ds)
 {
-    /* return the size of the left subtree to the LCA */
-    int result_left = size_of_path_time1(LCA->left,time1);
-
-    /* return the size of the right subtree to the LCA */
-    int result_right = size_of_path_time2(LCA->right,time2);
-
-    /* return the size of result_left and the size of result_right and add 1 because of the LCA */
-    return 1 + result_left + result_right;
+    unsigned long long log_sequence;
 
+    return restore_Snapshot(path, ds, &log_sequence);
 }
 
+
 /*************************************************/
 
-/* Initialize a data structure */
-typedef struct DataStructure
-{
-    int best_quality;               /* save the best quality in the data structure */
-    int flag_best_quality;          /* flag if there is a quality with the same value as the best quality */
-    AvlTree* timeTree;              /* Avl tree sorted by time */
-    AvlTree* qualityTree;           /* Avl tree sorted by quality */
-} DataStructure;
+#define LOG_BATCH_MAGIC 0x4C4C5641u             /* "AVLL" in a little endian file */
+#define LOG_RECORD_BYTES 9                      /* A record is its kind in one byte followed by two ints */
+#define LOG_DEFAULT_BATCH 256                   /* Default number of records of a batch */
+#define LOG_DEFAULT_INTERVAL_MS 10              /* Default age of the oldest record that forces a sync */
 
-/* Initialize a data structure with a given value */
+/* Additions read from the log and not yet applied */
+typedef struct LogRun
+{
+    int* times;                                 /* Times of the additions */
+    int* qualities;                             /* Qualities of the additions */
+    size_t count;                               /* Number of additions */
+    size_t capacity;                            /* Number of additions the arrays can hold */
+} LogRun;
+
+static long long monotonic_ns(void);
+static size_t log_batch_bytes(size_t count);
+static unsigned long long checksum_of_LogBatch(const LogBatchHeader* header, const unsigned char* records);
+static int commit_OperationLog(OperationLog* log);
+static int truncate_log_file(const char* path, FILE* file, size_t bytes, const unsigned char* kept);
+static void apply_log_records(DataStructure* ds, const unsigned char* records, size_t count, LogRun* run);
+static size_t replay_log_file(DataStructure* ds, const unsigned char* bytes, size_t size, unsigned long long* sequence);
+
+/* Function to read a monotonic clock in ns */
 /*  Time O(1) */
-DataStructure Init(int s)
+static long long monotonic_ns(void)
 {
-    DataStructure ds;
-
-    ds.best_quality = s; /* Set the best quality value */
-    ds.flag_best_quality = 0; /* Set the flag for the best quality */
-    ds.timeTree = NULL; /* Initialize the time tree to NULL */
-    ds.qualityTree = NULL; /* Initialize the quality tree to NULL */
-
-    return ds; /* Return the initialized data structure */
+#ifdef CLOCK_MONOTONIC
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+#else
+    return (long long)clock() * (1000000000LL / CLOCKS_PER_SEC);
+#endif
 }
 
-/* Add a product to the data structure */
-/*  Time O(log(n)) */
-void AddProduct(DataStructure* ds, int time, int quality)
+/* Function to get the size of a batch of the log file, the header and the records padded to 8 bytes */
+/*  Time O(1) */
+static size_t log_batch_bytes(size_t count)
 {
-    /* create node for time tree*/
-    AvlTree* node_time = createNode(time, time, quality);
-
-    /* create node for quality tree*/
-    AvlTree* node_quality = createNode(quality, time, quality);
-
-    /* insert node_time to time tree */
-    ds->timeTree = insert_in_TimeTree(ds->timeTree,node_time);
+    return sizeof(LogBatchHeader) + (count * LOG_RECORD_BYTES + 7) / 8 * 8;
+}
 
-    /* insert node_quality to quality tree */
-    ds->qualityTree = insert_in_QualityTree(ds->qualityTree,node_quality);
+/* Function to compute the checksum of a batch from its header and its padded records */
+/*  Time O(count) */
+static unsigned long long checksum_of_LogBatch(const LogBatchHeader* header, const unsigned char* records)
+{
+    unsigned long long seed = CHECKSUM_SEED ^ header->count ^ (header->first * CHECKSUM_PRIME);
 
-    /* if the quality is eqaul to our best quality then set the flag to tree */
-    if(quality==ds->best_quality)
-        ds->flag_best_quality=1;
+    return checksum_of_words(records, (log_batch_bytes(header->count) - sizeof(LogBatchHeader)) / 8, seed);
 }
 
-/* Remove a product from the data structure */
-/*  Time O(log(n)) */
-void RemoveProduct(DataStructure* ds, int time)
+/* Function to add an update to the batch of a log, the batch is written once it is full or its oldest record is too old */
+/*  Time O(1), plus a write and an fsync once per batch */
+static void append_to_OperationLog(OperationLog* log, int kind, int value1, int value2)
 {
-    /* find if the product is exists in time tree */
-    AvlTree* node_to_del = find (ds->timeTree,time);
-    int quality;
+    unsigned char* record;
 
-    /*input check, if the product not exists return and do nothing*/
-    if(!node_to_del)
+    /* After a failure the log no longer matches the data structure, nothing more is recorded */
+    if (log->failed)
         return;
 
-    /* find the quality of the product */
-    quality = node_to_del->quality;
+    record = log->batch + sizeof(LogBatchHeader) + log->count * LOG_RECORD_BYTES;
+    record[0] = (unsigned char)kind;
+    memcpy(record + 1, &value1, sizeof(int));
+    memcpy(record + 1 + sizeof(int), &value2, sizeof(int));
+    log->sequence++;
 
-    /* delete product from time tree */
-    ds->timeTree = deleteNode(ds->timeTree,time);
+    /* Group commit: one write and one fsync for the whole batch */
+    if (log->count++ == 0)
+    {
+        if (log->interval_ns >= 0)
+            log->first_ns = monotonic_ns();
+    }
+    else if (log->interval_ns >= 0 && monotonic_ns() - log->first_ns >= log->interval_ns)
+    {
+        commit_OperationLog(log);
+        return;
+    }
+    if (log->count == log->batch_size)
+        commit_OperationLog(log);
+}
 
-    /* delete product from quality tree */
-    ds->qualityTree = deleteNode_in_QualityTree(ds->qualityTree,quality,time);
+/* Function to write the batch of a log to its file and sync it, returns 0, or -1 if the log failed */
+/*  Time O(batch_size), plus an fsync */
+static int commit_OperationLog(OperationLog* log)
+{
+    LogBatchHeader header;
+    size_t bytes = log_batch_bytes(log->count);
+    unsigned char* records = log->batch + sizeof(LogBatchHeader);
 
-    /* if the quality of the deleted  product is eqaul to our best quality and there is not any product with that quality, set the flag to false */
-    if(ds->best_quality==quality && find(ds->qualityTree,quality) == NULL)
-        ds->flag_best_quality=0;
+    if (log->failed)
+        return -1;
+    if (log->count == 0)
+        return 0;
 
+    /* Pad the records with zeros to whole words, the checksum covers the padding */
+    memset(records + log->count * LOG_RECORD_BYTES, 0, bytes - sizeof(LogBatchHeader) - log->count * LOG_RECORD_BYTES);
+    header.magic = LOG_BATCH_MAGIC;
+    header.count = (unsigned int)log->count;
+    header.first = log->sequence - log->count;
+    header.checksum = checksum_of_LogBatch(&header, records);
+    memcpy(log->batch, &header, sizeof(header));
+
+    if (fwrite(log->batch, 1, bytes, log->file) != bytes || fflush(log->file) != 0)
+        log->failed = 1;
+#ifdef __linux__
+    if (!log->failed && fsync(fileno(log->file)) != 0)
+        log->failed = 1;
+#endif
+
+    log->batches++;
+    log->records += (long)log->count;
+    log->count = 0;
+    return log->failed ? -1 : 0;
 }
 
-/* Remove all k (k = number of products that have quality input) products with the same quality input from the data structure */
-/*  Time O(k*log(n)) */
-void RemoveQuality(DataStructure* ds, int quality)
+/* Function to cut a log file down to its first bytes, kept holds those bytes for the systems without ftruncate.
+   file is the open log or NULL. Returns 0, or -1 on failure */
+/*  Time O(1), O(bytes) without ftruncate */
+static int truncate_log_file(const char* path, FILE* file, size_t bytes, const unsigned char* kept)
 {
-    /* find if the product is exists in quality tree */
-    AvlTree* node_to_del = find(ds->qualityTree,quality);
-    int time;
+#ifdef __linux__
+    int result;
+
+    (void)kept;
+    if (file != NULL)
+        return ftruncate(fileno(file), (off_t)bytes) == 0 && fsync(fileno(file)) == 0 ? 0 : -1;
+    file = fopen(path, "r+b");
+    if (file == NULL)
+        return -1;
+    result = ftruncate(fileno(file), (off_t)bytes) == 0 && fsync(fileno(file)) == 0 ? 0 : -1;
+    fclose(file);
+    return result;
+#else
+    /* Rewrite the file with the bytes to keep */
+    int result = 0;
+
+    if (file != NULL)
+        fclose(file);
+    file = fopen(path, "wb");
+    if (file == NULL)
+        return -1;
+    if (bytes > 0 && fwrite(kept, 1, bytes, file) != bytes)
+        result = -1;
+    if (fclose(file) != 0)
+        result = -1;
+    return result;
+#endif
+}
 
-    /*input check, if the product not exists return and do nothing, also because we use recreation  in this function this is also the stop case when we deleted all the products with the same quality input*/
-    if(!node_to_del)
-        return;
+/* Function to apply log records to a data structure. Consecutive additions, also across batches, are collected in
+   run and applied together with AddProductsBulk, which keeps the first product of every time like the AddProduct calls
+   it replaces. The additions left in run at the end are applied by the caller */
+/*  Time O(k*log(n)) for k records, less for long runs of additions */
+static void apply_log_records(DataStructure* ds, const unsigned char* records, size_t count, LogRun* run)
+{
+    size_t i;
+    int value1, value2;
 
-    /* if the quality of the deleted products with quality input is eqaul to the best quality , set the flag to false */
-    if(ds->best_quality==quality)
-        ds->flag_best_quality=0;
+    for (i = 0; i < count; i++, records += LOG_RECORD_BYTES)
+    {
+        memcpy(&value1, records + 1, sizeof(int));
+        memcpy(&value2, records + 1 + sizeof(int), sizeof(int));
+
+        if (records[0] == LOG_ADD_PRODUCT)
+        {
+            if (run->count == run->capacity)
+            {
+                run->capacity = run->capacity == 0 ? 1024 : 2 * run->capacity;
+                run->times = (int*)realloc(run->times, run->capacity * sizeof(int));
+                run->qualities = (int*)realloc(run->qualities, run->capacity * sizeof(int));
+                if (run->times == NULL || run->qualities == NULL)
+                {
+                    exit(1);
+                }
+            }
+            run->times[run->count] = value1;
+            run->qualities[run->count++] = value2;
+            continue;
+        }
 
-    /* find the time of the deleted product in time tree */
-    time= node_to_del->time;
+        /* Any other update ends the run of additions */
+        AddProductsBulk(ds, run->times, run->qualities, run->count);
+        run->count = 0;
+        if (records[0] == LOG_REMOVE_PRODUCT)
+            RemoveProduct(ds, value1);
+        else if (records[0] == LOG_REMOVE_QUALITY_RANGE)
+            RemoveQualityRange(ds, value1, value2);
+        else if (records[0] == LOG_REMOVE_TIME_RANGE)
+            RemoveTimeRange(ds, value1, value2);
+    }
+}
 
-    /* delete product from time tree */
-    ds->timeTree = deleteNode(ds->timeTree,time);
+/* Function to replay the batches of a log file into a data structure, returns the size of the valid batches.
+   The records numbered below sequence are already in the data structure and skipped, sequence is moved past the last record.
+   Replay stops at the first batch that is incomplete or fails its checksum, the end of a log cut by a crash */
+/*  Time O(k*log(n)) for k records */
+static size_t replay_log_file(DataStructure* ds, const unsigned char* bytes, size_t size, unsigned long long* sequence)
+{
+    LogBatchHeader header;
+    LogRun run = { NULL, NULL, 0, 0 };
+    size_t offset = 0, batch, skip;
 
-    /* delete product from quality tree */
-    ds->qualityTree = deleteNode_in_QualityTree(ds->qualityTree,quality,time);
+    while (size - offset >= sizeof(LogBatchHeader))
+    {
+        memcpy(&header, bytes + offset, sizeof(header));
+        if (header.magic != LOG_BATCH_MAGIC || header.count == 0 ||
+            header.count > (size - offset - sizeof(LogBatchHeader)) / LOG_RECORD_BYTES)
+            break;
+        batch = log_batch_bytes(header.count);
+        if (batch > size - offset || checksum_of_LogBatch(&header, bytes + offset + sizeof(LogBatchHeader)) != header.checksum)
+            break;
+
+        /* Skip the records a snapshot already holds */
+        skip = 0;
+        if (header.first < *sequence)
+            skip = *sequence - header.first < header.count ? (size_t)(*sequence - header.first) : header.count;
+        apply_log_records(ds, bytes + offset + sizeof(LogBatchHeader) + skip * LOG_RECORD_BYTES, header.count - skip, &run);
+        if (header.first + header.count > *sequence)
+            *sequence = header.first + header.count;
+        offset += batch;
+    }
+    AddProductsBulk(ds, run.times, run.qualities, run.count);
 
-    /* Recursively delete every product in quality tree with quality input */
-    RemoveQuality(ds,quality);
+    free(run.times);
+    free(run.qualities);
+    return offset;
 }
 
-/* Function to get the ith ranked product (ith smallest quality) in a binary search tree */
-/*  Time O(log(n)) */
-int GetIthRankProduct(DataStructure ds, int i)
+/* Recover a data structure and attach an operation log to it. The data structure should be empty: the snapshot, when
+   snapshot_path is given and the file exists, is added first, then the updates of the log made after it are replayed.
+   An incomplete batch at the end of the log is cut off. From then on every AddProduct, AddProductsBulk, RemoveProduct,
+   RemoveQuality(Range), RemoveTimeRange and ExpireBefore is appended to the log. The records are written in batches
+   with one fsync each (group commit), an update is durable once its batch is synced. Returns 0, or -1 on failure */
+/*  Time O(k*log(n)) for k replayed records, plus RestoreSnapshot */
+int OpenLog(DataStructure* ds, const char* path, const char* snapshot_path, const LogOptions* options)
 {
-    int size_left;
+    OperationLog* log;
+    FILE* file;
+    unsigned char* bytes = NULL;
+    unsigned long long sequence = 0;
+    size_t size = 0, capacity = 0, valid;
 
-    /* Input check: If the qualityTree is NULL, return -1 */
-    if(ds.qualityTree == NULL)
+    if (ds->log != NULL)
         return -1;
 
-    /* Input check: If i is less than or equal to 0, or greater than the size of the tree, return -1 */
-    if(i<=0 || sizeOfNode(ds.qualityTree) < i)
-        return -1;
+    /* A missing snapshot is an empty one, a damaged one is an error */
+    if (snapshot_path != NULL)
+    {
+        file = fopen(snapshot_path, "rb");
+        if (file != NULL)
+        {
+            fclose(file);
+            if (restore_Snapshot(snapshot_path, ds, &sequence) != 0)
+                return -1;
+        }
+    }
 
-    /* Calculate the size of the left subtree */
-    size_left = sizeOfNode(ds.qualityTree->left);
+    /* Read the whole log, a missing file is an empty log */
+    file = fopen(path, "rb");
+    if (file != NULL)
+    {
+        while (!feof(file))
+        {
+            if (size == capacity)
+            {
+                capacity = capacity == 0 ? 65536 : 2 * capacity;
+                bytes = (unsigned char*)realloc(bytes, capacity);
+                if (bytes == NULL)
+                {
+                    exit(1);
+                }
+            }
+            size += fread(bytes + size, 1, capacity - size, file);
+            if (ferror(file))
+            {
+                fclose(file);
+                free(bytes);
+                return -1;
+            }
+        }
+        fclose(file);
+    }
+
+    /* Replay it with no log attached, then drop the end of a batch cut by a crash so new batches follow valid ones */
+    valid = replay_log_file(ds, bytes, size, &sequence);
+    if (valid < size && truncate_log_file(path, NULL, valid, bytes) != 0)
+    {
+        free(bytes);
+        return -1;
+    }
+    free(bytes);
 
-    /* If the current node is the ith ranked product, return its time */
-    if(size_left + 1 == i)
-        return ds.qualityTree->time;
+    file = fopen(path, "ab");
+    if (file == NULL)
+        return -1;
 
-    /* If the ith ranked product is in the left subtree, recursively search in the left subtree */
-    if(size_left + 1 > i)
+    log = (OperationLog*)malloc(sizeof(OperationLog));
+    if (log == NULL)
+    {
+        exit(1);
+    }
+    log->file = file;
+    log->sequence = sequence;
+    log->batch_size = options != NULL && options->batch_size > 0 ? options->batch_size : LOG_DEFAULT_BATCH;
+    log->interval_ns = (options != NULL && options->interval_ms != 0 ? options->interval_ms : LOG_DEFAULT_INTERVAL_MS) * 1000000LL;
+    log->count = 0;
+    log->first_ns = 0;
+    log->batches = 0;
+    log->records = 0;
+    log->failed = 0;
+    log->path = (char*)malloc(strlen(path) + 1);
+    log->snapshot_path = NULL;
+    log->batch = (unsigned char*)malloc(log_batch_bytes(log->batch_size));
+    if (log->path == NULL || log->batch == NULL)
+    {
+        exit(1);
+    }
+    strcpy(log->path, path);
+    if (snapshot_path != NULL)
     {
-        ds.qualityTree = ds.qualityTree ->left;
-        return GetIthRankProduct(ds, i);
+        log->snapshot_path = (char*)malloc(strlen(snapshot_path) + 1);
+        if (log->snapshot_path == NULL)
+        {
+            exit(1);
+        }
+        strcpy(log->snapshot_path, snapshot_path);
     }
 
-    /* If the ith ranked product is in the right subtree, recursively search in the right subtree */
-    ds.qualityTree = ds.qualityTree ->right;
-    return GetIthRankProduct(ds, i - size_left - 1);
+    ds->log = log;
+    return 0;
 }
 
-/* Function to get the ith ranked product (ith smallest quality) between two times in a binary search tree */
-/*  Time O(i*log(n)) , Space O(n)*/
-int GetIthRankProductBetween(DataStructure ds, int time1, int time2, int i)
+/* Write and sync the records of the log not yet synced, for example when the updates stop for a while.
+   Returns 0, or -1 if a write or a sync of the log ever failed */
+/*  Time O(batch_size), plus an fsync */
+int SyncLog(DataStructure* ds)
 {
-    AvlTree** container_of_nodes;
-    int * quality_of_nodes;
-    int max_quality;
+    if (ds->log == NULL)
+        return -1;
+    return commit_OperationLog(ds->log);
+}
 
-    AvlTree* LCA;
-    AvlTree* one_rank_product ,* Ith_Rank_Product;
-    int j;
+/* Get the number of ms left until the oldest record not yet synced is interval_ms old, 0 if it already is, or -1 if no record
+   is pending, the interval is disabled or no log is attached. The interval is only checked when an update arrives, so a caller
+   that needs it as a bound when the updates pause must call SyncLog by then (a timer or its event loop) */
+/*  Time O(1) */
+long LogNextDeadlineMs(const DataStructure* ds)
+{
+    OperationLog* log = ds->log;
+    long long left;
 
-    /* Input check: If the tree is empty, return -1 */
-    if(ds.timeTree == NULL)
+    if (log == NULL || log->failed || log->count == 0 || log->interval_ns < 0)
         return -1;
+    left = log->first_ns + log->interval_ns - monotonic_ns();
+    return left > 0 ? (long)(left / 1000000) : 0;
+}
+
+/* Save a snapshot of the data structure to the snapshot path given to OpenLog and empty the log, whose updates the snapshot
+   now holds. The snapshot stores the sequence number of the next record, so after a crash between the two steps the
+   records it already holds are skipped by the replay. Returns 0, or -1 on failure */
+/*  Time O(n) */
+int CheckpointLog(DataStructure* ds)
+{
+    OperationLog* log = ds->log;
 
-    /* Input check: If i is less than or equal to 0, return -1 */
-    if(i<=0)
+    if (log == NULL || log->snapshot_path == NULL || commit_OperationLog(log) != 0)
+        return -1;
+    if (SaveSnapshot(*ds, log->snapshot_path) != 0)
         return -1;
 
-    /* Input check: If time1 is not found in the timeTree, update time1 to its successor */
-    if(find(ds.timeTree,time1) == NULL)
+    /* Without ftruncate the file is reopened empty */
+    if (truncate_log_file(log->path, log->file, 0, NULL) != 0)
     {
-        time1 = successor(ds.timeTree,time1)->key;
+        log->failed = 1;
+        return -1;
     }
-    /* Input check: If time2 is not found in the timeTree, update time2 to its predecessor */
-    if(find(ds.timeTree,time2) == NULL)
+#ifndef __linux__
+    log->file = fopen(log->path, "ab");
+    if (log->file == NULL)
     {
-        time2 = predecessor(ds.timeTree,time2)->key;
+        exit(1);
     }
+#endif
+    return 0;
+}
 
-    /* Find the Lowest Common Ancestor (LCA) of time1 and time2 in the timeTree */
-    LCA = findLCA(ds.timeTree,time1,time2);
+/* Sync and detach the log of a data structure. Returns 0, or -1 if a write or a sync of the log ever failed */
+/*  Time O(batch_size), plus an fsync */
+int CloseLog(DataStructure* ds)
+{
+    OperationLog* log = ds->log;
+    int result;
 
-    /* Input check: If the size of the range in the tree is less than i, return -1 */
-    if(size_of_range_in_tree(LCA,time1,time2) < i)
+    if (log == NULL)
         return -1;
 
-    /* get the max quality of the tree and add 1 */
-    max_quality = maxQualityInTree(ds.qualityTree) + 1;
+    result = commit_OperationLog(log);
+    if (fclose(log->file) != 0)
+        result = -1;
+    free(log->batch);
+    free(log->path);
+    free(log->snapshot_path);
+    free(log);
+    ds->log = NULL;
+    return result;
+}
 
-    /* Allocate memory for an array of pointers to nodes and an array of quality values */
-    container_of_nodes = (AvlTree**)malloc(i*sizeof(AvlTree*));
-    quality_of_nodes = (int*)malloc(i*sizeof(int));
 
-    /* Find the worst ranked product i-1 times */
-    for(j=0;j<i-1;j++)
-    {
-        /* Get the worst ranked product between time1 and time2 */
-        one_rank_product = GetOneRankProductBetween(LCA,time1,time2);
+/*************************************************/
 
-        /* Store the worst ranked product and its quality in the arrays */
-        container_of_nodes[j]=one_rank_product;
-        quality_of_nodes[j]=one_rank_product->quality;
+/* Aggregates of the qualities of the products of a time range */
+typedef struct QualityAggregate
+{
+    int count;                                  /* Number of products */
+    long long sum;                              /* Sum of the qualities */
+    double squared_deviations;                  /* Sum of the squared deviations of the qualities from their mean */
+    int max;                                    /* Best (highest) quality, INT_MIN if there is no product */
+} QualityAggregate;
 
-        /* Set the quality of the worst ranked product to max_quality */
-        one_rank_product->quality=max_quality;
+static void add_node_to_QualityAggregate(QualityAggregate* aggregate, AvlTree* node);
+static void add_subtree_to_QualityAggregate(QualityAggregate* aggregate, AvlTree* tree);
+static void aggregate_between(AvlTree* tree, int time1, int time2, QualityAggregate* aggregate);
 
-        /* Fix the worst quality pointers in timeTree */
-        fix_worst_quality(ds.timeTree,one_rank_product->key);
+/* Function to add one product to an aggregate */
+/*  Time O(1) */
+static void add_node_to_QualityAggregate(QualityAggregate* aggregate, AvlTree* node)
+{
+    /* A product removed in lazy delete mode is not counted */
+    if (!node->alive)
+        return;
 
-    }
-    /* Get the ith ranked product between time1 and time2 */
-    Ith_Rank_Product = GetOneRankProductBetween(LCA,time1,time2);
+    aggregate->squared_deviations = merge_squared_deviations(aggregate->squared_deviations, aggregate->sum, aggregate->count, 0, node->quality, 1);
+    aggregate->count++;
+    aggregate->sum += node->quality;
+    if (node->quality > aggregate->max)
+        aggregate->max = node->quality;
+}
 
-    /* Restore the qualities of the previously changed nodes */
-    for(j=0;j<i-1;j++)
+/* Function to add every product of a time subtree to an aggregate, from the augmentations of its root with AVL_AGGREGATES,
+   by visiting the subtree otherwise */
+/*  Time O(1) with AVL_AGGREGATES, O(size of the subtree) otherwise */
+static void add_subtree_to_QualityAggregate(QualityAggregate* aggregate, AvlTree* tree)
+{
+    if (tree == NULL)
+        return;
+#ifdef AVL_AGGREGATES
+    aggregate->squared_deviations = merge_squared_deviations(aggregate->squared_deviations, aggregate->sum, aggregate->count,
+                                                             tree->squared_deviations, tree->sum_quality, tree->size);
+    aggregate->count += tree->size;
+    aggregate->sum += tree->sum_quality;
+    if (tree->max_quality > aggregate->max)
+        aggregate->max = tree->max_quality;
+#else
+    add_subtree_to_QualityAggregate(aggregate, tree->left);
+    add_node_to_QualityAggregate(aggregate, tree);
+    add_subtree_to_QualityAggregate(aggregate, tree->right);
+#endif
+}
+
+/* Function to aggregate the qualities of the products with a time between time1 and time2 (inclusive).
+   Below the LCA of the range, the path to time1 adds the nodes it passes on their left and their right subtrees,
+   and the path to time2 the mirror, like size_of_range_in_tree */
+/*  Time O(log(n)) with AVL_AGGREGATES, O(log(n) + k) otherwise, k the number of products in the range */
+static void aggregate_between(AvlTree* tree, int time1, int time2, QualityAggregate* aggregate)
+{
+    AvlTree* LCA;
+
+    aggregate->count = 0;
+    aggregate->sum = 0;
+    aggregate->squared_deviations = 0;
+    aggregate->max = INT_MIN;
+
+    /* Input check: an empty range holds no product */
+    if (time1 > time2)
+        return;
+    LCA = findLCA(tree, time1, time2);
+    if (LCA == NULL)
+        return;
+    add_node_to_QualityAggregate(aggregate, LCA);
+
+    for (tree = LCA->left; tree != NULL; )
+    {
+        if (tree->time >= time1)
+        {
+            add_node_to_QualityAggregate(aggregate, tree);
+            add_subtree_to_QualityAggregate(aggregate, tree->right);
+            tree = tree->left;
+        }
+        else
+            tree = tree->right;
+    }
+    for (tree = LCA->right; tree != NULL; )
     {
-        container_of_nodes[j]->quality=quality_of_nodes[j];
-        fix_worst_quality(ds.timeTree,container_of_nodes[j]->key);
+        if (tree->time <= time2)
+        {
+            add_node_to_QualityAggregate(aggregate, tree);
+            add_subtree_to_QualityAggregate(aggregate, tree->left);
+            tree = tree->right;
+        }
+        else
+            tree = tree->left;
     }
+}
 
-    /* Free the memory allocated for the arrays */
-    free(container_of_nodes);
-    free(quality_of_nodes);
+/* Function to count the products with a time between time1 and time2 (inclusive) */
+/*  Time O(log(n)) */
+int CountBetween(DataStructure ds, int time1, int time2)
+{
+    AvlTree* LCA;
 
-    /* Return the time of the ith ranked product */
-    return Ith_Rank_Product->key;
+    /* Input check: an empty range holds no product */
+    if (time1 > time2)
+        return 0;
 
+    LCA = findLCA(ds.timeTree, time1, time2);
+    if (LCA == NULL)
+        return 0;
+    return size_of_range_in_tree(LCA, time1, time2);
 }
 
-/* Function to check if a flag indicating the existence of the best quality is set in the DataStructure */
-/*  Time O(1) */
-int Exists(DataStructure ds)
+/* Function to get the sum of the qualities of the products with a time between time1 and time2 (inclusive) */
+/*  Time O(log(n)) with AVL_AGGREGATES, O(log(n) + k) otherwise, k the number of products in the range */
+long long SumQualityBetween(DataStructure ds, int time1, int time2)
 {
-    /* Return the value of the flag indicating the existence of the best quality */
-    return ds.flag_best_quality;
+    QualityAggregate aggregate;
+
+    aggregate_between(ds.timeTree, time1, time2, &aggregate);
+    return aggregate.sum;
+}
+
+/* Function to get the average quality of the products with a time between time1 and time2 (inclusive), 0 if there is none */
+/*  Time O(log(n)) with AVL_AGGREGATES, O(log(n) + k) otherwise, k the number of products in the range */
+double AvgQualityBetween(DataStructure ds, int time1, int time2)
+{
+    QualityAggregate aggregate;
+
+    aggregate_between(ds.timeTree, time1, time2, &aggregate);
+    if (aggregate.count == 0)
+        return 0;
+    return (double)aggregate.sum / aggregate.count;
 }
 
+/* Function to get the standard deviation of the qualities of the products with a time between time1 and time2 (inclusive), 0 if there is none */
+/*  Time O(log(n)) with AVL_AGGREGATES, O(log(n) + k) otherwise, k the number of products in the range */
+double StddevQualityBetween(DataStructure ds, int time1, int time2)
+{
+    QualityAggregate aggregate;
+
+    aggregate_between(ds.timeTree, time1, time2, &aggregate);
+    if (aggregate.count == 0)
+        return 0;
+
+    /* Population variance, the squared deviations merged along the range over the count */
+    return sqrt(aggregate.squared_deviations / aggregate.count);
+}
 
-int main()
+/* Function to get the best (highest) quality of the products with a time between time1 and time2 (inclusive), INT_MIN if there is none */
+/*  Time O(log(n)) with AVL_AGGREGATES, O(log(n) + k) otherwise, k the number of products in the range */
+int MaxQualityBetween(DataStructure ds, int time1, int time2)
 {
-    DataStructure ds = Init(11) // initializes an empty data structure
-    AddProduct(&ds, 4, 11) // Adds a product at time t=4 and quality q=11
-    AddProduct(&ds, 6, 12) // Adds a product at time t=6 and quality q=12
-    AddProduct(&ds, 2, 13) // Adds a product at time t=2 and quality q=13
-    AddProduct(&ds, 1, 14) // Adds a product at time t=1 and quality q=14
-    AddProduct(&ds, 3, 15) // Adds a product at time t=3 and quality q=15
-    AddProduct(&ds, 5, 17) // Adds a product at time t=5 and quality q=17
-    AddProduct(&ds, 7, 17) // Adds a product at time t=7 and quality q=17
-    GetIthRankProduct(ds, 1) //The i=1 best product has time t=4 and quality q=11,returns 4
-    GetIthRankProduct(ds, 2) //The i=2 best product has time t=6 and quality q=12,returns 6
-    GetIthRankProduct(ds, 6) //The i=”6 best product” has time t=5 and quality q=17,returns 5
-    GetIthRankProduct(ds, 7) //The i=”7 best product” has time t=7 and quality q=17,returns 7
-    GetIthRankBetween(ds, 2, 6, 3) // looks at values with time {2,3,4,5,6} and returns the i=”3 best product” between them, which has time t=2.
-    Exists(ds) // returns 1, since there exists a product with quality q=s=11
-    RemoveProduct(&ds, 4) // removes product with time t=4 from the data structure
-    Exists(ds) // returns 0, since there is no product with quality q=s=11
+    QualityAggregate aggregate;
 
-    return 0;
+    aggregate_between(ds.timeTree, time1, time2, &aggregate);
+    return aggregate.max;
 }
@@ -0,0 +1,443 @@
+#ifndef AVL_H
+#define AVL_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define BPLUS_ORDER 16                          /* Maximum number of entries of a B+ tree node, every key array fills one cache line */
+
+typedef struct NodeSlab
+{
+    struct NodeSlab* next;          /* Pointer to the previously allocated slab of the pool */
+    size_t bytes;                   /* Number of bytes of the slab including this header */
+    int mapped;                     /* 1 if the slab was mapped with mmap, 0 if it was allocated with malloc */
+} NodeSlab;
+
+typedef struct NodePool
+{
+    size_t object_size;             /* Size of one node handed out by the pool */
+    int huge_pages;                 /* 1 if new slabs should be backed by huge pages */
+
+    NodeSlab* slabs;                /* List of every slab of the pool */
+    char* next_unused;              /* Next never used node in the newest slab */
+    char* slab_end;                 /* End of the newest slab */
+    void* free_list;                /* List of released nodes, linked through their first bytes */
+
+    long hits;                      /* Allocations served from the free list */
+    long misses;                    /* Allocations served from fresh slab memory */
+    long slab_count;                /* Number of slabs of the pool */
+    long in_use;                    /* Number of nodes currently handed out */
+    size_t bytes;                   /* Number of bytes held by the slabs */
+} NodePool;
+
+
+typedef struct AvlTree
+{
+    int time;                       /* Time value of the product, the key of the time tree */
+    int quality;                    /* Quality value of the product, the key (with time) of the quality tree */
+
+    /* Links of the node in the time tree */
+    int height;                     /* Height of the node in the AVL time tree, its rank with the WAVL and red-black schemes */
+    int size;                       /* Number of alive products in the time subtree rooted at this node */
+    struct AvlTree* left;           /* Pointer to the left child of the node */
+    struct AvlTree* right;          /* Pointer to the right child of the node */
+    struct AvlTree* worst_quality;  /* Pointer to the node with the worst quality in the time subtree rooted at this node */
+#ifdef AVL_AGGREGATES
+    /* Quality aggregates of the time subtree, only with AVL_AGGREGATES (the library and its users must agree on it) */
+    long long sum_quality;          /* Sum of the qualities of the time subtree rooted at this node */
+    double squared_deviations;      /* Sum of the squared deviations of the qualities from their mean in the time subtree rooted at this node */
+    int max_quality;                /* Best (highest) quality of the time subtree rooted at this node */
+#endif
+    short alive;                    /* 0 once the product was removed in lazy delete mode, the node is then kept only for the shape */
+
+    /* Links of the node in the quality tree */
+    short q_height;                 /* Height of the node in the AVL quality tree */
+    int q_size;                     /* Number of alive products in the quality subtree rooted at this node */
+    struct AvlTree* q_left;         /* Pointer to the left child of the node in the quality tree */
+    struct AvlTree* q_right;        /* Pointer to the right child of the node in the quality tree */
+
+} AvlTree;
+
+typedef struct RankTimeNode
+{
+    int time;                       /* Time value of a product stored in the owning rank subtree */
+    int height;                     /* Height of the node in the inner AVL tree */
+    int size;                       /* Number of alive times in the inner subtree rooted at this node */
+    int alive;                      /* 0 once the product of the time was removed, the node is then kept only for the shape */
+
+    struct RankTimeNode* left;      /* Pointer to the left child of the node */
+    struct RankTimeNode* right;     /* Pointer to the right child of the node */
+
+} RankTimeNode;
+
+typedef struct RankTree
+{
+    int time;                       /* Time value of the product */
+    int quality;                    /* Quality value of the product, the tree is sorted by (quality, time) */
+    int alive;                      /* 0 once the product was removed, the node is then kept only for the shape */
+    int size;                       /* Number of nodes (alive or not) in the subtree, keeps the tree weight balanced */
+
+    struct RankTree* left;          /* Pointer to the left child of the node */
+    struct RankTree* right;         /* Pointer to the right child of the node */
+
+    RankTimeNode* times;            /* AVL tree of the times of the products in the subtree rooted at this node, removed ones are marked */
+
+} RankTree;
+
+typedef struct RankIndex
+{
+    RankTree* root;                 /* Root of the weight balanced tree sorted by quality */
+    int alive;                      /* Number of products in the index */
+    int dead;                       /* Number of removed products still kept as nodes in the tree */
+    NodePool rankPool;              /* Allocator of the RankTree nodes */
+    NodePool timePool;              /* Allocator of the RankTimeNode nodes of the inner trees */
+} RankIndex;
+
+typedef union BPlusSlot
+{
+    struct BPlusNode* child;        /* Child of an internal node */
+    AvlTree* product;               /* Node of a product stored in a leaf */
+} BPlusSlot;
+
+typedef struct BPlusNode
+{
+    int count;                      /* Number of entries of the node */
+    int leaf;                       /* 1 for a leaf, 0 for an internal node */
+    int qualities[BPLUS_ORDER];     /* Leaf: quality of every product, internal: quality of a key above the previous child and at most the first key of the child */
+    int times[BPLUS_ORDER];         /* Leaf: time of every product, internal: time of that separator key, the one of the first child is not read */
+    int sizes[BPLUS_ORDER];         /* Number of products below every entry, 1 in a leaf */
+    BPlusSlot slots[BPLUS_ORDER];   /* Leaf: the products, internal: the children */
+    struct BPlusNode* next;         /* Next leaf in (quality, time) order */
+} BPlusNode;
+
+typedef struct BPlusTree
+{
+    BPlusNode* root;                /* Root of the B+ tree sorted by (quality, time) */
+    int size;                       /* Number of products in the tree */
+    NodePool pool;                  /* Allocator of the BPlusNode nodes */
+} BPlusTree;
+
+typedef struct QualitySlot
+{
+    int quality;                    /* Quality of the slot */
+    int count;                      /* Number of products with the quality, 0 for an empty slot */
+} QualitySlot;
+
+typedef struct QualityHistogram
+{
+    QualitySlot* slots;             /* Open addressing table with linear probing, NULL until the first product */
+    size_t capacity;                /* Number of slots, a power of two */
+    size_t used;                    /* Number of distinct qualities in the table */
+    int shift;                      /* 64 - log2(capacity), the hash of a quality keeps the top bits of its product */
+} QualityHistogram;
+
+typedef struct TimeSlot
+{
+    int time;                       /* Time of the product of the slot */
+    AvlTree* node;                  /* Node of the product, NULL for an empty slot */
+} TimeSlot;
+
+typedef struct TimeIndex
+{
+    TimeSlot* slots;                /* Open addressing table with linear probing, NULL until the first product */
+    size_t capacity;                /* Number of slots, a power of two */
+    size_t used;                    /* Number of products in the table */
+    int shift;                      /* 64 - log2(capacity), the hash of a time keeps the top bits of its product */
+} TimeIndex;
+
+/*************************************************/
+
+#define QUALITY_INDEX_AVL 0         /* the products are ordered by quality in the AVL quality tree */
+#define QUALITY_INDEX_BPLUS 1       /* the products are ordered by quality in a B+ tree with subtree counts */
+
+#define BALANCE_AVL 0               /* the time tree is an AVL tree, a deletion may rotate all the way up */
+#define BALANCE_WAVL 1              /* the time tree is a weak AVL tree, at most two rotations per deletion */
+#define BALANCE_RED_BLACK 2         /* the time tree is a red-black tree, kept as ranks with rank differences 0 (red) or 1 */
+#define BALANCE_TREAP 3             /* the time tree is a treap with priorities hashed from the times, updated by split and join */
+
+/* Options of a data structure, a zeroed struct gives the defaults of Init */
+typedef struct InitOptions
+{
+    int huge_pages;                 /* back the node slabs with huge pages when the system allows it */
+    int lazy_free;                  /* nodes removed by RemoveTimeRange are freed a few at a time by the next updates */
+    int quality_index;              /* QUALITY_INDEX_AVL or QUALITY_INDEX_BPLUS */
+    int time_index;                 /* keep a hash index from time to node, the lookups of a time take O(1) */
+    int lazy_delete;                /* RemoveProduct only marks the product removed, the trees are rebuilt once enough products are removed */
+    int balance;                    /* BALANCE_AVL, BALANCE_WAVL, BALANCE_RED_BLACK or BALANCE_TREAP, the balancing scheme of the time tree */
+    int rank_index;                 /* keep the rank index, the rank queries in a time range take O(log^2(n)) but every update O(log^2(n)) amortized */
+} InitOptions;
+
+/* Counters of the node allocators of a data structure */
+typedef struct AllocatorStats
+{
+    long hits;                      /* node allocations served from a free list */
+    long misses;                    /* node allocations served from fresh slab memory */
+    long slabs;                     /* number of slabs held */
+    long nodes_in_use;              /* number of nodes currently allocated */
+    size_t bytes;                   /* number of bytes held by the slabs */
+} AllocatorStats;
+
+/* Kinds of operations counted by the statistics, the index of their counters in Stats */
+#define STATS_ADD_PRODUCT 0             /* AddProduct */
+#define STATS_ADD_PRODUCTS_BULK 1       /* AddProductsBulk */
+#define STATS_REMOVE_PRODUCT 2          /* RemoveProduct */
+#define STATS_REMOVE_QUALITY 3          /* RemoveQuality and RemoveQualityRange */
+#define STATS_REMOVE_TIME_RANGE 4       /* RemoveTimeRange and ExpireBefore */
+#define STATS_GET_ITH_RANK 5            /* GetIthRankProduct */
+#define STATS_GET_ITH_RANK_BETWEEN 6    /* GetIthRankProductBetween */
+#define STATS_GET_ITH_RANKS 7           /* GetIthRankProducts */
+#define STATS_OPERATIONS 8              /* Number of kinds of operations */
+#define STATS_LATENCY_BUCKETS 32        /* Bucket b of a latency histogram counts the calls that took [2^b, 2^(b+1)) ns */
+
+/* Counters of one kind of operation */
+typedef struct OperationStats
+{
+    long calls;                         /* number of calls */
+    long nodes_visited;                 /* nodes read by the descents of the trees and indexes */
+    long rotations;                     /* rotations of the time and quality trees */
+    long node_updates;                  /* calls to update_Node_Variables and update_Quality_Node_Variables */
+    long allocations;                   /* nodes allocated from the pools */
+    long total_ns;                      /* time spent in the calls */
+    long latency[STATS_LATENCY_BUCKETS]; /* histogram of the latency of the calls, in powers of two of ns */
+} OperationStats;
+
+/* Counters of every kind of operation since Init or ResetStats, and gauges of the shape of the data structure.
+   The counters are only kept when the library is built with AVL_STATS, otherwise they are zero */
+typedef struct Stats
+{
+    OperationStats operations[STATS_OPERATIONS]; /* counters of every kind of operation, indexed by STATS_ADD_PRODUCT... */
+    int time_tree_height;               /* height of the time tree */
+    int quality_index_height;           /* height of the quality tree, or number of levels of the B+ tree */
+    long products;                      /* number of products */
+    size_t bytes_in_use;                /* bytes of the nodes currently allocated */
+    size_t bytes_reserved;              /* bytes held by the slabs of the pools */
+} Stats;
+
+/* Kinds of updates recorded by the operation log */
+#define LOG_ADD_PRODUCT 1               /* AddProduct(time, quality), AddProductsBulk records one per product */
+#define LOG_REMOVE_PRODUCT 2            /* RemoveProduct(time) */
+#define LOG_REMOVE_QUALITY_RANGE 3      /* RemoveQualityRange(quality1, quality2) and RemoveQuality */
+#define LOG_REMOVE_TIME_RANGE 4         /* RemoveTimeRange(time1, time2) and ExpireBefore */
+
+/* Group commit settings of an operation log, a zeroed struct gives the defaults */
+typedef struct LogOptions
+{
+    size_t batch_size;              /* records per batch, a full batch is written and synced, default 256 */
+    long interval_ms;               /* an update arriving this long after the oldest unsynced one syncs the batch, default 10, negative for none.
+                                       Without a later update, the caller syncs by LogNextDeadlineMs */
+} LogOptions;
+
+/* Header of a batch of the log file, followed by count records of 9 bytes (kind, two ints) padded to 8 bytes */
+typedef struct LogBatchHeader
+{
+    unsigned int magic;             /* "AVLL" */
+    unsigned int count;             /* Number of records of the batch */
+    unsigned long long first;       /* Sequence number of the first record, the records of a log are numbered from 0 */
+    unsigned long long checksum;    /* Checksum of the padded records, seeded with count and first */
+} LogBatchHeader;
+
+/* Append only log of the updates of a data structure. Records are kept in a batch and written with one fsync */
+typedef struct OperationLog
+{
+    FILE* file;                     /* The log file, opened for appending */
+    char* path;                     /* Path of the log file */
+    char* snapshot_path;            /* Path of the snapshot written by CheckpointLog, NULL if there is none */
+    unsigned long long sequence;    /* Sequence number of the next record, kept across checkpoints */
+    unsigned char* batch;           /* LogBatchHeader followed by the records not yet written */
+    size_t count;                   /* Number of records in the batch */
+    size_t batch_size;              /* Number of records that fills a batch */
+    long long interval_ns;          /* Age of the oldest record that forces a sync, negative for none */
+    long long first_ns;             /* Monotonic time of the oldest record of the batch */
+    long batches;                   /* Number of batches written */
+    long records;                   /* Number of records written */
+    int failed;                     /* 1 once a write or a sync failed, the later records are dropped */
+} OperationLog;
+
+/* Node pool and indexes of a data structure. They are kept behind one pointer, so the copy of a DataStructure
+   that every query takes by value stays small */
+typedef struct DataStructureState
+{
+    NodePool nodePool;              /* Allocator of the nodes of timeTree and qualityTree */
+    BPlusTree qualityBPlus;         /* B+ tree sorted by quality, used instead of qualityTree with QUALITY_INDEX_BPLUS */
+    RankIndex rankIndex;            /* Products sorted by quality with the times of every subtree, answers range rank queries */
+    QualityHistogram histogram;     /* Number of products of every quality */
+    TimeIndex timeIndex;            /* Node of every time, kept only if time_index is 1 */
+} DataStructureState;
+
+/* Initialize a data structure */
+typedef struct DataStructure
+{
+    int best_quality;               /* save the best quality in the data structure */
+    int flag_best_quality;          /* flag if there is a quality with the same value as the best quality */
+    AvlTree* timeTree;              /* Avl tree sorted by time */
+    AvlTree* rightmost;             /* Node with the largest time, a larger time is appended along the right spine, NULL until it is looked up again */
+    int balance;                    /* Balancing scheme of the time tree, BALANCE_AVL... */
+    AvlTree* qualityTree;           /* Avl tree sorted by quality */
+    int quality_index;              /* QUALITY_INDEX_AVL or QUALITY_INDEX_BPLUS */
+    int rank_index;                 /* 1 if the rank index is kept */
+    int time_index;                 /* 1 if the time index is kept */
+    int lazy_delete;                /* 1 if RemoveProduct only marks the products removed */
+    int dead;                       /* Number of removed products still kept as nodes in the trees */
+    int lazy_free;                  /* 1 if removed time ranges are freed lazily */
+    AvlTree* detached;              /* Stack of detached time subtrees waiting to be freed, linked through q_left */
+    DataStructureState* state;      /* Node pool and indexes, allocated by Init and shared by every copy of the data structure */
+    Stats* stats;                   /* Counters of the operations, allocated by Init with AVL_STATS and NULL otherwise */
+    OperationLog* log;              /* Log the updates are recorded in, attached by OpenLog and NULL otherwise */
+} DataStructure;
+
+/* A time range of a RangeBestIterator with the product of the lowest (quality, time) in it */
+typedef struct RangeBestEntry
+{
+    AvlTree* product;               /* Product with the lowest (quality, time) between time1 and time2 */
+    AvlTree* LCA;                   /* Lowest common ancestor of the range in the time tree, its subtree holds the range */
+    int time1;                      /* First time of the range */
+    int time2;                      /* Last time of the range */
+} RangeBestEntry;
+
+/* Cursor over the products between two times in rank order (lowest quality first). It only reads the time tree,
+   an update of the data structure invalidates it */
+typedef struct RangeBestIterator
+{
+    AvlTree* timeTree;              /* Time tree of the data structure */
+    RangeBestEntry* heap;           /* Binary min heap of the ranges not yet returned, by (quality, time) of their product */
+    size_t count;                   /* Number of ranges in the heap */
+    size_t capacity;                /* Number of ranges the heap can hold */
+} RangeBestIterator;
+
+/* Time tree part of a product in the compact format, 24 bytes */
+typedef struct CompactNode
+{
+    int time;                           /* Time value of the product, the key of the time tree */
+    int quality;                        /* Quality value of the product */
+    unsigned int left;                  /* Index of the left child in the time tree */
+    unsigned int right;                 /* Index of the right child in the time tree */
+    unsigned int worst_quality;         /* Index of the product with the worst quality in the time subtree */
+    int size;                           /* Size of the time subtree rooted at this node */
+} CompactNode;
+
+/* Quality tree part of a product in the compact format, 12 bytes */
+typedef struct CompactQualityNode
+{
+    unsigned int q_left;                /* Index of the left child in the quality tree */
+    unsigned int q_right;               /* Index of the right child in the quality tree */
+    int q_size;                         /* Size of the quality subtree rooted at this node */
+} CompactQualityNode;
+
+/* A data structure with the same two trees as DataStructure, its products are records of parallel arrays addressed by 32 bit indices.
+   The heights are kept in byte arrays next to the records, only the updates read them */
+typedef struct CompactDataStructure
+{
+    int best_quality;                   /* save the best quality in the data structure */
+    int flag_best_quality;              /* flag if there is a quality with the same value as the best quality */
+    unsigned int timeRoot;              /* Index of the root of the time tree */
+    unsigned int qualityRoot;           /* Index of the root of the quality tree */
+
+    CompactNode* nodes;                 /* Time tree records, record 0 is the empty sentinel */
+    CompactQualityNode* q_nodes;        /* Quality tree records of the same products */
+    unsigned char* heights;             /* Height of every record in the time tree, 0 for the sentinel */
+    unsigned char* q_heights;           /* Height of every record in the quality tree, 0 for the sentinel */
+    unsigned int capacity;              /* Number of records the arrays can hold */
+    unsigned int used;                  /* Number of records ever handed out, including the sentinel */
+    unsigned int free_list;             /* Released records, linked through their left index */
+    void* mapping;                      /* Snapshot file the arrays point into when loaded by LoadSnapshot, NULL otherwise */
+    size_t mapping_bytes;               /* Size of the mapping */
+} CompactDataStructure;
+
+#define SNAPSHOT_VERSION 2              /* Version of the snapshot layout written by SaveSnapshot */
+#define SNAPSHOT_ALIGN 64               /* Every section of a snapshot starts on a multiple of this offset */
+
+/* First bytes of a snapshot file. The file holds the arrays of a CompactDataStructure at the given offsets,
+   the trees link their records by index so the file can be mapped at any address */
+typedef struct SnapshotHeader
+{
+    char magic[8];                      /* "AVLSNAP" */
+    unsigned int version;               /* SNAPSHOT_VERSION */
+    unsigned int byte_order;            /* 0x01020304 in the byte order of the machine that saved the file */
+    unsigned int node_bytes;            /* sizeof(CompactNode) */
+    unsigned int q_node_bytes;          /* sizeof(CompactQualityNode) */
+    unsigned long long file_bytes;      /* Size of the file */
+    unsigned long long checksum;        /* Checksum of the whole file computed with this field set to 0 */
+
+    int best_quality;                   /* best_quality of the data structure */
+    int flag_best_quality;              /* flag_best_quality of the data structure */
+    unsigned int timeRoot;              /* Index of the root of the time tree */
+    unsigned int qualityRoot;           /* Index of the root of the quality tree */
+    unsigned int used;                  /* Number of records of every array, including the sentinel */
+    unsigned int free_list;             /* Released records, linked through their left index */
+
+    unsigned long long nodes_offset;    /* Offset of the CompactNode array */
+    unsigned long long q_nodes_offset;  /* Offset of the CompactQualityNode array */
+    unsigned long long heights_offset;  /* Offset of the time tree heights */
+    unsigned long long q_heights_offset; /* Offset of the quality tree heights */
+    unsigned long long log_sequence;    /* Number of logged updates the snapshot holds, 0 without a log */
+} SnapshotHeader;
+
+
+/***** functions *****/
+/* Node allocator, shared by ConcurrentAVL.c and the data structures of AVLGeneric.h */
+void init_NodePool(NodePool* pool, size_t object_size, int huge_pages);
+void* alloc_from_NodePool(NodePool* pool);
+void free_to_NodePool(NodePool* pool, void* node);
+void destroy_NodePool(NodePool* pool);
+
+DataStructure Init(int s);
+DataStructure InitWithOptions(int s, const InitOptions* options);
+void Destroy(DataStructure* ds);
+void GetAllocatorStats(DataStructure ds, AllocatorStats* stats);
+void GetStats(DataStructure ds, Stats* stats);
+void ResetStats(DataStructure* ds);
+
+void AddProduct(DataStructure* ds, int time, int quality);
+void AddProductsBulk(DataStructure* ds, const int* times, const int* qualities, size_t n);
+void RemoveProduct(DataStructure* ds, int time);
+void RemoveQualityRange(DataStructure* ds, int quality1, int quality2);
+void RemoveQuality(DataStructure* ds, int quality);
+void RemoveTimeRange(DataStructure* ds, int time1, int time2);
+void ExpireBefore(DataStructure* ds, int time);
+size_t ReclaimDetached(DataStructure* ds, size_t budget);
+
+int GetIthRankProduct(DataStructure ds, int i);
+void GetIthRankProducts(DataStructure ds, const int* ranks, int* out, size_t m);
+int GetIthRankProductBetween(DataStructure ds, int time1, int time2, int i);
+int GetIthRankProductKey(DataStructure ds, int time1, int time2, int i, int* quality);
+int CountProductsUpTo(DataStructure ds, int time1, int time2, int quality, int time);
+int CountProductsInBand(DataStructure ds, int time1, int time2, int quality1, int quality2);
+int GetBestProductInBand(DataStructure ds, int time1, int time2, int quality_min, int* quality);
+size_t GetProductsInBand(DataStructure ds, int time1, int time2, int quality1, int quality2, int* times, int* qualities, size_t max);
+size_t GetProductsByTime(DataStructure ds, int* times, int* qualities);
+RangeBestIterator InitRangeBestIterator(DataStructure ds, int time1, int time2);
+int NextRangeBest(RangeBestIterator* it, int* time, int* quality);
+void DestroyRangeBestIterator(RangeBestIterator* it);
+int Exists(DataStructure ds);
+int CountBetween(DataStructure ds, int time1, int time2);
+long long SumQualityBetween(DataStructure ds, int time1, int time2);
+double AvgQualityBetween(DataStructure ds, int time1, int time2);
+double StddevQualityBetween(DataStructure ds, int time1, int time2);
+int MaxQualityBetween(DataStructure ds, int time1, int time2);
+int FindProduct(DataStructure ds, int time, int* quality);
+int CountQuality(DataStructure ds, int quality);
+int ExistsQuality(DataStructure ds, int quality);
+
+CompactDataStructure InitCompact(int s);
+void DestroyCompact(CompactDataStructure* cds);
+void AddProductCompact(CompactDataStructure* cds, int time, int quality);
+void RemoveProductCompact(CompactDataStructure* cds, int time);
+void RemoveQualityCompact(CompactDataStructure* cds, int quality);
+int GetIthRankProductCompact(CompactDataStructure cds, int i);
+int ExistsCompact(CompactDataStructure cds);
+int FindCompact(CompactDataStructure cds, int time);
+int CountBetweenCompact(CompactDataStructure cds, int time1, int time2);
+int GetWorstProductCompact(CompactDataStructure cds);
+
+int SaveSnapshot(DataStructure ds, const char* path);
+int SaveSnapshotCompact(CompactDataStructure cds, const char* path);
+int LoadSnapshot(const char* path, CompactDataStructure* cds, int verify);
+int RestoreSnapshot(const char* path, DataStructure* ds);
+
+int OpenLog(DataStructure* ds, const char* path, const char* snapshot_path, const LogOptions* options);
+int SyncLog(DataStructure* ds);
+long LogNextDeadlineMs(const DataStructure* ds);
+int CheckpointLog(DataStructure* ds);
+int CloseLog(DataStructure* ds);
+
+#endif
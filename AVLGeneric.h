@@ -0,0 +1,556 @@
+#ifndef AVL_GENERIC_H
+#define AVL_GENERIC_H
+
+#include <stdlib.h>
+#include "AVL.h"
+
+/* A type generic version of the two AVL trees of DataStructure, generated by macros for given time and quality types.
+   Every comparison goes through the time_less and quality_less macros given to AVL_GENERIC_DEFINE, so the compiler
+   inlines them like the open coded int comparisons of AVL.c instead of calling a comparator through a pointer.
+
+   AVL_GENERIC_DEFINE(name, time_type, quality_type, time_less, quality_less) defines
+     name##Node, name##DataStructure
+     Init##name(s), Destroy##name(&ds)
+     AddProduct##name(&ds, time, quality), RemoveProduct##name(&ds, time), RemoveQuality##name(&ds, quality)
+     GetIthRankProduct##name(ds, i, &time), Find##name(ds, time, &quality), Exists##name(ds)
+     CountBetween##name(ds, time1, time2), GetWorstProductBetween##name(ds, time1, time2, &time)
+   as static inline functions, so every translation unit that uses the types expands the macro once.
+   AVL_GENERIC_DEFINE_AUGMENTED adds a user defined value kept in every node of the time tree.
+
+   For 64 bit ns times and float qualities:
+     AVL_GENERIC_DEFINE(Ns, long long, float, AVL_GENERIC_LESS, AVL_GENERIC_LESS)
+     NsDataStructure ds = InitNs(0.5f);
+     AddProductNs(&ds, 1700000000123456789LL, 0.25f);
+
+   The quality tree is sorted by (quality, time) and the time tree keeps the size and the worst quality of every subtree,
+   like the time and quality trees of DataStructure. The nodes come from a NodePool of AVL.c, link with libavl.a */
+
+#define AVL_GENERIC_LESS(a, b) ((a) < (b))  /* Comparison of the built in arithmetic types */
+#define AVL_GENERIC_MAX_HEIGHT 48           /* Bound on the height of an AVL tree of up to 2^32 nodes */
+#define AVL_GENERIC_NO_AUGMENT(node) ((void)(node))  /* Augmentation of the data structures without one */
+
+/* The node and the data structure */
+#define AVL_GENERIC_TYPES(name, time_type, quality_type, augment_type) \
+typedef struct name##Node \
+{ \
+    time_type time;                 /* Time value of the product, the key of the time tree */ \
+    quality_type quality;           /* Quality value of the product, the key (with time) of the quality tree */ \
+    int height;                     /* Height of the node in the time tree */ \
+    int size;                       /* Size of the time subtree rooted at this node */ \
+    struct name##Node* left;        /* Left child in the time tree */ \
+    struct name##Node* right;       /* Right child in the time tree */ \
+    struct name##Node* worst_quality; /* Node with the worst quality in the time subtree rooted at this node */ \
+    int q_height;                   /* Height of the node in the quality tree */ \
+    int q_size;                     /* Size of the quality subtree rooted at this node */ \
+    struct name##Node* q_left;      /* Left child in the quality tree */ \
+    struct name##Node* q_right;     /* Right child in the quality tree */ \
+    augment_type augment;           /* Value of the time subtree rooted at this node, kept by the augment macro */ \
+} name##Node; \
+\
+typedef struct name##DataStructure \
+{ \
+    quality_type best_quality;      /* save the best quality in the data structure */ \
+    int flag_best_quality;          /* flag if there is a quality with the same value as the best quality */ \
+    name##Node* timeTree;           /* Avl tree sorted by time */ \
+    name##Node* qualityTree;        /* Avl tree sorted by (quality, time) */ \
+    NodePool nodePool;              /* Allocator of the nodes */ \
+} name##DataStructure;
+
+/* The orders of the two trees and the variables kept in their nodes */
+#define AVL_GENERIC_ORDERS(name, time_less, quality_less, augment) \
+/* Function to check if a node comes before another one in the time tree */ \
+/*  Time O(1) */ \
+static inline int time_before_##name(const name##Node* a, const name##Node* b) \
+{ \
+    return time_less(a->time, b->time); \
+} \
+\
+/* Function to check if a node comes before another one in the quality tree, by (quality, time) */ \
+/*  Time O(1) */ \
+static inline int quality_before_##name(const name##Node* a, const name##Node* b) \
+{ \
+    if (quality_less(a->quality, b->quality)) \
+        return 1; \
+    if (quality_less(b->quality, a->quality)) \
+        return 0; \
+    return time_less(a->time, b->time); \
+} \
+\
+/* Function to return the node with the worse quality of two nodes, NULL loses to every node */ \
+/*  Time O(1) */ \
+static inline name##Node* worse_of_##name##Nodes(name##Node* a, name##Node* b) \
+{ \
+    if (a == NULL) \
+        return b; \
+    if (b == NULL || quality_before_##name(a, b)) \
+        return a; \
+    return b; \
+} \
+\
+/* Function to update the size, worst_quality and augmentation of a node in the time tree, for the ancestors of an update \
+   whose height did not change */ \
+/*  Time O(1) */ \
+static inline void update_##name##Node_Size(name##Node* node) \
+{ \
+    node->size = 1 + (node->left != NULL ? node->left->size : 0) + (node->right != NULL ? node->right->size : 0); \
+    node->worst_quality = worse_of_##name##Nodes(worse_of_##name##Nodes(node->left != NULL ? node->left->worst_quality : NULL, node), \
+                                                 node->right != NULL ? node->right->worst_quality : NULL); \
+    augment(node); \
+} \
+\
+/* Function to update the height, size, and worst_quality of a node in the time tree */ \
+/*  Time O(1) */ \
+static inline void update_##name##Node_Variables(name##Node* node) \
+{ \
+    int left = node->left != NULL ? node->left->height : 0; \
+    int right = node->right != NULL ? node->right->height : 0; \
+\
+    node->height = 1 + (left > right ? left : right); \
+    update_##name##Node_Size(node); \
+} \
+\
+/* Function to update the size of a node in the quality tree */ \
+/*  Time O(1) */ \
+static inline void update_##name##Quality_Node_Size(name##Node* node) \
+{ \
+    node->q_size = 1 + (node->q_left != NULL ? node->q_left->q_size : 0) + (node->q_right != NULL ? node->q_right->q_size : 0); \
+} \
+\
+/* Function to update the height and size of a node in the quality tree */ \
+/*  Time O(1) */ \
+static inline void update_##name##Quality_Node_Variables(name##Node* node) \
+{ \
+    int left = node->q_left != NULL ? node->q_left->q_height : 0; \
+    int right = node->q_right != NULL ? node->q_right->q_height : 0; \
+\
+    node->q_height = 1 + (left > right ? left : right); \
+    update_##name##Quality_Node_Size(node); \
+}
+
+/* The rotations, insertion and deletion of one of the trees. The same code serves both trees,
+   tree names the tree (TimeTree or QualityTree), left, right and height its fields, before its order.
+   update recomputes every variable of a node, update_size all but the height */
+#define AVL_GENERIC_TREE(name, tree, left, right, height, before, update, update_size) \
+/* Function to get the height of a node, 0 for an empty subtree */ \
+/*  Time O(1) */ \
+static inline int heightOf_##name##tree(name##Node* node) \
+{ \
+    return node != NULL ? node->height : 0; \
+} \
+\
+/* Function to perform a left rotation */ \
+/*  Time O(1) */ \
+static inline name##Node* leftRotate_##name##tree(name##Node* node) \
+{ \
+    name##Node* sub_tree = node->right; \
+\
+    node->right = sub_tree->left; \
+    sub_tree->left = node; \
+    update(node); \
+    update(sub_tree); \
+    return sub_tree; \
+} \
+\
+/* Function to perform a right rotation */ \
+/*  Time O(1) */ \
+static inline name##Node* rightRotate_##name##tree(name##Node* node) \
+{ \
+    name##Node* sub_tree = node->left; \
+\
+    node->left = sub_tree->right; \
+    sub_tree->right = node; \
+    update(node); \
+    update(sub_tree); \
+    return sub_tree; \
+} \
+\
+/* Function to update a node and restore its AVL balance, returns the new root of its subtree */ \
+/*  Time O(1) */ \
+static inline name##Node* balance_##name##tree(name##Node* node) \
+{ \
+    int balance_factor = heightOf_##name##tree(node->left) - heightOf_##name##tree(node->right); \
+\
+    if (balance_factor > 1) \
+    { \
+        if (heightOf_##name##tree(node->left->left) < heightOf_##name##tree(node->left->right)) \
+            node->left = leftRotate_##name##tree(node->left); \
+        return rightRotate_##name##tree(node); \
+    } \
+    if (balance_factor < -1) \
+    { \
+        if (heightOf_##name##tree(node->right->right) < heightOf_##name##tree(node->right->left)) \
+            node->right = rightRotate_##name##tree(node->right); \
+        return leftRotate_##name##tree(node); \
+    } \
+    update(node); \
+    return node; \
+} \
+\
+/* Function to insert a node, returns 0 without inserting it if a node with the same key exists. \
+   Like insert_in_TimeTree of AVL.c, the path is rebalanced bottom-up only until a height stops changing */ \
+/*  Time O(log(n)) */ \
+static inline int insert_in_##name##tree(name##Node** root, name##Node* node) \
+{ \
+    name##Node** path[AVL_GENERIC_MAX_HEIGHT]; \
+    name##Node** link = root; \
+    int depth = 0; \
+    int old_height; \
+\
+    /* Descend to the empty link of the node, keeping the links of the path */ \
+    while (*link != NULL) \
+    { \
+        path[depth++] = link; \
+        if (before(node, *link)) \
+            link = &(*link)->left; \
+        else if (before(*link, node)) \
+            link = &(*link)->right; \
+        else \
+            return 0; \
+    } \
+\
+    node->left = NULL; \
+    node->right = NULL; \
+    update(node); \
+    *link = node; \
+\
+    /* Rebalance the path from the bottom up while the height of the subtrees changes */ \
+    while (depth > 0) \
+    { \
+        link = path[--depth]; \
+        old_height = (*link)->height; \
+        *link = balance_##name##tree(*link); \
+        if ((*link)->height == old_height) \
+            break; \
+    } \
+\
+    /* The ancestors above only gained the node */ \
+    while (depth > 0) \
+        update_size(*path[--depth]); \
+    return 1; \
+} \
+\
+/* Function to unlink a node of the tree in a single descent, the node must be in the tree. \
+   Like deleteNode of AVL.c, a node with two children is replaced by its successor and the path is rebalanced \
+   bottom-up only until a height stops changing */ \
+/*  Time O(log(n)) */ \
+static inline void delete_in_##name##tree(name##Node** root, name##Node* node) \
+{ \
+    name##Node** path[AVL_GENERIC_MAX_HEIGHT]; \
+    name##Node** link = root; \
+    name##Node* successor; \
+    int depth = 0; \
+    int node_depth; \
+    int old_height; \
+\
+    /* Descend to the node, keeping the links of the path */ \
+    while (*link != node) \
+    { \
+        path[depth++] = link; \
+        link = before(node, *link) ? &(*link)->left : &(*link)->right; \
+    } \
+\
+    if (node->left == NULL || node->right == NULL) \
+    { \
+        /* If the node has no children or only one child, the child takes its place */ \
+        *link = node->left != NULL ? node->left : node->right; \
+    } \
+    else \
+    { \
+        /* If the node has two children, continue the descent to the successor (smallest in the right subtree) */ \
+        node_depth = depth; \
+        path[depth++] = link; \
+        link = &node->right; \
+        while ((*link)->left != NULL) \
+        { \
+            path[depth++] = link; \
+            link = &(*link)->left; \
+        } \
+\
+        /* Unlink the successor, its right child takes its place */ \
+        successor = *link; \
+        *link = successor->right; \
+\
+        /* The successor takes the place of the node, the path below it goes through the successor now */ \
+        successor->left = node->left; \
+        successor->right = node->right; \
+        successor->height = node->height; \
+        *path[node_depth] = successor; \
+        if (node_depth + 1 < depth) \
+            path[node_depth + 1] = &successor->right; \
+    } \
+\
+    /* Rebalance the path from the bottom up while the height of the subtrees changes */ \
+    while (depth > 0) \
+    { \
+        link = path[--depth]; \
+        old_height = (*link)->height; \
+        *link = balance_##name##tree(*link); \
+        if ((*link)->height == old_height) \
+            break; \
+    } \
+\
+    /* The ancestors above only lost the node */ \
+    while (depth > 0) \
+        update_size(*path[--depth]); \
+}
+
+/* The operations of the data structure */
+#define AVL_GENERIC_OPERATIONS(name, time_type, quality_type, time_less, quality_less) \
+/* Initialize a data structure with a given value */ \
+/*  Time O(1) */ \
+static inline name##DataStructure Init##name(quality_type s) \
+{ \
+    name##DataStructure ds; \
+\
+    ds.best_quality = s; \
+    ds.flag_best_quality = 0; \
+    ds.timeTree = NULL; \
+    ds.qualityTree = NULL; \
+    init_NodePool(&ds.nodePool, sizeof(name##Node), 0); \
+    return ds; \
+} \
+\
+/* Release every node of the data structure, it is left empty and can be used again */ \
+/*  Time O(number of slabs) */ \
+static inline void Destroy##name(name##DataStructure* ds) \
+{ \
+    destroy_NodePool(&ds->nodePool); \
+    ds->flag_best_quality = 0; \
+    ds->timeTree = NULL; \
+    ds->qualityTree = NULL; \
+} \
+\
+/* Function to find the node of a time, NULL if there is none */ \
+/*  Time O(log(n)) */ \
+static inline name##Node* find_in_##name##TimeTree(name##Node* tree, time_type time) \
+{ \
+    while (tree != NULL) \
+    { \
+        if (time_less(time, tree->time)) \
+            tree = tree->left; \
+        else if (time_less(tree->time, time)) \
+            tree = tree->right; \
+        else \
+            return tree; \
+    } \
+    return NULL; \
+} \
+\
+/* Function to find the node with the smallest time among the nodes of a quality, NULL if there is none */ \
+/*  Time O(log(n)) */ \
+static inline name##Node* find_in_##name##QualityTree(name##Node* tree, quality_type quality) \
+{ \
+    name##Node* found = NULL; \
+\
+    while (tree != NULL) \
+    { \
+        if (quality_less(tree->quality, quality)) \
+            tree = tree->q_right; \
+        else \
+        { \
+            if (!quality_less(quality, tree->quality)) \
+                found = tree; \
+            tree = tree->q_left; \
+        } \
+    } \
+    return found; \
+} \
+\
+/* Add a product to the data structure, a product whose time already exists is ignored */ \
+/*  Time O(log(n)) */ \
+static inline void AddProduct##name(name##DataStructure* ds, time_type time, quality_type quality) \
+{ \
+    name##Node* node = (name##Node*)alloc_from_NodePool(&ds->nodePool); \
+\
+    node->time = time; \
+    node->quality = quality; \
+    if (!insert_in_##name##TimeTree(&ds->timeTree, node)) \
+    { \
+        free_to_NodePool(&ds->nodePool, node); \
+        return; \
+    } \
+    insert_in_##name##QualityTree(&ds->qualityTree, node); \
+\
+    if (!quality_less(quality, ds->best_quality) && !quality_less(ds->best_quality, quality)) \
+        ds->flag_best_quality = 1; \
+} \
+\
+/* Function to unlink a node from both trees and free it */ \
+/*  Time O(log(n)) */ \
+static inline void remove_##name##Node(name##DataStructure* ds, name##Node* node) \
+{ \
+    quality_type quality = node->quality; \
+\
+    delete_in_##name##TimeTree(&ds->timeTree, node); \
+    delete_in_##name##QualityTree(&ds->qualityTree, node); \
+    free_to_NodePool(&ds->nodePool, node); \
+\
+    /* If it had the best quality, check if another product still has it */ \
+    if (!quality_less(quality, ds->best_quality) && !quality_less(ds->best_quality, quality)) \
+        ds->flag_best_quality = find_in_##name##QualityTree(ds->qualityTree, quality) != NULL; \
+} \
+\
+/* Remove a product from the data structure */ \
+/*  Time O(log(n)) */ \
+static inline void RemoveProduct##name(name##DataStructure* ds, time_type time) \
+{ \
+    name##Node* node = find_in_##name##TimeTree(ds->timeTree, time); \
+\
+    if (node != NULL) \
+        remove_##name##Node(ds, node); \
+} \
+\
+/* Remove every product with a given quality from the data structure */ \
+/*  Time O(k*log(n)) (k = number of removed products) */ \
+static inline void RemoveQuality##name(name##DataStructure* ds, quality_type quality) \
+{ \
+    name##Node* node; \
+\
+    while ((node = find_in_##name##QualityTree(ds->qualityTree, quality)) != NULL) \
+        remove_##name##Node(ds, node); \
+} \
+\
+/* Function to get the ith ranked product (ith smallest (quality, time)), returns 0 if there is none */ \
+/*  Time O(log(n)) */ \
+static inline int GetIthRankProduct##name(name##DataStructure ds, int i, time_type* time) \
+{ \
+    name##Node* tree = ds.qualityTree; \
+    int size_left; \
+\
+    while (tree != NULL) \
+    { \
+        size_left = tree->q_left != NULL ? tree->q_left->q_size : 0; \
+        if (i == size_left + 1) \
+        { \
+            *time = tree->time; \
+            return 1; \
+        } \
+        if (i <= size_left) \
+            tree = tree->q_left; \
+        else \
+        { \
+            i -= size_left + 1; \
+            tree = tree->q_right; \
+        } \
+    } \
+    return 0; \
+} \
+\
+/* Function to find the quality of the product of a time, returns 0 if there is none */ \
+/*  Time O(log(n)) */ \
+static inline int Find##name(name##DataStructure ds, time_type time, quality_type* quality) \
+{ \
+    name##Node* node = find_in_##name##TimeTree(ds.timeTree, time); \
+\
+    if (node == NULL) \
+        return 0; \
+    *quality = node->quality; \
+    return 1; \
+} \
+\
+/* Function to check if a product with the best quality exists */ \
+/*  Time O(1) */ \
+static inline int Exists##name(name##DataStructure ds) \
+{ \
+    return ds.flag_best_quality; \
+} \
+\
+/* Function to find the root of the smallest time subtree that holds every time between time1 and time2, NULL if none does */ \
+/*  Time O(log(n)) */ \
+static inline name##Node* split_node_of_##name(name##Node* tree, time_type time1, time_type time2) \
+{ \
+    while (tree != NULL && (time_less(tree->time, time1) || time_less(time2, tree->time))) \
+        tree = time_less(tree->time, time1) ? tree->right : tree->left; \
+    return tree; \
+} \
+\
+/* Function to count the products with a time between time1 and time2 (inclusive) */ \
+/*  Time O(log(n)) */ \
+static inline int CountBetween##name(name##DataStructure ds, time_type time1, time_type time2) \
+{ \
+    name##Node* split = split_node_of_##name(ds.timeTree, time1, time2); \
+    name##Node* tree; \
+    int count; \
+\
+    if (split == NULL) \
+        return 0; \
+    count = 1; \
+\
+    /* The right subtrees on the way down to time1 are whole, and so are the left ones on the way to time2 */ \
+    for (tree = split->left; tree != NULL; ) \
+    { \
+        if (!time_less(tree->time, time1)) \
+        { \
+            count += 1 + (tree->right != NULL ? tree->right->size : 0); \
+            tree = tree->left; \
+        } \
+        else \
+            tree = tree->right; \
+    } \
+    for (tree = split->right; tree != NULL; ) \
+    { \
+        if (!time_less(time2, tree->time)) \
+        { \
+            count += 1 + (tree->left != NULL ? tree->left->size : 0); \
+            tree = tree->right; \
+        } \
+        else \
+            tree = tree->left; \
+    } \
+    return count; \
+} \
+\
+/* Function to get the product with the worst quality (lowest (quality, time)) between time1 and time2, returns 0 if there is none */ \
+/*  Time O(log(n)) */ \
+static inline int GetWorstProductBetween##name(name##DataStructure ds, time_type time1, time_type time2, time_type* time) \
+{ \
+    name##Node* split = split_node_of_##name(ds.timeTree, time1, time2); \
+    name##Node* worst; \
+    name##Node* tree; \
+\
+    if (split == NULL) \
+        return 0; \
+    worst = split; \
+\
+    /* Same walk as CountBetween, taking the worst quality of the whole subtrees */ \
+    for (tree = split->left; tree != NULL; ) \
+    { \
+        if (!time_less(tree->time, time1)) \
+        { \
+            worst = worse_of_##name##Nodes(worse_of_##name##Nodes(worst, tree), tree->right != NULL ? tree->right->worst_quality : NULL); \
+            tree = tree->left; \
+        } \
+        else \
+            tree = tree->right; \
+    } \
+    for (tree = split->right; tree != NULL; ) \
+    { \
+        if (!time_less(time2, tree->time)) \
+        { \
+            worst = worse_of_##name##Nodes(worse_of_##name##Nodes(worst, tree), tree->left != NULL ? tree->left->worst_quality : NULL); \
+            tree = tree->right; \
+        } \
+        else \
+            tree = tree->left; \
+    } \
+    *time = worst->time; \
+    return 1; \
+}
+
+/* Define the types and the functions of a data structure with the given time and quality types, and an augmentation
+   of the time tree: every node has an augment_type field augment, and augment(node) recomputes it from node and its
+   children (node->left and node->right, which may be NULL) whenever the subtree of node changes.
+   time_less(a, b) and quality_less(a, b) are macros or inline functions giving a strict weak order */
+#define AVL_GENERIC_DEFINE_AUGMENTED(name, time_type, quality_type, time_less, quality_less, augment_type, augment) \
+AVL_GENERIC_TYPES(name, time_type, quality_type, augment_type) \
+AVL_GENERIC_ORDERS(name, time_less, quality_less, augment) \
+AVL_GENERIC_TREE(name, TimeTree, left, right, height, time_before_##name, update_##name##Node_Variables, update_##name##Node_Size) \
+AVL_GENERIC_TREE(name, QualityTree, q_left, q_right, q_height, quality_before_##name, update_##name##Quality_Node_Variables, \
+                 update_##name##Quality_Node_Size) \
+AVL_GENERIC_OPERATIONS(name, time_type, quality_type, time_less, quality_less)
+
+/* Define a data structure with only the size and worst quality augmentations */
+#define AVL_GENERIC_DEFINE(name, time_type, quality_type, time_less, quality_less) \
+AVL_GENERIC_DEFINE_AUGMENTED(name, time_type, quality_type, time_less, quality_less, char, AVL_GENERIC_NO_AUGMENT)
+
+#endif
@@ -0,0 +1,1000 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "ConcurrentAVL.h"
+
+/***** functions *****/
+static void retire_node(ConcurrentDataStructure* cds, NodePool* pool, void* node, unsigned long stamp);
+static void free_RetiredList(RetiredList* list);
+static void try_advance_epoch(ConcurrentDataStructure* cds);
+static ConcurrentVersion* begin_write(ConcurrentDataStructure* cds);
+static void publish_write(ConcurrentDataStructure* cds, ConcurrentVersion* version);
+static void discard_write(ConcurrentDataStructure* cds, ConcurrentVersion* version);
+static ConcurrentVersion* pin_version(ConcurrentDataStructure* cds, ConcurrentReader* reader);
+static void unpin_version(ConcurrentReader* reader);
+
+static VersionedTimeNode* createVersionedTimeNode(ConcurrentDataStructure* cds, int time, int quality);
+static VersionedTimeNode* copy_VersionedTimeNode(ConcurrentDataStructure* cds, VersionedTimeNode* node);
+static int heightOfVersionedNode(VersionedTimeNode* node);
+static int sizeOfVersionedNode(VersionedTimeNode* node);
+static void update_VersionedNode_Variables(VersionedTimeNode* node);
+static VersionedTimeNode* leftRotate_Versioned(ConcurrentDataStructure* cds, VersionedTimeNode* node);
+static VersionedTimeNode* rightRotate_Versioned(ConcurrentDataStructure* cds, VersionedTimeNode* node);
+static VersionedTimeNode* balance_Versioned(ConcurrentDataStructure* cds, VersionedTimeNode* node);
+static VersionedTimeNode* find_in_VersionedTree(VersionedTimeNode* tree, int time);
+static VersionedTimeNode* insert_in_VersionedTree(ConcurrentDataStructure* cds, VersionedTimeNode* tree, int time, int quality);
+static VersionedTimeNode* deleteNode_in_VersionedTree(ConcurrentDataStructure* cds, VersionedTimeNode* tree, int time);
+static VersionedTimeNode* build_VersionedTree(ConcurrentDataStructure* cds, const int* times, int n);
+static void retire_VersionedTree(ConcurrentDataStructure* cds, VersionedTimeNode* tree);
+static int count_versioned_times_until(VersionedTimeNode* tree, int time);
+static int count_versioned_times_between(VersionedTimeNode* tree, int time1, int time2);
+
+static VersionedRankNode* createVersionedRankNode(ConcurrentDataStructure* cds, int time, int quality);
+static VersionedRankNode* copy_VersionedRankNode(ConcurrentDataStructure* cds, VersionedRankNode* node);
+static int sizeOfVersionedRankNode(VersionedRankNode* node);
+static int aliveInVersionedRankNode(VersionedRankNode* node);
+static void retire_VersionedRankTree(ConcurrentDataStructure* cds, VersionedRankNode* tree);
+static int collect_VersionedRankTree(VersionedRankNode* tree, int* times, int* qualities, int count);
+static VersionedRankNode* build_VersionedRankTree(ConcurrentDataStructure* cds, const int* times, const int* qualities, int* sorted_times, int* scratch, int lo, int hi);
+static VersionedRankNode* rebuild_VersionedRankTree(ConcurrentDataStructure* cds, ConcurrentVersion* version, VersionedRankNode* tree, int extra_time, int extra_quality, int has_extra);
+static int insert_in_VersionedRankTree(ConcurrentDataStructure* cds, ConcurrentVersion* version, VersionedRankNode** link, int time, int quality);
+static void remove_from_VersionedRankTree(ConcurrentDataStructure* cds, ConcurrentVersion* version, int time, int quality);
+static int count_below_in_VersionedRankTree(VersionedRankNode* tree, int quality);
+static int collect_quality_from_VersionedRankTree(VersionedRankNode* tree, int quality, int* times, int count);
+static int select_in_VersionedRankTree(VersionedRankNode* tree, int i);
+static int select_between_in_VersionedRankTree(VersionedRankNode* tree, int time1, int time2, int i);
+static void remove_from_ConcurrentVersion(ConcurrentDataStructure* cds, ConcurrentVersion* version, int time, int quality);
+
+
+/***** functions *****/
+
+/* Function to retire a node unlinked by the update in progress. A node created by the same update was never
+   published and is freed at once, any other node is freed once the readers of its epoch are gone */
+/*  Time O(1) amortized */
+static void retire_node(ConcurrentDataStructure* cds, NodePool* pool, void* node, unsigned long stamp)
+{
+    RetiredList* list;
+
+    if (stamp == cds->stamp)
+    {
+        free_to_NodePool(pool, node);
+        return;
+    }
+
+    list = &cds->limbo[atomic_load_explicit(&cds->epoch, memory_order_relaxed) % CONCURRENT_EPOCHS];
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity == 0 ? 256 : 2 * list->capacity;
+        list->nodes = (RetiredNode*)realloc(list->nodes, list->capacity * sizeof(RetiredNode));
+        if (list->nodes == NULL)
+        {
+            exit(1);
+        }
+    }
+    list->nodes[list->count].pool = pool;
+    list->nodes[list->count].node = node;
+    list->count++;
+}
+
+/* Function to free every node of a retired list */
+/*  Time O(n) */
+static void free_RetiredList(RetiredList* list)
+{
+    size_t i;
+
+    for (i = 0; i < list->count; i++)
+        free_to_NodePool(list->nodes[i].pool, list->nodes[i].node);
+    list->count = 0;
+}
+
+/* Function to advance the global epoch if every reader inside a query announced the current one.
+   The nodes retired two epochs ago can then no longer be reached by any reader and are freed */
+/*  Time O(number of reader slots) */
+static void try_advance_epoch(ConcurrentDataStructure* cds)
+{
+    unsigned long epoch = atomic_load_explicit(&cds->epoch, memory_order_relaxed);
+    unsigned long announced;
+    int slots = atomic_load(&cds->reader_slots);
+    int i;
+
+    for (i = 0; i < slots; i++)
+    {
+        announced = atomic_load(&cds->readers[i].epoch);
+        if (announced != 0 && announced != 2 * epoch + 1)
+            return;
+    }
+
+    atomic_store(&cds->epoch, epoch + 1);
+    free_RetiredList(&cds->limbo[(epoch + 2) % CONCURRENT_EPOCHS]);
+}
+
+/* Function to start an update, returns a private copy of the current version that the update modifies */
+/*  Time O(1) */
+static ConcurrentVersion* begin_write(ConcurrentDataStructure* cds)
+{
+    ConcurrentVersion* version;
+
+    pthread_mutex_lock(&cds->write_lock);
+    cds->stamp++;
+
+    version = (ConcurrentVersion*)alloc_from_NodePool(&cds->versionPool);
+    *version = *atomic_load_explicit(&cds->current, memory_order_relaxed);
+    version->stamp = cds->stamp;
+    return version;
+}
+
+/* Function to publish the version built by an update and retire the one it replaces */
+/*  Time O(number of reader slots) */
+static void publish_write(ConcurrentDataStructure* cds, ConcurrentVersion* version)
+{
+    ConcurrentVersion* old = atomic_load_explicit(&cds->current, memory_order_relaxed);
+
+    atomic_store(&cds->current, version);
+    retire_node(cds, &cds->versionPool, old, old->stamp);
+    try_advance_epoch(cds);
+    pthread_mutex_unlock(&cds->write_lock);
+}
+
+/* Function to end an update that changed nothing, the private version is dropped */
+/*  Time O(1) */
+static void discard_write(ConcurrentDataStructure* cds, ConcurrentVersion* version)
+{
+    free_to_NodePool(&cds->versionPool, version);
+    pthread_mutex_unlock(&cds->write_lock);
+}
+
+/* Function to enter a query: announce the current epoch, then read the version to query */
+/*  Time O(1) */
+static ConcurrentVersion* pin_version(ConcurrentDataStructure* cds, ConcurrentReader* reader)
+{
+    unsigned long epoch = atomic_load(&cds->epoch);
+
+    atomic_store(&reader->epoch, 2 * epoch + 1);
+    return atomic_load(&cds->current);
+}
+
+/* Function to leave a query, the nodes of the version may be freed afterwards */
+/*  Time O(1) */
+static void unpin_version(ConcurrentReader* reader)
+{
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+/* Function to Allocate node of a persistent time tree */
+/*  Time O(1) */
+static VersionedTimeNode* createVersionedTimeNode(ConcurrentDataStructure* cds, int time, int quality)
+{
+    /* Allocate memory for the new node */
+    VersionedTimeNode* newNode = (VersionedTimeNode*)alloc_from_NodePool(&cds->timePool);
+
+    /* Initialize node values */
+    newNode->time = time;
+    newNode->quality = quality;
+    newNode->height = 0;
+    newNode->size = 1;
+    newNode->stamp = cds->stamp;
+    newNode->left = NULL;
+    newNode->right = NULL;
+
+    /* Return a pointer to the new node */
+    return newNode;
+}
+
+/* Function to get a node that the update in progress may modify, a published node is copied and retired */
+/*  Time O(1) */
+static VersionedTimeNode* copy_VersionedTimeNode(ConcurrentDataStructure* cds, VersionedTimeNode* node)
+{
+    VersionedTimeNode* copy;
+
+    if (node->stamp == cds->stamp)
+        return node;
+
+    copy = (VersionedTimeNode*)alloc_from_NodePool(&cds->timePool);
+    *copy = *node;
+    copy->stamp = cds->stamp;
+    retire_node(cds, &cds->timePool, node, node->stamp);
+    return copy;
+}
+
+/* Function to return the height of a persistent tree node  */
+/*  Time O(1) */
+static int heightOfVersionedNode(VersionedTimeNode* node)
+{
+    /* If the node is NULL, return -1 */
+    if (node == NULL)
+        return -1;
+    /* Return the height of the node */
+    return node->height;
+}
+
+/* Function to return the size of a persistent tree node  */
+/*  Time O(1) */
+static int sizeOfVersionedNode(VersionedTimeNode* node)
+{
+    /* If the node is NULL, return 0 */
+    if (node == NULL)
+        return 0;
+    /* Return the size of the node */
+    return node->size;
+}
+
+/* Function to update the height and size of a persistent tree node */
+/*  Time O(1) */
+static void update_VersionedNode_Variables(VersionedTimeNode* node)
+{
+    int left_height = heightOfVersionedNode(node->left);
+    int right_height = heightOfVersionedNode(node->right);
+
+    node->height = (left_height > right_height ? left_height : right_height) + 1;
+    node->size = sizeOfVersionedNode(node->left) + sizeOfVersionedNode(node->right) + 1;
+}
+
+/* Function to perform a left rotation in a persistent tree, the two nodes that change are copied */
+/*  Time O(1) */
+static VersionedTimeNode* leftRotate_Versioned(ConcurrentDataStructure* cds, VersionedTimeNode* node)
+{
+    VersionedTimeNode* sub_tree_1;
+
+    node = copy_VersionedTimeNode(cds, node);
+    sub_tree_1 = copy_VersionedTimeNode(cds, node->right);
+
+    /* Perform rotation */
+    node->right = sub_tree_1->left;
+    sub_tree_1->left = node;
+
+    /* Update all variables of the nodes */
+    update_VersionedNode_Variables(node);
+    update_VersionedNode_Variables(sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to perform a right rotation in a persistent tree, the two nodes that change are copied */
+/*  Time O(1) */
+static VersionedTimeNode* rightRotate_Versioned(ConcurrentDataStructure* cds, VersionedTimeNode* node)
+{
+    VersionedTimeNode* sub_tree_1;
+
+    node = copy_VersionedTimeNode(cds, node);
+    sub_tree_1 = copy_VersionedTimeNode(cds, node->left);
+
+    /* Perform rotation */
+    node->left = sub_tree_1->right;
+    sub_tree_1->right = node;
+
+    /* Update all variables of the nodes */
+    update_VersionedNode_Variables(node);
+    update_VersionedNode_Variables(sub_tree_1);
+
+    /* Return new root */
+    return sub_tree_1;
+}
+
+/* Function to balance a node of a persistent tree, the node must belong to the update in progress */
+/*  Time O(1) */
+static VersionedTimeNode* balance_Versioned(ConcurrentDataStructure* cds, VersionedTimeNode* node)
+{
+    int balance = heightOfVersionedNode(node->left) - heightOfVersionedNode(node->right);
+
+    /* Left heavy, a left-right case first turns into a left-left case */
+    if (balance > 1)
+    {
+        if (heightOfVersionedNode(node->left->left) < heightOfVersionedNode(node->left->right))
+            node->left = leftRotate_Versioned(cds, node->left);
+        return rightRotate_Versioned(cds, node);
+    }
+
+    /* Right heavy, a right-left case first turns into a right-right case */
+    if (balance < -1)
+    {
+        if (heightOfVersionedNode(node->right->right) < heightOfVersionedNode(node->right->left))
+            node->right = rightRotate_Versioned(cds, node->right);
+        return leftRotate_Versioned(cds, node);
+    }
+
+    return node;
+}
+
+/* Function to find a node of a given time in a persistent tree */
+/*  Time O(log(n)) */
+static VersionedTimeNode* find_in_VersionedTree(VersionedTimeNode* tree, int time)
+{
+    while (tree != NULL && tree->time != time)
+        tree = time < tree->time ? tree->left : tree->right;
+    return tree;
+}
+
+/* Function to insert a time that is not in the tree yet, the path to it is copied */
+/*  Time O(log(n)) */
+static VersionedTimeNode* insert_in_VersionedTree(ConcurrentDataStructure* cds, VersionedTimeNode* tree, int time, int quality)
+{
+    /* If the tree is empty, the new node becomes the root */
+    if (tree == NULL)
+        return createVersionedTimeNode(cds, time, quality);
+
+    tree = copy_VersionedTimeNode(cds, tree);
+    if (time < tree->time)
+        tree->left = insert_in_VersionedTree(cds, tree->left, time, quality);
+    else
+        tree->right = insert_in_VersionedTree(cds, tree->right, time, quality);
+
+    /* update all variables of the node and balance the tree if necessary */
+    update_VersionedNode_Variables(tree);
+    return balance_Versioned(cds, tree);
+}
+
+/* Function to delete a time that is in the tree, the path to it is copied */
+/*  Time O(log(n)) */
+static VersionedTimeNode* deleteNode_in_VersionedTree(ConcurrentDataStructure* cds, VersionedTimeNode* tree, int time)
+{
+    VersionedTimeNode* temp;
+
+    /* If the node has no children or only one child, replace it with the child */
+    if (tree->time == time && (tree->left == NULL || tree->right == NULL))
+    {
+        temp = tree->left != NULL ? tree->left : tree->right;
+        retire_node(cds, &cds->timePool, tree, tree->stamp);
+        return temp;
+    }
+
+    tree = copy_VersionedTimeNode(cds, tree);
+    if (time < tree->time)
+        tree->left = deleteNode_in_VersionedTree(cds, tree->left, time);
+    else if (time > tree->time)
+        tree->right = deleteNode_in_VersionedTree(cds, tree->right, time);
+    else
+    {
+        /* If the node has two children, copy the successor's product and delete the successor */
+        temp = tree->right;
+        while (temp->left != NULL)
+            temp = temp->left;
+        tree->time = temp->time;
+        tree->quality = temp->quality;
+        tree->right = deleteNode_in_VersionedTree(cds, tree->right, temp->time);
+    }
+
+    /* update all variables of the node and balance the tree if necessary */
+    update_VersionedNode_Variables(tree);
+    return balance_Versioned(cds, tree);
+}
+
+/* Function to build a perfectly balanced persistent tree from a sorted array of times */
+/*  Time O(n) */
+static VersionedTimeNode* build_VersionedTree(ConcurrentDataStructure* cds, const int* times, int n)
+{
+    VersionedTimeNode* node;
+    int mid;
+
+    if (n <= 0)
+        return NULL;
+
+    /* The middle time becomes the root, each half becomes a subtree */
+    mid = n / 2;
+    node = createVersionedTimeNode(cds, times[mid], 0);
+    node->left = build_VersionedTree(cds, times, mid);
+    node->right = build_VersionedTree(cds, times + mid + 1, n - mid - 1);
+
+    update_VersionedNode_Variables(node);
+    return node;
+}
+
+/* Function to retire every node of a persistent tree */
+/*  Time O(n) */
+static void retire_VersionedTree(ConcurrentDataStructure* cds, VersionedTimeNode* tree)
+{
+    if (tree == NULL)
+        return;
+
+    retire_VersionedTree(cds, tree->left);
+    retire_VersionedTree(cds, tree->right);
+    retire_node(cds, &cds->timePool, tree, tree->stamp);
+}
+
+/* Function to count the times that are less than or equal to a given time in a persistent tree */
+/*  Time O(log(n)) */
+static int count_versioned_times_until(VersionedTimeNode* tree, int time)
+{
+    int count = 0;
+
+    while (tree != NULL)
+    {
+        if (tree->time <= time)
+        {
+            /* The node and its whole left subtree are counted, continue to the right */
+            count += sizeOfVersionedNode(tree->left) + 1;
+            tree = tree->right;
+        }
+        else
+            tree = tree->left;
+    }
+    return count;
+}
+
+/* Function to count the times between time1 and time2 (inclusive) in a persistent tree */
+/*  Time O(log(n)) */
+static int count_versioned_times_between(VersionedTimeNode* tree, int time1, int time2)
+{
+    if (tree == NULL || time1 > time2)
+        return 0;
+
+    /* time1 - 1 would overflow for the smallest int */
+    if (time1 == INT_MIN)
+        return count_versioned_times_until(tree, time2);
+
+    return count_versioned_times_until(tree, time2) - count_versioned_times_until(tree, time1 - 1);
+}
+
+/* Function to Allocate node of the persistent rank index */
+/*  Time O(1) */
+static VersionedRankNode* createVersionedRankNode(ConcurrentDataStructure* cds, int time, int quality)
+{
+    /* Allocate memory for the new node */
+    VersionedRankNode* newNode = (VersionedRankNode*)alloc_from_NodePool(&cds->rankPool);
+
+    /* Initialize node values */
+    newNode->time = time;
+    newNode->quality = quality;
+    newNode->alive = 1;
+    newNode->size = 1;
+    newNode->stamp = cds->stamp;
+    newNode->left = NULL;
+    newNode->right = NULL;
+    newNode->times = createVersionedTimeNode(cds, time, 0);
+
+    /* Return a pointer to the new node */
+    return newNode;
+}
+
+/* Function to get a rank node that the update in progress may modify, a published node is copied and retired */
+/*  Time O(1) */
+static VersionedRankNode* copy_VersionedRankNode(ConcurrentDataStructure* cds, VersionedRankNode* node)
+{
+    VersionedRankNode* copy;
+
+    if (node->stamp == cds->stamp)
+        return node;
+
+    copy = (VersionedRankNode*)alloc_from_NodePool(&cds->rankPool);
+    *copy = *node;
+    copy->stamp = cds->stamp;
+    retire_node(cds, &cds->rankPool, node, node->stamp);
+    return copy;
+}
+
+/* Function to return the number of nodes (alive or not) of a rank subtree */
+/*  Time O(1) */
+static int sizeOfVersionedRankNode(VersionedRankNode* node)
+{
+    /* If the node is NULL, return 0 */
+    if (node == NULL)
+        return 0;
+    /* Return the size of the node */
+    return node->size;
+}
+
+/* Function to return the number of alive products of a rank subtree, the size of its inner tree */
+/*  Time O(1) */
+static int aliveInVersionedRankNode(VersionedRankNode* node)
+{
+    /* If the node is NULL, return 0 */
+    if (node == NULL)
+        return 0;
+    return sizeOfVersionedNode(node->times);
+}
+
+/* Function to retire every node of a rank subtree and of its inner trees */
+/*  Time O(n*log(n)) */
+static void retire_VersionedRankTree(ConcurrentDataStructure* cds, VersionedRankNode* tree)
+{
+    if (tree == NULL)
+        return;
+
+    retire_VersionedRankTree(cds, tree->left);
+    retire_VersionedRankTree(cds, tree->right);
+    retire_VersionedTree(cds, tree->times);
+    retire_node(cds, &cds->rankPool, tree, tree->stamp);
+}
+
+/* Function to collect the alive products of a rank subtree in (quality, time) order */
+/*  Time O(n) */
+static int collect_VersionedRankTree(VersionedRankNode* tree, int* times, int* qualities, int count)
+{
+    if (tree == NULL)
+        return count;
+
+    count = collect_VersionedRankTree(tree->left, times, qualities, count);
+    if (tree->alive)
+    {
+        times[count] = tree->time;
+        qualities[count] = tree->quality;
+        count++;
+    }
+    return collect_VersionedRankTree(tree->right, times, qualities, count);
+}
+
+/* Function to build a perfectly balanced rank subtree from products sorted by (quality, time).
+   On return sorted_times[lo..hi) holds the times of the products sorted by time */
+/*  Time O(n*log(n)) */
+static VersionedRankNode* build_VersionedRankTree(ConcurrentDataStructure* cds, const int* times, const int* qualities, int* sorted_times, int* scratch, int lo, int hi)
+{
+    VersionedRankNode* node;
+    int mid, i, j, k;
+
+    if (lo >= hi)
+        return NULL;
+
+    mid = lo + (hi - lo) / 2;
+
+    /* Allocate the node without an inner tree, it is built once the children are done */
+    node = (VersionedRankNode*)alloc_from_NodePool(&cds->rankPool);
+    node->time = times[mid];
+    node->quality = qualities[mid];
+    node->alive = 1;
+    node->size = hi - lo;
+    node->stamp = cds->stamp;
+    node->left = build_VersionedRankTree(cds, times, qualities, sorted_times, scratch, lo, mid);
+    node->right = build_VersionedRankTree(cds, times, qualities, sorted_times, scratch, mid + 1, hi);
+
+    /* Merge the sorted times of the left and the right subtrees */
+    i = lo;
+    j = mid + 1;
+    k = lo;
+    while (i < mid && j < hi)
+        scratch[k++] = sorted_times[i] < sorted_times[j] ? sorted_times[i++] : sorted_times[j++];
+    while (i < mid)
+        scratch[k++] = sorted_times[i++];
+    while (j < hi)
+        scratch[k++] = sorted_times[j++];
+
+    /* Copy the merged times back and insert the time of the node in its place */
+    k = lo;
+    for (i = lo; i < hi - 1 && scratch[i] < node->time; i++)
+        sorted_times[k++] = scratch[i];
+    sorted_times[k++] = node->time;
+    for (; i < hi - 1; i++)
+        sorted_times[k++] = scratch[i];
+
+    node->times = build_VersionedTree(cds, sorted_times + lo, hi - lo);
+    return node;
+}
+
+/* Function to rebuild a rank subtree into a perfectly balanced one, dropping the removed products.
+   If has_extra is set the product (extra_time, extra_quality) is added to the rebuilt subtree */
+/*  Time O(n*log(n)) , Space O(n)*/
+static VersionedRankNode* rebuild_VersionedRankTree(ConcurrentDataStructure* cds, ConcurrentVersion* version, VersionedRankNode* tree, int extra_time, int extra_quality, int has_extra)
+{
+    int* times;
+    int* qualities;
+    int* sorted_times;
+    int* scratch;
+    int capacity = sizeOfVersionedRankNode(tree) + 1;
+    int count, j;
+    VersionedRankNode* result;
+
+    /* Allocate memory for the products of the subtree and the merge buffers */
+    times = (int*)malloc(4 * capacity * sizeof(int));
+    if (times == NULL)
+    {
+        exit(1);
+    }
+    qualities = times + capacity;
+    sorted_times = qualities + capacity;
+    scratch = sorted_times + capacity;
+
+    /* Collect the alive products in (quality, time) order, the other nodes are dropped now */
+    count = collect_VersionedRankTree(tree, times, qualities, 0);
+    version->dead -= sizeOfVersionedRankNode(tree) - count;
+
+    /* Insert the extra product in its place */
+    if (has_extra)
+    {
+        for (j = count; j > 0 && (qualities[j - 1] > extra_quality || (qualities[j - 1] == extra_quality && times[j - 1] > extra_time)); j--)
+        {
+            times[j] = times[j - 1];
+            qualities[j] = qualities[j - 1];
+        }
+        times[j] = extra_time;
+        qualities[j] = extra_quality;
+        count++;
+    }
+
+    /* Retire the old subtree and build the new one */
+    retire_VersionedRankTree(cds, tree);
+    result = build_VersionedRankTree(cds, times, qualities, sorted_times, scratch, 0, count);
+
+    /* Free the memory allocated for the arrays */
+    free(times);
+
+    return result;
+}
+
+/* Function to insert a product into a persistent rank subtree, returns the change of its size */
+/*  Time O(log^2(n)) amortized */
+static int insert_in_VersionedRankTree(ConcurrentDataStructure* cds, ConcurrentVersion* version, VersionedRankNode** link, int time, int quality)
+{
+    VersionedRankNode* node = *link;
+    VersionedRankNode** child;
+    int old_size, delta;
+
+    /* If the subtree is empty, the new node becomes the root */
+    if (node == NULL)
+    {
+        *link = createVersionedRankNode(cds, time, quality);
+        return 1;
+    }
+
+    /* If the child would hold more than 3/4 of the subtree, rebuild the subtree with the product */
+    child = quality < node->quality || (quality == node->quality && time < node->time) ? &node->left : &node->right;
+    if ((sizeOfVersionedRankNode(*child) + 1) * 4 > (node->size + 1) * 3)
+    {
+        old_size = node->size;
+        *link = rebuild_VersionedRankTree(cds, version, node, time, quality, 1);
+        return sizeOfVersionedRankNode(*link) - old_size;
+    }
+
+    /* Copy the node, insert into the child and add the time to the inner tree of the node */
+    node = copy_VersionedRankNode(cds, node);
+    *link = node;
+    child = quality < node->quality || (quality == node->quality && time < node->time) ? &node->left : &node->right;
+    delta = insert_in_VersionedRankTree(cds, version, child, time, quality);
+    node->size += delta;
+    node->times = insert_in_VersionedTree(cds, node->times, time, 0);
+
+    return delta;
+}
+
+/* Function to remove a product from the persistent rank index, the node is only marked as removed */
+/*  Time O(log^2(n)) amortized */
+static void remove_from_VersionedRankTree(ConcurrentDataStructure* cds, ConcurrentVersion* version, int time, int quality)
+{
+    VersionedRankNode** link = &version->rankTree;
+    VersionedRankNode* node;
+
+    while (*link != NULL)
+    {
+        /* Every node on the path holds the time in its inner tree */
+        node = copy_VersionedRankNode(cds, *link);
+        *link = node;
+        node->times = deleteNode_in_VersionedTree(cds, node->times, time);
+
+        /* A removed product with the same key may still be on the path, the alive one is to its right */
+        if (node->alive && quality == node->quality && time == node->time)
+        {
+            node->alive = 0;
+            version->dead++;
+            break;
+        }
+
+        link = quality < node->quality || (quality == node->quality && time < node->time) ? &node->left : &node->right;
+    }
+
+    /* Once most of the nodes are removed products, rebuild the whole index */
+    if (version->dead > version->alive)
+        version->rankTree = rebuild_VersionedRankTree(cds, version, version->rankTree, 0, 0, 0);
+}
+
+/* Function to count the alive products with a quality smaller than a given quality */
+/*  Time O(log(n)) */
+static int count_below_in_VersionedRankTree(VersionedRankNode* tree, int quality)
+{
+    int count = 0;
+
+    while (tree != NULL)
+    {
+        if (tree->quality < quality)
+        {
+            /* The node and its whole left subtree are counted, continue to the right */
+            count += aliveInVersionedRankNode(tree->left) + tree->alive;
+            tree = tree->right;
+        }
+        else
+            tree = tree->left;
+    }
+    return count;
+}
+
+/* Function to collect the times of the alive products with a given quality in time order */
+/*  Time O(log(n) + k) */
+static int collect_quality_from_VersionedRankTree(VersionedRankNode* tree, int quality, int* times, int count)
+{
+    if (tree == NULL)
+        return count;
+
+    if (quality <= tree->quality)
+        count = collect_quality_from_VersionedRankTree(tree->left, quality, times, count);
+    if (tree->alive && tree->quality == quality)
+        times[count++] = tree->time;
+    if (quality >= tree->quality)
+        count = collect_quality_from_VersionedRankTree(tree->right, quality, times, count);
+    return count;
+}
+
+/* Function to get the time of the ith ranked product (ith smallest quality), -1 if there is none */
+/*  Time O(log(n)) */
+static int select_in_VersionedRankTree(VersionedRankNode* tree, int i)
+{
+    int count_left;
+
+    while (tree != NULL)
+    {
+        /* If the ith ranked product is in the left subtree, continue in the left subtree */
+        count_left = aliveInVersionedRankNode(tree->left);
+        if (i <= count_left)
+        {
+            tree = tree->left;
+            continue;
+        }
+        i -= count_left;
+
+        /* If the current node is alive it is the next ranked product */
+        if (tree->alive)
+        {
+            if (i == 1)
+                return tree->time;
+            i--;
+        }
+
+        /* Otherwise the ith ranked product is in the right subtree */
+        tree = tree->right;
+    }
+    return -1;
+}
+
+/* Function to get the time of the ith ranked product between two times, -1 if there is none */
+/*  Time O(log^2(n)) */
+static int select_between_in_VersionedRankTree(VersionedRankNode* tree, int time1, int time2, int i)
+{
+    int count_left;
+
+    while (tree != NULL)
+    {
+        /* Count the products of the left subtree with a time between time1 and time2 */
+        count_left = tree->left != NULL ? count_versioned_times_between(tree->left->times, time1, time2) : 0;
+
+        /* If the ith ranked product is in the left subtree, continue in the left subtree */
+        if (i <= count_left)
+        {
+            tree = tree->left;
+            continue;
+        }
+        i -= count_left;
+
+        /* If the current node is in the range it is the next ranked product */
+        if (tree->alive && tree->time >= time1 && tree->time <= time2)
+        {
+            if (i == 1)
+                return tree->time;
+            i--;
+        }
+
+        /* Otherwise the ith ranked product is in the right subtree */
+        tree = tree->right;
+    }
+
+    /* There are less than i products between time1 and time2 */
+    return -1;
+}
+
+/* Function to remove a product that is in the version from both of its trees */
+/*  Time O(log^2(n)) amortized */
+static void remove_from_ConcurrentVersion(ConcurrentDataStructure* cds, ConcurrentVersion* version, int time, int quality)
+{
+    version->timeTree = deleteNode_in_VersionedTree(cds, version->timeTree, time);
+    version->alive--;
+    if (quality == cds->best_quality)
+        version->best_count--;
+    remove_from_VersionedRankTree(cds, version, time, quality);
+}
+
+
+/*************************************************/
+
+/* Initialize a concurrent data structure with a given value */
+/*  Time O(1) */
+ConcurrentDataStructure* InitConcurrent(int s)
+{
+    ConcurrentDataStructure* cds;
+    ConcurrentVersion* version;
+    int i;
+
+    cds = (ConcurrentDataStructure*)calloc(1, sizeof(ConcurrentDataStructure));
+    if (cds == NULL)
+    {
+        exit(1);
+    }
+
+    /* The reader slots are aligned so that every reader writes its own cache line */
+    cds->readers = (ConcurrentReader*)aligned_alloc(64, CONCURRENT_MAX_READERS * sizeof(ConcurrentReader));
+    if (cds->readers == NULL)
+    {
+        exit(1);
+    }
+    for (i = 0; i < CONCURRENT_MAX_READERS; i++)
+    {
+        atomic_init(&cds->readers[i].epoch, 0);
+        atomic_init(&cds->readers[i].in_use, 0);
+    }
+    atomic_init(&cds->reader_slots, 0);
+    atomic_init(&cds->epoch, 1);
+
+    pthread_mutex_init(&cds->write_lock, NULL);
+    cds->best_quality = s; /* Set the best quality value */
+    cds->stamp = 1;
+    init_NodePool(&cds->versionPool, sizeof(ConcurrentVersion), 0);
+    init_NodePool(&cds->timePool, sizeof(VersionedTimeNode), 0);
+    init_NodePool(&cds->rankPool, sizeof(VersionedRankNode), 0);
+
+    /* Publish the empty version */
+    version = (ConcurrentVersion*)alloc_from_NodePool(&cds->versionPool);
+    version->timeTree = NULL;
+    version->rankTree = NULL;
+    version->alive = 0;
+    version->dead = 0;
+    version->best_count = 0;
+    version->stamp = cds->stamp;
+    atomic_init(&cds->current, version);
+
+    return cds;
+}
+
+/* Release a concurrent data structure, no reader or writer may use it anymore */
+/*  Time O(number of slabs) */
+void DestroyConcurrent(ConcurrentDataStructure* cds)
+{
+    int i;
+
+    /* Every node, retired or not, lives in one of the pools */
+    destroy_NodePool(&cds->versionPool);
+    destroy_NodePool(&cds->timePool);
+    destroy_NodePool(&cds->rankPool);
+    for (i = 0; i < CONCURRENT_EPOCHS; i++)
+        free(cds->limbo[i].nodes);
+
+    pthread_mutex_destroy(&cds->write_lock);
+    free(cds->readers);
+    free(cds);
+}
+
+/* Register the calling thread as a reader, returns its slot or NULL if every slot is taken */
+/*  Time O(CONCURRENT_MAX_READERS) */
+ConcurrentReader* RegisterConcurrentReader(ConcurrentDataStructure* cds)
+{
+    int i, expected, slots;
+
+    for (i = 0; i < CONCURRENT_MAX_READERS; i++)
+    {
+        expected = 0;
+        if (atomic_compare_exchange_strong(&cds->readers[i].in_use, &expected, 1))
+        {
+            /* Make sure the writers scan the slot */
+            slots = atomic_load(&cds->reader_slots);
+            while (slots < i + 1 && !atomic_compare_exchange_weak(&cds->reader_slots, &slots, i + 1))
+                ;
+            return &cds->readers[i];
+        }
+    }
+    return NULL;
+}
+
+/* Release the slot of a reader, the reader must not be inside a query */
+/*  Time O(1) */
+void UnregisterConcurrentReader(ConcurrentReader* reader)
+{
+    atomic_store(&reader->epoch, 0);
+    atomic_store(&reader->in_use, 0);
+}
+
+/* Add a product to the concurrent data structure */
+/*  Time O(log^2(n)) amortized */
+void AddProductConcurrent(ConcurrentDataStructure* cds, int time, int quality)
+{
+    ConcurrentVersion* version = begin_write(cds);
+
+    /* input check: if a product with the same time exists do nothing */
+    if (find_in_VersionedTree(version->timeTree, time) != NULL)
+    {
+        discard_write(cds, version);
+        return;
+    }
+
+    version->timeTree = insert_in_VersionedTree(cds, version->timeTree, time, quality);
+    insert_in_VersionedRankTree(cds, version, &version->rankTree, time, quality);
+    version->alive++;
+    if (quality == cds->best_quality)
+        version->best_count++;
+
+    publish_write(cds, version);
+}
+
+/* Remove a product from the concurrent data structure */
+/*  Time O(log^2(n)) amortized */
+void RemoveProductConcurrent(ConcurrentDataStructure* cds, int time)
+{
+    ConcurrentVersion* version = begin_write(cds);
+    VersionedTimeNode* node = find_in_VersionedTree(version->timeTree, time);
+
+    /*input check, if the product not exists return and do nothing*/
+    if (node == NULL)
+    {
+        discard_write(cds, version);
+        return;
+    }
+
+    remove_from_ConcurrentVersion(cds, version, time, node->quality);
+    publish_write(cds, version);
+}
+
+/* Remove all k products with a given quality from the concurrent data structure, the readers see all of them or none */
+/*  Time O(k*log^2(n)) amortized */
+void RemoveQualityConcurrent(ConcurrentDataStructure* cds, int quality)
+{
+    ConcurrentVersion* version = begin_write(cds);
+    int* times;
+    int k, i;
+
+    /* Count the products with the quality with two rank descents */
+    k = quality == INT_MAX ? version->alive : count_below_in_VersionedRankTree(version->rankTree, quality + 1);
+    k -= count_below_in_VersionedRankTree(version->rankTree, quality);
+
+    /*input check, if there is no product with the quality return and do nothing*/
+    if (k == 0)
+    {
+        discard_write(cds, version);
+        return;
+    }
+
+    times = (int*)malloc(k * sizeof(int));
+    if (times == NULL)
+    {
+        exit(1);
+    }
+    collect_quality_from_VersionedRankTree(version->rankTree, quality, times, 0);
+    for (i = 0; i < k; i++)
+        remove_from_ConcurrentVersion(cds, version, times[i], quality);
+    free(times);
+
+    publish_write(cds, version);
+}
+
+/* Function to get the ith ranked product (ith smallest quality) of the latest version, lock-free */
+/*  Time O(log(n)) */
+int GetIthRankProductConcurrent(ConcurrentDataStructure* cds, ConcurrentReader* reader, int i)
+{
+    ConcurrentVersion* version = pin_version(cds, reader);
+    int time = -1;
+
+    /* Input check: If i is less than or equal to 0, or greater than the number of products, return -1 */
+    if (i > 0 && i <= version->alive)
+        time = select_in_VersionedRankTree(version->rankTree, i);
+
+    unpin_version(reader);
+    return time;
+}
+
+/* Function to get the ith ranked product between two times of the latest version, lock-free */
+/*  Time O(log^2(n)) */
+int GetIthRankProductBetweenConcurrent(ConcurrentDataStructure* cds, ConcurrentReader* reader, int time1, int time2, int i)
+{
+    ConcurrentVersion* version;
+    int time;
+
+    /* Input check: If i is less than or equal to 0, or the range is empty, return -1 */
+    if (i <= 0 || time1 > time2)
+        return -1;
+
+    version = pin_version(cds, reader);
+    time = select_between_in_VersionedRankTree(version->rankTree, time1, time2, i);
+    unpin_version(reader);
+    return time;
+}
+
+/* Function to check if there is a product with the best quality in the latest version, lock-free */
+/*  Time O(1) */
+int ExistsConcurrent(ConcurrentDataStructure* cds, ConcurrentReader* reader)
+{
+    ConcurrentVersion* version = pin_version(cds, reader);
+    int exists = version->best_count > 0;
+
+    unpin_version(reader);
+    return exists;
+}
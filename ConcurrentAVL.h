@@ -0,0 +1,108 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "AVL.h"
+
+#define CONCURRENT_MAX_READERS 128      /* Maximum number of reader threads registered at once */
+#define CONCURRENT_EPOCHS 3             /* Nodes retired in epoch e are freed once the global epoch reaches e + 2 */
+
+/* Node of a persistent AVL tree sorted by time. Used for the time tree (time -> quality)
+   and for the inner time trees of the rank index. Published nodes are never modified, an update copies them */
+typedef struct VersionedTimeNode
+{
+    int time;                           /* Time value of the product, the key of the tree */
+    int quality;                        /* Quality value of the product, 0 in the inner trees */
+    int height;                         /* Height of the node */
+    int size;                           /* Size of the subtree rooted at this node */
+    unsigned long stamp;                /* Update that created the node, only that update may modify it */
+    struct VersionedTimeNode* left;     /* Pointer to the left child of the node */
+    struct VersionedTimeNode* right;    /* Pointer to the right child of the node */
+} VersionedTimeNode;
+
+/* Node of the persistent rank index, a weight balanced tree sorted by (quality, time) like RankTree */
+typedef struct VersionedRankNode
+{
+    int time;                           /* Time value of the product */
+    int quality;                        /* Quality value of the product */
+    int alive;                          /* 0 once the product was removed, the node is then kept only for the shape */
+    int size;                           /* Number of nodes (alive or not) in the subtree */
+    unsigned long stamp;                /* Update that created the node, only that update may modify it */
+    struct VersionedRankNode* left;     /* Pointer to the left child of the node */
+    struct VersionedRankNode* right;    /* Pointer to the right child of the node */
+    VersionedTimeNode* times;           /* Persistent tree of the times of every alive product in the subtree */
+} VersionedRankNode;
+
+/* An immutable snapshot of the data structure, a writer publishes a new one after every update */
+typedef struct ConcurrentVersion
+{
+    VersionedTimeNode* timeTree;        /* Products sorted by time */
+    VersionedRankNode* rankTree;        /* Products sorted by (quality, time) with the times of every subtree */
+    int alive;                          /* Number of products */
+    int dead;                           /* Number of removed products still kept as nodes in the rank tree */
+    int best_count;                     /* Number of products with the best quality */
+    unsigned long stamp;                /* Update that created the version */
+} ConcurrentVersion;
+
+/* Epoch announced by a reader thread, every slot fills its own cache line */
+typedef struct ConcurrentReader
+{
+    atomic_ulong epoch;                 /* 2 * epoch + 1 while the reader is inside a query, 0 otherwise */
+    atomic_int in_use;                  /* 1 while a thread owns the slot */
+    char padding[64 - sizeof(atomic_ulong) - sizeof(atomic_int)];
+} ConcurrentReader;
+
+/* Nodes unlinked by the writers, waiting until no reader can still see them */
+typedef struct RetiredNode
+{
+    NodePool* pool;                     /* Pool the node is released to */
+    void* node;                         /* The retired node */
+} RetiredNode;
+
+typedef struct RetiredList
+{
+    RetiredNode* nodes;                 /* Retired nodes of one epoch */
+    size_t count;                       /* Number of retired nodes */
+    size_t capacity;                    /* Number of nodes the array can hold */
+} RetiredList;
+
+/* A data structure with lock-free readers. Writers are serialized by write_lock, copy the root-to-leaf paths
+   they modify and publish a new version atomically. Readers pin the current epoch and read one version,
+   old nodes are freed by epoch based reclamation */
+typedef struct ConcurrentDataStructure
+{
+    /* Read by every query */
+    _Atomic(ConcurrentVersion*) current; /* The latest published version */
+    atomic_ulong epoch;                 /* Global epoch, advanced by the writers */
+    ConcurrentReader* readers;          /* CONCURRENT_MAX_READERS reader slots */
+    atomic_int reader_slots;            /* Number of slots ever used, the writers only scan those */
+    char padding[64];                   /* Keeps the writer state below off the cache line of the fields above */
+
+    /* Owned by the writer holding write_lock */
+    pthread_mutex_t write_lock;         /* Serializes the updates */
+    int best_quality;                   /* save the best quality in the data structure */
+    unsigned long stamp;                /* Number of the update in progress */
+    NodePool versionPool;               /* Allocator of the versions */
+    NodePool timePool;                  /* Allocator of the time tree and inner tree nodes */
+    NodePool rankPool;                  /* Allocator of the rank index nodes */
+    RetiredList limbo[CONCURRENT_EPOCHS]; /* Retired nodes of the last epochs, indexed by epoch % CONCURRENT_EPOCHS */
+} ConcurrentDataStructure;
+
+
+/***** functions *****/
+ConcurrentDataStructure* InitConcurrent(int s);
+void DestroyConcurrent(ConcurrentDataStructure* cds);
+ConcurrentReader* RegisterConcurrentReader(ConcurrentDataStructure* cds);
+void UnregisterConcurrentReader(ConcurrentReader* reader);
+
+void AddProductConcurrent(ConcurrentDataStructure* cds, int time, int quality);
+void RemoveProductConcurrent(ConcurrentDataStructure* cds, int time);
+void RemoveQualityConcurrent(ConcurrentDataStructure* cds, int quality);
+
+int GetIthRankProductConcurrent(ConcurrentDataStructure* cds, ConcurrentReader* reader, int i);
+int GetIthRankProductBetweenConcurrent(ConcurrentDataStructure* cds, ConcurrentReader* reader, int time1, int time2, int i);
+int ExistsConcurrent(ConcurrentDataStructure* cds, ConcurrentReader* reader);
+
+#endif
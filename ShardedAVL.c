@@ -0,0 +1,384 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "ShardedAVL.h"
+
+/***** functions *****/
+static int shard_of_time(ShardedDataStructure* sds, int time);
+static int shard_size(Shard* shard);
+static int shard_is_skewed(ShardedDataStructure* sds, int size);
+static int shard_range(ShardedDataStructure* sds, int s, int time1, int time2, int* range1, int* range2);
+static int select_in_Shards(ShardedDataStructure* sds, int first, int last, int time1, int time2, int i);
+static void redistribute_Shards(ShardedDataStructure* sds);
+
+
+/***** functions *****/
+
+/* Function to find the shard that holds a given time */
+/*  Time O(log(number of shards)) */
+static int shard_of_time(ShardedDataStructure* sds, int time)
+{
+    int lo = 0;
+    int hi = sds->shard_count - 1;
+    int mid;
+
+    /* Find the last shard whose lower bound is at most the time */
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo + 1) / 2;
+        if (sds->shards[mid].lower <= time)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Function to get the number of products of a shard, its lock must be held */
+/*  Time O(1) */
+static int shard_size(Shard* shard)
+{
+    return shard->ds.timeTree != NULL ? shard->ds.timeTree->size : 0;
+}
+
+/* Function to check if a shard of a given size holds much more than its share of the products.
+   It is compared with the average of the other shards, the average of all of them would include its own size */
+/*  Time O(1) */
+static int shard_is_skewed(ShardedDataStructure* sds, int size)
+{
+    long others;
+
+    /* A single shard has nothing to move its products to */
+    if (sds->shard_count < 2)
+        return 0;
+
+    others = atomic_load(&sds->products) - size;
+    return size > 2 * (others / (sds->shard_count - 1)) + SHARD_REBALANCE_MIN;
+}
+
+/* Function to clip a time range to a shard. A shard that lies entirely inside the range gets the whole
+   time range, its rank queries then use the quality index instead of the rank index. Returns 0 if they do not overlap */
+/*  Time O(1) */
+static int shard_range(ShardedDataStructure* sds, int s, int time1, int time2, int* range1, int* range2)
+{
+    int lower = sds->shards[s].lower;
+    int upper = s + 1 < sds->shard_count ? sds->shards[s + 1].lower - 1 : INT_MAX;
+
+    if (time2 < lower || time1 > upper)
+        return 0;
+
+    if (time1 <= lower && time2 >= upper)
+    {
+        *range1 = INT_MIN;
+        *range2 = INT_MAX;
+    }
+    else
+    {
+        *range1 = time1;
+        *range2 = time2;
+    }
+    return 1;
+}
+
+/* Function to get the ith ranked product between two times across the shards first..last, their locks must be held.
+   Every shard keeps a window of its ranks that may hold the answer. The middle product of the largest window is
+   counted in every shard, which tells on which side of it the answer is, and the windows shrink to that side */
+/*  Time O(k^2*log^3(n)) for k shards, O(k^2*log^2(n)) over the whole time range */
+static int select_in_Shards(ShardedDataStructure* sds, int first, int last, int time1, int time2, int i)
+{
+    int range1[SHARDED_MAX_SHARDS], range2[SHARDED_MAX_SHARDS];
+    int lo[SHARDED_MAX_SHARDS], hi[SHARDED_MAX_SHARDS], counts[SHARDED_MAX_SHARDS];
+    int total = 0, below, pivot, rank, time, quality, s;
+
+    /* Start with the whole range of every shard */
+    for (s = first; s <= last; s++)
+    {
+        lo[s] = 0;
+        hi[s] = 0;
+        if (shard_range(sds, s, time1, time2, &range1[s], &range2[s]))
+            hi[s] = CountProductsUpTo(sds->shards[s].ds, range1[s], range2[s], INT_MAX, INT_MAX);
+        total += hi[s];
+    }
+
+    /* Input check: If i is less than or equal to 0, or greater than the number of products in the range, return -1 */
+    if (i <= 0 || i > total)
+        return -1;
+
+    while (1)
+    {
+        /* The pivot is the middle product of the largest window */
+        pivot = first;
+        for (s = first + 1; s <= last; s++)
+            if (hi[s] - lo[s] > hi[pivot] - lo[pivot])
+                pivot = s;
+        rank = lo[pivot] + (hi[pivot] - lo[pivot]) / 2;
+        time = GetIthRankProductKey(sds->shards[pivot].ds, range1[pivot], range2[pivot], rank + 1, &quality);
+
+        /* Count the products of every shard that rank up to the pivot */
+        below = 0;
+        for (s = first; s <= last; s++)
+        {
+            if (s == pivot)
+                counts[s] = rank + 1;
+            else if (hi[s] > lo[s])
+                counts[s] = CountProductsUpTo(sds->shards[s].ds, range1[s], range2[s], quality, time);
+            else
+                counts[s] = lo[s];
+            below += counts[s];
+        }
+
+        /* If exactly i products rank up to the pivot, the pivot is the answer */
+        if (below == i)
+            return time;
+
+        /* Otherwise keep the side of the pivot that holds the answer, the pivot itself is dropped */
+        for (s = first; s <= last; s++)
+        {
+            if (below > i)
+            {
+                if (s == pivot)
+                    hi[s] = rank;
+                else if (counts[s] < hi[s])
+                    hi[s] = counts[s];
+            }
+            else if (counts[s] > lo[s])
+                lo[s] = counts[s];
+        }
+    }
+}
+
+/* Function to move the boundaries so that every shard holds the same number of products, the layout lock must be held for writing */
+/*  Time O(n*log(n)) */
+static void redistribute_Shards(ShardedDataStructure* sds)
+{
+    int* times;
+    int* qualities;
+    size_t n = 0, start, end, s;
+
+    for (s = 0; s < (size_t)sds->shard_count; s++)
+        n += (size_t)shard_size(&sds->shards[s]);
+
+    /* Too few products to give each shard one */
+    if (n < (size_t)sds->shard_count)
+        return;
+
+    times = (int*)malloc(2 * n * sizeof(int));
+    if (times == NULL)
+    {
+        exit(1);
+    }
+    qualities = times + n;
+
+    /* The shards hold consecutive time ranges, so listing them in order gives every product in time order */
+    start = 0;
+    for (s = 0; s < (size_t)sds->shard_count; s++)
+        start += GetProductsByTime(sds->shards[s].ds, times + start, qualities + start);
+
+    /* Empty every shard and give it the next n / shard_count products */
+    for (s = 0; s < (size_t)sds->shard_count; s++)
+    {
+        start = s * n / sds->shard_count;
+        end = (s + 1) * n / sds->shard_count;
+        sds->shards[s].lower = s == 0 ? INT_MIN : times[start];
+        RemoveTimeRange(&sds->shards[s].ds, INT_MIN, INT_MAX);
+        AddProductsBulk(&sds->shards[s].ds, times + start, qualities + start, end - start);
+    }
+    atomic_fetch_add(&sds->rebalances, 1);
+
+    /* Free the memory allocated for the arrays */
+    free(times);
+}
+
+
+/*************************************************/
+
+/* Initialize a sharded data structure with a given value. The shards start with equal time ranges over the
+   non negative times, the first one also takes the negative times. The times in use are usually much smaller,
+   so the first shard gets skewed after SHARD_REBALANCE_MIN products and the first rebalance moves the boundaries to them */
+/*  Time O(number of shards) */
+ShardedDataStructure* InitSharded(int s, int shard_count, const InitOptions* options)
+{
+    ShardedDataStructure* sds;
+    int i;
+
+    /* Input check: keep the number of shards in [1, SHARDED_MAX_SHARDS] */
+    if (shard_count < 1)
+        shard_count = 1;
+    if (shard_count > SHARDED_MAX_SHARDS)
+        shard_count = SHARDED_MAX_SHARDS;
+
+    sds = (ShardedDataStructure*)malloc(sizeof(ShardedDataStructure));
+    if (sds == NULL)
+    {
+        exit(1);
+    }
+    sds->shards = (Shard*)malloc(shard_count * sizeof(Shard));
+    if (sds->shards == NULL)
+    {
+        exit(1);
+    }
+
+    sds->best_quality = s;
+    sds->shard_count = shard_count;
+    pthread_rwlock_init(&sds->layout_lock, NULL);
+    atomic_init(&sds->products, 0);
+    atomic_init(&sds->rebalances, 0);
+
+    for (i = 0; i < shard_count; i++)
+    {
+        sds->shards[i].ds = InitWithOptions(s, options);
+        pthread_rwlock_init(&sds->shards[i].lock, NULL);
+        sds->shards[i].lower = i == 0 ? INT_MIN : (int)((long long)INT_MAX * i / shard_count);
+    }
+    return sds;
+}
+
+/* Release a sharded data structure, no thread may use it anymore */
+/*  Time O(number of slabs) */
+void DestroySharded(ShardedDataStructure* sds)
+{
+    int i;
+
+    for (i = 0; i < sds->shard_count; i++)
+    {
+        Destroy(&sds->shards[i].ds);
+        pthread_rwlock_destroy(&sds->shards[i].lock);
+    }
+    pthread_rwlock_destroy(&sds->layout_lock);
+    free(sds->shards);
+    free(sds);
+}
+
+/* Move the shard boundaries so that every shard holds the same number of products.
+   Called automatically once a shard holds much more than its share */
+/*  Time O(n*log(n)) */
+void RebalanceShards(ShardedDataStructure* sds)
+{
+    pthread_rwlock_wrlock(&sds->layout_lock);
+    redistribute_Shards(sds);
+    pthread_rwlock_unlock(&sds->layout_lock);
+}
+
+/* Add a product to the sharded data structure, only the shard of its time is locked */
+/*  Time O(log(n)), plus O(n*log(n)) for a rebalance amortized over Omega(n / number of shards) additions */
+void AddProductSharded(ShardedDataStructure* sds, int time, int quality)
+{
+    Shard* shard;
+    int old_size, size;
+
+    pthread_rwlock_rdlock(&sds->layout_lock);
+    shard = &sds->shards[shard_of_time(sds, time)];
+
+    pthread_rwlock_wrlock(&shard->lock);
+    old_size = shard_size(shard);
+    AddProduct(&shard->ds, time, quality);
+    size = shard_size(shard);
+    pthread_rwlock_unlock(&shard->lock);
+
+    if (size > old_size)
+        atomic_fetch_add(&sds->products, 1);
+    pthread_rwlock_unlock(&sds->layout_lock);
+
+    /* If the shard got skewed, rebalance once no operation is running. Another thread may have done it meanwhile */
+    if (size > old_size && shard_is_skewed(sds, size))
+    {
+        pthread_rwlock_wrlock(&sds->layout_lock);
+        shard = &sds->shards[shard_of_time(sds, time)];
+        if (shard_is_skewed(sds, shard_size(shard)))
+            redistribute_Shards(sds);
+        pthread_rwlock_unlock(&sds->layout_lock);
+    }
+}
+
+/* Remove a product from the sharded data structure, only the shard of its time is locked */
+/*  Time O(log(n)) */
+void RemoveProductSharded(ShardedDataStructure* sds, int time)
+{
+    Shard* shard;
+    int old_size;
+
+    pthread_rwlock_rdlock(&sds->layout_lock);
+    shard = &sds->shards[shard_of_time(sds, time)];
+
+    pthread_rwlock_wrlock(&shard->lock);
+    old_size = shard_size(shard);
+    RemoveProduct(&shard->ds, time);
+    if (shard_size(shard) < old_size)
+        atomic_fetch_sub(&sds->products, 1);
+    pthread_rwlock_unlock(&shard->lock);
+
+    pthread_rwlock_unlock(&sds->layout_lock);
+}
+
+/* Remove every product with a given quality, one shard after the other */
+/*  Time O(number of shards*log(n) + k*log(n/k + 1)) */
+void RemoveQualitySharded(ShardedDataStructure* sds, int quality)
+{
+    Shard* shard;
+    int old_size, i;
+
+    pthread_rwlock_rdlock(&sds->layout_lock);
+    for (i = 0; i < sds->shard_count; i++)
+    {
+        shard = &sds->shards[i];
+        pthread_rwlock_wrlock(&shard->lock);
+        old_size = shard_size(shard);
+        RemoveQuality(&shard->ds, quality);
+        atomic_fetch_sub(&sds->products, old_size - shard_size(shard));
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    pthread_rwlock_unlock(&sds->layout_lock);
+}
+
+/* Function to get the ith ranked product (ith smallest quality) across every shard */
+/*  Time O(k^2*log^2(n)) for k shards */
+int GetIthRankProductSharded(ShardedDataStructure* sds, int i)
+{
+    return GetIthRankProductBetweenSharded(sds, INT_MIN, INT_MAX, i);
+}
+
+/* Function to get the ith ranked product between two times, only the shards that overlap the range are locked */
+/*  Time O(log^2(n)) for one shard, O(k^2*log^3(n)) for k shards */
+int GetIthRankProductBetweenSharded(ShardedDataStructure* sds, int time1, int time2, int i)
+{
+    int first, last, s, time;
+
+    /* Input check: If i is less than or equal to 0, or the range is empty, return -1 */
+    if (i <= 0 || time1 > time2)
+        return -1;
+
+    pthread_rwlock_rdlock(&sds->layout_lock);
+    first = shard_of_time(sds, time1);
+    last = shard_of_time(sds, time2);
+
+    /* Lock the shards in order, every thread takes them in the same order */
+    for (s = first; s <= last; s++)
+        pthread_rwlock_rdlock(&sds->shards[s].lock);
+
+    if (first == last)
+        time = GetIthRankProductBetween(sds->shards[first].ds, time1, time2, i);
+    else
+        time = select_in_Shards(sds, first, last, time1, time2, i);
+
+    for (s = first; s <= last; s++)
+        pthread_rwlock_unlock(&sds->shards[s].lock);
+    pthread_rwlock_unlock(&sds->layout_lock);
+    return time;
+}
+
+/* Function to check if a product with the best quality exists in any shard */
+/*  Time O(number of shards) */
+int ExistsSharded(ShardedDataStructure* sds)
+{
+    int exists = 0;
+    int i;
+
+    pthread_rwlock_rdlock(&sds->layout_lock);
+    for (i = 0; i < sds->shard_count && !exists; i++)
+    {
+        pthread_rwlock_rdlock(&sds->shards[i].lock);
+        exists = Exists(sds->shards[i].ds);
+        pthread_rwlock_unlock(&sds->shards[i].lock);
+    }
+    pthread_rwlock_unlock(&sds->layout_lock);
+    return exists;
+}
@@ -0,0 +1,46 @@
+#ifndef SHARDED_AVL_H
+#define SHARDED_AVL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "AVL.h"
+
+#define SHARDED_MAX_SHARDS 64           /* Maximum number of shards of a sharded data structure */
+#define SHARD_REBALANCE_MIN 1024        /* A shard is skewed once it holds this many products more than twice the average of the other shards */
+
+/* One time range of a sharded data structure */
+typedef struct Shard
+{
+    DataStructure ds;                   /* The products with a time in [lower, lower of the next shard) */
+    pthread_rwlock_t lock;              /* Taken for writing by the updates of the shard, for reading by the queries */
+    int lower;                          /* Smallest time of the shard, INT_MIN for the first shard */
+} Shard;
+
+/* Products partitioned by time range across independent data structures, each with its own lock,
+   so updates of different time ranges run in parallel. The boundaries move when a shard gets skewed */
+typedef struct ShardedDataStructure
+{
+    int best_quality;                   /* save the best quality in the data structure */
+    int shard_count;                    /* Number of shards */
+    Shard* shards;                      /* The shards in time order */
+    pthread_rwlock_t layout_lock;       /* Taken for reading by every operation, for writing while the boundaries move */
+    atomic_long products;               /* Number of products in all the shards */
+    atomic_long rebalances;             /* Number of times the boundaries moved */
+} ShardedDataStructure;
+
+
+/***** functions *****/
+ShardedDataStructure* InitSharded(int s, int shard_count, const InitOptions* options);
+void DestroySharded(ShardedDataStructure* sds);
+void RebalanceShards(ShardedDataStructure* sds);
+
+void AddProductSharded(ShardedDataStructure* sds, int time, int quality);
+void RemoveProductSharded(ShardedDataStructure* sds, int time);
+void RemoveQualitySharded(ShardedDataStructure* sds, int quality);
+
+int GetIthRankProductSharded(ShardedDataStructure* sds, int i);
+int GetIthRankProductBetweenSharded(ShardedDataStructure* sds, int time1, int time2, int i);
+int ExistsSharded(ShardedDataStructure* sds);
+
+#endif
@@ -0,0 +1,740 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../AVL.h"
+#include "../AVLGeneric.h"
+
+/* Replays a mix of operations on a preloaded data structure and reports the throughput and latency of every operation.
+
+   usage: avl_bench [-n sizes] [-o ops] [-m mix] [-d distribution] [-t theta] [-q qualities] [-i index] [-b balance] [-R] [-H] [-L] [-A] [-G] [-s seed]
+     -n  comma separated preload sizes, default 1000,10000,100000,1000000
+     -o  number of replayed operations per size, default 1000000
+     -m  weights of the operations, default add=25,remove=25,quality=1,rank=25,between=20,exists=4
+     -d  key distribution: uniform, zipf or monotonic, default uniform
+     -t  skew of the zipf distribution, default 0.99
+     -q  number of distinct qualities, default 100000
+     -i  quality index: avl or bplus, default avl
+     -b  balancing scheme of the time tree: avl, wavl, rb or treap, default avl
+     -R  keep the rank index: GetIthRankProductBetween in O(log^2(n)), every update in O(log^2(n)) amortized
+     -H  back the node slabs with huge pages
+     -L  lazy delete mode: RemoveProduct only marks the products removed
+     -A  measure ingestion instead: n products added one by one with increasing times (appended along the right spine),
+         with 10% late arrivals, with the same times shuffled (a full descent each), and with one AddProductsBulk
+     -G  compare the engine of AVLGeneric.h generated for int times and qualities with DataStructure instead: n products
+         added in random order, n ranks, n CountBetween windows and the n removals
+     -s  random seed, default 1 */
+
+#define OP_ADD 0
+#define OP_REMOVE 1
+#define OP_QUALITY 2
+#define OP_RANK 3
+#define OP_BETWEEN 4
+#define OP_EXISTS 5
+#define OP_COUNT 6
+
+#define GENERIC_ADD 0
+#define GENERIC_RANK 1
+#define GENERIC_COUNT_BETWEEN 2
+#define GENERIC_REMOVE 3
+#define GENERIC_PHASES 4
+
+#define DIST_UNIFORM 0
+#define DIST_ZIPF 1
+#define DIST_MONOTONIC 2
+
+static const char* op_names[OP_COUNT] = { "add", "remove", "quality", "rank", "between", "exists" };
+static const char* op_functions[OP_COUNT] = { "AddProduct", "RemoveProduct", "RemoveQuality", "GetIthRankProduct", "GetIthRankProductBetween", "Exists" };
+static const char* balance_names[4] = { "avl", "wavl", "rb", "treap" };
+static const char* generic_phase_names[GENERIC_PHASES] = { "AddProduct", "GetIthRankProduct", "CountBetween", "RemoveProduct" };
+
+/* The engine of AVLGeneric.h for the int times and qualities of DataStructure, -G compares the two */
+AVL_GENERIC_DEFINE(Int, int, int, AVL_GENERIC_LESS, AVL_GENERIC_LESS)
+
+typedef struct Zipf
+{
+    double items;                   /* Number of keys */
+    double theta;                   /* Skew, the key of rank r is drawn with probability proportional to 1/r^theta */
+    double alpha;
+    double zetan;
+    double eta;
+    double zeta2;
+} Zipf;
+
+typedef struct Config
+{
+    long sizes[32];                 /* Preload sizes */
+    int size_count;
+    long ops;                       /* Replayed operations per size */
+    int weights[OP_COUNT];          /* Weight of every operation in the mix */
+    int distribution;
+    double theta;
+    int qualities;
+    int quality_index;
+    int balance;                    /* -b: balancing scheme of the time tree */
+    int rank_index;                 /* -R: keep the rank index */
+    int huge_pages;
+    int lazy_delete;                /* -L: RemoveProduct only marks the products removed */
+    int ingest;                     /* -A: measure ingestion instead of the mix */
+    int generic;                    /* -G: compare the engine of AVLGeneric.h with DataStructure instead of the mix */
+    unsigned long seed;
+} Config;
+
+static unsigned long long rng_state;
+
+/* xorshift64* generator, the benchmark does not depend on the quality of rand() */
+static unsigned long long next_random(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double random_unit(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Sum of 1/i^theta for i = 1..n, exact for the first million terms and integrated for the rest */
+static double zeta(double n, double theta)
+{
+    double sum = 0;
+    double i;
+    double exact = n < 1e6 ? n : 1e6;
+
+    for (i = 1; i <= exact; i++)
+        sum += 1.0 / pow(i, theta);
+    if (n > exact)
+        sum += (pow(n, 1 - theta) - pow(exact, 1 - theta)) / (1 - theta) + 0.5 * (pow(n, -theta) - pow(exact, -theta));
+    return sum;
+}
+
+/* Zipfian generator of Gray et al., as used by YCSB */
+static void init_zipf(Zipf* zipf, double items, double theta)
+{
+    zipf->items = items;
+    zipf->theta = theta;
+    zipf->zeta2 = zeta(2, theta);
+    zipf->zetan = zeta(items, theta);
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->eta = (1 - pow(2.0 / items, 1 - theta)) / (1 - zipf->zeta2 / zipf->zetan);
+}
+
+static long next_zipf(Zipf* zipf)
+{
+    double u = random_unit();
+    double uz = u * zipf->zetan;
+    long rank;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, zipf->theta))
+        return 1;
+    rank = (long)(zipf->items * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha));
+    return rank < (long)zipf->items ? rank : (long)zipf->items - 1;
+}
+
+/* Spread the hot ranks over the key space so they are not all neighbours in the time tree */
+static long scramble(long rank, long items)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        hash ^= (unsigned long long)(rank >> (8 * i)) & 0xff;
+        hash *= 1099511628211ULL;
+    }
+    return (long)(hash % (unsigned long long)items);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(double* sorted, long n, double p)
+{
+    long index = (long)(p * (n - 1) + 0.5);
+
+    return n > 0 ? sorted[index] : 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: avl_bench [-n sizes] [-o ops] [-m mix] [-d uniform|zipf|monotonic] [-t theta] [-q qualities] [-i avl|bplus] [-b avl|wavl|rb|treap] [-R] [-H] [-L] [-A] [-G] [-s seed]\n");
+    exit(2);
+}
+
+static void parse_mix(Config* config, const char* mix)
+{
+    char buffer[256];
+    char* item;
+    char* value;
+    int op;
+
+    memset(config->weights, 0, sizeof(config->weights));
+    strncpy(buffer, mix, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    for (item = strtok(buffer, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        value = strchr(item, '=');
+        if (value == NULL)
+            usage();
+        *value++ = '\0';
+        for (op = 0; op < OP_COUNT && strcmp(item, op_names[op]) != 0; op++)
+            ;
+        if (op == OP_COUNT)
+            usage();
+        config->weights[op] = atoi(value);
+    }
+}
+
+static void parse_args(Config* config, int argc, char** argv)
+{
+    char* item;
+    int i;
+
+    config->size_count = 0;
+    config->ops = 1000000;
+    parse_mix(config, "add=25,remove=25,quality=1,rank=25,between=20,exists=4");
+    config->distribution = DIST_UNIFORM;
+    config->theta = 0.99;
+    config->qualities = 100000;
+    config->quality_index = QUALITY_INDEX_AVL;
+    config->balance = BALANCE_AVL;
+    config->rank_index = 0;
+    config->huge_pages = 0;
+    config->lazy_delete = 0;
+    config->ingest = 0;
+    config->generic = 0;
+    config->seed = 1;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-H") == 0)
+        {
+            config->huge_pages = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-R") == 0)
+        {
+            config->rank_index = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-L") == 0)
+        {
+            config->lazy_delete = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-A") == 0)
+        {
+            config->ingest = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-G") == 0)
+        {
+            config->generic = 1;
+            continue;
+        }
+        if (argv[i][0] != '-' || i + 1 >= argc)
+            usage();
+        switch (argv[i][1])
+        {
+        case 'n':
+            for (item = strtok(argv[++i], ","); item != NULL && config->size_count < 32; item = strtok(NULL, ","))
+                config->sizes[config->size_count++] = (long)atof(item);
+            break;
+        case 'o':
+            config->ops = (long)atof(argv[++i]);
+            break;
+        case 'm':
+            parse_mix(config, argv[++i]);
+            break;
+        case 'd':
+            i++;
+            if (strcmp(argv[i], "uniform") == 0)
+                config->distribution = DIST_UNIFORM;
+            else if (strcmp(argv[i], "zipf") == 0)
+                config->distribution = DIST_ZIPF;
+            else if (strcmp(argv[i], "monotonic") == 0)
+                config->distribution = DIST_MONOTONIC;
+            else
+                usage();
+            break;
+        case 't':
+            config->theta = atof(argv[++i]);
+            break;
+        case 'q':
+            config->qualities = atoi(argv[++i]);
+            break;
+        case 'i':
+            i++;
+            if (strcmp(argv[i], "avl") == 0)
+                config->quality_index = QUALITY_INDEX_AVL;
+            else if (strcmp(argv[i], "bplus") == 0)
+                config->quality_index = QUALITY_INDEX_BPLUS;
+            else
+                usage();
+            break;
+        case 'b':
+            i++;
+            if (strcmp(argv[i], "avl") == 0)
+                config->balance = BALANCE_AVL;
+            else if (strcmp(argv[i], "wavl") == 0)
+                config->balance = BALANCE_WAVL;
+            else if (strcmp(argv[i], "rb") == 0)
+                config->balance = BALANCE_RED_BLACK;
+            else if (strcmp(argv[i], "treap") == 0)
+                config->balance = BALANCE_TREAP;
+            else
+                usage();
+            break;
+        case 's':
+            config->seed = strtoul(argv[++i], NULL, 10);
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (config->size_count == 0)
+    {
+        config->sizes[0] = 1000;
+        config->sizes[1] = 10000;
+        config->sizes[2] = 100000;
+        config->sizes[3] = 1000000;
+        config->size_count = 4;
+    }
+}
+
+/* Key generator shared by the preload and the replay */
+typedef struct Keys
+{
+    int distribution;
+    long space;                     /* Times are drawn from [0, space) */
+    Zipf zipf;
+    Zipf quality_zipf;
+    int qualities;
+    long next_time;                 /* Monotonic mode: next time to add */
+    long oldest_time;               /* Monotonic mode: oldest time that may still be stored */
+} Keys;
+
+static int next_time(Keys* keys)
+{
+    if (keys->distribution == DIST_ZIPF)
+        return (int)scramble(next_zipf(&keys->zipf), keys->space);
+    return (int)(next_random() % (unsigned long long)keys->space);
+}
+
+static int next_quality(Keys* keys)
+{
+    if (keys->distribution == DIST_ZIPF)
+        return (int)next_zipf(&keys->quality_zipf);
+    return (int)(next_random() % (unsigned long long)keys->qualities);
+}
+
+static void run_size(Config* config, long n)
+{
+    InitOptions options;
+    DataStructure ds;
+    Keys keys;
+    int* times;
+    int* qualities;
+    double* latencies[OP_COUNT];
+    long counts[OP_COUNT];
+    double totals[OP_COUNT];
+    int total_weight = 0;
+    long i, window;
+    int op, pick, time1, time2, rank;
+    double start, elapsed, all = 0;
+    volatile int sink = 0;
+
+    for (op = 0; op < OP_COUNT; op++)
+        total_weight += config->weights[op];
+    if (total_weight <= 0)
+        usage();
+
+    /* Times are drawn from a space four times the preload size, so about half of the removes hit */
+    keys.distribution = config->distribution;
+    keys.space = n * 4 > 1000 ? n * 4 : 1000;
+    if (keys.space > 2000000000L)
+        keys.space = 2000000000L;
+    keys.qualities = config->qualities;
+    if (config->distribution == DIST_ZIPF)
+    {
+        init_zipf(&keys.zipf, (double)keys.space, config->theta);
+        init_zipf(&keys.quality_zipf, (double)keys.qualities, config->theta);
+    }
+    keys.next_time = 0;
+    keys.oldest_time = 0;
+    window = keys.space / 100 > 1 ? keys.space / 100 : 1;
+
+    memset(&options, 0, sizeof(options));
+    options.huge_pages = config->huge_pages;
+    options.quality_index = config->quality_index;
+    options.lazy_delete = config->lazy_delete;
+    options.balance = config->balance;
+    options.rank_index = config->rank_index;
+    ds = InitWithOptions(0, &options);
+
+    /* Preload n products in one bulk load */
+    times = (int*)malloc((size_t)n * sizeof(int));
+    qualities = (int*)malloc((size_t)n * sizeof(int));
+    if (times == NULL || qualities == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++)
+    {
+        times[i] = config->distribution == DIST_MONOTONIC ? (int)keys.next_time++ : next_time(&keys);
+        qualities[i] = next_quality(&keys);
+    }
+    start = now_ns();
+    AddProductsBulk(&ds, times, qualities, (size_t)n);
+    printf("\nsize=%ld preload %.3f s\n", n, (now_ns() - start) / 1e9);
+    free(times);
+    free(qualities);
+
+    for (op = 0; op < OP_COUNT; op++)
+    {
+        latencies[op] = (double*)malloc((size_t)(config->ops + 1) * sizeof(double));
+        if (latencies[op] == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        counts[op] = 0;
+        totals[op] = 0;
+    }
+
+    /* Replay the mix, the arguments of every operation are drawn before its clock starts */
+    for (i = 0; i < config->ops; i++)
+    {
+        pick = (int)(next_random() % (unsigned long long)total_weight);
+        for (op = 0; pick >= config->weights[op]; op++)
+            pick -= config->weights[op];
+
+        switch (op)
+        {
+        case OP_ADD:
+            time1 = config->distribution == DIST_MONOTONIC ? (int)keys.next_time++ : next_time(&keys);
+            time2 = next_quality(&keys);
+            start = now_ns();
+            AddProduct(&ds, time1, time2);
+            break;
+        case OP_REMOVE:
+            if (config->distribution == DIST_MONOTONIC)
+                time1 = (int)(keys.oldest_time < keys.next_time ? keys.oldest_time++ : keys.oldest_time);
+            else
+                time1 = next_time(&keys);
+            start = now_ns();
+            RemoveProduct(&ds, time1);
+            break;
+        case OP_QUALITY:
+            time1 = next_quality(&keys);
+            start = now_ns();
+            RemoveQuality(&ds, time1);
+            break;
+        case OP_RANK:
+            rank = (int)(next_random() % (unsigned long long)(n + 1)) + 1;
+            start = now_ns();
+            sink += GetIthRankProduct(ds, rank);
+            break;
+        case OP_BETWEEN:
+            if (config->distribution == DIST_MONOTONIC)
+                time1 = (int)(keys.next_time - window - (long)(next_random() % (unsigned long long)(window + 1)));
+            else
+                time1 = next_time(&keys);
+            time2 = (int)(time1 + window);
+            rank = (int)(next_random() % 10) + 1;
+            start = now_ns();
+            sink += GetIthRankProductBetween(ds, time1, time2, rank);
+            break;
+        default:
+            start = now_ns();
+            sink += Exists(ds);
+            break;
+        }
+        elapsed = now_ns() - start;
+        latencies[op][counts[op]++] = elapsed;
+        totals[op] += elapsed;
+        all += elapsed;
+    }
+
+    printf("size=%ld ops=%ld distribution=%s index=%s balance=%s rank_index=%d\n", n, config->ops,
+        config->distribution == DIST_UNIFORM ? "uniform" : config->distribution == DIST_ZIPF ? "zipf" : "monotonic",
+        config->quality_index == QUALITY_INDEX_BPLUS ? "bplus" : "avl", balance_names[config->balance], config->rank_index);
+    printf("%-26s %10s %12s %10s %10s %10s\n", "operation", "count", "ops/s", "p50 ns", "p99 ns", "p999 ns");
+    for (op = 0; op < OP_COUNT; op++)
+    {
+        if (counts[op] == 0)
+        {
+            free(latencies[op]);
+            continue;
+        }
+        qsort(latencies[op], (size_t)counts[op], sizeof(double), compare_doubles);
+        printf("%-26s %10ld %12.0f %10.0f %10.0f %10.0f\n", op_functions[op], counts[op],
+            totals[op] > 0 ? counts[op] / (totals[op] / 1e9) : 0,
+            percentile(latencies[op], counts[op], 0.50),
+            percentile(latencies[op], counts[op], 0.99),
+            percentile(latencies[op], counts[op], 0.999));
+        free(latencies[op]);
+    }
+    printf("%-26s %10ld %12.0f\n", "total", config->ops, all > 0 ? config->ops / (all / 1e9) : 0);
+    (void)sink;
+
+    Destroy(&ds);
+}
+
+/* Adds the products one by one in the given order and returns the ns per product, or adds them with one AddProductsBulk */
+static double ingest(Config* config, const int* times, const int* qualities, long n, int bulk)
+{
+    InitOptions options;
+    DataStructure ds;
+    double start, elapsed;
+    long i;
+
+    memset(&options, 0, sizeof(options));
+    options.huge_pages = config->huge_pages;
+    options.quality_index = config->quality_index;
+    options.balance = config->balance;
+    options.rank_index = config->rank_index;
+    ds = InitWithOptions(0, &options);
+
+    start = now_ns();
+    if (bulk)
+        AddProductsBulk(&ds, times, qualities, (size_t)n);
+    else
+    {
+        for (i = 0; i < n; i++)
+            AddProduct(&ds, times[i], qualities[i]);
+    }
+    elapsed = now_ns() - start;
+
+    Destroy(&ds);
+    return elapsed / n;
+}
+
+/* Compares the ingestion of n products in increasing time order with the same products in other orders */
+static void run_ingest(Config* config, long n)
+{
+    Keys keys;
+    int* times;
+    int* qualities;
+    int* late;
+    long i, j;
+    int swap;
+
+    times = (int*)malloc((size_t)n * 3 * sizeof(int));
+    if (times == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    qualities = times + n;
+    late = qualities + n;
+
+    keys.distribution = config->distribution == DIST_ZIPF ? DIST_ZIPF : DIST_UNIFORM;
+    keys.qualities = config->qualities;
+    if (keys.distribution == DIST_ZIPF)
+        init_zipf(&keys.quality_zipf, (double)keys.qualities, config->theta);
+    for (i = 0; i < n; i++)
+    {
+        times[i] = (int)i;
+        qualities[i] = next_quality(&keys);
+    }
+
+    /* Late arrivals: every tenth time is swapped with one up to 16 places later, so it comes after larger times */
+    memcpy(late, times, (size_t)n * sizeof(int));
+    for (i = 0; i + 16 < n; i += 10)
+    {
+        j = i + 1 + (long)(next_random() % 16);
+        swap = late[i];
+        late[i] = late[j];
+        late[j] = swap;
+    }
+
+    printf("\nsize=%ld ingestion index=%s balance=%s rank_index=%d\n", n, config->quality_index == QUALITY_INDEX_BPLUS ? "bplus" : "avl",
+        balance_names[config->balance], config->rank_index);
+    printf("%-26s %12s\n", "order", "ns/product");
+    printf("%-26s %12.0f\n", "increasing", ingest(config, times, qualities, n, 0));
+    printf("%-26s %12.0f\n", "increasing, 10% late", ingest(config, late, qualities, n, 0));
+
+    /* Shuffle the times, every insertion then descends from the root */
+    for (i = n - 1; i > 0; i--)
+    {
+        j = (long)(next_random() % (unsigned long long)(i + 1));
+        swap = times[i];
+        times[i] = times[j];
+        times[j] = swap;
+    }
+    printf("%-26s %12.0f\n", "shuffled", ingest(config, times, qualities, n, 0));
+    printf("%-26s %12.0f\n", "AddProductsBulk", ingest(config, times, qualities, n, 1));
+
+    free(times);
+}
+
+/* Runs the phases of -G on a DataStructure with the options of the command line, stores the ns per operation of each */
+static void generic_phases_of_DataStructure(Config* config, const int* times, const int* qualities, const int* ranks, long n, double* ns)
+{
+    InitOptions options;
+    DataStructure ds;
+    volatile int sink = 0;
+    double start;
+    long i;
+
+    memset(&options, 0, sizeof(options));
+    options.huge_pages = config->huge_pages;
+    options.quality_index = config->quality_index;
+    options.balance = config->balance;
+    options.rank_index = config->rank_index;
+    ds = InitWithOptions(0, &options);
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+        AddProduct(&ds, times[i], qualities[i]);
+    ns[GENERIC_ADD] = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+        sink += GetIthRankProduct(ds, ranks[i]);
+    ns[GENERIC_RANK] = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+        sink += CountBetween(ds, times[i], times[i] + ranks[i] / 16);
+    ns[GENERIC_COUNT_BETWEEN] = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+        RemoveProduct(&ds, times[i]);
+    ns[GENERIC_REMOVE] = (now_ns() - start) / n;
+
+    (void)sink;
+    Destroy(&ds);
+}
+
+/* Runs the same phases on the engine of AVLGeneric.h generated for int times and qualities */
+static void generic_phases_of_IntDataStructure(const int* times, const int* qualities, const int* ranks, long n, double* ns)
+{
+    IntDataStructure ds;
+    volatile int sink = 0;
+    double start;
+    int time;
+    long i;
+
+    ds = InitInt(0);
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+        AddProductInt(&ds, times[i], qualities[i]);
+    ns[GENERIC_ADD] = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+    {
+        if (GetIthRankProductInt(ds, ranks[i], &time))
+            sink += time;
+    }
+    ns[GENERIC_RANK] = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+        sink += CountBetweenInt(ds, times[i], times[i] + ranks[i] / 16);
+    ns[GENERIC_COUNT_BETWEEN] = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+        RemoveProductInt(&ds, times[i]);
+    ns[GENERIC_REMOVE] = (now_ns() - start) / n;
+
+    (void)sink;
+    DestroyInt(&ds);
+}
+
+/* Compares the engine of AVLGeneric.h with DataStructure on the same n products in random order */
+static void run_generic(Config* config, long n)
+{
+    Keys keys;
+    double data_structure_ns[GENERIC_PHASES], generic_ns[GENERIC_PHASES];
+    int* times;
+    int* qualities;
+    int* ranks;
+    long i, j;
+    int swap, phase;
+
+    times = (int*)malloc((size_t)n * 3 * sizeof(int));
+    if (times == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    qualities = times + n;
+    ranks = qualities + n;
+
+    keys.distribution = config->distribution == DIST_ZIPF ? DIST_ZIPF : DIST_UNIFORM;
+    keys.qualities = config->qualities;
+    if (keys.distribution == DIST_ZIPF)
+        init_zipf(&keys.quality_zipf, (double)keys.qualities, config->theta);
+    for (i = 0; i < n; i++)
+    {
+        times[i] = (int)i;
+        qualities[i] = next_quality(&keys);
+        ranks[i] = 1 + (int)(next_random() % (unsigned long long)n);
+    }
+    for (i = n - 1; i > 0; i--)
+    {
+        j = (long)(next_random() % (unsigned long long)(i + 1));
+        swap = times[i];
+        times[i] = times[j];
+        times[j] = swap;
+    }
+
+    generic_phases_of_DataStructure(config, times, qualities, ranks, n, data_structure_ns);
+    generic_phases_of_IntDataStructure(times, qualities, ranks, n, generic_ns);
+
+    printf("\nsize=%ld AVLGeneric.h against DataStructure index=%s balance=%s rank_index=%d\n", n,
+        config->quality_index == QUALITY_INDEX_BPLUS ? "bplus" : "avl", balance_names[config->balance], config->rank_index);
+    printf("%-26s %14s %14s\n", "operation", "DataStructure", "AVLGeneric.h");
+    for (phase = 0; phase < GENERIC_PHASES; phase++)
+        printf("%-26s %11.0f ns %11.0f ns\n", generic_phase_names[phase], data_structure_ns[phase], generic_ns[phase]);
+
+    free(times);
+}
+
+int main(int argc, char** argv)
+{
+    Config config;
+    int i;
+
+    parse_args(&config, argc, argv);
+    rng_state = config.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (i = 0; i < config.size_count; i++)
+    {
+        if (config.ingest)
+            run_ingest(&config, config.sizes[i]);
+        else if (config.generic)
+            run_generic(&config, config.sizes[i]);
+        else
+            run_size(&config, config.sizes[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "../ConcurrentAVL.h"
+
+/* Measures how the read throughput scales with the number of reader threads while one writer keeps updating.
+   The concurrent data structure is compared with a DataStructure whose operations all take one mutex.
+
+   usage: avl_concurrent_bench [-n products] [-r readers] [-d seconds] [-w] [-s seed]
+     -n  number of preloaded products, default 100000
+     -r  largest number of reader threads, default the number of online processors
+     -d  duration of every run in seconds, default 1
+     -w  no writer thread, the readers run alone
+     -s  random seed, default 1 */
+
+#define MODE_LOCKED 0
+#define MODE_CONCURRENT 1
+
+typedef struct Shared
+{
+    int mode;
+    int products;                   /* Number of products kept in the data structure */
+    DataStructure ds;               /* Used by MODE_LOCKED behind lock */
+    pthread_mutex_t lock;
+    ConcurrentDataStructure* cds;   /* Used by MODE_CONCURRENT */
+    atomic_int stop;
+} Shared;
+
+typedef struct Worker
+{
+    Shared* shared;
+    pthread_t thread;
+    unsigned long long seed;
+    long operations;
+} Worker;
+
+/* xorshift64* generator, one per thread */
+static unsigned long long next_random(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Every fourth query is a range query over a tenth of the times, the others are rank queries */
+static void* reader_main(void* argument)
+{
+    Worker* worker = (Worker*)argument;
+    Shared* shared = worker->shared;
+    ConcurrentReader* reader = NULL;
+    int i, time1;
+
+    if (shared->mode == MODE_CONCURRENT)
+        reader = RegisterConcurrentReader(shared->cds);
+
+    while (!atomic_load_explicit(&shared->stop, memory_order_relaxed))
+    {
+        i = 1 + (int)(next_random(&worker->seed) % (unsigned long long)(shared->products / 2));
+        time1 = (int)(next_random(&worker->seed) % (unsigned long long)(2 * shared->products));
+
+        if (shared->mode == MODE_CONCURRENT)
+        {
+            if (worker->operations % 4 == 0)
+                GetIthRankProductBetweenConcurrent(shared->cds, reader, time1, time1 + shared->products / 5, 1 + i % 16);
+            else
+                GetIthRankProductConcurrent(shared->cds, reader, i);
+        }
+        else
+        {
+            pthread_mutex_lock(&shared->lock);
+            if (worker->operations % 4 == 0)
+                GetIthRankProductBetween(shared->ds, time1, time1 + shared->products / 5, 1 + i % 16);
+            else
+                GetIthRankProduct(shared->ds, i);
+            pthread_mutex_unlock(&shared->lock);
+        }
+        worker->operations++;
+    }
+
+    if (reader != NULL)
+        UnregisterConcurrentReader(reader);
+    return NULL;
+}
+
+/* Replaces a random product by a new one with a fresh time, the number of products stays the same */
+static void* writer_main(void* argument)
+{
+    Worker* worker = (Worker*)argument;
+    Shared* shared = worker->shared;
+    int next_time = 2 * shared->products;
+    int oldest_time = 0;
+    int quality;
+
+    while (!atomic_load_explicit(&shared->stop, memory_order_relaxed))
+    {
+        quality = (int)(next_random(&worker->seed) % 100000);
+        if (shared->mode == MODE_CONCURRENT)
+        {
+            AddProductConcurrent(shared->cds, next_time++, quality);
+            RemoveProductConcurrent(shared->cds, oldest_time++);
+        }
+        else
+        {
+            pthread_mutex_lock(&shared->lock);
+            AddProduct(&shared->ds, next_time++, quality);
+            RemoveProduct(&shared->ds, oldest_time++);
+            pthread_mutex_unlock(&shared->lock);
+        }
+        worker->operations += 2;
+    }
+    return NULL;
+}
+
+/* Runs the readers and the writer for a while and prints the throughputs */
+static void run(int mode, int products, int readers, int writer, double seconds, unsigned long seed)
+{
+    Shared shared;
+    InitOptions options;
+    Worker* workers;
+    unsigned long long state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    struct timespec pause = { 0, 10000000 };
+    double start, elapsed;
+    long reads = 0;
+    int i, count = readers + (writer ? 1 : 0);
+
+    memset(&shared, 0, sizeof(shared));
+    shared.mode = mode;
+    shared.products = products;
+    atomic_init(&shared.stop, 0);
+    pthread_mutex_init(&shared.lock, NULL);
+
+    /* Preload the products at the even times, the writer replaces them in time order */
+    if (mode == MODE_CONCURRENT)
+    {
+        shared.cds = InitConcurrent(0);
+        for (i = 0; i < products; i++)
+            AddProductConcurrent(shared.cds, 2 * i, (int)(next_random(&state) % 100000));
+    }
+    else
+    {
+        /* The mutex baseline keeps a rank index too, like the concurrent mode */
+        memset(&options, 0, sizeof(options));
+        options.rank_index = 1;
+        shared.ds = InitWithOptions(0, &options);
+        for (i = 0; i < products; i++)
+            AddProduct(&shared.ds, 2 * i, (int)(next_random(&state) % 100000));
+    }
+
+    workers = (Worker*)calloc(count, sizeof(Worker));
+    if (workers == NULL)
+    {
+        exit(1);
+    }
+
+    start = now_seconds();
+    for (i = 0; i < count; i++)
+    {
+        workers[i].shared = &shared;
+        workers[i].seed = state + i * 0x9E3779B97F4A7C15ULL;
+        pthread_create(&workers[i].thread, NULL, i < readers ? reader_main : writer_main, &workers[i]);
+    }
+
+    while (now_seconds() - start < seconds)
+        nanosleep(&pause, NULL);
+    atomic_store(&shared.stop, 1);
+    for (i = 0; i < count; i++)
+        pthread_join(workers[i].thread, NULL);
+    elapsed = now_seconds() - start;
+
+    for (i = 0; i < readers; i++)
+        reads += workers[i].operations;
+    printf("%-10s %7d %14.0f %14.0f %14.0f\n", mode == MODE_CONCURRENT ? "concurrent" : "locked", readers,
+        reads / elapsed, reads / elapsed / readers, writer ? workers[readers].operations / elapsed : 0.0);
+
+    if (mode == MODE_CONCURRENT)
+        DestroyConcurrent(shared.cds);
+    else
+        Destroy(&shared.ds);
+    pthread_mutex_destroy(&shared.lock);
+    free(workers);
+}
+
+int main(int argc, char** argv)
+{
+    int products = 100000;
+    int max_readers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = 1;
+    int writer = 1;
+    unsigned long seed = 1;
+    int i, readers, mode;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            products = (int)atof(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            max_readers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0)
+            writer = 0;
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 10);
+        else
+        {
+            fprintf(stderr, "usage: avl_concurrent_bench [-n products] [-r readers] [-d seconds] [-w] [-s seed]\n");
+            return 1;
+        }
+    }
+    if (products < 10 || max_readers < 1 || max_readers > CONCURRENT_MAX_READERS)
+    {
+        fprintf(stderr, "avl_concurrent_bench: need at least 10 products and 1 to %d readers\n", CONCURRENT_MAX_READERS);
+        return 1;
+    }
+
+    printf("%-10s %7s %14s %14s %14s\n", "mode", "readers", "reads/s", "reads/s/thread", "writes/s");
+    for (mode = MODE_LOCKED; mode <= MODE_CONCURRENT; mode++)
+    {
+        for (readers = 1; readers < max_readers; readers *= 2)
+            run(mode, products, readers, writer, seconds, seed);
+        run(mode, products, max_readers, writer, seconds, seed);
+    }
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../ConcurrentAVL.h"
+
+/* Test of the concurrent mode. ConcurrentDataStructure is first compared with DataStructure on one thread,
+   then readers query it while a writer updates it. The readers check that every answer is a possible one,
+   and once they stop the products are compared with a DataStructure that got the same updates.
+   make test also runs it built with ThreadSanitizer, which reports the data races of the readers and the writer.
+
+   usage: test_concurrent [seed] */
+
+#define TIMES 4096                  /* The products have the times 0 .. TIMES - 1 */
+#define QUALITIES 100               /* and the qualities 0 .. QUALITIES - 1 */
+#define BEST_QUALITY 7              /* The quality s of Init, Exists looks for it */
+#define DIFFERENTIAL_STEPS 60000    /* Updates of the single thread comparison */
+#define CHECK_EVERY 97              /* Updates between two comparisons of the queries */
+#define READERS 3                   /* Reader threads of the stress test */
+#define WRITER_STEPS 40000          /* Updates of the writer thread */
+
+typedef struct Shared
+{
+    ConcurrentDataStructure* cds;
+    atomic_int stop;                /* Set once the writer is done */
+} Shared;
+
+typedef struct Reader
+{
+    Shared* shared;
+    unsigned long long seed;
+    long queries;
+    int failed;                     /* 1 once an impossible answer was seen */
+} Reader;
+
+/* xorshift64* generator, every thread has its own state */
+static unsigned long long next_random(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Random integer in [lo, hi] */
+static int random_between(unsigned long long* state, int lo, int hi)
+{
+    return lo + (int)(next_random(state) % (unsigned long long)(hi - lo + 1));
+}
+
+/* Apply one random update to both data structures */
+static void random_update(ConcurrentDataStructure* cds, DataStructure* ds, unsigned long long* state)
+{
+    int op = random_between(state, 0, 99);
+    int time = random_between(state, 0, TIMES - 1);
+    int quality = random_between(state, 0, QUALITIES - 1);
+
+    if (op < 55)
+    {
+        AddProductConcurrent(cds, time, quality);
+        AddProduct(ds, time, quality);
+    }
+    else if (op < 99)
+    {
+        RemoveProductConcurrent(cds, time);
+        RemoveProduct(ds, time);
+    }
+    else
+    {
+        RemoveQualityConcurrent(cds, quality);
+        RemoveQuality(ds, quality);
+    }
+}
+
+/* Compare the queries of both data structures, returns 0 or 1 on a difference */
+static int compare(ConcurrentDataStructure* cds, DataStructure ds, unsigned long long* state)
+{
+    ConcurrentReader* reader = RegisterConcurrentReader(cds);
+    int i, k, time1, time2, failed = 0;
+
+    for (i = 0; i <= CountBetween(ds, 0, TIMES - 1) + 1; i++)
+        failed |= GetIthRankProduct(ds, i) != GetIthRankProductConcurrent(cds, reader, i);
+    for (k = 0; k < 32; k++)
+    {
+        time1 = random_between(state, -1, TIMES);
+        time2 = time1 + random_between(state, -1, TIMES / 4);
+        i = random_between(state, 0, 40);
+        failed |= GetIthRankProductBetween(ds, time1, time2, i) != GetIthRankProductBetweenConcurrent(cds, reader, time1, time2, i);
+    }
+    failed |= Exists(ds) != ExistsConcurrent(cds, reader);
+
+    UnregisterConcurrentReader(reader);
+    return failed;
+}
+
+/* Compare ConcurrentDataStructure with DataStructure on one thread, returns 0 or 1 on a difference */
+static int test_differential(unsigned long long seed)
+{
+    InitOptions options;
+    ConcurrentDataStructure* cds = InitConcurrent(BEST_QUALITY);
+    DataStructure ds;
+    unsigned long long state = seed;
+    int step;
+
+    memset(&options, 0, sizeof(options));
+    options.rank_index = 1;
+    ds = InitWithOptions(BEST_QUALITY, &options);
+
+    for (step = 1; step <= DIFFERENTIAL_STEPS; step++)
+    {
+        random_update(cds, &ds, &state);
+        if (step % CHECK_EVERY == 0 && compare(cds, ds, &state))
+        {
+            printf("FAIL differential (step %d)\n", step);
+            return 1;
+        }
+    }
+
+    Destroy(&ds);
+    DestroyConcurrent(cds);
+    printf("differential ok\n");
+    return 0;
+}
+
+/* Reader thread: query the versions the writer publishes, every answer must be a product of the asked range */
+static void* run_reader(void* arg)
+{
+    Reader* reader = (Reader*)arg;
+    ConcurrentDataStructure* cds = reader->shared->cds;
+    ConcurrentReader* handle = RegisterConcurrentReader(cds);
+    int i, time, time1, time2;
+
+    while (!atomic_load(&reader->shared->stop))
+    {
+        i = random_between(&reader->seed, 1, TIMES / 2);
+        time = GetIthRankProductConcurrent(cds, handle, i);
+        reader->failed |= time < -1 || time >= TIMES;
+
+        time1 = random_between(&reader->seed, 0, TIMES - 1);
+        time2 = time1 + random_between(&reader->seed, 0, TIMES / 8);
+        time = GetIthRankProductBetweenConcurrent(cds, handle, time1, time2, 1 + i % 16);
+        reader->failed |= time != -1 && (time < time1 || time > time2);
+
+        ExistsConcurrent(cds, handle);
+        reader->queries++;
+    }
+
+    UnregisterConcurrentReader(handle);
+    return NULL;
+}
+
+/* Run readers next to a writer, then compare the products with a DataStructure, returns 0 or 1 on a failure */
+static int test_readers_and_writer(unsigned long long seed)
+{
+    Shared shared;
+    Reader readers[READERS];
+    pthread_t threads[READERS];
+    DataStructure ds = Init(BEST_QUALITY);
+    unsigned long long state = seed;
+    long queries = 0;
+    int i, failed = 0;
+
+    shared.cds = InitConcurrent(BEST_QUALITY);
+    atomic_init(&shared.stop, 0);
+    for (i = 0; i < TIMES / 2; i++)
+    {
+        AddProductConcurrent(shared.cds, 2 * i, i % QUALITIES);
+        AddProduct(&ds, 2 * i, i % QUALITIES);
+    }
+
+    for (i = 0; i < READERS; i++)
+    {
+        readers[i].shared = &shared;
+        readers[i].seed = seed + (unsigned long long)(i + 1) * 0x9E3779B97F4A7C15ULL;
+        readers[i].queries = 0;
+        readers[i].failed = 0;
+        pthread_create(&threads[i], NULL, run_reader, &readers[i]);
+    }
+
+    /* The writer is this thread, the DataStructure follows it */
+    for (i = 0; i < WRITER_STEPS; i++)
+        random_update(shared.cds, &ds, &state);
+
+    atomic_store(&shared.stop, 1);
+    for (i = 0; i < READERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        failed |= readers[i].failed;
+        queries += readers[i].queries;
+    }
+
+    if (failed || compare(shared.cds, ds, &state))
+    {
+        printf("FAIL readers and writer\n");
+        return 1;
+    }
+
+    Destroy(&ds);
+    DestroyConcurrent(shared.cds);
+    printf("readers and writer ok (%ld queries)\n", queries);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long long seed = (argc > 1 ? strtoull(argv[1], NULL, 10) : 1) * 0x9E3779B97F4A7C15ULL + 1;
+
+    if (test_differential(seed) || test_readers_and_writer(seed + 1))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,970 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "../AVL.h"
+
+/* Differential test of DataStructure and CompactDataStructure against a plain array of the products indexed by time.
+
+   Every combination of the options replays the same kind of random updates on a data structure and on the array,
+   and every few steps each query of the data structure is compared with the answer computed from the array, and the invariants
+   of its trees (balance, subtree counts and aggregates, the shared nodes of the two indexes, the finger) are walked.
+   The snapshots and the operation log are checked by reloading them and comparing the products. Exits with 1 at the first difference.
+
+   usage: test_differential [seed] */
+
+#define TIMES 1024                  /* The products have the times 0 .. TIMES - 1 */
+#define QUALITIES 32                /* and the qualities -QUALITIES .. QUALITIES - 1 */
+#define BEST_QUALITY 0              /* The quality s of Init, Exists looks for it */
+#define STEPS 3000                  /* Random updates per combination of the options */
+#define CHECK_EVERY 150             /* Updates between two comparisons of every query */
+#define WINDOWS 8                   /* Random time windows compared at every check */
+#define SNAPSHOT_PATH "test_differential.snapshot"
+#define LOG_PATH "test_differential.log"
+#define OPTION_BITS 7               /* Bits of the mode that selects the options, every option has its own */
+
+/* The products of the data structure, one slot per time */
+typedef struct Model
+{
+    int present[TIMES];
+    int quality[TIMES];
+} Model;
+
+/* What the invariant walk finds below a node of the time tree */
+typedef struct SubtreeFacts
+{
+    int height;                     /* Height, or rank with the WAVL and red-black schemes, -1 for an empty tree (0 with red-black) */
+    int size;                       /* Number of alive products */
+    int dead;                       /* Number of products removed in lazy delete mode */
+    AvlTree* worst;                 /* Alive product of the lowest (quality, time), NULL if there is none */
+    long long sum;                  /* Sum of the qualities of the alive products */
+    long long squares;              /* Sum of their squares */
+    int max;                        /* Highest quality of the alive products, INT_MIN if there is none */
+} SubtreeFacts;
+
+static unsigned long long rng_state;
+static const char* failed_check = NULL;
+
+/* xorshift64* generator, the test does not depend on the quality of rand() */
+static unsigned long long next_random(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Random integer in [lo, hi] */
+static int random_between(int lo, int hi)
+{
+    return lo + (int)(next_random() % (unsigned long long)(hi - lo + 1));
+}
+
+/* Record the first failed comparison, the checks go on so the caller reports one name */
+static void expect(int condition, const char* name)
+{
+    if (!condition && failed_check == NULL)
+        failed_check = name;
+}
+
+/* Collect the products of the array in rank order, lowest quality first and then lowest time. Returns their number */
+static int ranked_products(const Model* model, int* times, int* qualities)
+{
+    int quality, time, n = 0;
+
+    for (quality = -QUALITIES; quality < QUALITIES; quality++)
+    {
+        for (time = 0; time < TIMES; time++)
+        {
+            if (model->present[time] && model->quality[time] == quality)
+            {
+                times[n] = time;
+                qualities[n] = quality;
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+/* Random time window, sometimes empty, unbounded or reaching past the stored times */
+static void random_window(int k, int* time1, int* time2)
+{
+    if (k == 0)
+    {
+        *time1 = INT_MIN;
+        *time2 = INT_MAX;
+        return;
+    }
+    if (k == 1)
+    {
+        *time1 = random_between(0, TIMES);
+        *time2 = *time1 - 1;
+        return;
+    }
+    *time1 = random_between(-TIMES / 8, TIMES);
+    *time2 = *time1 + random_between(0, TIMES / 2);
+    if (k == 2)
+        *time1 = INT_MIN;
+}
+
+/* Compare every query of the data structure that reads a time window */
+static void check_window(DataStructure ds, const int* ranked_times, const int* ranked_qualities, int n, int time1, int time2)
+{
+    static int window_times[TIMES], window_qualities[TIMES], out_times[TIMES], out_qualities[TIMES];
+    RangeBestIterator it;
+    long long sum = 0;
+    double deviations = 0;
+    int count = 0, max = INT_MIN;
+    int i, k, time, quality, quality1, quality2, expected, below;
+    size_t listed;
+
+    /* The products of the window keep the rank order of the whole list */
+    for (i = 0; i < n; i++)
+    {
+        if (ranked_times[i] >= time1 && ranked_times[i] <= time2)
+        {
+            window_times[count] = ranked_times[i];
+            window_qualities[count] = ranked_qualities[i];
+            sum += ranked_qualities[i];
+            if (ranked_qualities[i] > max)
+                max = ranked_qualities[i];
+            count++;
+        }
+    }
+
+    expect(CountBetween(ds, time1, time2) == count, "CountBetween");
+    expect(SumQualityBetween(ds, time1, time2) == sum, "SumQualityBetween");
+    expect(MaxQualityBetween(ds, time1, time2) == max, "MaxQualityBetween");
+    expect(fabs(AvgQualityBetween(ds, time1, time2) - (count > 0 ? (double)sum / count : 0)) < 1e-9, "AvgQualityBetween");
+    for (i = 0; i < count; i++)
+        deviations += ((double)window_qualities[i] - (double)sum / count) * ((double)window_qualities[i] - (double)sum / count);
+    expect(fabs(StddevQualityBetween(ds, time1, time2) - (count > 0 ? sqrt(deviations / count) : 0)) < 1e-9, "StddevQualityBetween");
+
+    /* The ranks of the window, with one past the end. With the rank index the queries only read it */
+    for (k = 0; k < 6; k++)
+    {
+        i = k < 5 ? random_between(1, count + 1) : count + 1;
+        expected = i <= count ? window_times[i - 1] : -1;
+        expect(GetIthRankProductBetween(ds, time1, time2, i) == expected, "GetIthRankProductBetween");
+        quality = INT_MIN;
+        expect(GetIthRankProductKey(ds, time1, time2, i, &quality) == expected, "GetIthRankProductKey");
+        expect(expected == -1 || quality == window_qualities[i - 1], "GetIthRankProductKey quality");
+    }
+    expect(GetIthRankProductBetween(ds, time1, time2, 0) == -1, "GetIthRankProductBetween 0");
+
+    /* Counts up to a (quality, time) key */
+    for (k = 0; k < 4; k++)
+    {
+        quality = random_between(-QUALITIES - 1, QUALITIES);
+        time = random_between(-1, TIMES);
+        for (i = 0, expected = 0; i < count; i++)
+            if (window_qualities[i] < quality || (window_qualities[i] == quality && window_times[i] <= time))
+                expected++;
+        expect(CountProductsUpTo(ds, time1, time2, quality, time) == expected, "CountProductsUpTo");
+    }
+    expect(CountProductsUpTo(ds, time1, time2, INT_MAX, INT_MAX) == count, "CountProductsUpTo all");
+
+    /* Quality bands of the window */
+    for (k = 0; k < 4; k++)
+    {
+        quality1 = k == 0 ? INT_MIN : random_between(-QUALITIES - 1, QUALITIES);
+        quality2 = k == 1 ? INT_MAX : quality1 + random_between(0, QUALITIES / 2);
+        for (i = 0, expected = 0, below = 0; i < count; i++)
+        {
+            if (window_qualities[i] < quality1)
+                below++;
+            else if (window_qualities[i] <= quality2)
+                expected++;
+        }
+        expect(CountProductsInBand(ds, time1, time2, quality1, quality2) == expected, "CountProductsInBand");
+
+        quality = INT_MIN;
+        time = GetBestProductInBand(ds, time1, time2, quality1, &quality);
+        expect(time == (below < count ? window_times[below] : -1), "GetBestProductInBand");
+        expect(below == count || quality == window_qualities[below], "GetBestProductInBand quality");
+
+        listed = GetProductsInBand(ds, time1, time2, quality1, quality2, out_times, out_qualities, TIMES);
+        expect(listed == (size_t)expected, "GetProductsInBand");
+        for (i = 0; i < (int)listed && i < expected; i++)
+            expect(out_times[i] == window_times[below + i] && out_qualities[i] == window_qualities[below + i], "GetProductsInBand order");
+        if (expected > 1)
+            expect(GetProductsInBand(ds, time1, time2, quality1, quality2, out_times, out_qualities, 1) == 1, "GetProductsInBand max");
+    }
+
+    /* The cursor returns the whole window in rank order */
+    it = InitRangeBestIterator(ds, time1, time2);
+    for (i = 0; NextRangeBest(&it, &time, &quality); i++)
+        expect(i < count && time == window_times[i] && quality == window_qualities[i], "NextRangeBest");
+    expect(i == count, "NextRangeBest count");
+    DestroyRangeBestIterator(&it);
+}
+
+/* The treap priority of a time, the same bijection as priority_of_time in AVL.c */
+static unsigned int treap_priority(int time)
+{
+    unsigned int h = (unsigned int)time;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Check if a product comes before another one in rank order, lowest (quality, time) first */
+static int ranks_before(AvlTree* a, AvlTree* b)
+{
+    return a->quality < b->quality || (a->quality == b->quality && a->time < b->time);
+}
+
+/* Check if the key (quality1, time1) comes before the key (quality2, time2) in rank order */
+static int keys_before(int quality1, long long time1, int quality2, long long time2)
+{
+    return quality1 < quality2 || (quality1 == quality2 && time1 < time2);
+}
+
+/* Walk the time subtree of a node, its times must lie strictly between low and high. Every field the node keeps about its
+   subtree is compared with what is found below it, and so is the balance of the scheme. red is 1 for a red child of a red-black tree */
+static void walk_TimeTree(AvlTree* node, int balance, long long low, long long high, int red, SubtreeFacts* facts)
+{
+    SubtreeFacts left, right;
+    AvlTree* child;
+#ifdef AVL_AGGREGATES
+    double deviations;
+#endif
+    int k, difference;
+
+    memset(facts, 0, sizeof(SubtreeFacts));
+    facts->height = balance == BALANCE_RED_BLACK ? 0 : -1;
+    facts->max = INT_MIN;
+    if (node == NULL || failed_check != NULL)
+        return;
+
+    expect(node->time > low && node->time < high, "invariant time order");
+    walk_TimeTree(node->left, balance, low, node->time, balance == BALANCE_RED_BLACK && node->left != NULL && node->left->height == node->height, &left);
+    walk_TimeTree(node->right, balance, node->time, high, balance == BALANCE_RED_BLACK && node->right != NULL && node->right->height == node->height, &right);
+
+    /* The counts and the aggregates of the alive products */
+    facts->size = left.size + right.size + node->alive;
+    facts->dead = left.dead + right.dead + !node->alive;
+    facts->sum = left.sum + right.sum + (node->alive ? node->quality : 0);
+    facts->squares = left.squares + right.squares + (node->alive ? (long long)node->quality * node->quality : 0);
+    facts->max = left.max > right.max ? left.max : right.max;
+    if (node->alive && node->quality > facts->max)
+        facts->max = node->quality;
+    facts->worst = left.worst;
+    if (node->alive && (facts->worst == NULL || ranks_before(node, facts->worst)))
+        facts->worst = node;
+    if (right.worst != NULL && (facts->worst == NULL || ranks_before(right.worst, facts->worst)))
+        facts->worst = right.worst;
+
+    expect(node->size == facts->size, "invariant size");
+    expect(node->worst_quality == facts->worst, "invariant worst_quality");
+#ifdef AVL_AGGREGATES
+    expect(node->sum_quality == facts->sum, "invariant sum_quality");
+    deviations = facts->size > 0 ? facts->squares - (double)facts->sum * facts->sum / facts->size : 0;
+    expect(fabs(node->squared_deviations - deviations) < 1e-9 * (1 + deviations), "invariant squared_deviations");
+    expect(node->max_quality == facts->max, "invariant max_quality");
+#endif
+
+    /* The balance of the scheme */
+    facts->height = node->height;
+    if (balance == BALANCE_AVL)
+    {
+        expect(node->height == (left.height > right.height ? left.height : right.height) + 1, "invariant AVL height");
+        expect(left.height - right.height <= 1 && right.height - left.height <= 1, "invariant AVL balance");
+    }
+    else if (balance == BALANCE_WAVL)
+    {
+        /* Rank differences 1 or 2, and every leaf has rank 0 */
+        expect(node->height - left.height >= 1 && node->height - left.height <= 2, "invariant WAVL rank");
+        expect(node->height - right.height >= 1 && node->height - right.height <= 2, "invariant WAVL rank");
+        expect(node->left != NULL || node->right != NULL || node->height == 0, "invariant WAVL leaf");
+    }
+    else if (balance == BALANCE_RED_BLACK)
+    {
+        /* Rank differences 0 (a red child) or 1, a missing child is black and a red node has no red child */
+        for (k = 0; k < 2; k++)
+        {
+            child = k == 0 ? node->left : node->right;
+            difference = node->height - (k == 0 ? left.height : right.height);
+            expect(difference == 0 || difference == 1, "invariant red-black rank");
+            expect(child != NULL || difference == 1, "invariant red-black missing child");
+            expect(!red || difference == 1, "invariant red-black red child");
+        }
+    }
+    else
+    {
+        /* Every node has a higher priority than its children */
+        expect(node->left == NULL || treap_priority(node->time) > treap_priority(node->left->time), "invariant treap priority");
+        expect(node->right == NULL || treap_priority(node->time) > treap_priority(node->right->time), "invariant treap priority");
+    }
+}
+
+/* Walk the AVL quality subtree of a node, its keys must lie strictly between the products low and high (NULL for no bound).
+   Returns its height, or -1 for an empty tree */
+static int walk_QualityTree(AvlTree* node, AvlTree* low, AvlTree* high, int* size, int* nodes)
+{
+    int left_size = 0, right_size = 0, left_height, right_height;
+
+    if (node == NULL || failed_check != NULL)
+        return -1;
+
+    expect((low == NULL || ranks_before(low, node)) && (high == NULL || ranks_before(node, high)), "invariant quality order");
+    left_height = walk_QualityTree(node->q_left, low, node, &left_size, nodes);
+    right_height = walk_QualityTree(node->q_right, node, high, &right_size, nodes);
+    *size = left_size + right_size + node->alive;
+    (*nodes)++;
+
+    expect(node->q_size == *size, "invariant q_size");
+    expect(node->q_height == (left_height > right_height ? left_height : right_height) + 1, "invariant q_height");
+    expect(left_height - right_height <= 1 && right_height - left_height <= 1, "invariant quality balance");
+    return node->q_height;
+}
+
+/* Find a product in the quality tree by its (quality, time) key, NULL if it is not there */
+static AvlTree* find_in_QualityTree(AvlTree* tree, AvlTree* product)
+{
+    while (tree != NULL && tree != product)
+        tree = ranks_before(product, tree) ? tree->q_left : tree->q_right;
+    return tree;
+}
+
+/* Count the time tree nodes that the quality tree holds too, every product has one node in both trees */
+static int count_shared_nodes(AvlTree* time_tree, AvlTree* quality_tree)
+{
+    if (time_tree == NULL)
+        return 0;
+    return (find_in_QualityTree(quality_tree, time_tree) == time_tree) +
+        count_shared_nodes(time_tree->left, quality_tree) + count_shared_nodes(time_tree->right, quality_tree);
+}
+
+/* Walk a B+ subtree: the keys increase across the linked leaves, every leaf is at the same depth, every count matches the
+   entries below and every separator key routes to its child. Sets the first key of the subtree and returns its number of products */
+static int walk_BPlusNode(BPlusNode* node, int depth, int* leaf_depth, BPlusNode** last_leaf, AvlTree** last_product,
+    int* first_quality, int* first_time)
+{
+    AvlTree* product;
+    int i, size = 0, child_size, quality, time;
+
+    expect(node->count >= 1 && node->count <= BPLUS_ORDER, "invariant B+ count");
+    for (i = 0; i < node->count && failed_check == NULL; i++)
+    {
+        if (node->leaf)
+        {
+            product = node->slots[i].product;
+            expect(product->alive && product->quality == node->qualities[i] && product->time == node->times[i], "invariant B+ product");
+            expect(*last_product == NULL || ranks_before(*last_product, product), "invariant B+ order");
+            expect(node->sizes[i] == 1, "invariant B+ leaf size");
+            *last_product = product;
+            size++;
+            continue;
+        }
+        /* A separator is above every key of the previous child and at most the first key of its child, the first one is not read */
+        expect(i == 0 || keys_before((*last_product)->quality, (*last_product)->time, node->qualities[i], node->times[i]), "invariant B+ separator");
+        child_size = walk_BPlusNode(node->slots[i].child, depth + 1, leaf_depth, last_leaf, last_product, &quality, &time);
+        expect(node->sizes[i] == child_size, "invariant B+ size");
+        expect(i == 0 || keys_before(node->qualities[i], node->times[i], quality, time + 1LL), "invariant B+ separator");
+        if (i == 0)
+        {
+            *first_quality = quality;
+            *first_time = time;
+        }
+        size += child_size;
+    }
+    if (node->leaf)
+    {
+        *first_quality = node->qualities[0];
+        *first_time = node->times[0];
+        expect(*leaf_depth == -1 || *leaf_depth == depth, "invariant B+ depth");
+        expect(*last_leaf == NULL || (*last_leaf)->next == node, "invariant B+ leaf links");
+        *leaf_depth = depth;
+        *last_leaf = node;
+    }
+    return size;
+}
+
+/* Check the invariants of every tree and index of the data structure, n is the number of products of the array */
+static void check_invariants(DataStructure ds, int n)
+{
+    SubtreeFacts facts;
+    BPlusNode* last_leaf = NULL;
+    AvlTree* last_product = NULL;
+    AvlTree* node;
+    int size = 0, nodes = 0, leaf_depth = -1, quality, time;
+
+    walk_TimeTree(ds.timeTree, ds.balance, (long long)INT_MIN - 1, (long long)INT_MAX + 1, 0, &facts);
+    expect(facts.size == n, "invariant products");
+    expect(facts.dead == ds.dead, "invariant dead");
+    expect(ds.lazy_delete || ds.dead == 0, "invariant dead without lazy delete");
+
+    /* The finger is the node of the largest time, or not known */
+    for (node = ds.timeTree; node != NULL && node->right != NULL; node = node->right)
+        ;
+    expect(ds.rightmost == NULL || ds.rightmost == node, "invariant rightmost");
+
+    if (ds.quality_index == QUALITY_INDEX_AVL)
+    {
+        walk_QualityTree(ds.qualityTree, NULL, NULL, &size, &nodes);
+        expect(size == n && nodes == n + ds.dead, "invariant quality tree products");
+        expect(count_shared_nodes(ds.timeTree, ds.qualityTree) == nodes, "invariant shared nodes");
+    }
+    else if (ds.state->qualityBPlus.root != NULL)
+    {
+        size = walk_BPlusNode(ds.state->qualityBPlus.root, 0, &leaf_depth, &last_leaf, &last_product, &quality, &time);
+        expect(size == n && ds.state->qualityBPlus.size == n && last_leaf->next == NULL, "invariant B+ products");
+    }
+    else
+        expect(n == 0 && ds.state->qualityBPlus.size == 0, "invariant B+ empty");
+
+    expect(!ds.rank_index || ds.state->rankIndex.alive == n, "invariant rank index products");
+    expect(!ds.time_index || ds.state->timeIndex.used == (size_t)n, "invariant time index products");
+}
+
+/* Compare every query of the data structure with the array */
+static void check_DataStructure(DataStructure ds, const Model* model)
+{
+    static int ranked_times[TIMES], ranked_qualities[TIMES], times[TIMES], qualities[TIMES], ranks[64], out[64];
+    Stats before, after;
+    long calls;
+    int n, i, k, count, time1, time2, time, quality, best = 0;
+    size_t listed;
+
+    n = ranked_products(model, ranked_times, ranked_qualities);
+    check_invariants(ds, n);
+
+    /* Time order */
+    listed = GetProductsByTime(ds, times, qualities);
+    expect(listed == (size_t)n, "GetProductsByTime count");
+    for (time = 0, i = 0; time < TIMES && i < (int)listed; time++)
+    {
+        if (model->present[time])
+        {
+            expect(times[i] == time && qualities[i] == model->quality[time], "GetProductsByTime");
+            i++;
+        }
+    }
+
+    /* Every rank, with the ranks out of range */
+    GetStats(ds, &before);
+    for (i = 0; i <= n + 1; i++)
+        expect(GetIthRankProduct(ds, i) == (i >= 1 && i <= n ? ranked_times[i - 1] : -1), "GetIthRankProduct");
+
+    /* The gauges, and the calls are counted when the library is built with AVL_STATS */
+    GetStats(ds, &after);
+    calls = after.operations[STATS_GET_ITH_RANK].calls - before.operations[STATS_GET_ITH_RANK].calls;
+    expect(calls == 0 || calls == n + 2, "GetStats calls");
+    expect(after.products == n, "GetStats products");
+    expect(n == 0 || (2 << after.time_tree_height) > n, "GetStats time_tree_height");
+    expect(after.bytes_in_use <= after.bytes_reserved, "GetStats bytes");
+
+    /* A batch of random ranks, some out of range, and a run of consecutive ones */
+    for (k = 0; k < 64; k++)
+        ranks[k] = k < 32 ? random_between(-1, n + 2) : n / 2 + k - 32;
+    GetIthRankProducts(ds, ranks, out, 64);
+    for (k = 0; k < 64; k++)
+        expect(out[k] == (ranks[k] >= 1 && ranks[k] <= n ? ranked_times[ranks[k] - 1] : -1), "GetIthRankProducts");
+
+    for (k = 0; k < WINDOWS; k++)
+    {
+        random_window(k, &time1, &time2);
+        check_window(ds, ranked_times, ranked_qualities, n, time1, time2);
+    }
+
+    /* Lookups by time and by quality */
+    for (k = 0; k < 16; k++)
+    {
+        time = random_between(-1, TIMES);
+        quality = INT_MIN;
+        i = time >= 0 && time < TIMES && model->present[time];
+        expect(FindProduct(ds, time, &quality) == i, "FindProduct");
+        expect(!i || quality == model->quality[time], "FindProduct quality");
+
+        quality = random_between(-QUALITIES, QUALITIES);
+        for (time = 0, count = 0; time < TIMES; time++)
+            if (model->present[time] && model->quality[time] == quality)
+                count++;
+        expect(CountQuality(ds, quality) == count, "CountQuality");
+        expect(ExistsQuality(ds, quality) == (count > 0), "ExistsQuality");
+    }
+    for (time = 0; time < TIMES; time++)
+        if (model->present[time] && model->quality[time] == BEST_QUALITY)
+            best = 1;
+    expect(Exists(ds) == best, "Exists");
+}
+
+/* Add a batch of random products with AddProductsBulk, a time repeated in the batch keeps its first quality */
+static void random_bulk(DataStructure* ds, Model* model, int n)
+{
+    static int batch_times[TIMES], batch_qualities[TIMES];
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        batch_times[i] = random_between(0, TIMES - 1);
+        batch_qualities[i] = random_between(-QUALITIES, QUALITIES - 1);
+    }
+    AddProductsBulk(ds, batch_times, batch_qualities, (size_t)n);
+    for (i = 0; i < n; i++)
+    {
+        if (!model->present[batch_times[i]])
+        {
+            model->present[batch_times[i]] = 1;
+            model->quality[batch_times[i]] = batch_qualities[i];
+        }
+    }
+}
+
+/* Append products in increasing time order, the path of the rightmost finger, with removals behind the last time */
+static void random_appends(DataStructure* ds, Model* model, int last_time)
+{
+    int time, quality, removed;
+
+    for (time = random_between(0, 3); time <= last_time; time += random_between(1, 3))
+    {
+        quality = random_between(-QUALITIES, QUALITIES - 1);
+        AddProduct(ds, time, quality);
+        model->present[time] = 1;
+        model->quality[time] = quality;
+
+        /* Sometimes the last product itself, so the finger has to be found again */
+        if (time % 5 == 0)
+        {
+            removed = time % 3 == 0 ? time : random_between(0, time);
+            RemoveProduct(ds, removed);
+            model->present[removed] = 0;
+        }
+        if (time % CHECK_EVERY == 0)
+            check_DataStructure(*ds, model);
+    }
+}
+
+/* Apply one random update to the data structure and to the array */
+static void random_update(DataStructure* ds, Model* model, int lazy_free)
+{
+    int op = random_between(0, 999);
+    int time = random_between(0, TIMES - 1);
+    int quality = random_between(-QUALITIES, QUALITIES - 1);
+    int time2, quality2, i;
+
+    if (op < 560)
+    {
+        AddProduct(ds, time, quality);
+        if (!model->present[time])
+        {
+            model->present[time] = 1;
+            model->quality[time] = quality;
+        }
+    }
+    else if (op < 940)
+    {
+        RemoveProduct(ds, time);
+        model->present[time] = 0;
+    }
+    else if (op < 955)
+    {
+        RemoveQuality(ds, quality);
+        for (i = 0; i < TIMES; i++)
+            if (model->present[i] && model->quality[i] == quality)
+                model->present[i] = 0;
+    }
+    else if (op < 965)
+    {
+        /* A few qualities, sometimes every one from the lowest */
+        quality2 = quality + random_between(0, 3);
+        if (op % 4 == 0)
+            quality = INT_MIN;
+        RemoveQualityRange(ds, quality, quality2);
+        for (i = 0; i < TIMES; i++)
+            if (model->present[i] && model->quality[i] >= quality && model->quality[i] <= quality2)
+                model->present[i] = 0;
+    }
+    else if (op < 980)
+    {
+        time2 = time + random_between(0, 40);
+        RemoveTimeRange(ds, time, time2);
+        for (i = time; i <= time2 && i < TIMES; i++)
+            model->present[i] = 0;
+    }
+    else if (op < 983)
+    {
+        time = random_between(0, TIMES / 8);
+        ExpireBefore(ds, time);
+        for (i = 0; i < time; i++)
+            model->present[i] = 0;
+    }
+    else
+    {
+        /* Most batches are inserted one by one, the large ones rebuild the trees */
+        random_bulk(ds, model, op % 9 == 0 ? TIMES / 4 : random_between(1, 16));
+    }
+
+    /* The detached nodes are also freed a few at a time by the next updates */
+    if (lazy_free && op % 7 == 0)
+        ReclaimDetached(ds, 8);
+}
+
+/* Load a snapshot into a CompactDataStructure, with and without verifying it, and compare it with the array */
+static void check_loaded_snapshot(const Model* model)
+{
+    static int ranked_times[TIMES], ranked_qualities[TIMES];
+    CompactDataStructure loaded;
+    int n, i, verify;
+
+    n = ranked_products(model, ranked_times, ranked_qualities);
+    for (verify = 0; verify <= 1; verify++)
+    {
+        expect(LoadSnapshot(SNAPSHOT_PATH, &loaded, verify) == 0, "LoadSnapshot");
+        if (failed_check != NULL)
+            return;
+        for (i = 0; i <= n + 1; i++)
+            expect(GetIthRankProductCompact(loaded, i) == (i >= 1 && i <= n ? ranked_times[i - 1] : -1), "LoadSnapshot rank");
+        expect(CountBetweenCompact(loaded, 0, TIMES - 1) == n, "LoadSnapshot count");
+        DestroyCompact(&loaded);
+    }
+}
+
+/* Compare a data structure with another one through the products in time order */
+static int same_products(DataStructure a, DataStructure b)
+{
+    static int times_a[TIMES], qualities_a[TIMES], times_b[TIMES], qualities_b[TIMES];
+    size_t n = GetProductsByTime(a, times_a, qualities_a);
+
+    return GetProductsByTime(b, times_b, qualities_b) == n &&
+        memcmp(times_a, times_b, n * sizeof(int)) == 0 && memcmp(qualities_a, qualities_b, n * sizeof(int)) == 0;
+}
+
+/* Save a data structure to a snapshot, then load it back and restore it into a DataStructure with the same options */
+static void check_snapshot(DataStructure ds, const Model* model, const InitOptions* options)
+{
+    DataStructure restored;
+
+    expect(SaveSnapshot(ds, SNAPSHOT_PATH) == 0, "SaveSnapshot");
+    check_loaded_snapshot(model);
+
+    restored = InitWithOptions(BEST_QUALITY, options);
+    expect(RestoreSnapshot(SNAPSHOT_PATH, &restored) == 0, "RestoreSnapshot");
+    expect(same_products(ds, restored), "RestoreSnapshot products");
+    Destroy(&restored);
+    remove(SNAPSHOT_PATH);
+}
+
+/* Replay random updates on every combination of the options, returns 0 or 1 on the first difference */
+static int test_DataStructure(void)
+{
+    static Model model;
+    InitOptions options;
+    DataStructure ds;
+    int mode, step;
+
+    for (mode = 0; mode < 1 << OPTION_BITS; mode++)
+    {
+        memset(&options, 0, sizeof(options));
+        options.rank_index = mode & 1;
+        options.lazy_free = (mode >> 1) & 1;
+        options.quality_index = (mode >> 2) & 1 ? QUALITY_INDEX_BPLUS : QUALITY_INDEX_AVL;
+        options.time_index = (mode >> 3) & 1;
+        options.lazy_delete = (mode >> 4) & 1;
+        options.balance = mode >> 5;
+
+        ds = InitWithOptions(BEST_QUALITY, &options);
+        memset(&model, 0, sizeof(model));
+
+        /* Every run starts with appends, which all expire before a bulk load into the empty trees */
+        random_appends(&ds, &model, TIMES / 2);
+        ExpireBefore(&ds, TIMES);
+        memset(&model, 0, sizeof(model));
+        check_DataStructure(ds, &model);
+        random_bulk(&ds, &model, TIMES / 2);
+
+        for (step = 1; step <= STEPS && failed_check == NULL; step++)
+        {
+            random_update(&ds, &model, options.lazy_free);
+            if (step % CHECK_EVERY == 0)
+                check_DataStructure(ds, &model);
+            if (step % (STEPS / 2) == 0)
+                check_snapshot(ds, &model, &options);
+        }
+        Destroy(&ds);
+
+        if (failed_check != NULL)
+        {
+            printf("FAIL %s (step %d, rank_index=%d lazy_free=%d quality_index=%d time_index=%d lazy_delete=%d balance=%d)\n", failed_check,
+                step - 1, options.rank_index, options.lazy_free, options.quality_index, options.time_index, options.lazy_delete, options.balance);
+            return 1;
+        }
+    }
+    printf("DataStructure: %d combinations of the options ok\n", mode);
+    return 0;
+}
+
+/* Replay random updates on a CompactDataStructure, returns 0 or 1 on the first difference */
+static int test_CompactDataStructure(void)
+{
+    static Model model;
+    static int ranked_times[TIMES], ranked_qualities[TIMES];
+    CompactDataStructure cds = InitCompact(BEST_QUALITY);
+    CompactDataStructure loaded;
+    unsigned int index;
+    int step, op, time, quality, n, i, time1, time2, count, best;
+
+    memset(&model, 0, sizeof(model));
+    for (step = 1; step <= 4 * STEPS && failed_check == NULL; step++)
+    {
+        op = random_between(0, 99);
+        time = random_between(0, TIMES - 1);
+        quality = random_between(-QUALITIES, QUALITIES - 1);
+        if (op < 55)
+        {
+            AddProductCompact(&cds, time, quality);
+            if (!model.present[time])
+            {
+                model.present[time] = 1;
+                model.quality[time] = quality;
+            }
+        }
+        else if (op < 98)
+        {
+            RemoveProductCompact(&cds, time);
+            model.present[time] = 0;
+        }
+        else
+        {
+            RemoveQualityCompact(&cds, quality);
+            for (i = 0; i < TIMES; i++)
+                if (model.present[i] && model.quality[i] == quality)
+                    model.present[i] = 0;
+        }
+
+        if (step % CHECK_EVERY != 0)
+            continue;
+
+        n = ranked_products(&model, ranked_times, ranked_qualities);
+        for (i = 0; i <= n + 1; i++)
+            expect(GetIthRankProductCompact(cds, i) == (i >= 1 && i <= n ? ranked_times[i - 1] : -1), "GetIthRankProductCompact");
+        for (i = 0; i < 16; i++)
+        {
+            time = random_between(-1, TIMES);
+            expect(FindCompact(cds, time) == (time >= 0 && time < TIMES && model.present[time]), "FindCompact");
+            random_window(i % WINDOWS, &time1, &time2);
+            for (time = 0, count = 0; time < TIMES; time++)
+                if (model.present[time] && time >= time1 && time <= time2)
+                    count++;
+            expect(CountBetweenCompact(cds, time1, time2) == count, "CountBetweenCompact");
+        }
+        time = GetWorstProductCompact(cds);
+        expect(n == 0 ? time == -1 : time >= 0 && time < TIMES && model.present[time] && model.quality[time] == ranked_qualities[0],
+            "GetWorstProductCompact");
+        for (time = 0, best = 0; time < TIMES; time++)
+            if (model.present[time] && model.quality[time] == BEST_QUALITY)
+                best = 1;
+        expect(ExistsCompact(cds) == best, "ExistsCompact");
+    }
+
+    expect(SaveSnapshotCompact(cds, SNAPSHOT_PATH) == 0, "SaveSnapshotCompact");
+    check_loaded_snapshot(&model);
+    remove(SNAPSHOT_PATH);
+
+    /* A child index past the records is refused when verifying, although the checksum of the file is right */
+    for (i = 0; i < 2 && cds.used > 1; i++)
+    {
+        index = i == 0 ? cds.nodes[cds.used - 1].right : cds.q_nodes[cds.used - 1].q_left;
+        if (i == 0)
+            cds.nodes[cds.used - 1].right = cds.used;
+        else
+            cds.q_nodes[cds.used - 1].q_left = cds.used + 1000;
+        expect(SaveSnapshotCompact(cds, SNAPSHOT_PATH) == 0 && LoadSnapshot(SNAPSHOT_PATH, &loaded, 1) == -1, "LoadSnapshot child index");
+        if (i == 0)
+            cds.nodes[cds.used - 1].right = index;
+        else
+            cds.q_nodes[cds.used - 1].q_left = index;
+        remove(SNAPSHOT_PATH);
+    }
+    DestroyCompact(&cds);
+
+    if (failed_check != NULL)
+    {
+        printf("FAIL %s (step %d)\n", failed_check, step - 1);
+        return 1;
+    }
+    printf("CompactDataStructure ok\n");
+    return 0;
+}
+
+/* Check the counters of the node pool through removals and reuse, with and without huge pages. Returns 0 or 1 on a difference */
+static int test_NodePool(void)
+{
+    InitOptions options;
+    AllocatorStats stats;
+    DataStructure ds;
+    int huge_pages, time, n = 50000;
+
+    for (huge_pages = 0; huge_pages <= 1; huge_pages++)
+    {
+        memset(&options, 0, sizeof(options));
+        options.huge_pages = huge_pages;
+        ds = InitWithOptions(BEST_QUALITY, &options);
+
+        /* One node per product, all of them fresh. With one quality the ranks follow the times */
+        for (time = 0; time < n; time++)
+            AddProduct(&ds, time, 1);
+        GetAllocatorStats(ds, &stats);
+        expect(stats.nodes_in_use == n && stats.misses == n && stats.hits == 0, "GetAllocatorStats adds");
+        expect(stats.slabs > 0 && stats.bytes >= (size_t)n * sizeof(AvlTree), "GetAllocatorStats slabs");
+
+        /* The removed nodes go to the free list and the next additions take them back */
+        for (time = 0; time < n; time += 2)
+            RemoveProduct(&ds, time);
+        GetAllocatorStats(ds, &stats);
+        expect(stats.nodes_in_use == n / 2, "GetAllocatorStats removes");
+        for (time = 0; time < n; time += 2)
+            AddProduct(&ds, time, 1);
+        GetAllocatorStats(ds, &stats);
+        expect(stats.nodes_in_use == n && stats.misses == n && stats.hits == n / 2, "GetAllocatorStats reuse");
+        expect(GetIthRankProduct(ds, 1) == 0 && GetIthRankProduct(ds, n) == n - 1, "NodePool products");
+        Destroy(&ds);
+
+        if (failed_check != NULL)
+        {
+            printf("FAIL %s (huge_pages=%d)\n", failed_check, huge_pages);
+            return 1;
+        }
+    }
+    printf("NodePool ok\n");
+    return 0;
+}
+
+/* Compare the quality aggregates of random windows with the array of the qualities, for qualities close to each other
+   but far from 0, whose squares do not fit in the precision of a double */
+static int test_QualityAggregates(void)
+{
+    static int qualities[99999];
+    DataStructure ds;
+    long long sum;
+    double mean, deviations;
+    int i, k, time1, time2, count, n = 99999, base = 1000000000;
+
+    ds = Init(base);
+    for (i = 0; i < n; i++)
+    {
+        qualities[i] = base + i % 3;
+        AddProduct(&ds, i, qualities[i]);
+    }
+    /* As many of each of the three qualities */
+    expect(fabs(StddevQualityBetween(ds, 0, n - 1) - sqrt(2.0 / 3)) < 1e-6, "StddevQualityBetween large qualities");
+
+    /* Remove a random half, then compare random windows */
+    for (k = 0; k < n / 2; k++)
+    {
+        i = random_between(0, n - 1);
+        if (qualities[i] != 0)
+        {
+            RemoveProduct(&ds, i);
+            qualities[i] = 0;
+        }
+    }
+    for (k = 0; k < 100 && failed_check == NULL; k++)
+    {
+        time1 = random_between(0, n - 1);
+        time2 = random_between(time1, n - 1);
+        sum = 0;
+        count = 0;
+        for (i = time1; i <= time2; i++)
+        {
+            if (qualities[i] != 0)
+            {
+                sum += qualities[i];
+                count++;
+            }
+        }
+        mean = count > 0 ? (double)sum / count : 0;
+        deviations = 0;
+        for (i = time1; i <= time2; i++)
+            if (qualities[i] != 0)
+                deviations += (qualities[i] - mean) * (qualities[i] - mean);
+        expect(SumQualityBetween(ds, time1, time2) == sum, "SumQualityBetween large qualities");
+        expect(fabs(AvgQualityBetween(ds, time1, time2) - mean) < 1e-6, "AvgQualityBetween large qualities");
+        expect(fabs(StddevQualityBetween(ds, time1, time2) - (count > 0 ? sqrt(deviations / count) : 0)) < 1e-6, "StddevQualityBetween large qualities");
+    }
+    Destroy(&ds);
+
+    if (failed_check != NULL)
+    {
+        printf("FAIL %s\n", failed_check);
+        return 1;
+    }
+    printf("QualityAggregates ok\n");
+    return 0;
+}
+
+/* Log random updates, then replay the log into a new data structure, returns 0 or 1 on a difference */
+static int test_OperationLog(void)
+{
+    static Model model;
+    LogOptions log_options;
+    DataStructure ds, replayed;
+    long deadline;
+    int step;
+
+    remove(LOG_PATH);
+    remove(SNAPSHOT_PATH);
+    memset(&model, 0, sizeof(model));
+    log_options.batch_size = 64;
+    log_options.interval_ms = -1;
+
+    ds = Init(BEST_QUALITY);
+    expect(OpenLog(&ds, LOG_PATH, SNAPSHOT_PATH, &log_options) == 0, "OpenLog");
+    for (step = 1; step <= STEPS && failed_check == NULL; step++)
+    {
+        random_update(&ds, &model, 0);
+        if (step == STEPS / 2)
+            expect(CheckpointLog(&ds) == 0, "CheckpointLog");
+    }
+    expect(CloseLog(&ds) == 0, "CloseLog");
+
+    /* The snapshot of the checkpoint and the records after it give back the same products */
+    replayed = Init(BEST_QUALITY);
+    expect(OpenLog(&replayed, LOG_PATH, SNAPSHOT_PATH, &log_options) == 0, "OpenLog replay");
+    expect(same_products(ds, replayed), "OpenLog replay products");
+    check_DataStructure(replayed, &model);
+    expect(CloseLog(&replayed) == 0, "CloseLog replay");
+
+    Destroy(&ds);
+    Destroy(&replayed);
+    remove(LOG_PATH);
+    remove(SNAPSHOT_PATH);
+
+    /* With an interval, the pending records have a deadline until they are synced */
+    log_options.interval_ms = 60000;
+    ds = Init(BEST_QUALITY);
+    expect(OpenLog(&ds, LOG_PATH, NULL, &log_options) == 0, "OpenLog interval");
+    expect(LogNextDeadlineMs(&ds) == -1, "LogNextDeadlineMs nothing pending");
+    AddProduct(&ds, 0, BEST_QUALITY);
+    deadline = LogNextDeadlineMs(&ds);
+    expect(deadline > 0 && deadline <= 60000, "LogNextDeadlineMs pending");
+    expect(SyncLog(&ds) == 0 && LogNextDeadlineMs(&ds) == -1, "LogNextDeadlineMs synced");
+    expect(CloseLog(&ds) == 0, "CloseLog interval");
+    Destroy(&ds);
+    remove(LOG_PATH);
+
+    if (failed_check != NULL)
+    {
+        printf("FAIL %s\n", failed_check);
+        return 1;
+    }
+    printf("OperationLog ok\n");
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    rng_state = argc > 1 ? strtoull(argv[1], NULL, 10) * 0x9E3779B97F4A7C15ULL + 1 : 1;
+
+    if (test_DataStructure() || test_NodePool() || test_CompactDataStructure() || test_QualityAggregates() ||
+        test_OperationLog())
+        return 1;
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../AVLGeneric.h"
+
+/* Differential test of the data structures generated by AVLGeneric.h against a plain array of the products indexed by time.
+
+   The engine is instantiated for 64 bit ns times and float qualities, with an augmentation that keeps the sum of the
+   qualities of every time subtree. Random additions and removals are replayed on it and on the array, and every few steps
+   each query is compared with the answer computed from the array, and both trees are walked for their order, balance,
+   sizes, worst qualities and sums. Exits with 1 at the first difference.
+
+   usage: test_generic [seed] */
+
+#define TIMES 1024                  /* The products have the times BASE_TIME + TICK * (0 .. TIMES - 1) */
+#define BASE_TIME 1700000000000000000LL
+#define TICK 1000003LL
+#define QUALITIES 32                /* and the qualities (-QUALITIES .. QUALITIES - 1) / 4 */
+#define BEST_QUALITY 0.0f           /* The quality s of InitNs, ExistsNs looks for it */
+#define STEPS 20000                 /* Random updates */
+#define CHECK_EVERY 500             /* Updates between two comparisons of every query */
+#define WINDOWS 16                  /* Random time windows compared at every check */
+
+/* The sum of the qualities of a time subtree, the halves and quarters of the test add up exactly */
+#define SUM_AUGMENT(node) ((node)->augment = (node)->quality + ((node)->left != NULL ? (node)->left->augment : 0) + \
+                                             ((node)->right != NULL ? (node)->right->augment : 0))
+
+AVL_GENERIC_DEFINE_AUGMENTED(Ns, long long, float, AVL_GENERIC_LESS, AVL_GENERIC_LESS, double, SUM_AUGMENT)
+
+/* The products of the data structure, one slot per time */
+typedef struct Model
+{
+    int present[TIMES];
+    float quality[TIMES];
+} Model;
+
+static unsigned long long rng_state;
+static const char* failed_check = NULL;
+
+/* xorshift64* generator, the test does not depend on the quality of rand() */
+static unsigned long long next_random(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Random integer in [lo, hi] */
+static int random_between(int lo, int hi)
+{
+    return lo + (int)(next_random() % (unsigned long long)(hi - lo + 1));
+}
+
+/* Record the first failed comparison, the checks go on so the caller reports one name */
+static void expect(int condition, const char* name)
+{
+    if (!condition && failed_check == NULL)
+        failed_check = name;
+}
+
+/* The time of a slot of the array */
+static long long time_of(int slot)
+{
+    return BASE_TIME + TICK * slot;
+}
+
+/* A random quality, sometimes the best one */
+static float random_quality(void)
+{
+    return random_between(-QUALITIES, QUALITIES - 1) / 4.0f;
+}
+
+/* Collect the slots of the products of the array in rank order, lowest quality first and then lowest time. Returns their number */
+static int ranked_slots(const Model* model, int* slots)
+{
+    int quality, slot, n = 0;
+
+    for (quality = -QUALITIES; quality < QUALITIES; quality++)
+        for (slot = 0; slot < TIMES; slot++)
+            if (model->present[slot] && model->quality[slot] == quality / 4.0f)
+                slots[n++] = slot;
+    return n;
+}
+
+/* Walk the time subtree of a node, its times must lie strictly between those of low and high (NULL for no bound).
+   Returns its height and compares the size, worst quality and sum each node keeps with what is found below it */
+static int walk_TimeTree(NsNode* node, const NsNode* low, const NsNode* high, int* size, NsNode** worst, double* sum)
+{
+    int left_height, right_height, left_size, right_size;
+    NsNode* left_worst;
+    NsNode* right_worst;
+    double left_sum, right_sum;
+
+    *size = 0;
+    *worst = NULL;
+    *sum = 0;
+    if (node == NULL || failed_check != NULL)
+        return 0;
+
+    expect((low == NULL || low->time < node->time) && (high == NULL || node->time < high->time), "invariant time order");
+    left_height = walk_TimeTree(node->left, low, node, &left_size, &left_worst, &left_sum);
+    right_height = walk_TimeTree(node->right, node, high, &right_size, &right_worst, &right_sum);
+
+    *size = left_size + right_size + 1;
+    *worst = worse_of_NsNodes(worse_of_NsNodes(left_worst, node), right_worst);
+    *sum = left_sum + right_sum + node->quality;
+    expect(node->height == 1 + (left_height > right_height ? left_height : right_height), "invariant height");
+    expect(left_height - right_height <= 1 && right_height - left_height <= 1, "invariant AVL balance");
+    expect(node->size == *size, "invariant size");
+    expect(node->worst_quality == *worst, "invariant worst_quality");
+    expect(node->augment == *sum, "invariant augment");
+    return node->height;
+}
+
+/* Walk the quality subtree of a node, its keys must lie strictly between those of low and high (NULL for no bound).
+   Returns its height and compares the size each node keeps with what is found below it */
+static int walk_QualityTree(NsNode* node, const NsNode* low, const NsNode* high, int* size)
+{
+    int left_height, right_height, left_size, right_size;
+
+    *size = 0;
+    if (node == NULL || failed_check != NULL)
+        return 0;
+
+    expect((low == NULL || quality_before_Ns(low, node)) && (high == NULL || quality_before_Ns(node, high)), "invariant quality order");
+    left_height = walk_QualityTree(node->q_left, low, node, &left_size);
+    right_height = walk_QualityTree(node->q_right, node, high, &right_size);
+
+    *size = left_size + right_size + 1;
+    expect(node->q_height == 1 + (left_height > right_height ? left_height : right_height), "invariant q_height");
+    expect(left_height - right_height <= 1 && right_height - left_height <= 1, "invariant quality AVL balance");
+    expect(node->q_size == *size, "invariant q_size");
+    return node->q_height;
+}
+
+/* Compare every query of the data structure with the array, and walk both trees */
+static void check_NsDataStructure(NsDataStructure ds, const Model* model)
+{
+    static int slots[TIMES];
+    NsNode* worst;
+    double sum;
+    long long time, time1, time2;
+    float quality = 0;
+    int i, k, n, size, slot, slot1, slot2, count, worst_slot, exists;
+
+    /* Every rank, and one past the end */
+    n = ranked_slots(model, slots);
+    for (i = 1; i <= n; i++)
+        expect(GetIthRankProductNs(ds, i, &time) && time == time_of(slots[i - 1]), "GetIthRankProductNs");
+    expect(!GetIthRankProductNs(ds, n + 1, &time), "GetIthRankProductNs past the end");
+
+    /* Every time, and the times between the slots */
+    exists = 0;
+    for (slot = 0; slot < TIMES; slot++)
+    {
+        expect(FindNs(ds, time_of(slot), &quality) == model->present[slot], "FindNs");
+        if (model->present[slot])
+            expect(quality == model->quality[slot], "FindNs quality");
+        expect(!FindNs(ds, time_of(slot) + 1, &quality), "FindNs between the times");
+        if (model->present[slot] && model->quality[slot] == BEST_QUALITY)
+            exists = 1;
+    }
+    expect(ExistsNs(ds) == exists, "ExistsNs");
+
+    /* Random windows, whose bounds fall on a time or between two */
+    for (k = 0; k < WINDOWS; k++)
+    {
+        slot1 = random_between(-2, TIMES);
+        slot2 = slot1 + random_between(-1, TIMES / 2);
+        time1 = time_of(slot1) - random_between(0, 1);
+        time2 = time_of(slot2) + random_between(0, 1);
+
+        count = 0;
+        worst_slot = -1;
+        for (slot = slot1 < 0 ? 0 : slot1; slot <= slot2 && slot < TIMES; slot++)
+        {
+            if (!model->present[slot])
+                continue;
+            count++;
+            if (worst_slot < 0 || model->quality[slot] < model->quality[worst_slot])
+                worst_slot = slot;
+        }
+        expect(CountBetweenNs(ds, time1, time2) == count, "CountBetweenNs");
+        expect(GetWorstProductBetweenNs(ds, time1, time2, &time) == (count > 0), "GetWorstProductBetweenNs");
+        if (count > 0)
+            expect(time == time_of(worst_slot), "GetWorstProductBetweenNs time");
+    }
+
+    /* The invariants of both trees */
+    walk_TimeTree(ds.timeTree, NULL, NULL, &size, &worst, &sum);
+    expect(size == n, "invariant products");
+    walk_QualityTree(ds.qualityTree, NULL, NULL, &size);
+    expect(size == n, "invariant quality products");
+}
+
+/* One random update, mostly additions and removals by time, sometimes the removal of a quality */
+static void random_update(NsDataStructure* ds, Model* model)
+{
+    int op = random_between(0, 99);
+    int slot = random_between(0, TIMES - 1);
+    float quality = random_quality();
+
+    if (op < 55)
+    {
+        /* A time that already exists keeps its quality */
+        AddProductNs(ds, time_of(slot), quality);
+        if (!model->present[slot])
+        {
+            model->present[slot] = 1;
+            model->quality[slot] = quality;
+        }
+    }
+    else if (op < 98)
+    {
+        RemoveProductNs(ds, time_of(slot));
+        model->present[slot] = 0;
+    }
+    else
+    {
+        RemoveQualityNs(ds, quality);
+        for (slot = 0; slot < TIMES; slot++)
+            if (model->present[slot] && model->quality[slot] == quality)
+                model->present[slot] = 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static Model model;
+    NsDataStructure ds;
+    int step;
+
+    rng_state = argc > 1 ? strtoull(argv[1], NULL, 10) * 0x9E3779B97F4A7C15ULL + 1 : 1;
+
+    ds = InitNs(BEST_QUALITY);
+    for (step = 1; step <= STEPS && failed_check == NULL; step++)
+    {
+        random_update(&ds, &model);
+        if (step % CHECK_EVERY == 0)
+            check_NsDataStructure(ds, &model);
+    }
+
+    /* Destroy leaves it empty and usable */
+    DestroyNs(&ds);
+    memset(&model, 0, sizeof(model));
+    check_NsDataStructure(ds, &model);
+    DestroyNs(&ds);
+
+    if (failed_check != NULL)
+    {
+        printf("FAIL %s (step %d)\n", failed_check, step - 1);
+        return 1;
+    }
+    printf("generic ok\n");
+    return 0;
+}
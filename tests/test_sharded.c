@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "../ShardedAVL.h"
+
+/* Test of the sharded container. For several numbers of shards, products are added in increasing time order
+   (where every product lands in the last shard) and in random order. After every addition no shard may hold more
+   than twice the average of the other shards plus SHARD_REBALANCE_MIN products, and the rank queries across
+   the shards are compared with one DataStructure that holds the same products.
+   Then writers update disjoint time ranges in parallel next to a reader, and the products are compared at the end.
+   make test also runs it built with ThreadSanitizer and the operation counters of AVL_STATS.
+
+   usage: test_sharded [seed] [threads], with threads only the parallel part runs */
+
+#define APPENDS 200000              /* Products added in increasing time order */
+#define RANDOM_TIMES 1000000        /* The random additions and removals use the times 0 .. RANDOM_TIMES - 1 */
+#define RANDOM_STEPS 100000         /* Random updates */
+#define QUALITIES 1000              /* The products have the qualities 0 .. QUALITIES - 1 */
+#define BEST_QUALITY 7              /* The quality s of Init, Exists looks for it */
+#define CHECK_EVERY 20000           /* Updates between two comparisons of the queries */
+#define WRITERS 4                   /* Writer threads, each one updates its own time range */
+#define WRITER_TIMES 20000          /* Number of times of the range of a writer */
+#define WRITER_STEPS 30000          /* Updates of every writer */
+
+/* A writer thread and the products of its time range */
+typedef struct Writer
+{
+    ShardedDataStructure* sds;
+    int first_time;                 /* The range is first_time .. first_time + WRITER_TIMES - 1 */
+    unsigned long long seed;
+    int present[WRITER_TIMES];
+    int quality[WRITER_TIMES];
+} Writer;
+
+/* A reader thread, it queries until the writers are done */
+typedef struct Reader
+{
+    ShardedDataStructure* sds;
+    atomic_int* stop;
+    unsigned long long seed;
+    int failed;                     /* 1 once an impossible answer was seen */
+} Reader;
+
+static unsigned long long rng_state;
+
+/* xorshift64* generator, every thread has its own state */
+static unsigned long long next_random_of(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Random integer in [lo, hi] from the state of a thread */
+static int random_between_of(unsigned long long* state, int lo, int hi)
+{
+    return lo + (int)(next_random_of(state) % (unsigned long long)(hi - lo + 1));
+}
+
+/* Random integer in [lo, hi] from the state of the main thread */
+static int random_between(int lo, int hi)
+{
+    return random_between_of(&rng_state, lo, hi);
+}
+
+/* Check that no shard holds much more than its share, returns 0 or 1 if one does */
+static int check_balance(ShardedDataStructure* sds)
+{
+    long products = 0, size, others;
+    int s;
+
+    for (s = 0; s < sds->shard_count; s++)
+        products += CountBetween(sds->shards[s].ds, INT_MIN, INT_MAX);
+    if (products != atomic_load(&sds->products))
+        return 1;
+
+    for (s = 0; s < sds->shard_count && sds->shard_count > 1; s++)
+    {
+        size = CountBetween(sds->shards[s].ds, INT_MIN, INT_MAX);
+        others = (products - size) / (sds->shard_count - 1);
+        if (size > 2 * others + SHARD_REBALANCE_MIN)
+            return 1;
+    }
+    return 0;
+}
+
+/* Compare the queries across the shards with a DataStructure, returns 0 or 1 on a difference */
+static int compare(ShardedDataStructure* sds, DataStructure ds, int max_time)
+{
+    int n = CountBetween(ds, INT_MIN, INT_MAX);
+    int k, i, time1, time2;
+
+    for (k = 0; k < 32; k++)
+    {
+        i = k == 0 ? n + 1 : random_between(1, n > 0 ? n : 1);
+        if (GetIthRankProductSharded(sds, i) != GetIthRankProduct(ds, i))
+            return 1;
+
+        time1 = random_between(-1, max_time);
+        time2 = time1 + random_between(0, max_time / 4);
+        i = random_between(1, 32);
+        if (GetIthRankProductBetweenSharded(sds, time1, time2, i) != GetIthRankProductBetween(ds, time1, time2, i))
+            return 1;
+    }
+    return ExistsSharded(sds) != Exists(ds);
+}
+
+/* Add products in increasing time order, then random updates, returns 0 or 1 on a failure */
+static int test_shards(int shard_count)
+{
+    ShardedDataStructure* sds = InitSharded(BEST_QUALITY, shard_count, NULL);
+    DataStructure ds = Init(BEST_QUALITY);
+    int step, time, quality;
+
+    /* The appends all land in the last shard, only the rebalances spread them */
+    for (step = 1; step <= APPENDS; step++)
+    {
+        quality = random_between(0, QUALITIES - 1);
+        AddProductSharded(sds, step, quality);
+        AddProduct(&ds, step, quality);
+        if (check_balance(sds) || (step % CHECK_EVERY == 0 && compare(sds, ds, APPENDS)))
+        {
+            printf("FAIL %d shards, append %d (%ld rebalances)\n", shard_count, step, atomic_load(&sds->rebalances));
+            return 1;
+        }
+    }
+    if (shard_count > 1 && atomic_load(&sds->rebalances) == 0)
+    {
+        printf("FAIL %d shards, no rebalance after %d appends\n", shard_count, APPENDS);
+        return 1;
+    }
+
+    for (step = 1; step <= RANDOM_STEPS; step++)
+    {
+        time = random_between(0, RANDOM_TIMES - 1);
+        quality = random_between(0, QUALITIES - 1);
+        if (step % 50 == 0)
+        {
+            RemoveQualitySharded(sds, quality);
+            RemoveQuality(&ds, quality);
+        }
+        else if (step % 3 == 0)
+        {
+            RemoveProductSharded(sds, time);
+            RemoveProduct(&ds, time);
+        }
+        else
+        {
+            AddProductSharded(sds, time, quality);
+            AddProduct(&ds, time, quality);
+        }
+        if (step % CHECK_EVERY == 0 && compare(sds, ds, RANDOM_TIMES))
+        {
+            printf("FAIL %d shards, random step %d\n", shard_count, step);
+            return 1;
+        }
+    }
+
+    printf("%d shards ok (%ld rebalances)\n", shard_count, atomic_load(&sds->rebalances));
+    DestroySharded(sds);
+    Destroy(&ds);
+    return 0;
+}
+
+/* Writer thread: random additions and removals in its own time range */
+static void* run_writer(void* arg)
+{
+    Writer* writer = (Writer*)arg;
+    int step, offset, quality;
+
+    for (step = 0; step < WRITER_STEPS; step++)
+    {
+        offset = random_between_of(&writer->seed, 0, WRITER_TIMES - 1);
+        quality = random_between_of(&writer->seed, 0, QUALITIES - 1);
+        if (step % 3 == 0)
+        {
+            RemoveProductSharded(writer->sds, writer->first_time + offset);
+            writer->present[offset] = 0;
+        }
+        else
+        {
+            AddProductSharded(writer->sds, writer->first_time + offset, quality);
+            if (!writer->present[offset])
+            {
+                writer->present[offset] = 1;
+                writer->quality[offset] = quality;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Reader thread: rank queries next to the writers, every answer must be a time of the asked range */
+static void* run_reader(void* arg)
+{
+    Reader* reader = (Reader*)arg;
+    int time, time1, time2;
+
+    while (!atomic_load(reader->stop))
+    {
+        time = GetIthRankProductSharded(reader->sds, random_between_of(&reader->seed, 1, 100));
+        reader->failed |= time < -1 || time >= WRITERS * WRITER_TIMES;
+
+        time1 = random_between_of(&reader->seed, 0, WRITERS * WRITER_TIMES - 1);
+        time2 = time1 + random_between_of(&reader->seed, 0, WRITER_TIMES);
+        time = GetIthRankProductBetweenSharded(reader->sds, time1, time2, random_between_of(&reader->seed, 1, 8));
+        reader->failed |= time != -1 && (time < time1 || time > time2);
+
+        ExistsSharded(reader->sds);
+    }
+    return NULL;
+}
+
+/* Run writers of disjoint time ranges in parallel next to a reader, then compare the products, returns 0 or 1 on a failure */
+static int test_threads(void)
+{
+    static Writer writers[WRITERS];
+    pthread_t threads[WRITERS + 1];
+    Reader reader;
+    atomic_int stop;
+    ShardedDataStructure* sds = InitSharded(BEST_QUALITY, WRITERS, NULL);
+    DataStructure ds = Init(BEST_QUALITY);
+    int w, offset;
+
+    atomic_init(&stop, 0);
+    reader.sds = sds;
+    reader.stop = &stop;
+    reader.seed = next_random_of(&rng_state);
+    reader.failed = 0;
+    pthread_create(&threads[WRITERS], NULL, run_reader, &reader);
+
+    for (w = 0; w < WRITERS; w++)
+    {
+        memset(&writers[w], 0, sizeof(Writer));
+        writers[w].sds = sds;
+        writers[w].first_time = w * WRITER_TIMES;
+        writers[w].seed = next_random_of(&rng_state);
+        pthread_create(&threads[w], NULL, run_writer, &writers[w]);
+    }
+    for (w = 0; w < WRITERS; w++)
+        pthread_join(threads[w], NULL);
+    atomic_store(&stop, 1);
+    pthread_join(threads[WRITERS], NULL);
+
+    /* The products of every range are the ones its writer kept */
+    for (w = 0; w < WRITERS; w++)
+        for (offset = 0; offset < WRITER_TIMES; offset++)
+            if (writers[w].present[offset])
+                AddProduct(&ds, writers[w].first_time + offset, writers[w].quality[offset]);
+
+    if (reader.failed || check_balance(sds) || compare(sds, ds, WRITERS * WRITER_TIMES))
+    {
+        printf("FAIL %d writers\n", WRITERS);
+        return 1;
+    }
+
+    printf("%d writers and a reader ok (%ld rebalances)\n", WRITERS, atomic_load(&sds->rebalances));
+    DestroySharded(sds);
+    Destroy(&ds);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    static const int shard_counts[] = { 1, 2, 3, 8 };
+    size_t k;
+
+    rng_state = argc > 1 ? strtoull(argv[1], NULL, 10) * 0x9E3779B97F4A7C15ULL + 1 : 1;
+
+    /* make test runs the ThreadSanitizer build only on the parallel part */
+    if (argc > 2 && strcmp(argv[2], "threads") == 0)
+        return test_threads();
+
+    for (k = 0; k < sizeof(shard_counts) / sizeof(shard_counts[0]); k++)
+        if (test_shards(shard_counts[k]))
+            return 1;
+    return test_threads();
+}